@@ -0,0 +1,199 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Luminous/DistanceFieldGenerator.hpp>
+#include <Luminous/DxtEncoder.hpp>
+#include <Luminous/Image.hpp>
+#include <Luminous/PixelFormat.hpp>
+
+#include <Squish/squish.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <vector>
+
+namespace
+{
+  /// Image with smooth gradients and some hard edges, roughly the kind of
+  /// content that is resampled and compressed when generating mipmaps
+  Luminous::Image testImage(int width, int height, const Luminous::PixelFormat & format)
+  {
+    Luminous::Image image;
+    image.allocate(width, height, format);
+    const int channels = format.numChannels();
+    for (int y = 0; y < height; ++y) {
+      unsigned char * line = image.line(y);
+      for (int x = 0; x < width; ++x) {
+        const bool edge = ((x / 64) + (y / 64)) % 2;
+        for (int c = 0; c < channels; ++c)
+          line[x * channels + c] = edge ? 255 - (x + c * 40) % 256 : (y + c * 80) % 256;
+      }
+    }
+    return image;
+  }
+
+  /// Argument 0 is the source width, the source is a 16:9 RGBA image
+  void imageCopyResample(benchmark::State & state)
+  {
+    const int width = state.range(0), height = width * 9 / 16;
+    const Luminous::Image source = testImage(width, height, Luminous::PixelFormat::rgbaUByte());
+    Luminous::Image target;
+
+    for (auto _: state) {
+      target.copyResample(source, width * 3 / 4, height * 3 / 4);
+      benchmark::DoNotOptimize(target.data());
+    }
+    state.SetItemsProcessed(state.iterations() * width * height);
+  }
+  BENCHMARK(imageCopyResample)->Arg(512)->Arg(1920)->Arg(3840);
+
+  void imageMinify(benchmark::State & state)
+  {
+    const int width = state.range(0), height = width * 9 / 16;
+    const Luminous::Image source = testImage(width, height, Luminous::PixelFormat::rgbaUByte());
+    Luminous::Image target;
+
+    for (auto _: state) {
+      target.minify(source, width / 3, height / 3);
+      benchmark::DoNotOptimize(target.data());
+    }
+    state.SetItemsProcessed(state.iterations() * width * height);
+  }
+  BENCHMARK(imageMinify)->Arg(512)->Arg(1920)->Arg(3840);
+
+  void imageQuarterSize(benchmark::State & state)
+  {
+    const int width = state.range(0), height = width * 9 / 16;
+    const Luminous::Image source = testImage(width, height, Luminous::PixelFormat::rgbaUByte());
+    Luminous::Image target;
+
+    for (auto _: state) {
+      target.quarterSize(source);
+      benchmark::DoNotOptimize(target.data());
+    }
+    state.SetItemsProcessed(state.iterations() * width * height);
+  }
+  BENCHMARK(imageQuarterSize)->Arg(512)->Arg(1920)->Arg(3840);
+
+  /// Argument 0 is the image size, argument 1 squish flags
+  void squishCompress(benchmark::State & state)
+  {
+    const int size = state.range(0);
+    const int flags = state.range(1);
+    const Luminous::Image source = testImage(size, size, Luminous::PixelFormat::rgbaUByte());
+    std::vector<unsigned char> blocks(squish::GetStorageRequirements(size, size, flags));
+
+    for (auto _: state) {
+      squish::CompressImage(source.data(), size, size, blocks.data(), flags);
+      benchmark::DoNotOptimize(blocks.data());
+    }
+    state.SetItemsProcessed(state.iterations() * size * size);
+  }
+  BENCHMARK(squishCompress)
+      ->Args({256, squish::kDxt1 | squish::kColourRangeFit})
+      ->Args({256, squish::kDxt1 | squish::kColourClusterFit})
+      ->Args({256, squish::kDxt5 | squish::kColourRangeFit})
+      ->Args({1024, squish::kDxt1 | squish::kColourRangeFit})
+      ->Args({1024, squish::kDxt5 | squish::kColourRangeFit})
+      ->Unit(benchmark::kMillisecond);
+
+  /// Argument 0 is the image size, argument 1 the compression
+  void dxtEncoderCompress(benchmark::State & state)
+  {
+    const int size = state.range(0);
+    const auto compression = static_cast<Luminous::PixelFormat::Compression>(state.range(1));
+    const Luminous::Image source = testImage(size, size, Luminous::PixelFormat::rgbaUByte());
+    std::vector<unsigned char> blocks(Luminous::DxtEncoder::compressedSize(size, size, compression));
+
+    for (auto _: state) {
+      Luminous::DxtEncoder::compress(source, compression, blocks.data());
+      benchmark::DoNotOptimize(blocks.data());
+    }
+    state.SetItemsProcessed(state.iterations() * size * size);
+    state.SetBytesProcessed(state.iterations() * size * size * 4);
+  }
+  BENCHMARK(dxtEncoderCompress)
+      ->Args({1024, Luminous::PixelFormat::COMPRESSED_RGB_DXT1})
+      ->Args({1024, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5})
+      ->Args({3840, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5})
+      ->Unit(benchmark::kMillisecond);
+
+  void squishDecompress(benchmark::State & state)
+  {
+    const int size = state.range(0);
+    const int flags = state.range(1);
+    const Luminous::Image source = testImage(size, size, Luminous::PixelFormat::rgbaUByte());
+    std::vector<unsigned char> blocks(squish::GetStorageRequirements(size, size, flags));
+    squish::CompressImage(source.data(), size, size, blocks.data(), flags | squish::kColourRangeFit);
+    std::vector<unsigned char> rgba(size * size * 4);
+
+    for (auto _: state) {
+      squish::DecompressImage(rgba.data(), size, size, blocks.data(), flags);
+      benchmark::DoNotOptimize(rgba.data());
+    }
+    state.SetItemsProcessed(state.iterations() * size * size);
+  }
+  BENCHMARK(squishDecompress)->Args({1024, squish::kDxt1})->Args({1024, squish::kDxt5});
+
+  /// Glyph-like shape for distance field generation
+  Luminous::Image glyphImage(int size)
+  {
+    Luminous::Image image;
+    image.allocate(size, size, Luminous::PixelFormat::redUByte());
+    const float r = size * 0.35f;
+    for (int y = 0; y < size; ++y) {
+      unsigned char * line = image.line(y);
+      for (int x = 0; x < size; ++x) {
+        const float dx = x - size * 0.5f, dy = y - size * 0.5f;
+        const float d = std::sqrt(dx * dx + dy * dy);
+        line[x] = (d < r && d > r * 0.6f) || std::abs(dx) < size * 0.05f ? 255 : 0;
+      }
+    }
+    return image;
+  }
+
+  /// Argument 0 is the source size, the target is 1/8 of it like with fonts
+  void distanceFieldGenerate(benchmark::State & state)
+  {
+    const int size = state.range(0);
+    const Luminous::Image source = glyphImage(size);
+    Luminous::Image target;
+    target.allocate(size / 8, size / 8, Luminous::PixelFormat::redUByte());
+
+    for (auto _: state) {
+      Luminous::DistanceFieldGenerator::generate(source, Nimble::Vector2i(size, size), target, size / 16);
+      benchmark::DoNotOptimize(target.data());
+    }
+    state.SetItemsProcessed(state.iterations() * size * size);
+  }
+  BENCHMARK(distanceFieldGenerate)->Arg(256)->Arg(512)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+  /// Argument 0 is the number of 256x256 glyphs generated with one call
+  void distanceFieldGenerateBatch(benchmark::State & state)
+  {
+    const int size = 256;
+    const int count = state.range(0);
+    const Luminous::Image source = glyphImage(size);
+    std::vector<Luminous::Image> targets(count);
+    std::vector<Luminous::DistanceFieldGenerator::Job> jobs;
+    for (Luminous::Image & target: targets) {
+      target.allocate(size / 8, size / 8, Luminous::PixelFormat::redUByte());
+      jobs.push_back({&source, Nimble::Vector2i(size, size), &target, size / 16});
+    }
+
+    for (auto _: state) {
+      Luminous::DistanceFieldGenerator::generateBatch(jobs.data(), jobs.size());
+      benchmark::DoNotOptimize(targets.data());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(distanceFieldGenerateBatch)->Arg(16)->Arg(64)->Unit(benchmark::kMillisecond)->UseRealTime();
+}
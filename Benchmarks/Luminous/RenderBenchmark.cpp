@@ -0,0 +1,237 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Luminous/GfxDriver.hpp>
+#include <Luminous/MultiHead.hpp>
+#include <Luminous/PixelFormat.hpp>
+#include <Luminous/RenderContext.hpp>
+#include <Luminous/RenderDriverHeadless.hpp>
+#include <Luminous/RenderManager.hpp>
+#include <Luminous/Spline.hpp>
+#include <Luminous/Texture.hpp>
+
+#include <Radiant/TimeStamp.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace
+{
+  /// One render thread that renders the first window of a full HD
+  /// configuration with RenderDriverHeadless
+  class HeadlessRenderer : public Luminous::GfxDriver
+  {
+  public:
+    HeadlessRenderer()
+      : m_driver(*this, 0)
+    {
+      m_multiHead.createFullHDConfig();
+      Luminous::RenderManager::setDrivers({&m_driver});
+      Luminous::RenderManager::setThreadIndex(0);
+      m_driver.setCommandRecordingEnabled(false);
+      m_context.reset(new Luminous::RenderContext(m_driver, &m_multiHead.window(0)));
+      m_context->initialize();
+    }
+
+    ~HeadlessRenderer()
+    {
+      m_context.reset();
+      Luminous::RenderManager::setDrivers({});
+    }
+
+    virtual Luminous::RenderContext & renderContext(unsigned int) override { return *m_context; }
+    virtual unsigned int renderThreadCount() const override { return 1; }
+    virtual Luminous::RenderDriver & renderDriver(unsigned int) override { return m_driver; }
+
+    Luminous::RenderContext & context() { return *m_context; }
+
+    void beginFrame()
+    {
+      const auto & window = m_multiHead.window(0);
+      const auto & area = window.area(0);
+      m_context->beginFrame(Radiant::TimeStamp::currentTime(), m_frame);
+      m_context->setWindowArea(&window, &area);
+      m_driver.setViewport(area.viewport());
+      m_context->beginArea();
+      m_context->pushViewTransform(area.viewTransform());
+    }
+
+    void endFrame(benchmark::State & state)
+    {
+      m_context->popViewTransform();
+      m_context->endArea();
+      m_context->endFrame(m_frame++);
+
+      const auto & stats = m_driver.lastFrameStatistics();
+      state.counters["drawCalls"] = stats.drawCalls;
+      state.counters["stateChanges"] = stats.stateChanges;
+      state.counters["bufferBytesUploaded"] = stats.bufferBytesUploaded;
+      state.counters["textureBytesUploaded"] = stats.textureBytesUploaded;
+    }
+
+  private:
+    Luminous::MultiHead m_multiHead;
+    Luminous::RenderDriverHeadless m_driver;
+    std::unique_ptr<Luminous::RenderContext> m_context;
+    unsigned int m_frame = 0;
+  };
+
+  /// Positions of count items in a grid that covers a full HD screen
+  Nimble::Rectf gridCell(int index, int count)
+  {
+    int columns = std::max(1, int(std::sqrt(float(count) * 16.f / 9.f)));
+    int rows = (count + columns - 1) / columns;
+    Nimble::Vector2f size(1920.f / columns, 1080.f / rows);
+    Nimble::Vector2f pos((index % columns) * size.x, (index / columns) * size.y);
+    return Nimble::Rectf(pos, pos + size * 0.9f);
+  }
+
+  void renderRoundedRects(benchmark::State & state)
+  {
+    HeadlessRenderer renderer;
+    auto & r = renderer.context();
+    const int count = state.range(0);
+
+    Luminous::Style style;
+    style.setFillColor(0.2f, 0.4f, 0.8f, 0.9f);
+
+    for (auto _: state) {
+      renderer.beginFrame();
+      for (int i = 0; i < count; ++i) {
+        Nimble::Rectf rect = gridCell(i, count);
+        r.drawRoundedRect(rect, Nimble::Vector4f(8, 8, 8, 8), Nimble::Vector2f(0, 8), style);
+      }
+      renderer.endFrame(state);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(renderRoundedRects)->Arg(100)->Arg(1000)->Arg(10000);
+
+  void renderImages(benchmark::State & state)
+  {
+    HeadlessRenderer renderer;
+    auto & r = renderer.context();
+    const int count = state.range(0);
+
+    // A handful of different textures, so that the state sorting has
+    // something to do
+    const int textureCount = 16;
+    std::vector<uint8_t> pixels(256 * 256 * 4, 128);
+    std::vector<Luminous::Texture> textures(textureCount);
+    for (auto & tex: textures)
+      tex.setData(256, 256, Luminous::PixelFormat::rgbaUByte(), pixels.data());
+
+    Luminous::Style style;
+    style.setFillColor(1, 1, 1, 1);
+
+    for (auto _: state) {
+      renderer.beginFrame();
+      for (int i = 0; i < count; ++i) {
+        style.setTexture(textures[i % textureCount]);
+        r.drawRect(gridCell(i, count), style);
+      }
+      renderer.endFrame(state);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(renderImages)->Arg(100)->Arg(1000)->Arg(10000);
+
+  void renderText(benchmark::State & state)
+  {
+    HeadlessRenderer renderer;
+    auto & r = renderer.context();
+    const int count = state.range(0);
+    const auto flags = state.range(1) ? Luminous::RenderContext::TextDynamic
+                                      : Luminous::RenderContext::TextStatic;
+
+    Luminous::TextStyle style;
+    style.setFontPixelSize(16);
+    style.setFillColor(1, 1, 1, 1);
+
+    std::vector<QString> labels;
+    for (int i = 0; i < count; ++i)
+      labels.push_back(QString("Label number %1").arg(i));
+
+    for (auto _: state) {
+      renderer.beginFrame();
+      for (int i = 0; i < count; ++i)
+        r.drawText(labels[i], gridCell(i, count), style, flags);
+      renderer.endFrame(state);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(renderText)->Args({100, 0})->Args({1000, 0})->Args({100, 1})->Args({1000, 1});
+
+  void renderSplines(benchmark::State & state)
+  {
+    HeadlessRenderer renderer;
+    auto & r = renderer.context();
+    const int pointCount = state.range(0);
+
+    Luminous::Spline spline;
+    for (int i = 0; i < pointCount; ++i) {
+      float t = float(i) / pointCount;
+      Nimble::Vector2f p(100.f + 1720.f * t, 540.f + 400.f * std::sin(t * 40.f));
+      spline.addControlPoint(p, Radiant::ColorPMA(1, 0, 0, 1), 5.f, t);
+      if (i % 100 == 99)
+        spline.endPath();
+    }
+    spline.endPath();
+
+    for (auto _: state) {
+      renderer.beginFrame();
+      spline.render(r);
+      renderer.endFrame(state);
+    }
+    state.SetItemsProcessed(state.iterations() * pointCount);
+  }
+  BENCHMARK(renderSplines)->Arg(1000)->Arg(10000)->Arg(100000);
+
+  /// Typical mixed scene, a grid of cards with an image, a title and a
+  /// rounded background
+  void renderMixedScene(benchmark::State & state)
+  {
+    HeadlessRenderer renderer;
+    auto & r = renderer.context();
+    const int count = state.range(0);
+
+    std::vector<uint8_t> pixels(128 * 128 * 4, 200);
+    Luminous::Texture texture;
+    texture.setData(128, 128, Luminous::PixelFormat::rgbaUByte(), pixels.data());
+
+    Luminous::Style background;
+    background.setFillColor(0.1f, 0.1f, 0.1f, 0.8f);
+    Luminous::Style image;
+    image.setFillColor(1, 1, 1, 1);
+    image.setTexture(texture);
+    Luminous::TextStyle title;
+    title.setFontPixelSize(14);
+    title.setFillColor(1, 1, 1, 1);
+
+    for (auto _: state) {
+      renderer.beginFrame();
+      for (int i = 0; i < count; ++i) {
+        Nimble::Rectf cell = gridCell(i, count);
+        r.drawRoundedRect(cell, Nimble::Vector4f(6, 6, 6, 6), Nimble::Vector2f(0, 6), background);
+        Nimble::Rectf imageRect = cell;
+        imageRect.shrink(cell.width() * 0.1f);
+        r.drawRect(imageRect, image);
+        r.drawText("Card", cell, title);
+      }
+      renderer.endFrame(state);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(renderMixedScene)->Arg(100)->Arg(1000);
+}
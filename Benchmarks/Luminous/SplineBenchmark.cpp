@@ -0,0 +1,83 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Luminous/SplineManager.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+
+namespace
+{
+  /// Hand-writing like stroke with some noise
+  Luminous::SplineManager::SplineData makeStroke(int index, int points)
+  {
+    Luminous::SplineManager::SplineData data;
+    data.width = 3.f + index % 4;
+    data.color = Radiant::ColorPMA(0.1f, 0.1f, 0.1f, 1.f);
+    data.depth = index;
+    const Nimble::Vector2f origin(index % 20 * 90.f, index / 20 * 60.f);
+    for (int i = 0; i < points; ++i) {
+      const float t = i * 0.15f;
+      data.points << origin + Nimble::Vector2f(t * 4.f + std::sin(t * 1.7f) * 8.f,
+                                               std::cos(t * 2.3f) * 12.f + std::sin(t * 7.1f) * 1.5f);
+    }
+    return data;
+  }
+
+  /// Tessellates argument 0 strokes with argument 1 points each
+  void splineManagerTessellate(benchmark::State & state)
+  {
+    const int strokes = state.range(0), points = state.range(1);
+    Luminous::SplineManager::Splines splines;
+    for (int i = 0; i < strokes; ++i)
+      splines << Luminous::SplineManager::SplineInfo{i + 1, makeStroke(i, points)};
+
+    for (auto _: state) {
+      state.PauseTiming();
+      Luminous::SplineManager manager;
+      manager.addSplines(splines);
+      state.ResumeTiming();
+
+      manager.update();
+    }
+    state.SetItemsProcessed(state.iterations() * strokes * points);
+  }
+  BENCHMARK(splineManagerTessellate)->Args({10, 100})->Args({100, 100})->Args({20, 1000})
+      ->Unit(benchmark::kMillisecond);
+
+  /// Interactive drawing: one stroke grows by a point and the manager is
+  /// updated every frame while there are argument 0 finished strokes
+  void splineManagerDrawing(benchmark::State & state)
+  {
+    const int strokes = state.range(0);
+    const int points = 200;
+    const auto stroke = makeStroke(strokes, points);
+
+    for (auto _: state) {
+      state.PauseTiming();
+      Luminous::SplineManager manager;
+      for (int i = 0; i < strokes; ++i)
+        manager.addSpline(makeStroke(i, 100));
+      manager.update();
+      state.ResumeTiming();
+
+      auto id = manager.beginSpline(stroke.points[0], stroke.width, stroke.color, stroke.depth);
+      for (int i = 1; i < points; ++i) {
+        manager.continueSpline(id, stroke.points[i]);
+        manager.update();
+      }
+      manager.endSpline(id);
+      manager.update();
+    }
+    state.SetItemsProcessed(state.iterations() * points);
+  }
+  BENCHMARK(splineManagerDrawing)->Arg(0)->Arg(100)->Unit(benchmark::kMillisecond);
+}
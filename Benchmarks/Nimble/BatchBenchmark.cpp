@@ -0,0 +1,182 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Nimble/Batch.hpp>
+#include <Nimble/Random.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+namespace
+{
+  using namespace Nimble;
+
+  /// Benchmark argument 0 is the element count, argument 1 is
+  /// Batch::InstructionSet, or -1 for a plain loop of the scalar functions
+  void setArgs(benchmark::internal::Benchmark * b)
+  {
+    for (int count : {16, 1024, 65536}) {
+      b->Args({count, -1});
+      for (int set = Batch::INSTRUCTION_SET_SCALAR; set <= Batch::supportedInstructionSet(); ++set)
+        b->Args({count, set});
+    }
+  }
+
+  /// Returns false if the benchmark should use the plain loop
+  bool selectInstructionSet(const benchmark::State & state)
+  {
+    if (state.range(1) < 0)
+      return false;
+    Batch::setInstructionSet(static_cast<Batch::InstructionSet>(state.range(1)));
+    return true;
+  }
+
+  std::vector<Vector2f> randomPoints2(size_t count)
+  {
+    RandomUniform rnd(1234);
+    std::vector<Vector2f> points(count);
+    for (auto & p: points)
+      p.make(rnd.randMinMax(-1000, 1000), rnd.randMinMax(-1000, 1000));
+    return points;
+  }
+
+  std::vector<Vector3f> randomPoints3(size_t count)
+  {
+    RandomUniform rnd(1234);
+    std::vector<Vector3f> points(count);
+    for (auto & p: points)
+      p.make(rnd.randMinMax(-1000, 1000), rnd.randMinMax(-1000, 1000), rnd.randMinMax(-1, 1));
+    return points;
+  }
+
+  Matrix3f testMatrix3()
+  {
+    return Matrix3f::makeTranslation(10, 20) * Matrix3f::makeRotation(0.3f) * Matrix3f::makeScale(1.5f, 1.5f);
+  }
+
+  void projectMatrix3(benchmark::State & state)
+  {
+    const size_t count = state.range(0);
+    const Matrix3f m = testMatrix3();
+    const std::vector<Vector2f> in = randomPoints2(count);
+    std::vector<Vector2f> out(count);
+    const bool batch = selectInstructionSet(state);
+
+    for (auto _: state) {
+      if (batch) {
+        Batch::project(m, in.data(), out.data(), count);
+      } else {
+        for (size_t i = 0; i < count; ++i)
+          out[i] = m.project(in[i]);
+      }
+      benchmark::DoNotOptimize(out.data());
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(projectMatrix3)->Apply(setArgs);
+
+  void transformAffine(benchmark::State & state)
+  {
+    const size_t count = state.range(0);
+    const Matrix3f m = testMatrix3();
+    const std::vector<Vector2f> in = randomPoints2(count);
+    std::vector<Vector2f> out(count);
+    const bool batch = selectInstructionSet(state);
+
+    for (auto _: state) {
+      if (batch) {
+        Batch::transformAffine(m, in.data(), out.data(), count);
+      } else {
+        for (size_t i = 0; i < count; ++i)
+          out[i] = m.project(in[i]);
+      }
+      benchmark::DoNotOptimize(out.data());
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(transformAffine)->Apply(setArgs);
+
+  void projectMatrix4(benchmark::State & state)
+  {
+    const size_t count = state.range(0);
+    const Matrix4f m = Matrix4f::simpleProjection(1920, 1080) * Matrix4f::makeRotation(0.3f, Vector3f(0, 1, 0));
+    const std::vector<Vector3f> in = randomPoints3(count);
+    std::vector<Vector3f> out(count);
+    const bool batch = selectInstructionSet(state);
+
+    for (auto _: state) {
+      if (batch) {
+        Batch::project(m, in.data(), out.data(), count);
+      } else {
+        for (size_t i = 0; i < count; ++i)
+          out[i] = m.project(in[i]);
+      }
+      benchmark::DoNotOptimize(out.data());
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(projectMatrix4)->Apply(setArgs);
+
+  void boundingBox(benchmark::State & state)
+  {
+    const size_t count = state.range(0);
+    const std::vector<Vector2f> points = randomPoints2(count);
+    const bool batch = selectInstructionSet(state);
+
+    for (auto _: state) {
+      Rectf bounds;
+      if (batch) {
+        bounds = Batch::boundingBox(points.data(), count);
+      } else {
+        for (size_t i = 0; i < count; ++i)
+          bounds.expand(points[i]);
+      }
+      benchmark::DoNotOptimize(bounds);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(boundingBox)->Apply(setArgs);
+
+  void intersects(benchmark::State & state)
+  {
+    const size_t count = state.range(0);
+    RandomUniform rnd(1234);
+    std::vector<Rectangle> rects;
+    rects.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      Matrix3f m = Matrix3f::makeTranslation(rnd.randMinMax(-1000, 1000), rnd.randMinMax(-1000, 1000)) *
+          Matrix3f::makeRotation(rnd.randMinMax(0, 6.28f));
+      rects.emplace_back(SizeF(rnd.randMinMax(10, 200), rnd.randMinMax(10, 200)), m);
+    }
+    const Rectangle rect(SizeF(600, 400), Matrix3f::makeRotation(0.2f));
+    std::vector<uint8_t> results(count);
+    const bool batch = selectInstructionSet(state);
+
+    for (auto _: state) {
+      size_t hits = 0;
+      if (batch) {
+        hits = Batch::intersects(rect, rects.data(), count, results.data());
+      } else {
+        for (size_t i = 0; i < count; ++i) {
+          results[i] = rect.intersects(rects[i]) ? 1 : 0;
+          hits += results[i];
+        }
+      }
+      benchmark::DoNotOptimize(hits);
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK(intersects)->Apply(setArgs);
+}
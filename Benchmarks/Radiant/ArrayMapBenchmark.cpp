@@ -0,0 +1,83 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Radiant/ArrayMap.hpp>
+
+#include <Nimble/Random.hpp>
+
+#include <QByteArray>
+
+#include <benchmark/benchmark.h>
+
+#include <map>
+#include <vector>
+
+namespace
+{
+  /// Keys of the size and shape typically used for attribute and event names
+  std::vector<QByteArray> makeKeys(int count)
+  {
+    std::vector<QByteArray> keys;
+    for (int i = 0; i < count; ++i)
+      keys.push_back(QByteArray("attribute-") + QByteArray::number(i));
+    return keys;
+  }
+
+  /// Lookup order that doesn't follow the insertion order
+  std::vector<int> makeLookupOrder(int count)
+  {
+    Nimble::RandomUniform rnd(1234);
+    std::vector<int> order(1024);
+    for (auto & i: order)
+      i = rnd.rand0X(uint32_t(count));
+    return order;
+  }
+
+  template <typename Map>
+  void lookup(benchmark::State & state)
+  {
+    const int count = state.range(0);
+    const auto keys = makeKeys(count);
+    const auto order = makeLookupOrder(count);
+
+    Map map;
+    for (int i = 0; i < count; ++i)
+      map[keys[i]] = i;
+
+    for (auto _: state) {
+      int sum = 0;
+      for (int i: order)
+        sum += map.find(keys[i])->second;
+      benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * order.size());
+  }
+  BENCHMARK_TEMPLATE(lookup, Radiant::ArrayMap<QByteArray, int>)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+  BENCHMARK_TEMPLATE(lookup, std::map<QByteArray, int>)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+
+  template <typename Map>
+  void insertErase(benchmark::State & state)
+  {
+    const int count = state.range(0);
+    const auto keys = makeKeys(count);
+
+    for (auto _: state) {
+      Map map;
+      for (int i = 0; i < count; ++i)
+        map[keys[i]] = i;
+      for (int i = 0; i < count; i += 2)
+        map.erase(keys[i]);
+      benchmark::DoNotOptimize(map.size());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+  BENCHMARK_TEMPLATE(insertErase, Radiant::ArrayMap<QByteArray, int>)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+  BENCHMARK_TEMPLATE(insertErase, std::map<QByteArray, int>)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Radiant/BGThread.hpp>
+#include <Radiant/Task.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <thread>
+
+namespace
+{
+  /// Adds a batch of short tasks to a BGThread and waits until all of them
+  /// have been executed. Measures the scheduling overhead per task.
+  /// Argument 0 is the number of tasks, argument 1 the number of threads.
+  void bgThreadThroughput(benchmark::State & state)
+  {
+    const int taskCount = state.range(0);
+    Radiant::BGThread bg("Benchmark");
+    bg.run(state.range(1));
+
+    std::atomic<int> done{0};
+    for (auto _: state) {
+      done = 0;
+      for (int i = 0; i < taskCount; ++i)
+        bg.addTask(std::make_shared<Radiant::SingleShotTask>([&done] { ++done; }));
+      while (done.load() < taskCount)
+        std::this_thread::yield();
+    }
+    state.SetItemsProcessed(state.iterations() * taskCount);
+    bg.stopWhenDone();
+  }
+  BENCHMARK(bgThreadThroughput)
+      ->Args({1000, 1})->Args({1000, 4})->Args({10000, 4})->Args({10000, 8})
+      ->UseRealTime();
+
+  /// Same as bgThreadThroughput, but every task is scheduled to the future
+  /// with a different priority, so the tasks are picked from a sorted queue
+  /// instead of the front of it.
+  void bgThreadMixedPriorities(benchmark::State & state)
+  {
+    const int taskCount = state.range(0);
+    Radiant::BGThread bg("Benchmark");
+    bg.run(state.range(1));
+
+    std::atomic<int> done{0};
+    for (auto _: state) {
+      done = 0;
+      for (int i = 0; i < taskCount; ++i) {
+        auto task = std::make_shared<Radiant::SingleShotTask>([&done] { ++done; });
+        task->setPriority(Radiant::Task::PRIORITY_NORMAL + (i % 5) - 2);
+        task->scheduleFromNowSecs((i % 7) * 0.0001);
+        bg.addTask(task);
+      }
+      while (done.load() < taskCount)
+        std::this_thread::yield();
+    }
+    state.SetItemsProcessed(state.iterations() * taskCount);
+    bg.stopWhenDone();
+  }
+  BENCHMARK(bgThreadMixedPriorities)->Args({1000, 4})->Args({10000, 4})->UseRealTime();
+
+  /// Round-trip time of a single task from addTask to execution when the
+  /// worker threads are idle
+  void bgThreadLatency(benchmark::State & state)
+  {
+    Radiant::BGThread bg("Benchmark");
+    bg.run(state.range(0));
+
+    std::atomic<bool> done{false};
+    for (auto _: state) {
+      done = false;
+      bg.addTask(std::make_shared<Radiant::SingleShotTask>([&done] { done = true; }));
+      while (!done.load())
+        std::this_thread::yield();
+    }
+    bg.stopWhenDone();
+  }
+  BENCHMARK(bgThreadLatency)->Arg(1)->Arg(4)->UseRealTime();
+}
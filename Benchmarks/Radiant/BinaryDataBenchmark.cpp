@@ -0,0 +1,83 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Radiant/BinaryData.hpp>
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+  /// Writes a typical event payload: a few numbers, vectors and a string
+  void writeMessage(Radiant::BinaryData & bd, int i)
+  {
+    bd.writeInt32(i);
+    bd.writeFloat32(i * 0.5f);
+    bd.writeVector2Float32(Nimble::Vector2f(i, -i));
+    bd.writeVector4Float32(Nimble::Vector4f(1, 0.5f, 0.25f, 1));
+    bd.writeString("widget/interaction");
+  }
+
+  void binaryDataEncode(benchmark::State & state)
+  {
+    const int count = state.range(0);
+    Radiant::BinaryData bd;
+
+    for (auto _: state) {
+      bd.clear();
+      for (int i = 0; i < count; ++i)
+        writeMessage(bd, i);
+      benchmark::DoNotOptimize(bd.data());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.SetBytesProcessed(state.iterations() * bd.total());
+  }
+  BENCHMARK(binaryDataEncode)->Arg(1)->Arg(100)->Arg(10000);
+
+  void binaryDataDecode(benchmark::State & state)
+  {
+    const int count = state.range(0);
+    Radiant::BinaryData bd;
+    for (int i = 0; i < count; ++i)
+      writeMessage(bd, i);
+
+    QByteArray str;
+    for (auto _: state) {
+      bd.rewind();
+      for (int i = 0; i < count; ++i) {
+        benchmark::DoNotOptimize(bd.readInt32());
+        benchmark::DoNotOptimize(bd.readFloat32());
+        benchmark::DoNotOptimize(bd.readVector2Float32());
+        benchmark::DoNotOptimize(bd.readVector4Float32());
+        bd.readString(str);
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.SetBytesProcessed(state.iterations() * bd.total());
+  }
+  BENCHMARK(binaryDataDecode)->Arg(1)->Arg(100)->Arg(10000);
+
+  /// Blob round-trip, used for instance for image and audio payloads
+  void binaryDataBlob(benchmark::State & state)
+  {
+    const int bytes = state.range(0);
+    std::vector<uint8_t> blob(bytes, 0x5a), out;
+    Radiant::BinaryData bd;
+
+    for (auto _: state) {
+      bd.clear();
+      bd.writeBlob(blob.data(), bytes);
+      bd.rewind();
+      bd.readBlob(out);
+      benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+  }
+  BENCHMARK(binaryDataBlob)->Arg(64)->Arg(4096)->Arg(1 << 20);
+}
@@ -0,0 +1,56 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Radiant/ImageConversion.hpp>
+#include <Radiant/VideoImage.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+
+namespace
+{
+  /// Converts a full HD video frame from argument 0 to argument 1, both
+  /// are Radiant::ImageFormat values
+  void imageConversion(benchmark::State & state)
+  {
+    const auto sourceFormat = static_cast<Radiant::ImageFormat>(state.range(0));
+    const auto targetFormat = static_cast<Radiant::ImageFormat>(state.range(1));
+    const int width = 1920, height = 1080;
+
+    Radiant::VideoImage source, target;
+    source.allocateMemory(sourceFormat, width, height, 32);
+    target.allocateMemory(targetFormat, width, height, 32);
+
+    // Gradient in luma or packed pixel data, the contents don't affect the
+    // conversion speed
+    source.zero();
+    for (int y = 0; y < height; ++y)
+      memset(source.m_planes[0].line(y), y & 0xff, source.m_planes[0].m_linesize);
+
+    for (auto _: state) {
+      if (!Radiant::ImageConversion::convert(&source, &target)) {
+        state.SkipWithError("Unsupported conversion");
+        break;
+      }
+      benchmark::DoNotOptimize(target.m_planes[0].m_data);
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * width * height);
+  }
+  BENCHMARK(imageConversion)
+      ->Args({Radiant::IMAGE_YUV_420P, Radiant::IMAGE_RGBA})
+      ->Args({Radiant::IMAGE_YUV_420P, Radiant::IMAGE_RGB})
+      ->Args({Radiant::IMAGE_YUV_422P, Radiant::IMAGE_RGBA})
+      ->Args({Radiant::IMAGE_YUV_420P, Radiant::IMAGE_GRAYSCALE})
+      ->Args({Radiant::IMAGE_GRAYSCALE, Radiant::IMAGE_RGBA})
+      ->Args({Radiant::IMAGE_RGB, Radiant::IMAGE_RGBA})
+      ->Args({Radiant::IMAGE_RGB, Radiant::IMAGE_GRAYSCALE});
+}
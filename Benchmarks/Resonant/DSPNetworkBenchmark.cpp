@@ -0,0 +1,128 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Resonant/AudioLoop.hpp>
+#include <Resonant/DSPNetwork.hpp>
+#include <Resonant/ModuleGain.hpp>
+#include <Resonant/ModuleOutCollect.hpp>
+
+#include <Nimble/Math.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+  /// Stereo sine oscillator used as a signal source
+  class Oscillator : public Resonant::Module
+  {
+  public:
+    Oscillator(float frequency) : m_step(frequency * float(Nimble::Math::TWO_PI) / 44100.f) {}
+
+    virtual bool prepare(int & channelsIn, int & channelsOut) override
+    {
+      channelsIn = 0;
+      channelsOut = 2;
+      return true;
+    }
+
+    virtual void process(float **, float ** out, int n, const Resonant::CallbackTime &) override
+    {
+      for (int i = 0; i < n; ++i) {
+        out[0][i] = out[1][i] = std::sin(m_phase) * 0.1f;
+        m_phase += m_step;
+      }
+      m_phase = std::fmod(m_phase, float(Nimble::Math::TWO_PI));
+    }
+
+  private:
+    float m_step;
+    float m_phase = 0;
+  };
+
+  /// Runs the DSPNetwork processing cycles without an audio device.
+  /// Argument 0 is the number of sources, each source goes through argument
+  /// 1 gain modules before the output collector. Argument 2 is the cycle
+  /// length in samples.
+  void dspNetworkCycle(benchmark::State & state)
+  {
+    const int sources = state.range(0), chain = state.range(1), frames = state.range(2);
+
+    auto dsp = Resonant::DSPNetwork::instance();
+    std::vector<Resonant::ModulePtr> modules;
+
+    for (int s = 0; s < sources; ++s) {
+      QByteArray prev = "osc-" + QByteArray::number(s);
+      auto osc = std::make_shared<Oscillator>(220.f + s * 10.f);
+      osc->setId(prev);
+      auto item = std::make_shared<Resonant::DSPNetwork::Item>();
+      item->setModule(osc);
+      item->setUsePanner(false);
+      dsp->addModule(item);
+      modules.push_back(osc);
+
+      for (int g = 0; g < chain; ++g) {
+        QByteArray id = "gain-" + QByteArray::number(s) + "-" + QByteArray::number(g);
+        auto gain = std::make_shared<Resonant::ModuleGain>();
+        gain->setId(id);
+        gain->setGainInstant(0.9f);
+
+        auto gainItem = std::make_shared<Resonant::DSPNetwork::Item>();
+        gainItem->setModule(gain);
+        gainItem->setUsePanner(false);
+        // Only the last module in the chain is connected to the output
+        if (g + 1 == chain)
+          gainItem->setTargetChannel(0);
+        for (int c = 0; c < 2; ++c) {
+          Resonant::DSPNetwork::NewConnection conn;
+          conn.m_sourceId = prev;
+          conn.m_targetId = id;
+          conn.m_sourceChannel = c;
+          conn.m_targetChannel = c;
+          gainItem->addConnection(conn);
+        }
+        dsp->addModule(gainItem);
+        modules.push_back(gain);
+        prev = id;
+      }
+    }
+
+    std::vector<float> output(frames * 2);
+    dsp->collect()->setInterleavedBuffer(output.data());
+
+    const Resonant::CallbackTime time(Radiant::TimeStamp::currentTime(), 0, Resonant::CallbackTime::FLAG_NONE);
+    // The first cycle compiles the new modules to the network
+    dsp->doCycle(frames, time);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (auto _: state) {
+      dsp->doCycle(frames, time);
+      benchmark::DoNotOptimize(output.data());
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // The network is shared by all runs. Remove the modules so that the next
+    // run starts from an empty graph, and its ids are not renamed because of
+    // duplicates.
+    for (auto & module: modules)
+      Resonant::DSPNetwork::markDone(module);
+    dsp->doCycle(frames, time);
+
+    dsp->collect()->setInterleavedBuffer(nullptr);
+    state.SetItemsProcessed(state.iterations() * frames);
+    // Real-time budget usage at 44.1 kHz: values over 1 would underrun
+    state.counters["realTimeRatio"] = elapsed.count() / (frames / 44100.0 * state.iterations());
+  }
+  BENCHMARK(dspNetworkCycle)
+      ->Args({1, 1, 256})->Args({8, 2, 256})->Args({32, 4, 256})->Args({32, 4, 1024});
+}
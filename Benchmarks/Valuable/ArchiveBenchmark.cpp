@@ -0,0 +1,116 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Valuable/AttributeColor.hpp>
+#include <Valuable/AttributeFloat.hpp>
+#include <Valuable/AttributeString.hpp>
+#include <Valuable/AttributeVector.hpp>
+#include <Valuable/BinaryArchive.hpp>
+#include <Valuable/Node.hpp>
+#include <Valuable/XMLArchive.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+namespace
+{
+  /// Node with a typical mix of attributes
+  class Item : public Valuable::Node
+  {
+  public:
+    Item(Valuable::Node * host, const QByteArray & name, int index)
+      : Node(host, name)
+      , m_opacity(this, "opacity", 1.f)
+      , m_location(this, "location", Nimble::Vector2f(0, 0))
+      , m_size(this, "size", Nimble::Vector2f(100, 100))
+      , m_color(this, "color", Radiant::ColorPMA(1.f, 1.f, 1.f, 1.f))
+      , m_text(this, "text")
+    {
+      // Archives only include the USER layer by default, so the values
+      // need to be set there like an application would do
+      m_opacity = 0.5f + index % 2 * 0.5f;
+      m_location = Nimble::Vector2f(index * 10, index * 20);
+      m_size = Nimble::Vector2f(200, 100);
+      m_color = Radiant::ColorPMA(0.1f, 0.2f, 0.3f, 1.f);
+      m_text = QString("Item number %1").arg(index);
+    }
+
+  private:
+    Valuable::AttributeFloat m_opacity;
+    Valuable::AttributeVector2f m_location;
+    Valuable::AttributeVector2f m_size;
+    Valuable::AttributeColor m_color;
+    Valuable::AttributeString m_text;
+  };
+
+  class Tree
+  {
+  public:
+    Tree(int count)
+    {
+      for (int i = 0; i < count; ++i)
+        m_items.emplace_back(new Item(&m_root, "item-" + QByteArray::number(i), i));
+    }
+
+    Valuable::Node & root() { return m_root; }
+
+  private:
+    Valuable::Node m_root;
+    std::vector<std::unique_ptr<Item>> m_items;
+  };
+
+  /// Serializes a tree of argument 0 nodes to memory
+  template <typename ArchiveType>
+  void archiveWrite(benchmark::State & state)
+  {
+    Tree tree(state.range(0));
+    QByteArray buffer;
+
+    for (auto _: state) {
+      ArchiveType archive;
+      archive.setRoot(tree.root().serialize(archive));
+      archive.writeToMem(buffer);
+      benchmark::DoNotOptimize(buffer.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+    // Format changes show up in the results as size changes
+    state.counters["archiveBytes"] = buffer.size();
+  }
+  BENCHMARK_TEMPLATE(archiveWrite, Valuable::XMLArchive)->Arg(10)->Arg(1000);
+  BENCHMARK_TEMPLATE(archiveWrite, Valuable::BinaryArchive)->Arg(10)->Arg(1000);
+
+  /// Reads a tree of argument 0 nodes from memory and deserializes it to
+  /// an existing tree with the same structure
+  template <typename ArchiveType>
+  void archiveRead(benchmark::State & state)
+  {
+    Tree tree(state.range(0));
+    QByteArray buffer;
+    {
+      ArchiveType archive;
+      archive.setRoot(tree.root().serialize(archive));
+      archive.writeToMem(buffer);
+    }
+
+    for (auto _: state) {
+      ArchiveType archive;
+      archive.readFromMem(buffer);
+      bool ok = tree.root().deserialize(archive.root());
+      benchmark::DoNotOptimize(ok);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+  }
+  BENCHMARK_TEMPLATE(archiveRead, Valuable::XMLArchive)->Arg(10)->Arg(1000);
+  BENCHMARK_TEMPLATE(archiveRead, Valuable::BinaryArchive)->Arg(10)->Arg(1000);
+}
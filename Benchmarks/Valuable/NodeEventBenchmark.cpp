@@ -0,0 +1,116 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Valuable/AttributeFloat.hpp>
+#include <Valuable/Node.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace
+{
+  class Receiver : public Valuable::Node
+  {
+  public:
+    Receiver()
+    {
+      eventAddIn("ping");
+    }
+
+    virtual void eventProcess(const QByteArray & messageId, Radiant::BinaryData & data) override
+    {
+      if (messageId == "ping")
+        m_sum += data.readInt32();
+      else
+        Node::eventProcess(messageId, data);
+    }
+
+    int m_sum = 0;
+  };
+
+  /// Argument 0 is the number of listeners
+  void eventSendFunction(benchmark::State & state)
+  {
+    const int listeners = state.range(0);
+    Valuable::Node sender;
+    sender.eventAddOut("changed");
+
+    int calls = 0;
+    for (int i = 0; i < listeners; ++i)
+      sender.eventAddListener("changed", [&calls] { ++calls; });
+
+    for (auto _: state)
+      sender.eventSend("changed");
+    benchmark::DoNotOptimize(calls);
+    state.SetItemsProcessed(state.iterations() * listeners);
+  }
+  BENCHMARK(eventSendFunction)->Arg(1)->Arg(10)->Arg(100);
+
+  /// Events with BinaryData payload delivered to eventProcess of other nodes
+  void eventSendNode(benchmark::State & state)
+  {
+    const int listeners = state.range(0);
+    Valuable::Node sender;
+    sender.eventAddOut("changed");
+
+    std::vector<std::unique_ptr<Receiver>> receivers;
+    for (int i = 0; i < listeners; ++i) {
+      receivers.emplace_back(new Receiver());
+      sender.eventAddListener("changed", "ping", receivers.back().get());
+    }
+
+    for (auto _: state)
+      sender.eventSend("changed", 1);
+    state.SetItemsProcessed(state.iterations() * listeners);
+  }
+  BENCHMARK(eventSendNode)->Arg(1)->Arg(10)->Arg(100);
+
+  /// Events that are queued and delivered later in processQueue
+  void eventSendAfterUpdate(benchmark::State & state)
+  {
+    const int listeners = state.range(0);
+    Valuable::Node sender;
+    sender.eventAddOut("changed");
+
+    int calls = 0;
+    for (int i = 0; i < listeners; ++i)
+      sender.eventAddListener("changed", [&calls] { ++calls; }, Valuable::Node::AFTER_UPDATE);
+
+    for (auto _: state) {
+      sender.eventSend("changed");
+      Valuable::Node::processQueue();
+    }
+    benchmark::DoNotOptimize(calls);
+    state.SetItemsProcessed(state.iterations() * listeners);
+  }
+  BENCHMARK(eventSendAfterUpdate)->Arg(1)->Arg(10)->Arg(100);
+
+  /// Attribute change listeners, the most common event path in practice
+  void attributeChange(benchmark::State & state)
+  {
+    const int listeners = state.range(0);
+    Valuable::Node node;
+    Valuable::AttributeFloat value(&node, "value", 0.f);
+
+    int calls = 0;
+    for (int i = 0; i < listeners; ++i)
+      value.addListener([&calls] { ++calls; });
+
+    float v = 0;
+    for (auto _: state)
+      value = ++v;
+    benchmark::DoNotOptimize(calls);
+    state.SetItemsProcessed(state.iterations() * std::max(1, listeners));
+  }
+  BENCHMARK(attributeChange)->Arg(0)->Arg(1)->Arg(10);
+}
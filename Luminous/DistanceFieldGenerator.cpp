@@ -5,255 +5,475 @@
  * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
  * distributed with this source package or obtained from the GNU organization
  * (www.gnu.org).
- * 
+ *
  */
 
 #include "DistanceFieldGenerator.hpp"
 
 #include "Image.hpp"
 
-#include <Radiant/Grid.hpp>
+#include <Radiant/BGThread.hpp>
+#include <Radiant/Condition.hpp>
+#include <Radiant/Task.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LUMINOUS_SDF_SSE2 1
+#include <emmintrin.h>
+#endif
 
 namespace Luminous
 {
   namespace
   {
-    template<typename T, typename U>
-    void generalDistanceTransform1d(U * function,
-                                           T * output,
-                                           size_t output_stride,
-                                           int n,
-                                           int * locs,
-                                           float * ranges)
+    /// Source images smaller than this are processed on the calling thread only
+    const int s_parallelPixelLimit = 512 * 512;
+    /// Per-call buffers bigger than this are released after the call
+    const size_t s_maxRetainedBytes = 32 * 1024 * 1024;
+
+    /// Per-thread buffers for transforming one row or column
+    struct Scratch
+    {
+      std::vector<float> toBackground;
+      std::vector<float> toForeground;
+      std::vector<float> ranges;
+      std::vector<int> locs;
+      std::vector<float> values;
+
+      void reserve(int n)
+      {
+        if (int(locs.size()) < n) {
+          toBackground.resize(n);
+          toForeground.resize(n);
+          ranges.resize(n + 1);
+          locs.resize(n);
+          values.resize(n);
+        }
+      }
+    };
+
+    Scratch & scratch()
+    {
+      static thread_local Scratch s;
+      return s;
+    }
+
+    /// Source pixels needed to bilinearly sample the source at the
+    /// locations of the target pixels along one axis
+    struct Samples
+    {
+      /// Sorted source coordinates that are used
+      std::vector<int> coords;
+      /// For every target pixel, indices to coords of the two source pixels
+      std::vector<int> low, high;
+      /// For every target pixel, weight of the high pixel
+      std::vector<float> weight;
+
+      void init(int sourceSize, int targetSize, float scale)
+      {
+        std::vector<int> index(sourceSize, -1);
+        low.resize(targetSize);
+        high.resize(targetSize);
+        weight.resize(targetSize);
+
+        // Same sampling as Radiant::Grid::getInterpolatedSafe
+        for (int t = 0; t < targetSize; ++t) {
+          const float s = scale * t;
+          const int l = s;
+          weight[t] = s - l;
+          index[Nimble::Math::Clamp(l, 0, sourceSize - 1)] = 0;
+          index[Nimble::Math::Clamp(l + 1, 0, sourceSize - 1)] = 0;
+        }
+
+        coords.clear();
+        for (int s = 0; s < sourceSize; ++s) {
+          if (index[s] == 0) {
+            index[s] = int(coords.size());
+            coords.push_back(s);
+          }
+        }
+
+        for (int t = 0; t < targetSize; ++t) {
+          const int l = scale * t;
+          low[t] = index[Nimble::Math::Clamp(l, 0, sourceSize - 1)];
+          high[t] = index[Nimble::Math::Clamp(l + 1, 0, sourceSize - 1)];
+        }
+      }
+    };
+
+    /// Buffers of one generate call, owned by the calling thread
+    struct Buffers
     {
-      float inf = std::numeric_limits<float>::max();
+      Samples columns, rows;
+      /// Row transform results, one sampled column after another
+      std::vector<float> columnsToBackground, columnsToForeground;
+      /// Squared distances at the sampled source pixels, row-major
+      std::vector<float> gridToBackground, gridToForeground;
+
+      size_t bytes() const
+      {
+        return (columnsToBackground.capacity() + columnsToForeground.capacity() +
+                gridToBackground.capacity() + gridToForeground.capacity()) * sizeof(float);
+      }
+    };
+
+    Buffers & callBuffers()
+    {
+      static thread_local Buffers b;
+      return b;
+    }
+
+    /// Runs func(begin, end) for chunks of [0, count). The calling thread
+    /// processes chunks itself and idle BGThread workers help with the rest.
+    /// The caller only waits for chunks that are already being processed,
+    /// so this is safe to call from a BGThread task even if all the other
+    /// workers are busy.
+    void parallelFor(int count, int chunkSize, const std::function<void (int, int)> & func)
+    {
+      const int chunks = (count + chunkSize - 1) / chunkSize;
+      if (chunks <= 1) {
+        if (count > 0)
+          func(0, count);
+        return;
+      }
+
+      struct Shared
+      {
+        std::atomic<int> next{0};
+        std::atomic<int> done{0};
+        int chunks = 0;
+        int count = 0;
+        int chunkSize = 0;
+        const std::function<void (int, int)> * func = nullptr;
+        Radiant::Mutex mutex;
+        Radiant::Condition finished;
+
+        void work()
+        {
+          for (int chunk; (chunk = next.fetch_add(1)) < chunks;) {
+            const int begin = chunk * chunkSize;
+            (*func)(begin, std::min(count, begin + chunkSize));
+            if (done.fetch_add(1) + 1 == chunks)
+              finished.wakeAll(mutex);
+          }
+        }
+      };
+
+      auto shared = std::make_shared<Shared>();
+      shared->chunks = chunks;
+      shared->count = count;
+      shared->chunkSize = chunkSize;
+      shared->func = &func;
+
+      auto bg = Radiant::BGThread::instance();
+      const int helpers = std::min(chunks - 1, bg->threads());
+      for (int i = 0; i < helpers; ++i)
+        bg->addTask(std::make_shared<Radiant::SingleShotTask>([shared] { shared->work(); }));
+
+      shared->work();
+
+      Radiant::Guard g(shared->mutex);
+      while (shared->done < chunks)
+        shared->finished.wait(shared->mutex);
+    }
+
+    /// Felzenszwalb & Huttenlocher 1D squared distance transform of f, which
+    /// is 0 at the feature pixels and the clamped squared distance elsewhere.
+    /// The result is only evaluated at the sorted sample positions.
+    void distanceTransform1d(const float * f, int n,
+                             const std::vector<int> & samples,
+                             float * output, size_t outputStride, Scratch & s)
+    {
+      const float inf = std::numeric_limits<float>::max();
+      int * locs = s.locs.data();
+      float * ranges = s.ranges.data();
 
       int k = 0;
       locs[0] = 0;
       ranges[0] = -inf;
       ranges[1] = inf;
 
-      for(int q=1; q < n; ++q) {
+      for (int q = 1; q < n; ++q) {
         // s is the point of intersection for parabolas
-        //   x |-> (q-x)^2 + function[q])
+        //   x |-> (q-x)^2 + f[q]
         // and
-        //   x |-> (locs[k]-x)^2 + function[locs[k]]
-
-        float q2 = function[q] + q*q;
-retry:
-        float s = (q2 - (function[locs[k]] + locs[k]*locs[k])) / (2*(q - locs[k]));
-
-        if(s <= ranges[k]) {
-          k--;
-          goto retry;
+        //   x |-> (locs[k]-x)^2 + f[locs[k]]
+        const float q2 = f[q] + float(q) * q;
+        float is;
+        for (;;) {
+          const int l = locs[k];
+          is = (q2 - (f[l] + float(l) * l)) / (2 * (q - l));
+          if (is > ranges[k])
+            break;
+          --k;
         }
-        k++;
+        ++k;
         locs[k] = q;
-        ranges[k] = s;
-        ranges[k+1] = inf;
+        ranges[k] = is;
+        ranges[k + 1] = inf;
       }
 
       k = 0;
-      size_t index = 0;
-      for(int q=0; q < n; ++q) {
-        while(ranges[k+1] < q)
-          k++;
-
-
-        if(function[q] == 0) {
-          output[index] = 0;
-        } else { // height of lower envelope at locs[k]
-          int t = q-locs[k];
-          output[index] = t*t + function[locs[k]];
+      for (int q: samples) {
+        while (ranges[k + 1] < q)
+          ++k;
+
+        const float fq = f[q];
+        if (fq == 0) {
+          *output = 0;
+        } else {
+          // height of lower envelope at locs[k]
+          const int t = q - locs[k];
+          *output = float(t) * t + f[locs[k]];
         }
-
-        index += output_stride;
+        output += outputStride;
       }
     }
 
-    template<typename T, typename U>
-    void generalDistanceTransform2d(U * f, size_t stride, T * output, size_t w, size_t h,
-                                           std::vector<float> rowTransformed,
-                                           std::vector<int> locs,
-                                           std::vector<float> ranges
-                                           )
+    /// Writes toBackground = 0 for background (zero) pixels and inf
+    /// elsewhere, and toForeground the other way around
+    void threshold(const unsigned char * src, int n, float inf,
+                   float * toBackground, float * toForeground)
     {
-      if(rowTransformed.size() < w*h)
-        rowTransformed.resize(w*h);
-
-      if(locs.size() < std::max(w,h))
-        locs.resize(std::max(w, h));
+      int x = 0;
+#ifdef LUMINOUS_SDF_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      const __m128 infv = _mm_set1_ps(inf);
+      for (; x + 16 <= n; x += 16) {
+        const __m128i isZero8 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)), zero);
+        const __m128i isZero16lo = _mm_unpacklo_epi8(isZero8, isZero8);
+        const __m128i isZero16hi = _mm_unpackhi_epi8(isZero8, isZero8);
+        const __m128i isZero32[4] = {
+          _mm_unpacklo_epi16(isZero16lo, isZero16lo), _mm_unpackhi_epi16(isZero16lo, isZero16lo),
+          _mm_unpacklo_epi16(isZero16hi, isZero16hi), _mm_unpackhi_epi16(isZero16hi, isZero16hi)
+        };
+        for (int i = 0; i < 4; ++i) {
+          const __m128 mask = _mm_castsi128_ps(isZero32[i]);
+          _mm_storeu_ps(toBackground + x + i * 4, _mm_andnot_ps(mask, infv));
+          _mm_storeu_ps(toForeground + x + i * 4, _mm_and_ps(mask, infv));
+        }
+      }
+#endif
+      for (; x < n; ++x) {
+        const bool background = src[x] == 0;
+        toBackground[x] = background ? 0 : inf;
+        toForeground[x] = background ? inf : 0;
+      }
+    }
 
-      if(ranges.size() < std::max(w,h)+1)
-        ranges.resize(std::max(w,h)+1);
+    /// Converts interpolated signed squared distances to the final
+    /// normalized values: values[i] = clamp((0.5 + q) * maxValue)
+    void normalize(float * values, int n, float maxim, float maxValue)
+    {
+      int x = 0;
+      const float invMaxim = 1.0f / maxim;
+#ifdef LUMINOUS_SDF_SSE2
+      const __m128 signMask = _mm_set1_ps(-0.0f);
+      const __m128 half = _mm_set1_ps(0.5f);
+      const __m128 scale = _mm_set1_ps(invMaxim);
+      const __m128 maxv = _mm_set1_ps(maxValue);
+      for (; x + 4 <= n; x += 4) {
+        const __m128 v = _mm_loadu_ps(values + x);
+        const __m128 sign = _mm_and_ps(v, signMask);
+        const __m128 q = _mm_or_ps(_mm_sqrt_ps(_mm_andnot_ps(signMask, v)), sign);
+        __m128 r = _mm_mul_ps(_mm_add_ps(half, _mm_mul_ps(q, scale)), maxv);
+        r = _mm_min_ps(_mm_max_ps(r, _mm_setzero_ps()), maxv);
+        _mm_storeu_ps(values + x, r);
+      }
+#endif
+      for (; x < n; ++x) {
+        const float v = values[x];
+        const float q = (v < 0 ? -std::sqrt(-v) : std::sqrt(v)) * invMaxim;
+        values[x] = Nimble::Math::Clamp((0.5f + q) * maxValue, 0.0f, maxValue);
+      }
+    }
 
+    template <typename T>
+    void store(const float * values, int n, T * line)
+    {
+      // Clamp in double, float can't represent the maximum of 32-bit types
+      const double maxValue = std::numeric_limits<T>::max();
+      for (int x = 0; x < n; ++x)
+        line[x] = static_cast<T>(std::min<double>(values[x], maxValue));
+    }
 
-      for(size_t y=0; y < h; ++y) {
-        // transform row y,
-        // write result to column y of rowTransformed
-        generalDistanceTransform1d(&f[y * stride],
-                                   &rowTransformed[y], h, static_cast<int>(w),
-                                   locs.data(), ranges.data());
+#ifdef LUMINOUS_SDF_SSE2
+    template <>
+    void store<uint8_t>(const float * values, int n, uint8_t * line)
+    {
+      int x = 0;
+      for (; x + 8 <= n; x += 8) {
+        const __m128i a = _mm_cvttps_epi32(_mm_loadu_ps(values + x));
+        const __m128i b = _mm_cvttps_epi32(_mm_loadu_ps(values + x + 4));
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(line + x), packed);
       }
+      for (; x < n; ++x)
+        line[x] = static_cast<uint8_t>(values[x]);
+    }
 
-      for(size_t x=0; x < w; ++x) {
-        // transform row x of rowTransformed,
-        // write result to column x of output
-        generalDistanceTransform1d(&rowTransformed[x * h],
-                                   &output[x],
-                                   w, static_cast<int>(h),
-                                   locs.data(), ranges.data());
+    template <>
+    void store<uint16_t>(const float * values, int n, uint16_t * line)
+    {
+      // SSE2 only has signed saturation from 32 to 16 bits, so pack values
+      // biased to the signed range and flip the sign bit back afterwards
+      const __m128i bias32 = _mm_set1_epi32(0x8000);
+      const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+      int x = 0;
+      for (; x + 8 <= n; x += 8) {
+        const __m128i a = _mm_sub_epi32(_mm_cvttps_epi32(_mm_loadu_ps(values + x)), bias32);
+        const __m128i b = _mm_sub_epi32(_mm_cvttps_epi32(_mm_loadu_ps(values + x + 4)), bias32);
+        const __m128i packed = _mm_xor_si128(_mm_packs_epi32(a, b), bias16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(line + x), packed);
       }
+      for (; x < n; ++x)
+        line[x] = static_cast<uint16_t>(values[x]);
     }
+#endif
 
     template <typename T>
-    void writeImage(const float maxim, Luminous::Image & target,
-                    const Radiant::PtrGrid32u & distances_inv, const Radiant::PtrGrid32u & distances,
-                    const Nimble::Vector2f & scale)
+    void writeImage(const Buffers & b, float maxim, Luminous::Image & target,
+                    int rowBegin, int rowEnd, Scratch & s)
     {
-      const int theight = target.height(), twidth = target.width();
-      const float toInt = static_cast<float>((uint64_t(1) << (sizeof(T) * 8)) - 1);
-
-      for (int ty = 0; ty < theight; ++ty) {
-        T * line = reinterpret_cast<T*>(target.line(ty));
-        const float sy = scale.y*ty;
+      const int twidth = target.width();
+      const int columns = int(b.columns.coords.size());
+      const float maxValue = static_cast<float>(std::numeric_limits<T>::max());
+      float * values = s.values.data();
+
+      for (int ty = rowBegin; ty < rowEnd; ++ty) {
+        const float wyb = b.rows.weight[ty];
+        const float wyt = 1.0f - wyb;
+        const float * topBg = &b.gridToBackground[b.rows.low[ty] * columns];
+        const float * botBg = &b.gridToBackground[b.rows.high[ty] * columns];
+        const float * topFg = &b.gridToForeground[b.rows.low[ty] * columns];
+        const float * botFg = &b.gridToForeground[b.rows.high[ty] * columns];
 
         for (int tx = 0; tx < twidth; ++tx) {
-          const float sx = scale.x * tx;
-
-          float distance = distances.getInterpolatedSafe<float>(Nimble::Vector2(sx, sy));
-          float distance_inv = distances_inv.getInterpolatedSafe<float>(Nimble::Vector2(sx, sy));
-          float v = distance-distance_inv;
-          float sgn = v < 0 ? -1 : 1;
-          float q = sgn*std::sqrt(sgn*v) / maxim;
-          line[tx] = (0.5f + q) * toInt;
+          const int left = b.columns.low[tx], right = b.columns.high[tx];
+          const float wxr = b.columns.weight[tx];
+          const float wxl = 1.0f - wxr;
+
+          const float distance = topBg[left] * wxl * wyt + topBg[right] * wxr * wyt +
+              botBg[left] * wxl * wyb + botBg[right] * wxr * wyb;
+          const float distanceInv = topFg[left] * wxl * wyt + topFg[right] * wxr * wyt +
+              botFg[left] * wxl * wyb + botFg[right] * wxr * wyb;
+          values[tx] = distance - distanceInv;
         }
+
+        normalize(values, twidth, maxim, maxValue);
+        store(values, twidth, reinterpret_cast<T*>(target.line(ty)));
       }
     }
-  }
-
-  void DistanceFieldGenerator::generate(const Luminous::Image & src, Nimble::Vector2i srcSize, Luminous::Image & target, int radius)
-  {
-    const int sheight = srcSize.y, swidth = srcSize.x;
-    const int theight = target.height(), twidth = target.width();
-    const Nimble::Vector2f scale(float(swidth)/twidth, float(sheight)/theight);
-
-    assert(src.pixelFormat().bytesPerPixel() == 1);
 
-#if 1
-    const int spixels = sheight*swidth;
-    std::vector<uint32_t> orig(spixels), res(spixels), res_inverted(spixels);
+    void generateImpl(const DistanceFieldGenerator::Job & job, bool parallel)
+    {
+      const Luminous::Image & src = *job.src;
+      Luminous::Image & target = *job.target;
+      const int sheight = job.srcSize.y, swidth = job.srcSize.x;
+      const int theight = target.height(), twidth = target.width();
+      const int radius = job.radius;
 
-    // Squared distances are clamped to this
-    float inf = radius * radius;
+      assert(src.pixelFormat().bytesPerPixel() == 1);
 
-    for(int y=0; y < sheight; ++y) {
-      const unsigned char * p = src.line(y);
-      for(int x=0; x < swidth; ++x) {
-        orig[y*swidth + x] = *p == 0 ? 0 : inf;
-        p++;
+      const int bytesPerPixel = target.pixelFormat().bytesPerPixel();
+      if (bytesPerPixel != 1 && bytesPerPixel != 2 && bytesPerPixel != 4) {
+        Radiant::error("DistanceFieldGenerator::generate # Unsupported pixel format");
+        return;
       }
-    }
 
-    // temporary buffers
-    std::vector<float> rowTransformed;
-    std::vector<int> locs;
-    std::vector<float> ranges;
-
-    generalDistanceTransform2d(
-          orig.data(),
-          swidth,
-          res.data(),
-          static_cast<size_t>(swidth), static_cast<size_t>(sheight),
-          rowTransformed, locs, ranges
-          );
-
-    for(int i=0; i < spixels; ++i)
-      orig[i] = orig[i] == 0 ? inf : 0;
-
-    generalDistanceTransform2d(
-          orig.data(),
-          swidth,
-          res_inverted.data(),
-          swidth, sheight,
-          rowTransformed, locs, ranges
-          );
-
-
-    float maxim = 2*radius;
-
-    // squared distances
-    Radiant::PtrGrid32u distances(res.data(), swidth, sheight);
-    Radiant::PtrGrid32u distances_inv(res_inverted.data(), swidth, sheight);
-
-    if (target.pixelFormat().bytesPerPixel() == 1)
-      writeImage<uint8_t>(maxim, target, distances_inv, distances, scale);
-    else if (target.pixelFormat().bytesPerPixel() == 2)
-      writeImage<uint16_t>(maxim, target, distances_inv, distances, scale);
-    else if (target.pixelFormat().bytesPerPixel() == 4)
-      writeImage<uint32_t>(maxim, target, distances_inv, distances, scale);
-    else
-      Radiant::error("DistanceFieldGenerator::generate # Unsupported pixel format");
-
-#else
-    assert(target.pixelFormat().bytesPerPixel() == 1);
-
-    // Iterate all pixels in the target image
-    for (int ty = 0; ty < theight; ++ty) {
-      unsigned char * line = target.line(ty);
-      const int sy = Nimble::Math::Round(scale.y * ty);
-
-      for (int tx = 0; tx < twidth; ++tx) {
-        const int sx = Nimble::Math::Round(scale.x * tx);
-
-        // is this pixel "inside"
-        const bool pixelIn = src.line(sy)[sx] > 0x7f;
-
-        int best2 = radius*radius;
-
-        // manhattan distance optimization
-        int best1 = radius;
-
-        // this could actually test pixels from (sx, 0) -> (sx, sheight) and
-        // (0, sy) -> (swidth, sy) first, since after testing those, best1 with
-        // vm/um would be much smaller in most cases
-
-        // Iterate the neighbourhood in the source image
-        for (int v = std::max(0, sy-radius), vm = std::min(sheight, sy+radius); v < vm; ++v) {
-          const unsigned char * testLine = src.line(v);
-          for (int u = std::max(0, sx-radius), um = std::min(swidth, sx+radius); u < um; ++u) {
-
-            // Test if we found border
-            bool testIn = testLine[u] > 0x7f;
-            if (pixelIn == testIn)
-              continue;
-
-            int currentLength2 = (v-sy)*(v-sy) + (u-sx)*(u-sx);
-            if (currentLength2 > best2) continue;
-
-            best2 = currentLength2;
-
-            // manhattan length optimization to narrow down the search area
-            int currentLength1 = std::abs(v-sy) + std::abs(u-sx);
-            if (currentLength1 < best1) {
-              best1 = currentLength1;
-              vm = std::min(sheight, sy+currentLength1);
-              um = std::min(swidth, sx+currentLength1);
-              v = std::max(v, sy-currentLength1);
-              u = std::max(u, sx-currentLength1);
-            }
-          }
+      if (swidth <= 0 || sheight <= 0 || twidth <= 0 || theight <= 0)
+        return;
+
+      Buffers & b = callBuffers();
+      b.columns.init(swidth, twidth, float(swidth) / twidth);
+      b.rows.init(sheight, theight, float(sheight) / theight);
+
+      const int columns = int(b.columns.coords.size());
+      const int rows = int(b.rows.coords.size());
+
+      b.columnsToBackground.resize(size_t(columns) * sheight);
+      b.columnsToForeground.resize(size_t(columns) * sheight);
+      b.gridToBackground.resize(size_t(columns) * rows);
+      b.gridToForeground.resize(size_t(columns) * rows);
+
+      // Squared distances are clamped to this
+      const float inf = float(radius * radius);
+
+      parallel = parallel && swidth * sheight >= s_parallelPixelLimit;
+      auto run = [parallel] (int count, int chunkSize, const std::function<void (int, int)> & func) {
+        if (parallel)
+          parallelFor(count, chunkSize, func);
+        else
+          func(0, count);
+      };
+
+      // Transform all rows, but only evaluate the result at the sampled
+      // columns. Both the distance to the background and the distance to
+      // the foreground are computed in the same pass.
+      run(sheight, 64, [&] (int begin, int end) {
+        Scratch & s = scratch();
+        s.reserve(std::max(swidth, sheight));
+        for (int y = begin; y < end; ++y) {
+          threshold(src.line(y), swidth, inf, s.toBackground.data(), s.toForeground.data());
+          distanceTransform1d(s.toBackground.data(), swidth, b.columns.coords,
+                              &b.columnsToBackground[y], sheight, s);
+          distanceTransform1d(s.toForeground.data(), swidth, b.columns.coords,
+                              &b.columnsToForeground[y], sheight, s);
         }
+      });
+
+      // Transform the sampled columns, evaluate only at the sampled rows
+      run(columns, 16, [&] (int begin, int end) {
+        Scratch & s = scratch();
+        s.reserve(std::max(swidth, sheight));
+        for (int c = begin; c < end; ++c) {
+          distanceTransform1d(&b.columnsToBackground[size_t(c) * sheight], sheight, b.rows.coords,
+                              &b.gridToBackground[c], columns, s);
+          distanceTransform1d(&b.columnsToForeground[size_t(c) * sheight], sheight, b.rows.coords,
+                              &b.gridToForeground[c], columns, s);
+        }
+      });
+
+      const float maxim = 2 * radius;
+
+      run(theight, 32, [&] (int begin, int end) {
+        Scratch & s = scratch();
+        s.reserve(std::max(twidth, std::max(swidth, sheight)));
+        if (bytesPerPixel == 1)
+          writeImage<uint8_t>(b, maxim, target, begin, end, s);
+        else if (bytesPerPixel == 2)
+          writeImage<uint16_t>(b, maxim, target, begin, end, s);
+        else
+          writeImage<uint32_t>(b, maxim, target, begin, end, s);
+      });
+
+      if (b.bytes() > s_maxRetainedBytes)
+        b = Buffers();
+    }
+  }
 
-        // distance from 0 to 1 to the image edge
-        const float unsignedDistance = std::sqrt(float(best2)) / radius;
-
-        // signed distance normalized from 0 to 1
-        const float q = (pixelIn ? unsignedDistance : -unsignedDistance) * 0.5f + 0.5f;
+  void DistanceFieldGenerator::generate(const Luminous::Image & src, Nimble::Vector2i srcSize, Luminous::Image & target, int radius)
+  {
+    generateImpl(Job{&src, srcSize, &target, radius}, true);
+  }
 
-        line[tx] = q * 255;
-      }
+  void DistanceFieldGenerator::generateBatch(const Job * jobs, size_t count)
+  {
+    if (count == 1) {
+      generateImpl(jobs[0], true);
+      return;
     }
-#endif
+
+    // With several jobs it is cheaper to run each of them on one thread
+    parallelFor(int(count), 1, [jobs] (int begin, int end) {
+      for (int i = begin; i < end; ++i)
+        generateImpl(jobs[i], false);
+    });
   }
 }
@@ -21,11 +21,27 @@ namespace Luminous
   class DistanceFieldGenerator
   {
   public:
+    /// Parameters of one generate call, see generateBatch
+    struct Job
+    {
+      const Luminous::Image * src;
+      Nimble::Vector2i srcSize;
+      Luminous::Image * target;
+      int radius;
+    };
+
     /// Generates (usually low-resolution) distance field from a (high-resolution) src image
     /// Both images should be grayscale 8 bit images
+    /// Large images are processed in parallel using the BGThread workers.
     /// @param radius search neighbourhood size in src texels
     static  void LUMINOUS_API generate(const Luminous::Image & src, Nimble::Vector2i srcSize,
                                Luminous::Image & target, int radius);
+
+    /// Generates several distance fields. Jobs are processed in parallel
+    /// using the BGThread workers, which is faster than calling generate for
+    /// each of them when there are many small images, like font glyphs.
+    /// This function is thread-safe and returns when all jobs are done.
+    static void LUMINOUS_API generateBatch(const Job * jobs, size_t count);
   };
 }
 /// @endcond
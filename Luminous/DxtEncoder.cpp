@@ -0,0 +1,447 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "DxtEncoder.hpp"
+#include "Image.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LUMINOUS_DXT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Luminous
+{
+  namespace
+  {
+    /// 4x4 pixels in row-major order, every pixel is R, G, B, A bytes
+    struct alignas(16) Block
+    {
+      uint32_t pixels[16];
+    };
+
+    inline int channel(uint32_t pixel, int c)
+    {
+      return (pixel >> (c * 8)) & 0xff;
+    }
+
+    /// Multiplies two 8-bit values and divides by 255 with correct rounding
+    inline int mul8bit(int a, int b)
+    {
+      const int t = a * b + 128;
+      return (t + (t >> 8)) >> 8;
+    }
+
+    inline uint16_t toRgb565(const int c[3])
+    {
+      return uint16_t((mul8bit(c[0], 31) << 11) | (mul8bit(c[1], 63) << 5) | mul8bit(c[2], 31));
+    }
+
+    /// Expands 565 color back to 8 bits per channel, the same way as the GPU
+    inline void fromRgb565(uint16_t v, int c[3])
+    {
+      const int r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+      c[0] = (r << 3) | (r >> 2);
+      c[1] = (g << 2) | (g >> 4);
+      c[2] = (b << 3) | (b >> 2);
+    }
+
+    inline void writeU16(uint8_t * dst, uint16_t v)
+    {
+      dst[0] = uint8_t(v);
+      dst[1] = uint8_t(v >> 8);
+    }
+
+    inline void writeU32(uint8_t * dst, uint32_t v)
+    {
+      dst[0] = uint8_t(v);
+      dst[1] = uint8_t(v >> 8);
+      dst[2] = uint8_t(v >> 16);
+      dst[3] = uint8_t(v >> 24);
+    }
+
+    inline uint32_t swapRedBlue(uint32_t p)
+    {
+      return (p & 0xff00ff00u) | ((p >> 16) & 0xffu) | ((p & 0xffu) << 16);
+    }
+
+    /// Reads one block from the source. Pixels outside width x height are
+    /// replaced with the nearest edge pixel.
+    void loadBlock(const uint8_t * src, int lineSizeBytes, int width, int height,
+                   bool bgra, Block & block)
+    {
+      if (width >= 4 && height >= 4) {
+#ifdef LUMINOUS_DXT_SSE2
+        const __m128i greenAlpha = _mm_set1_epi32(int(0xff00ff00));
+        const __m128i low = _mm_set1_epi32(0xff);
+        for (int y = 0; y < 4; ++y) {
+          __m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + y * lineSizeBytes));
+          if (bgra) {
+            const __m128i blue = _mm_and_si128(_mm_srli_epi32(row, 16), low);
+            const __m128i red = _mm_slli_epi32(_mm_and_si128(row, low), 16);
+            row = _mm_or_si128(_mm_and_si128(row, greenAlpha), _mm_or_si128(red, blue));
+          }
+          _mm_store_si128(reinterpret_cast<__m128i*>(block.pixels + y * 4), row);
+        }
+        return;
+#else
+        for (int y = 0; y < 4; ++y)
+          std::memcpy(block.pixels + y * 4, src + y * lineSizeBytes, 16);
+#endif
+      } else {
+        for (int y = 0; y < 4; ++y) {
+          const uint8_t * line = src + std::min(y, height - 1) * lineSizeBytes;
+          for (int x = 0; x < 4; ++x)
+            std::memcpy(block.pixels + y * 4 + x, line + std::min(x, width - 1) * 4, 4);
+        }
+      }
+
+      if (bgra)
+        for (uint32_t & p: block.pixels)
+          p = swapRedBlue(p);
+    }
+
+    /// Finds the per-channel minimum and maximum of the block
+    void bounds(const Block & block, int mn[4], int mx[4])
+    {
+#ifdef LUMINOUS_DXT_SSE2
+      const __m128i * rows = reinterpret_cast<const __m128i*>(block.pixels);
+      __m128i lo = _mm_min_epu8(_mm_min_epu8(rows[0], rows[1]), _mm_min_epu8(rows[2], rows[3]));
+      __m128i hi = _mm_max_epu8(_mm_max_epu8(rows[0], rows[1]), _mm_max_epu8(rows[2], rows[3]));
+      lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+      hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+      lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+      hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+      const uint32_t l = uint32_t(_mm_cvtsi128_si32(lo));
+      const uint32_t h = uint32_t(_mm_cvtsi128_si32(hi));
+      for (int c = 0; c < 4; ++c) {
+        mn[c] = channel(l, c);
+        mx[c] = channel(h, c);
+      }
+#else
+      for (int c = 0; c < 4; ++c) {
+        mn[c] = 255;
+        mx[c] = 0;
+      }
+      for (uint32_t p: block.pixels) {
+        for (int c = 0; c < 4; ++c) {
+          mn[c] = std::min(mn[c], channel(p, c));
+          mx[c] = std::max(mx[c], channel(p, c));
+        }
+      }
+#endif
+    }
+
+    /// Chooses the color end points from the bounding box of the block.
+    /// The box diagonal is flipped to follow the direction where the colors
+    /// are correlated, and the end points are inset by 1/16 of the range,
+    /// which reduces the average error since the extremes are rarely hit.
+    void endPoints(const Block & block, const int mn[4], const int mx[4], int c0[3], int c1[3])
+    {
+      // Use the channel with the largest range as the reference
+      int ref = 0;
+      for (int c = 1; c < 3; ++c)
+        if (mx[c] - mn[c] > mx[ref] - mn[ref])
+          ref = c;
+
+      int lo[3] = { mn[0], mn[1], mn[2] };
+      int hi[3] = { mx[0], mx[1], mx[2] };
+
+      if (mx[ref] > mn[ref]) {
+        int center[3];
+        for (int c = 0; c < 3; ++c)
+          center[c] = mn[c] + mx[c];
+
+        int cov[3] = { 0, 0, 0 };
+        for (uint32_t p: block.pixels) {
+          const int r = 2 * channel(p, ref) - center[ref];
+          for (int c = 0; c < 3; ++c)
+            cov[c] += (2 * channel(p, c) - center[c]) * r;
+        }
+
+        for (int c = 0; c < 3; ++c)
+          if (cov[c] < 0)
+            std::swap(lo[c], hi[c]);
+      }
+
+      for (int c = 0; c < 3; ++c) {
+        const int inset = (hi[c] - lo[c]) / 16;
+        c0[c] = hi[c] - inset;
+        c1[c] = lo[c] + inset;
+      }
+    }
+
+    /// Finds the nearest of the four palette colors for every pixel, using
+    /// the L1 distance in RGB
+    uint32_t colorIndices(const Block & block, const int palette[4][3])
+    {
+#ifdef LUMINOUS_DXT_SSE2
+      const __m128i rgbMask = _mm_set1_epi32(0x00ffffff);
+      const __m128i byteMask = _mm_set1_epi32(0xff);
+      const __m128i one = _mm_set1_epi32(1);
+      const __m128i two = _mm_set1_epi32(2);
+      const __m128i shifts = _mm_set_epi32(64, 16, 4, 1);
+
+      __m128i colors[4];
+      for (int i = 0; i < 4; ++i)
+        colors[i] = _mm_set1_epi32(palette[i][0] | (palette[i][1] << 8) | (palette[i][2] << 16));
+
+      const __m128i * rows = reinterpret_cast<const __m128i*>(block.pixels);
+      uint32_t indices = 0;
+      for (int y = 0; y < 4; ++y) {
+        const __m128i row = _mm_and_si128(rows[y], rgbMask);
+        __m128i d[4];
+        for (int i = 0; i < 4; ++i) {
+          const __m128i diff = _mm_or_si128(_mm_subs_epu8(row, colors[i]), _mm_subs_epu8(colors[i], row));
+          d[i] = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(diff, byteMask),
+                                             _mm_and_si128(_mm_srli_epi32(diff, 8), byteMask)),
+                               _mm_srli_epi32(diff, 16));
+        }
+
+        // The palette is ordered c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1,
+        // so the nearest color can be found with a few comparisons
+        const __m128i b0 = _mm_cmpgt_epi32(d[0], d[3]);
+        const __m128i b1 = _mm_cmpgt_epi32(d[1], d[2]);
+        const __m128i b2 = _mm_cmpgt_epi32(d[0], d[2]);
+        const __m128i b3 = _mm_cmpgt_epi32(d[1], d[3]);
+        const __m128i b4 = _mm_cmpgt_epi32(d[2], d[3]);
+        const __m128i x0 = _mm_and_si128(b1, b2);
+        const __m128i x1 = _mm_and_si128(b0, b3);
+        const __m128i x2 = _mm_and_si128(b0, b4);
+        __m128i index = _mm_or_si128(_mm_and_si128(x2, one), _mm_and_si128(_mm_or_si128(x0, x1), two));
+
+        // Pack the four 2-bit indices of the row to one byte
+        index = _mm_mullo_epi16(index, shifts);
+        index = _mm_or_si128(index, _mm_srli_si128(index, 8));
+        index = _mm_or_si128(index, _mm_srli_si128(index, 4));
+        indices |= uint32_t(_mm_cvtsi128_si32(index) & 0xff) << (y * 8);
+      }
+      return indices;
+#else
+      uint32_t indices = 0;
+      for (int i = 0; i < 16; ++i) {
+        const uint32_t p = block.pixels[i];
+        int best = 0, bestDistance = 1 << 30;
+        for (int j = 0; j < 4; ++j) {
+          const int d = std::abs(channel(p, 0) - palette[j][0]) +
+              std::abs(channel(p, 1) - palette[j][1]) +
+              std::abs(channel(p, 2) - palette[j][2]);
+          if (d < bestDistance) {
+            bestDistance = d;
+            best = j;
+          }
+        }
+        indices |= uint32_t(best) << (i * 2);
+      }
+      return indices;
+#endif
+    }
+
+    /// Encodes the 8-byte color part of the block. With punchThrough, pixels
+    /// with alpha below 128 are encoded as transparent using the 3-color mode
+    /// of DXT1.
+    void encodeColor(const Block & block, const int mn[4], const int mx[4],
+                     bool punchThrough, uint8_t * dst)
+    {
+      int e0[3], e1[3];
+      endPoints(block, mn, mx, e0, e1);
+
+      uint16_t v0 = toRgb565(e0);
+      uint16_t v1 = toRgb565(e1);
+
+      if (punchThrough && mn[3] < 128) {
+        // 3-color mode requires v0 <= v1, index 3 is transparent
+        if (v0 > v1)
+          std::swap(v0, v1);
+        int c0[3], c1[3];
+        fromRgb565(v0, c0);
+        fromRgb565(v1, c1);
+        int palette[3][3];
+        for (int c = 0; c < 3; ++c) {
+          palette[0][c] = c0[c];
+          palette[1][c] = c1[c];
+          palette[2][c] = (c0[c] + c1[c]) / 2;
+        }
+
+        uint32_t indices = 0;
+        for (int i = 0; i < 16; ++i) {
+          const uint32_t p = block.pixels[i];
+          int best = 3;
+          if (channel(p, 3) >= 128) {
+            int bestDistance = 1 << 30;
+            for (int j = 0; j < 3; ++j) {
+              const int d = std::abs(channel(p, 0) - palette[j][0]) +
+                  std::abs(channel(p, 1) - palette[j][1]) +
+                  std::abs(channel(p, 2) - palette[j][2]);
+              if (d < bestDistance) {
+                bestDistance = d;
+                best = j;
+              }
+            }
+          }
+          indices |= uint32_t(best) << (i * 2);
+        }
+
+        writeU16(dst, v0);
+        writeU16(dst + 2, v1);
+        writeU32(dst + 4, indices);
+        return;
+      }
+
+      // 4-color mode requires v0 > v1. If the end points are the same, all
+      // indices are zero and the mode doesn't matter.
+      if (v0 < v1)
+        std::swap(v0, v1);
+
+      uint32_t indices = 0;
+      if (v0 != v1) {
+        int c0[3], c1[3];
+        fromRgb565(v0, c0);
+        fromRgb565(v1, c1);
+        int palette[4][3];
+        for (int c = 0; c < 3; ++c) {
+          palette[0][c] = c0[c];
+          palette[1][c] = c1[c];
+          palette[2][c] = (2 * c0[c] + c1[c]) / 3;
+          palette[3][c] = (c0[c] + 2 * c1[c]) / 3;
+        }
+        indices = colorIndices(block, palette);
+      }
+
+      writeU16(dst, v0);
+      writeU16(dst + 2, v1);
+      writeU32(dst + 4, indices);
+    }
+
+    /// DXT5 alpha block with the full alpha range of the block as the end
+    /// points. The index selection is exact for the given end points, see
+    /// "DXT5 alpha block index determination" by Fabian Giesen.
+    void encodeAlphaDxt5(const Block & block, int mn, int mx, uint8_t * dst)
+    {
+      dst[0] = uint8_t(mx);
+      dst[1] = uint8_t(mn);
+      dst += 2;
+
+      const int dist = mx - mn;
+      const int dist4 = dist * 4;
+      const int dist2 = dist * 2;
+      const int bias = (dist < 8 ? dist - 1 : dist / 2 + 2) - mn * 7;
+
+      int bits = 0, mask = 0;
+      for (uint32_t p: block.pixels) {
+        int a = channel(p, 3) * 7 + bias;
+
+        // Linear index from 0 (min) to 7 (max)
+        int t = a >= dist4 ? -1 : 0;
+        int index = t & 4;
+        a -= dist4 & t;
+        t = a >= dist2 ? -1 : 0;
+        index += t & 2;
+        a -= dist2 & t;
+        index += a >= dist;
+
+        // Convert to the DXT5 order, where 0 and 1 are the end points
+        index = -index & 7;
+        index ^= 2 > index;
+
+        mask |= index << bits;
+        if ((bits += 3) >= 8) {
+          *dst++ = uint8_t(mask);
+          mask >>= 8;
+          bits -= 8;
+        }
+      }
+    }
+
+    void encodeAlphaDxt3(const Block & block, uint8_t * dst)
+    {
+      for (int i = 0; i < 8; ++i) {
+        const int a0 = mul8bit(channel(block.pixels[i * 2], 3), 15);
+        const int a1 = mul8bit(channel(block.pixels[i * 2 + 1], 3), 15);
+        dst[i] = uint8_t(a0 | (a1 << 4));
+      }
+    }
+
+    inline int blockSize(PixelFormat::Compression compression)
+    {
+      return compression == PixelFormat::COMPRESSED_RGB_DXT1 ||
+          compression == PixelFormat::COMPRESSED_RGBA_DXT1 ? 8 : 16;
+    }
+
+    bool isSupportedCompression(PixelFormat::Compression compression)
+    {
+      return compression == PixelFormat::COMPRESSED_RGB_DXT1 ||
+          compression == PixelFormat::COMPRESSED_RGBA_DXT1 ||
+          compression == PixelFormat::COMPRESSED_RGBA_DXT3 ||
+          compression == PixelFormat::COMPRESSED_RGBA_DXT5;
+    }
+  }
+
+  bool DxtEncoder::isSupported(const PixelFormat & srcFormat)
+  {
+    return srcFormat.compression() == PixelFormat::COMPRESSION_NONE &&
+        srcFormat.type() == PixelFormat::TYPE_UBYTE &&
+        (srcFormat.layout() == PixelFormat::LAYOUT_RGBA || srcFormat.layout() == PixelFormat::LAYOUT_BGRA);
+  }
+
+  std::size_t DxtEncoder::compressedSize(int width, int height, PixelFormat::Compression compression)
+  {
+    const std::size_t blocks = std::size_t((width + 3) / 4) * std::size_t((height + 3) / 4);
+    return blocks * blockSize(compression);
+  }
+
+  bool DxtEncoder::compress(const void * src, int width, int height, int lineSizeBytes,
+                            const PixelFormat & srcFormat, PixelFormat::Compression compression,
+                            void * dst)
+  {
+    if (!isSupported(srcFormat) || !isSupportedCompression(compression))
+      return false;
+
+    const bool bgra = srcFormat.layout() == PixelFormat::LAYOUT_BGRA;
+    const bool punchThrough = compression == PixelFormat::COMPRESSED_RGBA_DXT1;
+    const int size = blockSize(compression);
+
+    const uint8_t * in = static_cast<const uint8_t*>(src);
+    uint8_t * out = static_cast<uint8_t*>(dst);
+
+    Block block;
+    int mn[4], mx[4];
+
+    for (int y = 0; y < height; y += 4) {
+      const uint8_t * line = in + std::size_t(y) * lineSizeBytes;
+      for (int x = 0; x < width; x += 4) {
+        loadBlock(line + x * 4, lineSizeBytes, width - x, height - y, bgra, block);
+        bounds(block, mn, mx);
+
+        if (compression == PixelFormat::COMPRESSED_RGBA_DXT5) {
+          encodeAlphaDxt5(block, mn[3], mx[3], out);
+          encodeColor(block, mn, mx, false, out + 8);
+        } else if (compression == PixelFormat::COMPRESSED_RGBA_DXT3) {
+          encodeAlphaDxt3(block, out);
+          encodeColor(block, mn, mx, false, out + 8);
+        } else {
+          encodeColor(block, mn, mx, punchThrough, out);
+        }
+        out += size;
+      }
+    }
+    return true;
+  }
+
+  bool DxtEncoder::compress(const Image & src, PixelFormat::Compression compression, void * dst)
+  {
+    return compress(src.data(), src.width(), src.height(), src.lineSize(),
+                    src.pixelFormat(), compression, dst);
+  }
+}
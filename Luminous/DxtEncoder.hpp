@@ -0,0 +1,69 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+#include "PixelFormat.hpp"
+
+#include <cstddef>
+
+namespace Luminous
+{
+  class Image;
+
+  /// Real-time DXT (S3TC) encoder for dynamic content.
+  ///
+  /// Squish, which MipMapGenerator uses for cached mipmaps, is tuned for
+  /// quality and is too slow for content that changes every frame, like
+  /// video snapshots or web views. This encoder uses the bounding box of
+  /// each 4x4 block, inset slightly and oriented along the dominant diagonal,
+  /// as the color end points, and SSE2 for finding the block bounds and the
+  /// color indices. It compresses hundreds of megabytes of RGBA data per
+  /// second on one core, at a quality comparable to squish::kColourRangeFit.
+  ///
+  /// Supported source formats are 8-bit RGBA and BGRA. Supported output
+  /// formats are DXT1 (RGB, or RGBA with 1-bit alpha), DXT3 and DXT5.
+  ///
+  /// All functions are thread-safe.
+  class DxtEncoder
+  {
+  public:
+    /// @returns true if images with the given pixel format can be compressed
+    LUMINOUS_API static bool isSupported(const PixelFormat & srcFormat);
+
+    /// @returns number of bytes needed for the compressed image. Partial
+    ///          blocks on the right and bottom edges are counted as full blocks.
+    LUMINOUS_API static std::size_t compressedSize(int width, int height,
+                                                   PixelFormat::Compression compression);
+
+    /// Compresses a rectangle of 8-bit RGBA or BGRA pixels. Blocks are
+    /// written in row-major order. Partial blocks on the right and bottom
+    /// edges are filled by repeating the last column and row.
+    /// @param src pointer to the top-left pixel of the rectangle
+    /// @param width width of the rectangle in pixels
+    /// @param height height of the rectangle in pixels
+    /// @param lineSizeBytes distance between the source rows in bytes
+    /// @param srcFormat format of the source pixels, see isSupported
+    /// @param compression output format
+    /// @param dst output buffer, must have at least compressedSize bytes
+    /// @returns false if the formats are not supported
+    LUMINOUS_API static bool compress(const void * src, int width, int height, int lineSizeBytes,
+                                      const PixelFormat & srcFormat,
+                                      PixelFormat::Compression compression, void * dst);
+
+    /// Compresses the whole image
+    /// @param src image to compress, see isSupported
+    /// @param compression output format
+    /// @param dst output buffer, must have at least compressedSize bytes
+    /// @returns false if the formats are not supported
+    LUMINOUS_API static bool compress(const Image & src, PixelFormat::Compression compression, void * dst);
+  };
+}
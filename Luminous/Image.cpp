@@ -724,6 +724,11 @@ namespace Luminous
   }
 */
   bool Image::read(const QString & filename, bool usePreMultipliedAlpha)
+  {
+    return readScaled(filename, Nimble::Size(), usePreMultipliedAlpha);
+  }
+
+  bool Image::readScaled(const QString & filename, Nimble::Size minSize, bool usePreMultipliedAlpha)
   {
     initDefaultImageCodecs();
 
@@ -739,7 +744,8 @@ namespace Luminous
     if (codec) {
       bool ok = false;
       try {
-        ok = codec->read(*this, file);
+        ok = minSize.isEmpty() ? codec->read(*this, file)
+                               : codec->readScaled(*this, file, minSize);
       } catch (std::bad_alloc & err) {
         Radiant::error("Image::read # %s: %s", filename.toUtf8().data(), err.what());
       }
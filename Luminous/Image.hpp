@@ -32,7 +32,7 @@ namespace Luminous
   /// Simple struct containing basic image information that can be quickly
   /// queried (with Image::ping) without loading the full image.
   struct ImageInfo {
-    ImageInfo() : width(0), height(0), mipmaps(1) {}
+    ImageInfo() : width(0), height(0), mipmaps(1), scaledRead(false) {}
     /// Width of the image
     int width;
     /// Height of the image
@@ -41,6 +41,9 @@ namespace Luminous
     int mipmaps;
     /// Pixel format of the image
     PixelFormat pf;
+    /// True if the codec can decode the image at reduced scale faster than
+    /// at full size, see Image::readScaled
+    bool scaledRead;
   };
 
   /// Simple image handling class
@@ -122,6 +125,15 @@ namespace Luminous
     /// @param filename name of the file to read from
     /// @return true if the image was successfully read
     bool read(const QString & filename, bool usePreMultipliedAlpha);
+    /// Load an image at reduced scale from the given filename. Codecs that
+    /// support it decode only what is needed for the requested size, for
+    /// example JPEG images are decoded with DCT scaling. The image is at
+    /// least minSize, but can be bigger, and it is the full size image if
+    /// the codec doesn't support scaled decoding.
+    /// @param filename name of the file to read from
+    /// @param minSize smallest acceptable size of the image
+    /// @return true if the image was successfully read
+    bool readScaled(const QString & filename, Nimble::Size minSize, bool usePreMultipliedAlpha);
     /// Save the image to a file
     /// @param filename name of the file to write to
     /// @return true if the image was successfully written
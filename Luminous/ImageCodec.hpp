@@ -55,6 +55,17 @@ namespace Luminous
       /// @return true if the file was decoded successfully, false otherwise
       virtual bool read(Image & image, QFile & file) = 0;
 
+      /// Read the image data at reduced scale. Codecs that can decode a
+      /// smaller image faster than the full image should override this and
+      /// set ImageInfo::scaledRead in ping. The default implementation reads
+      /// the full image.
+      /// @param image Image to store the data into
+      /// @param file file to read the data from
+      /// @param minSize smallest acceptable size, the decoded image can be
+      ///        bigger than this
+      /// @return true if the file was decoded successfully, false otherwise
+      virtual bool readScaled(Image & image, QFile & file, Nimble::Size minSize) { (void)minSize; return read(image, file); }
+
 #ifndef LUMINOUS_OPENGLES
       /// Read compressed image data from the given file.
       /// @param image image to read to
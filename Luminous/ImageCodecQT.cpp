@@ -97,7 +97,21 @@ namespace Luminous
     return checkFormat(img.format(), qformatOut, formatOut);
   }
 
-  static bool load(QImage & img, QFile & file)
+  /// Size for decoding the image at 1/2, 1/4 or 1/8 scale. These are the
+  /// scales that JPEG decoder can produce directly with DCT scaling.
+  static QSize scaledSize(QSize size, Nimble::Size minSize)
+  {
+    QSize scaled = size;
+    for (int scale = 2; scale <= 8; scale *= 2) {
+      QSize s((size.width() + scale - 1) / scale, (size.height() + scale - 1) / scale);
+      if (s.width() < minSize.width() || s.height() < minSize.height())
+        break;
+      scaled = s;
+    }
+    return scaled;
+  }
+
+  static bool load(QImage & img, QFile & file, Nimble::Size minSize)
   {
     QImageReader r(&file);
     const bool findBiggestImage = r.format() == "ico";
@@ -125,6 +139,13 @@ namespace Luminous
       if (bestIndex >= 0) {
         r.jumpToImage(bestIndex);
       }
+    } else if (!minSize.isEmpty() && r.supportsOption(QImageIOHandler::ScaledSize)) {
+      const QSize size = r.size();
+      if (size.isValid()) {
+        const QSize scaled = scaledSize(size, minSize);
+        if (scaled != size)
+          r.setScaledSize(scaled);
+      }
     }
     return r.read(&img);
   }
@@ -216,14 +237,20 @@ namespace Luminous
         Radiant::error("ImageCodecQT::ping # image has unsupported pixel format (%d: %dx%d)",
                        r.imageFormat(), r.size().width(), r.size().height());
       }
+      info.scaledRead = r.supportsOption(QImageIOHandler::ScaledSize);
     }
     return ok;
   }
 
   bool ImageCodecQT::read(Image & image, QFile & file)
+  {
+    return readScaled(image, file, Nimble::Size());
+  }
+
+  bool ImageCodecQT::readScaled(Image & image, QFile & file, Nimble::Size minSize)
   {
     QImage qi;
-    if (!load(qi, file))
+    if (!load(qi, file, minSize))
       return false;
 
     QImage::Format dstFormat;
@@ -12,6 +12,8 @@
 
 #include <Luminous/Image.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 
 #include <QFile>
@@ -85,6 +87,8 @@ namespace Luminous
 
     // always this
     info.pf = PixelFormat::rgbaUByte();
+    // Vector graphics can be rendered directly at any size
+    info.scaledRead = true;
 
     info.width = r->defaultSize().width();
     info.height = r->defaultSize().height();
@@ -93,6 +97,11 @@ namespace Luminous
   }
 
   bool ImageCodecSVG::read(Image & image, QFile & file)
+  {
+    return readScaled(image, file, Nimble::Size());
+  }
+
+  bool ImageCodecSVG::readScaled(Image & image, QFile & file, Nimble::Size minSize)
   {
     std::unique_ptr<QSvgRenderer> r = createRenderer(file);
 
@@ -102,6 +111,14 @@ namespace Luminous
 
     int width = r->defaultSize().width();
     int height = r->defaultSize().height();
+
+    if (!minSize.isEmpty() && minSize.width() < width && minSize.height() < height) {
+      // Keep the aspect ratio, the result is at least minSize
+      const float scale = std::max(float(minSize.width()) / width, float(minSize.height()) / height);
+      width = std::min(width, static_cast<int>(std::ceil(width * scale)));
+      height = std::min(height, static_cast<int>(std::ceil(height * scale)));
+    }
+
     QImage img(width, height, QImage::Format_ARGB32);
 
     // This might happen if the image size is too big
@@ -112,7 +129,7 @@ namespace Luminous
     image.allocate(width, height, PixelFormat::rgbaUByte());
     img.fill(0x00000000);
     QPainter painter(&img);
-    r->render(&painter);
+    r->render(&painter, QRectF(0, 0, width, height));
     painter.end();
 
     const uint8_t * src = img.bits();
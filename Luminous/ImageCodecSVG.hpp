@@ -31,6 +31,7 @@ public:
   virtual QString name() const OVERRIDE;
   virtual bool ping(ImageInfo & info, QFile & file) OVERRIDE;
   virtual bool read(Image & image, QFile & file) OVERRIDE;
+  virtual bool readScaled(Image & image, QFile & file, Nimble::Size minSize) OVERRIDE;
   /// not supported
   virtual bool write(const Image & image, QSaveFile & file) OVERRIDE;
 };
@@ -21,6 +21,7 @@ HEADERS += ProgramGL.hpp \
     MemoryManager.hpp \
     Nvml.hpp
 HEADERS += RenderDriverGL.hpp
+HEADERS += RenderDriverHeadless.hpp
 HEADERS += ResourceHandleGL.hpp
 HEADERS += StateGL.hpp
 HEADERS += TextureGL.hpp
@@ -40,6 +41,7 @@ HEADERS += ColorCorrection.hpp
 HEADERS += RGBCube.hpp
 HEADERS += ContextArray.hpp
 HEADERS += DistanceFieldGenerator.hpp
+HEADERS += DxtEncoder.hpp
 HEADERS += Export.hpp
 HEADERS += GLKeyStone.hpp
 HEADERS += Buffer.hpp
@@ -48,6 +50,7 @@ HEADERS += ImageCodecTGA.hpp
 HEADERS += Image.hpp
 HEADERS += Luminous.hpp
 HEADERS += Mipmap.hpp
+HEADERS += MipmapPyramid.hpp
 HEADERS += MultiHead.hpp
 HEADERS += PixelFormat.hpp
 HEADERS += PostProcessChain.hpp
@@ -109,6 +112,7 @@ SOURCES += ProgramGL.cpp \
     PostProcessContext.cpp \
     PostProcessFilter.cpp
 SOURCES += RenderDriverGL.cpp
+SOURCES += RenderDriverHeadless.cpp
 SOURCES += TextureGL.cpp
 SOURCES += VertexArrayGL.cpp
 SOURCES += BufferGL.cpp
@@ -132,11 +136,13 @@ SOURCES += CodecRegistry.cpp
 SOURCES += ColorCorrection.cpp
 SOURCES += RGBCube.cpp
 SOURCES += DistanceFieldGenerator.cpp
+SOURCES += DxtEncoder.cpp
 SOURCES += GLKeyStone.cpp
 SOURCES += Buffer.cpp
 SOURCES += Image.cpp
 SOURCES += Luminous.cpp
 SOURCES += Mipmap.cpp
+SOURCES += MipmapPyramid.cpp
 SOURCES += MultiHead.cpp
 SOURCES += PixelFormat.cpp
 SOURCES += PostProcessChain.cpp
@@ -56,6 +56,10 @@ namespace Luminous
       /// iteration and might send out-of-memory event every time the usage is
       /// more than the profile settings allows.
       double pollingIntervalS = 1.0;
+      /// Maximum amount of CPU memory used by decoded images (Mipmap levels)
+      /// before the least valuable images are released, even if the system
+      /// still has free memory. Zero means that there is no limit.
+      uint64_t maxImageMemoryMB = 0;
     };
 
   public:
@@ -14,6 +14,7 @@
 #include "Luminous/Texture.hpp"
 #include "Luminous/MemoryManager.hpp"
 #include "Luminous/MipMapGenerator.hpp"
+#include "Luminous/MipmapPyramid.hpp"
 #include "Luminous/RenderManager.hpp"
 
 #include <Radiant/FileUtils.hpp>
@@ -29,7 +30,9 @@
 #include <QDateTime>
 #include <QStandardPaths>
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 
 #ifdef RADIANT_LINUX
 #include <malloc.h>
@@ -52,6 +55,27 @@ namespace
 
   bool s_dxtSupported = true;
 
+  bool s_mipmapPyramids = true;
+  Luminous::MipmapPyramid::Compression s_pyramidCompression = Luminous::MipmapPyramid::NO_COMPRESSION;
+
+  /// When the image memory budget is exceeded, release images until the
+  /// usage is below this portion of the budget
+  const double s_budgetLowWaterMark = 0.9;
+  /// Mipmap levels used within this many deciseconds are considered visible
+  /// and are not released because of the budget
+  const int s_visibleDeciSeconds = 2;
+  /// Maximum amount of memory released in one MipmapReleaseTask run, the
+  /// rest is released incrementally in the following runs
+  const uint64_t s_maxReleaseBytesPerRun = 256ull << 20;
+
+  /// Memory accounting of all mipmap levels, see Mipmap::MemoryStats
+  std::atomic<uint64_t> s_usedBytes{0};
+  std::atomic<int> s_loadedLevels{0};
+  std::atomic<uint64_t> s_releasedBytes{0};
+  std::atomic<uint64_t> s_releasedLevels{0};
+  std::atomic<uint64_t> s_budgetReleasedBytes{0};
+  std::atomic<uint64_t> s_releaseRounds{0};
+
   /// Special time values in MipmapLevel::lastUsed
   enum LoadState {
     New,
@@ -98,6 +122,10 @@ namespace
     /// MipmapLevel without updating lastUsed, you can lock the MipmapLevel from
     /// being deleted by setting locked to 1 from 0.
     QAtomicInt locked;
+
+    /// Amount of CPU memory this level is accounted for in s_usedBytes. Only
+    /// modified by the thread that loads or releases the level.
+    uint64_t bytes = 0;
   };
 
   /////////////////////////////////////////////////////////////////////////////
@@ -115,6 +143,38 @@ namespace
     return StateCount + Luminous::RenderManager::lastFrameTime();
   }
 
+  /// CPU memory used by the images in the level
+  uint64_t imageBytes(const MipmapLevel & imageTex)
+  {
+    uint64_t bytes = 0;
+    if (imageTex.cimage)
+      bytes += imageTex.cimage->datasize() + sizeof(*imageTex.cimage);
+    if (imageTex.image)
+      bytes += uint64_t(imageTex.image->width()) * imageTex.image->height() *
+          imageTex.image->pixelFormat().bytesPerPixel() + sizeof(*imageTex.image);
+    return bytes;
+  }
+
+  /// Eviction order of mipmap levels, levels with higher cost are released
+  /// first. Big, low-priority images that haven't been used for a while are
+  /// the cheapest to reload compared to the memory they use.
+  /// @param age time since the level was last used, in deciseconds
+  /// @param expire expiration time of the mipmap, in deciseconds
+  float evictionCost(uint64_t bytes, int age, int expire, Radiant::Priority priority)
+  {
+    float cost = float(bytes) * (1.0f + float(age) / std::max(1, expire));
+    // Every 250 priority units halve or double the cost, so high-priority
+    // images are kept longer
+    const float priorityScale = Nimble::Math::Clamp<float>(
+          (Radiant::Task::PRIORITY_NORMAL - priority) / 250.0f, -4.0f, 4.0f);
+    cost *= std::exp2(priorityScale);
+    // Always prefer releasing expired levels before the ones that are still
+    // in use
+    if (age >= expire)
+      cost *= 16.0f;
+    return cost;
+  }
+
   /////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////
 
@@ -126,7 +186,9 @@ namespace
     , loader(std::move(t.loader))
     , lastUsed(t.lastUsed)
     , locked(t.locked)
+    , bytes(t.bytes)
   {
+    t.bytes = 0;
   }
 
   MipmapLevel & MipmapLevel::operator=(MipmapLevel && t)
@@ -138,6 +200,8 @@ namespace
     loader = std::move(t.loader);
     lastUsed = t.lastUsed;
     locked = t.locked;
+    bytes = t.bytes;
+    t.bytes = 0;
     return *this;
   }
 }
@@ -164,6 +228,10 @@ namespace Luminous
     bool tryLock(Luminous::Mipmap & mipmap, int level);
     void lock(Luminous::Mipmap & mipmap, int level);
     void unlock(Luminous::Mipmap & mipmap, int level);
+    /// Writes the generated level to the pyramid file, or to cacheFile if
+    /// the mipmap doesn't have a pyramid
+    void writeCache(Luminous::Mipmap & mipmap, const Image & image, int level,
+                    const QString & cacheFile);
 
   protected:
     std::weak_ptr<Luminous::Mipmap> m_mipmap;
@@ -230,12 +298,19 @@ namespace Luminous
 
     static void check(float wait);
 
+    /// Updates the memory accounting of the level. If the level grows and
+    /// the image memory budget is exceeded, starts releasing memory.
+    static void setLevelBytes(MipmapLevel & imageTex, uint64_t bytes);
+
+    /// Image memory budget of the current MemoryManager profile, or zero
+    static uint64_t budgetBytes();
+
   protected:
     virtual void doTask() OVERRIDE;
 
   private:
     MemoryManagerPtr m_memoryManager = MemoryManager::instance();
-    bool m_outOfMemory = false;
+    std::atomic<bool> m_outOfMemory{false};
   };
   std::weak_ptr<MipmapReleaseTask> s_releaseTask;
 
@@ -278,6 +353,9 @@ namespace Luminous
     std::shared_ptr<MipMapGenerator> m_mipmapGenerator;
 
     QString m_mipmapFormat;
+    /// All uncompressed mipmap levels in one cache file. If this is null,
+    /// every level is cached in a separate m_mipmapFormat file.
+    std::shared_ptr<MipmapPyramid> m_pyramid;
 
     std::vector<MipmapLevel> m_levels;
 
@@ -366,6 +444,7 @@ namespace Luminous
 
     bool ok = recursiveLoad(mipmap, imageTex, level);
     if (ok) {
+      MipmapReleaseTask::setLevelBytes(imageTex, imageBytes(imageTex));
       std::shared_ptr<const void> data(imageTex.image->data(), [img = imageTex.image] (const void*) {});
       /// @todo use Image::texture
       imageTex.texture.setData(imageTex.image->width(), imageTex.image->height(),
@@ -385,6 +464,7 @@ namespace Luminous
       }
     } else {
       imageTex.image.reset();
+      MipmapReleaseTask::setLevelBytes(imageTex, 0);
       imageTex.lastUsed = LoadError;
     }
     return ok;
@@ -405,9 +485,28 @@ namespace Luminous
       }
     }
 
-    // Try loading a pre-generated smaller-scale mipmap
-    Radiant::CacheManager::CacheItem cacheItem = mipmap.m_d->cacheItem(
-          m_filename, level, m_cacheFileFormat);
+    MipmapPyramid * pyramid = mipmap.m_d->m_pyramid.get();
+    Radiant::CacheManager::CacheItem cacheItem;
+
+    if (pyramid) {
+      // Try loading a pre-generated level from the pyramid. Uncompressed
+      // levels point directly to the memory mapped file.
+      if (pyramid->hasLevel(level)) {
+        Nimble::Size expectedSize = mipmap.mipmapSize(level);
+        if (auto image = pyramid->readLevel(level)) {
+          if (expectedSize == image->size()) {
+            imageTex.image = std::move(image);
+            return true;
+          }
+          Radiant::error("LoadImageTask::recursiveLoad # Level %d in '%s' size was (%d, %d), expected (%d, %d)",
+                         level, pyramid->filename().toUtf8().data(), image->width(), image->height(),
+                         expectedSize.width(), expectedSize.height());
+        }
+      }
+    } else {
+      // Try loading a pre-generated smaller-scale mipmap
+      cacheItem = mipmap.m_d->cacheItem(m_filename, level, m_cacheFileFormat);
+    }
 
     if (cacheItem.isValid) {
       if (!imageTex.image)
@@ -429,6 +528,29 @@ namespace Luminous
     }
 
 
+    // Decode the original image directly at reduced scale, unless the bigger
+    // level is already in memory. This avoids decoding the full size image
+    // and generating all the levels in between.
+    if (mipmap.m_d->m_sourceInfo.scaledRead &&
+        mipmap.m_d->m_levels[level - 1].lastUsed.load() < StateCount) {
+      const Nimble::Size is = mipmap.mipmapSize(level);
+      Image scaled;
+      if (scaled.readScaled(m_filename, is, true)) {
+        if (!imageTex.image)
+          imageTex.image.reset(new Image());
+
+        if (scaled.size() == is)
+          *imageTex.image = std::move(scaled);
+        else
+          imageTex.image->minify(scaled, is.width(), is.height());
+
+        writeCache(mipmap, *imageTex.image, level, cacheItem.path);
+        return true;
+      }
+      Radiant::warning("LoadImageTask::recursiveLoad # Scaled decoding of '%s' failed, decoding the full image",
+                       m_filename.toUtf8().data());
+    }
+
     {
       lock(mipmap, level - 1);
 
@@ -450,11 +572,20 @@ namespace Luminous
       unlock(mipmap, level - 1);
     }
 
-    imageTex.image->write(cacheItem.path);
+    writeCache(mipmap, *imageTex.image, level, cacheItem.path);
 
     return true;
   }
 
+  void LoadImageTask::writeCache(Luminous::Mipmap & mipmap, const Image & image, int level,
+                                 const QString & cacheFile)
+  {
+    if (auto & pyramid = mipmap.m_d->m_pyramid)
+      pyramid->writeLevel(level, image, s_pyramidCompression);
+    else
+      image.write(cacheFile);
+  }
+
   /////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////
 
@@ -497,6 +628,7 @@ namespace Luminous
     } else {
       m_tex.texture.setData(im->width(), im->height(), im->compression(), im->data());
       m_tex.cimage = std::move(im);
+      MipmapReleaseTask::setLevelBytes(m_tex, imageBytes(m_tex));
       int now = frameTime();
       m_tex.lastUsed.testAndSetOrdered(Loading, now);
       setState(*mipmap, Valuable::STATE_READY);
@@ -608,6 +740,14 @@ namespace Luminous
     }
 #endif // LUMINOUS_OPENGLES
 
+    if (s_mipmapPyramids && !mipmap.m_useCompressedMipmaps && mipmap.m_maxLevel > 0 &&
+        mipmap.m_sourceInfo.pf.compression() == Luminous::PixelFormat::COMPRESSION_NONE) {
+      Radiant::CacheManager::CacheItem cacheItem = mipmap.cacheItem(mipmap.m_filenameAbs, -1, "csmipmap");
+      auto pyramid = std::make_shared<MipmapPyramid>(cacheItem.path);
+      if (pyramid->open(MipmapPyramid::sourceHash(mipmap.m_filenameAbs), mipmap.m_maxLevel + 1))
+        mipmap.m_pyramid = std::move(pyramid);
+    }
+
     mipmap.m_levels.resize(mipmap.m_maxLevel+1);
     mipmap.m_state = Valuable::STATE_HEADER_READY;
 
@@ -631,17 +771,25 @@ namespace Luminous
   {
     scheduleFromNowSecs(10.0f);
     m_memoryManager->eventAddListener("out-of-memory", this, [this] {
-      if (!m_outOfMemory) {
-        m_outOfMemory = true;
+      if (!m_outOfMemory.exchange(true))
         check(0);
-      }
     });
   }
 
   void MipmapReleaseTask::doTask()
   {
+    const uint64_t budget = budgetBytes();
+    const uint64_t used = s_usedBytes;
+
+    // Bytes to release to get back under the image memory budget. Once the
+    // budget is exceeded, go a bit under it, so that we don't need to
+    // release something again right after the next image is loaded.
+    uint64_t overBudgetBytes = 0;
+    if (budget > 0 && used > budget)
+      overBudgetBytes = used - uint64_t(budget * s_budgetLowWaterMark);
+
     // This is how much we should try to release memory
-    const uint64_t todoBytes = m_memoryManager->overallocatedBytes();
+    const uint64_t todoBytes = std::max(m_memoryManager->overallocatedBytes(), overBudgetBytes);
 
     // Nothing to do, there is already enough available memory
     if (todoBytes == 0) {
@@ -652,8 +800,14 @@ namespace Luminous
 
     float delay = 10;
 
-    // lastUsed => (mipmap, level)
-    std::multimap<int, std::pair<MipmapPtr, int>> queue;
+    struct Candidate
+    {
+      float cost;
+      int lastUsed;
+      MipmapPtr mipmap;
+      int level;
+    };
+    std::vector<Candidate> queue;
 
     s_mipmapStoreMutex.lock();
     const int now = lastFrameTime();
@@ -663,6 +817,7 @@ namespace Luminous
       if(ptr) {
         if(ptr->isHeaderReady()) {
           const int expire = ptr->m_d->m_expireDeciSeconds;
+          const Radiant::Priority priority = ptr->m_d->m_loadingPriority;
           std::vector<MipmapLevel> & levels = ptr->m_d->m_levels;
           // do not expire the last mipmap level (smallest image)
           for(int level = 0, s = static_cast<int>(levels.size()) - 1; level < s; ++level) {
@@ -671,8 +826,12 @@ namespace Luminous
             if (lastUsed <= Loading)
               continue;
 
-            if(now >= lastUsed + expire) {
-              queue.emplace(lastUsed, std::make_pair(ptr, level));
+            const int age = now - lastUsed;
+            // When over the budget, also release levels that haven't expired
+            // yet, as long as they are not visible
+            if(age >= expire || (overBudgetBytes > 0 && age > s_visibleDeciSeconds)) {
+              queue.push_back({evictionCost(imageTex.bytes, age, expire, priority),
+                               lastUsed, ptr, level});
             } else {
               delay = std::min(delay, (lastUsed + expire - now) / 10.0f);
             }
@@ -689,46 +848,58 @@ namespace Luminous
     }
     s_mipmapStoreMutex.unlock();
 
+    std::sort(queue.begin(), queue.end(), [] (const Candidate & a, const Candidate & b) {
+      return a.cost > b.cost;
+    });
+
     uint64_t releasedBytes = 0;
-    for (auto & p: queue) {
-      const int lastUsed = p.first;
-      MipmapPtr & mipmap = p.second.first;
-      const int level = p.second.second;
+    int releasedLevels = 0;
+    bool incomplete = false;
+    for (auto & c: queue) {
+      if (releasedBytes >= todoBytes)
+        break;
+
+      if (releasedBytes >= s_maxReleaseBytesPerRun) {
+        incomplete = true;
+        break;
+      }
 
-      MipmapLevel & imageTex = mipmap->m_d->m_levels[level];
+      MipmapLevel & imageTex = c.mipmap->m_d->m_levels[c.level];
 
       if (imageTex.locked.testAndSetOrdered(0, 1)) {
-        if (imageTex.lastUsed.testAndSetOrdered(lastUsed, Loading)) {
+        if (imageTex.lastUsed.testAndSetOrdered(c.lastUsed, Loading)) {
           imageTex.texture.reset();
-          if (imageTex.cimage) {
-            releasedBytes += imageTex.cimage->datasize() + sizeof(*imageTex.cimage);
-            imageTex.cimage.reset();
-          }
-          if (imageTex.image) {
-            releasedBytes += imageTex.image->width() * imageTex.image->height() * imageTex.image->pixelFormat().bytesPerPixel()
-                + sizeof(*imageTex.image);
-            imageTex.image.reset();
-          }
+          releasedBytes += imageTex.bytes;
+          ++releasedLevels;
+          imageTex.cimage.reset();
+          imageTex.image.reset();
+          setLevelBytes(imageTex, 0);
           imageTex.lastUsed = New;
         }
         imageTex.locked = 0;
       } else {
         delay = 0;
       }
-
-      if (releasedBytes >= todoBytes) {
-        break;
-      }
     }
 
+    if (releasedLevels > 0) {
+      s_releasedBytes += releasedBytes;
+      s_releasedLevels += releasedLevels;
+      s_budgetReleasedBytes += std::min(releasedBytes, overBudgetBytes);
+      ++s_releaseRounds;
+
 #ifdef RADIANT_LINUX
-    // Force the application to really release the memory to OS, see #15188
-    malloc_trim(0);
+      // Force the application to really release the memory to OS, see #15188
+      malloc_trim(0);
 #endif
+    }
 
     if (releasedBytes >= todoBytes) {
       m_outOfMemory = false;
       scheduleFromNowSecs(60);
+    } else if (incomplete) {
+      // Let other tasks run before continuing
+      scheduleFromNowSecs(0.02);
     } else {
       scheduleFromNowSecs(std::max(delay, 0.5f));
     }
@@ -744,6 +915,41 @@ namespace Luminous
     }
   }
 
+  void MipmapReleaseTask::setLevelBytes(MipmapLevel & imageTex, uint64_t bytes)
+  {
+    const uint64_t old = imageTex.bytes;
+    if (old == bytes)
+      return;
+
+    imageTex.bytes = bytes;
+    if (old == 0)
+      ++s_loadedLevels;
+    else if (bytes == 0)
+      --s_loadedLevels;
+
+    if (bytes < old) {
+      s_usedBytes -= old - bytes;
+      return;
+    }
+
+    const uint64_t used = (s_usedBytes += bytes - old);
+    auto task = s_releaseTask.lock();
+    if (!task)
+      return;
+
+    const uint64_t budget = budgetBytes();
+    if (budget > 0 && used > budget && !task->m_outOfMemory.exchange(true))
+      check(0);
+  }
+
+  uint64_t MipmapReleaseTask::budgetBytes()
+  {
+    auto task = s_releaseTask.lock();
+    if (!task)
+      return 0;
+    return task->m_memoryManager->currentProfileSettings().maxImageMemoryMB << 20;
+  }
+
   /////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////
 
@@ -767,6 +973,9 @@ namespace Luminous
 
   Mipmap::D::~D()
   {
+    for (MipmapLevel & imageTex: m_levels)
+      MipmapReleaseTask::setLevelBytes(imageTex, 0);
+
     // Make a local copy, if PingTask is just finishing and removes m_d->m_ping
     std::shared_ptr<PingTask> ping = m_ping;
     if(ping) {
@@ -1262,6 +1471,34 @@ namespace Luminous
     }
   }
 
+  void Mipmap::setMipmapPyramidsEnabled(bool enabled)
+  {
+    s_mipmapPyramids = enabled;
+  }
+
+  bool Mipmap::mipmapPyramidsEnabled()
+  {
+    return s_mipmapPyramids;
+  }
+
+  void Mipmap::setMipmapPyramidCompression(MipmapPyramid::Compression compression)
+  {
+    s_pyramidCompression = compression;
+  }
+
+  Mipmap::MemoryStats Mipmap::memoryStats()
+  {
+    MemoryStats stats;
+    stats.usedBytes = s_usedBytes;
+    stats.budgetBytes = MipmapReleaseTask::budgetBytes();
+    stats.loadedLevels = s_loadedLevels;
+    stats.releasedBytes = s_releasedBytes;
+    stats.releasedLevels = s_releasedLevels;
+    stats.budgetReleasedBytes = s_budgetReleasedBytes;
+    stats.releaseRounds = s_releaseRounds;
+    return stats;
+  }
+
   void Mipmap::startLoading(bool compressedMipmaps)
   {
     assert(!m_d->m_ping);
@@ -12,6 +12,7 @@
 #define LUMINOUS_MIPMAP_HPP
 
 #include "Luminous.hpp"
+#include "MipmapPyramid.hpp"
 
 #include <Radiant/CacheManager.hpp>
 #include <Radiant/Task.hpp>
@@ -33,6 +34,28 @@ namespace Luminous
   class Mipmap : public Valuable::Node,
                  public std::enable_shared_from_this<Mipmap>
   {
+  public:
+    /// CPU memory usage of all decoded mipmap levels, see memoryStats()
+    struct MemoryStats
+    {
+      /// Memory used by all currently loaded mipmap levels
+      uint64_t usedBytes = 0;
+      /// Current image memory budget, see MemoryManager::ProfileSettings::maxImageMemoryMB.
+      /// Zero if there is no budget.
+      uint64_t budgetBytes = 0;
+      /// Number of currently loaded mipmap levels
+      int loadedLevels = 0;
+      /// Total number of bytes released since the application started
+      uint64_t releasedBytes = 0;
+      /// Total number of mipmap levels released since the application started
+      uint64_t releasedLevels = 0;
+      /// Part of releasedBytes that was released because of the image memory
+      /// budget, the rest was released because the system was low on memory
+      uint64_t budgetReleasedBytes = 0;
+      /// Number of release rounds that actually released something
+      uint64_t releaseRounds = 0;
+    };
+
   public:
     LUMINOUS_API ~Mipmap();
 
@@ -157,6 +180,27 @@ namespace Luminous
     /// @returns false if the cache directory can't be created
     LUMINOUS_API static bool setImageCachePath(const QString & path);
 
+    /// Uncompressed mipmap levels are cached by default in one pyramid file
+    /// per source image, see MipmapPyramid. Levels are loaded from the file
+    /// with memory mapping without copying. If pyramids are disabled, every
+    /// level is cached in a separate file. Affects only mipmaps that are
+    /// acquired after this call.
+    LUMINOUS_API static void setMipmapPyramidsEnabled(bool enabled);
+    LUMINOUS_API static bool mipmapPyramidsEnabled();
+
+    /// Sets the compression of the levels that are written to pyramid files.
+    /// The default is MipmapPyramid::NO_COMPRESSION, which allows reading
+    /// the levels without copying. COMPRESSION_LZ4 uses less disk space but
+    /// the levels need to be decompressed when loaded.
+    LUMINOUS_API static void setMipmapPyramidCompression(MipmapPyramid::Compression compression);
+
+    /// Returns CPU memory statistics of all Mipmap instances. When the memory
+    /// usage is over the budget, mipmap levels are released in the order of
+    /// their size, loading priority (see setLoadingPriority) and time since
+    /// they were last used. Levels that were rendered during the last few
+    /// frames are never released because of the budget.
+    LUMINOUS_API static MemoryStats memoryStats();
+
   private:
     Mipmap(const QString & filenameAbs);
 
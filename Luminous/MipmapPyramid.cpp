@@ -0,0 +1,412 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "MipmapPyramid.hpp"
+#include "Image.hpp"
+
+#include <Radiant/LockFile.hpp>
+#include <Radiant/Mutex.hpp>
+#include <Radiant/Platform.hpp>
+#include <Radiant/Trace.hpp>
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+
+#include <cstring>
+#include <vector>
+
+#include <lz4.h>
+
+#ifdef RADIANT_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+  const char s_magic[8] = {'c', 's', 'm', 'i', 'p', 'm', 'a', 'p'};
+  /// Update this when there is incompatible change in the file format
+  const uint32_t s_version = 1;
+  /// Level data is aligned to this many bytes in the file
+  const uint64_t s_alignment = 64;
+
+  enum LevelFlags
+  {
+    FLAG_PREMULTIPLIED_ALPHA = 1 << 0
+  };
+
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t levelCount;
+    uint64_t sourceHash;
+  };
+
+  /// Followed by the level table, one LevelEntry for every level
+  struct LevelEntry
+  {
+    int32_t width;
+    int32_t height;
+    int32_t lineSize;
+    int32_t layout;
+    int32_t type;
+    uint32_t flags;
+    uint32_t compression;
+    uint32_t reserved;
+    /// Offset of the level data in the file, zero if the level isn't stored
+    uint64_t offset;
+    /// Size of the level data in the file
+    uint64_t storedBytes;
+    /// Size of the decompressed level data
+    uint64_t rawBytes;
+  };
+
+  static_assert(sizeof(FileHeader) == 24, "FileHeader must not have padding");
+  static_assert(sizeof(LevelEntry) == 56, "LevelEntry must not have padding");
+
+  /// @return false if the entry points outside the file or is otherwise
+  ///         invalid, for example because it was not completely written
+  bool isValid(const LevelEntry & entry, uint64_t fileSize)
+  {
+    return entry.offset + entry.storedBytes <= fileSize && entry.compression <= Luminous::MipmapPyramid::COMPRESSION_LZ4 &&
+        entry.width > 0 && entry.height > 0 &&
+        entry.rawBytes == uint64_t(entry.lineSize) * entry.height;
+  }
+
+  /// Writes the file to the storage device. QFile::flush only gives the
+  /// data to the operating system.
+  bool sync(QFile & file)
+  {
+    if (!file.flush())
+      return false;
+#ifdef RADIANT_WINDOWS
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+  }
+
+  uint64_t fnv1a(uint64_t hash, const void * data, size_t bytes)
+  {
+    auto ptr = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < bytes; ++i) {
+      hash ^= ptr[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+}
+
+namespace Luminous
+{
+  class MipmapPyramid::D
+  {
+  public:
+    /// Shared with the images that point to the memory mapping of the file,
+    /// so that the mapping stays valid even if MipmapPyramid is deleted
+    struct File
+    {
+      File(const QString & filename) : file(filename) {}
+
+      QFile file;
+      Radiant::Mutex mutex;
+    };
+
+    D(const QString & filename)
+      : m_filename(filename)
+      , m_file(std::make_shared<File>(filename))
+    {}
+
+    bool create(uint64_t sourceHash, int levelCount);
+
+    static uint64_t entryOffset(int level)
+    {
+      return sizeof(FileHeader) + level * sizeof(LevelEntry);
+    }
+
+  public:
+    const QString m_filename;
+    std::shared_ptr<File> m_file;
+    /// Protected by m_file->mutex
+    std::vector<LevelEntry> m_levels;
+    bool m_open = false;
+  };
+
+  bool MipmapPyramid::D::create(uint64_t sourceHash, int levelCount)
+  {
+    QFile & file = m_file->file;
+
+    // The old file is removed instead of truncated, since other processes or
+    // an obsolete Mipmap of the same source might still have it mapped
+    file.close();
+    QFile::remove(m_filename);
+    if (!file.open(QFile::ReadWrite | QFile::Unbuffered))
+      return false;
+
+    FileHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.levelCount = levelCount;
+    header.sourceHash = sourceHash;
+
+    m_levels.assign(levelCount, LevelEntry());
+
+    const qint64 tableBytes = levelCount * sizeof(LevelEntry);
+    return file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+        file.write(reinterpret_cast<const char*>(m_levels.data()), tableBytes) == tableBytes &&
+        file.flush();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  MipmapPyramid::MipmapPyramid(const QString & filename)
+    : m_d(new D(filename))
+  {
+  }
+
+  MipmapPyramid::~MipmapPyramid()
+  {
+  }
+
+  const QString & MipmapPyramid::filename() const
+  {
+    return m_d->m_filename;
+  }
+
+  bool MipmapPyramid::open(uint64_t sourceHash, int levelCount)
+  {
+    Radiant::Guard g(m_d->m_file->mutex);
+    QFile & file = m_d->m_file->file;
+
+    // Closing the file would invalidate the memory mappings of existing images
+    if (file.isOpen())
+      return m_d->m_open;
+
+    // Unbuffered, so that reading the level table sees the entries that
+    // other processes have written
+    if (levelCount <= 0 || !file.open(QFile::ReadWrite | QFile::Unbuffered)) {
+      Radiant::error("MipmapPyramid::open # Failed to open %s: %s", m_d->m_filename.toUtf8().data(),
+                     file.errorString().toUtf8().data());
+      return false;
+    }
+
+    FileHeader header;
+    bool valid = file.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) &&
+        memcmp(header.magic, s_magic, sizeof(s_magic)) == 0 &&
+        header.version == s_version &&
+        header.levelCount == static_cast<uint32_t>(levelCount) &&
+        header.sourceHash == sourceHash;
+
+    if (valid) {
+      m_d->m_levels.resize(levelCount);
+      const qint64 tableBytes = levelCount * sizeof(LevelEntry);
+      valid = file.read(reinterpret_cast<char*>(m_d->m_levels.data()), tableBytes) == tableBytes;
+    }
+
+    if (valid) {
+      // Ignore levels that were not completely written
+      const uint64_t fileSize = file.size();
+      for (LevelEntry & entry: m_d->m_levels) {
+        if (entry.offset == 0)
+          continue;
+        if (!isValid(entry, fileSize))
+          entry = LevelEntry();
+      }
+    } else if (!m_d->create(sourceHash, levelCount)) {
+      Radiant::error("MipmapPyramid::open # Failed to write %s: %s", m_d->m_filename.toUtf8().data(),
+                     file.errorString().toUtf8().data());
+      file.close();
+      m_d->m_levels.clear();
+      return false;
+    }
+
+    m_d->m_open = true;
+    return true;
+  }
+
+  bool MipmapPyramid::isOpen() const
+  {
+    Radiant::Guard g(m_d->m_file->mutex);
+    return m_d->m_open;
+  }
+
+  bool MipmapPyramid::hasLevel(int level) const
+  {
+    Radiant::Guard g(m_d->m_file->mutex);
+    return level >= 0 && level < static_cast<int>(m_d->m_levels.size()) &&
+        m_d->m_levels[level].offset != 0;
+  }
+
+  std::shared_ptr<Image> MipmapPyramid::readLevel(int level) const
+  {
+    std::shared_ptr<D::File> file = m_d->m_file;
+    Radiant::Guard g(file->mutex);
+
+    if (level < 0 || level >= static_cast<int>(m_d->m_levels.size()))
+      return nullptr;
+
+    const LevelEntry entry = m_d->m_levels[level];
+    if (entry.offset == 0)
+      return nullptr;
+
+    const PixelFormat pf(PixelFormat::ChannelLayout(entry.layout), PixelFormat::ChannelType(entry.type),
+                         (entry.flags & FLAG_PREMULTIPLIED_ALPHA) != 0);
+
+    // Private mapping makes the pages copy-on-write, in case someone
+    // modifies the image
+    uchar * mapped = file->file.map(entry.offset, entry.storedBytes, QFileDevice::MapPrivateOption);
+    if (!mapped) {
+      Radiant::error("MipmapPyramid::readLevel # Failed to map level %d of %s: %s", level,
+                     m_d->m_filename.toUtf8().data(), file->file.errorString().toUtf8().data());
+      return nullptr;
+    }
+
+    if (entry.compression == NO_COMPRESSION) {
+      std::shared_ptr<Image> image(new Image(), [file, mapped] (Image * img) {
+        delete img;
+        Radiant::Guard g(file->mutex);
+        file->file.unmap(mapped);
+      });
+      image->setData(mapped, entry.width, entry.height, pf, entry.lineSize);
+      return image;
+    }
+
+    auto image = std::make_shared<Image>();
+    bool ok = image->allocate(entry.width, entry.height, pf) &&
+        uint64_t(image->lineSize()) * image->height() == entry.rawBytes;
+    if (ok) {
+      int bytes = LZ4_decompress_safe(reinterpret_cast<const char*>(mapped),
+                                      reinterpret_cast<char*>(image->data()),
+                                      static_cast<int>(entry.storedBytes),
+                                      static_cast<int>(entry.rawBytes));
+      ok = bytes >= 0 && uint64_t(bytes) == entry.rawBytes;
+    }
+    file->file.unmap(mapped);
+
+    if (!ok) {
+      Radiant::error("MipmapPyramid::readLevel # Level %d of %s is corrupted", level,
+                     m_d->m_filename.toUtf8().data());
+      return nullptr;
+    }
+    return image;
+  }
+
+  bool MipmapPyramid::writeLevel(int level, const Image & image, Compression compression)
+  {
+    const PixelFormat & pf = image.pixelFormat();
+    if (pf.compression() != PixelFormat::COMPRESSION_NONE || image.width() <= 0 || image.height() <= 0)
+      return false;
+
+    const int lineBytes = image.width() * pf.bytesPerPixel();
+    const uint64_t rawBytes = uint64_t(lineBytes) * image.height();
+
+    // Lines are stored without padding
+    const char * data = reinterpret_cast<const char*>(image.data());
+    std::vector<char> packed;
+    if (image.lineSize() != lineBytes) {
+      packed.resize(rawBytes);
+      for (int y = 0; y < image.height(); ++y)
+        memcpy(packed.data() + uint64_t(y) * lineBytes, image.line(y), lineBytes);
+      data = packed.data();
+    }
+
+    uint64_t storedBytes = rawBytes;
+    std::vector<char> compressed;
+    if (compression == COMPRESSION_LZ4) {
+      compression = NO_COMPRESSION;
+      if (rawBytes <= LZ4_MAX_INPUT_SIZE) {
+        compressed.resize(LZ4_compressBound(static_cast<int>(rawBytes)));
+        int bytes = LZ4_compress_default(data, compressed.data(), static_cast<int>(rawBytes),
+                                         static_cast<int>(compressed.size()));
+        // Incompressible data is stored as is, so that it can be mapped
+        if (bytes > 0 && uint64_t(bytes) < rawBytes) {
+          compression = COMPRESSION_LZ4;
+          data = compressed.data();
+          storedBytes = bytes;
+        }
+      }
+    }
+
+    Radiant::Guard g(m_d->m_file->mutex);
+    QFile & file = m_d->m_file->file;
+
+    if (!m_d->m_open || level < 0 || level >= static_cast<int>(m_d->m_levels.size()))
+      return false;
+
+    // Another task already wrote this level
+    if (m_d->m_levels[level].offset != 0)
+      return true;
+
+    // Other processes, or other MipmapPyramid objects for the same file,
+    // compute the append offset from the file size too. Keep the file
+    // locked over the append and the table update.
+    Radiant::LockFile lock(m_d->m_filename + ".lock", true);
+    if (!lock.isLocked()) {
+      Radiant::error("MipmapPyramid::writeLevel # Failed to lock %s", m_d->m_filename.toUtf8().data());
+      return false;
+    }
+
+    // Another writer stored the level after this file was opened
+    LevelEntry stored;
+    if (file.seek(D::entryOffset(level)) &&
+        file.read(reinterpret_cast<char*>(&stored), sizeof(stored)) == sizeof(stored) &&
+        stored.offset != 0 && isValid(stored, file.size())) {
+      m_d->m_levels[level] = stored;
+      return true;
+    }
+
+    LevelEntry entry = LevelEntry();
+    entry.width = image.width();
+    entry.height = image.height();
+    entry.lineSize = lineBytes;
+    entry.layout = pf.layout();
+    entry.type = pf.type();
+    entry.flags = pf.isPremultipliedAlpha() ? FLAG_PREMULTIPLIED_ALPHA : 0;
+    entry.compression = compression;
+    entry.offset = (file.size() + s_alignment - 1) / s_alignment * s_alignment;
+    entry.storedBytes = storedBytes;
+    entry.rawBytes = rawBytes;
+
+    // The data needs to be on disk before the table entry that points to it,
+    // otherwise a crash could leave an entry that points to garbage
+    bool ok = file.seek(entry.offset) &&
+        file.write(data, storedBytes) == qint64(storedBytes) &&
+        sync(file) &&
+        file.seek(D::entryOffset(level)) &&
+        file.write(reinterpret_cast<const char*>(&entry), sizeof(entry)) == sizeof(entry) &&
+        sync(file);
+
+    if (!ok) {
+      Radiant::error("MipmapPyramid::writeLevel # Failed to write level %d to %s: %s", level,
+                     m_d->m_filename.toUtf8().data(), file.errorString().toUtf8().data());
+      return false;
+    }
+
+    m_d->m_levels[level] = entry;
+    return true;
+  }
+
+  uint64_t MipmapPyramid::sourceHash(const QString & sourceFilename)
+  {
+    QFileInfo fi(sourceFilename);
+    const QByteArray path = fi.absoluteFilePath().toUtf8();
+    const qint64 size = fi.size();
+    const qint64 modified = fi.lastModified().toMSecsSinceEpoch();
+
+    uint64_t hash = 14695981039346656037ull;
+    hash = fnv1a(hash, path.data(), path.size());
+    hash = fnv1a(hash, &size, sizeof(size));
+    hash = fnv1a(hash, &modified, sizeof(modified));
+    return hash;
+  }
+}
@@ -0,0 +1,85 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+
+#include <Patterns/NotCopyable.hpp>
+
+#include <QString>
+
+#include <cstdint>
+#include <memory>
+
+namespace Luminous
+{
+  class Image;
+
+  /// Cache file that holds all mipmap levels of one source image.
+  ///
+  /// The file starts with a header that has the source image hash and a
+  /// table of all levels: image size, pixel format, compression, offset and
+  /// size of the level data. Levels are appended to the end of the file when
+  /// they are generated, and a level becomes visible to readers only after
+  /// its data is written and its table entry is updated.
+  ///
+  /// Uncompressed levels are read by memory-mapping the level data, the
+  /// returned Image points directly to the mapping and no copy is made. LZ4
+  /// compressed levels are decompressed from the mapping.
+  ///
+  /// All functions are thread-safe. Several processes can also use the same
+  /// file: appending a level is serialized with a lock file next to the
+  /// pyramid file, and the level data is synced to disk before the table
+  /// entry that points to it is written.
+  class LUMINOUS_API MipmapPyramid : public Patterns::NotCopyable
+  {
+  public:
+    enum Compression
+    {
+      NO_COMPRESSION = 0,
+      COMPRESSION_LZ4 = 1
+    };
+
+    MipmapPyramid(const QString & filename);
+    ~MipmapPyramid();
+
+    const QString & filename() const;
+
+    /// Opens the pyramid file, or creates it if it doesn't exist. If the
+    /// file was created for a different version of the source image or with
+    /// a different number of levels, all levels are discarded.
+    /// @param sourceHash hash of the source image, see sourceHash()
+    /// @param levelCount number of mipmap levels, including level 0
+    /// @return false if the file can't be opened for reading and writing
+    bool open(uint64_t sourceHash, int levelCount);
+    bool isOpen() const;
+
+    /// @return true if the level is stored in the file
+    bool hasLevel(int level) const;
+
+    /// Reads a level from the file. Uncompressed levels are not copied, the
+    /// image data points to a private memory mapping of the file, which is
+    /// kept alive as long as the returned image exists.
+    /// @return the level image or null if the level isn't stored or the
+    ///         file is corrupted
+    std::shared_ptr<Image> readLevel(int level) const;
+
+    /// Appends a level to the file. Compressed images are not supported.
+    bool writeLevel(int level, const Image & image, Compression compression = NO_COMPRESSION);
+
+    /// Hash of the source image path, size and modification time
+    static uint64_t sourceHash(const QString & sourceFilename);
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
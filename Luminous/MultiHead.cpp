@@ -309,6 +309,7 @@ namespace Luminous
       m_resizeable(this, "resizeable", &m_resizable),
       m_fsaaSamplesPerPixel(this, "fsaa-samples", -1),
       m_directRendering(this, "direct-rendering", true),
+      m_areaReplay(this, "area-replay", false),
       m_screennumber(this, "screennumber", -1),
       m_gpuAffinityMask(this, "gpu-affinity-mask", 0),
       m_icon(this, "icon", "cornerstone:Icons/cornerstone-application-icon.ico")
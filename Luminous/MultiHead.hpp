@@ -328,6 +328,18 @@ namespace Luminous {
       /// Set direct rendering mode
       void setDirectRendering(bool enable) { m_directRendering = enable; }
 
+      /// Area replay mode. When enabled and the window has several areas,
+      /// the draw commands of the scene are generated only for the first
+      /// area. The other areas replay the same commands with their own view
+      /// transform and viewport, see RenderContext::replayArea. The scene
+      /// is then culled with the first area, so the application needs to
+      /// render it with a clip rectangle that covers all the areas of the
+      /// window, see graphicsBounds.
+      /// @return true if area replay is enabled
+      bool areaReplay() const { return m_areaReplay; }
+      /// Set area replay mode
+      void setAreaReplay(bool enable) { m_areaReplay = enable; }
+
       std::optional<uint32_t> gpuAffinityMask() const
       {
         if (m_gpuAffinityMask.currentLayer() == DEFAULT)
@@ -380,6 +392,7 @@ namespace Luminous {
       Valuable::AttributeInt        m_fsaaSamplesPerPixel;
 
       Valuable::AttributeBool       m_directRendering;
+      Valuable::AttributeBool       m_areaReplay;
       Valuable::AttributeInt        m_screennumber; // for X11
 
       Valuable::AttributeT<uint32_t> m_gpuAffinityMask;
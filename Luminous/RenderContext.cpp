@@ -40,12 +40,37 @@
 #include "DxInterop.hpp"
 #endif
 
+#include <cstring>
+#include <map>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #define DEFAULT_RECURSION_LIMIT 4
 #define SHADER(str) #str
 
+namespace
+{
+  /// Entries that haven't been used in this many frames are removed from
+  /// the visibility cache
+  const unsigned int s_visibilityCacheFrames = 64;
+
+  inline uint64_t hashCombine(uint64_t h, uint64_t v)
+  {
+    h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  inline bool sameRectangle(const Nimble::Rectangle & a, const Nimble::Rectangle & b)
+  {
+    return a.center() == b.center() && a.axis0() == b.axis0() && a.axis1() == b.axis1() &&
+        a.extent0() == b.extent0() && a.extent1() == b.extent1();
+  }
+}
+
 namespace Luminous
 {
   class RenderContext::Internal
@@ -65,7 +90,7 @@ namespace Luminous
         , m_uniformBufferOffsetAlignment(0)
         , m_automaticDepthDiff(-1.0f/100000.0f)
         , m_driver(renderDriver)
-        , m_driverGL(static_cast<RenderDriverGL*>(&renderDriver))
+        , m_driverGL(dynamic_cast<RenderDriverGL*>(&renderDriver))
         , m_bufferIndex(0)
         , m_useOffScreenFrameBuffer(false)
         , m_finalFrameBuffer(FrameBuffer::WINDOW)
@@ -212,6 +237,69 @@ namespace Luminous
  
     std::vector<Valuable::Node::Uuid> m_viewWidgetPath;
     QByteArray m_viewWidgetPathId;
+    /// Hash of m_viewWidgetPath for each path depth
+    std::vector<uint64_t> m_viewWidgetPathHashes;
+
+    struct CullingScope
+    {
+      SubtreeVisibility visibility;
+      /// Clip stack when the scope was pushed. The scope is only valid for
+      /// this clip stack.
+      uint64_t clipKey;
+      size_t clipStackCount;
+    };
+    std::vector<CullingScope> m_cullingScopes;
+
+    struct VisibilityEntry
+    {
+      Nimble::Rectangle area;
+      uint64_t clipKey;
+      unsigned int frameNumber;
+      bool visible;
+    };
+    /// Key is a hash of the view widget path and the area, value is
+    /// the id of the object and the cached result
+    std::unordered_map<uint64_t, std::pair<Valuable::Node::Uuid, VisibilityEntry>> m_visibilityCache;
+    CullingStatistics m_cullingStatistics;
+
+    enum AreaReplayState
+    {
+      /// Nothing recorded in this frame
+      AREA_REPLAY_NONE,
+      /// Recording the commands of the current area
+      AREA_REPLAY_RECORDING,
+      /// The recorded commands can be replayed on the other areas
+      AREA_REPLAY_READY,
+      /// The recorded area used commands that can't be replayed, the other
+      /// areas are rendered normally
+      AREA_REPLAY_FAILED
+    };
+    AreaReplayState m_areaReplayState = AREA_REPLAY_NONE;
+    /// Transposed view transform of the recorded area
+    Nimble::Matrix4f m_recordedProjMatrix;
+    /// Uniform blocks allocated while recording, key is the uniform buffer
+    /// and the offset of the block in bytes
+    std::map<std::pair<BufferGL*, unsigned int>, const char*> m_recordedUniforms;
+
+    bool insideVisibleScope() const
+    {
+      if(m_cullingScopes.empty())
+        return false;
+      const CullingScope & scope = m_cullingScopes.back();
+      return scope.visibility == SUBTREE_VISIBLE &&
+          scope.clipStackCount == m_clipStacks.size() &&
+          scope.clipKey == m_clipStacks.top().key();
+    }
+
+    void expireVisibilityCache()
+    {
+      for(auto it = m_visibilityCache.begin(); it != m_visibilityCache.end();) {
+        if(m_frameNumber - it->second.second.frameNumber > s_visibilityCacheFrames)
+          it = m_visibilityCache.erase(it);
+        else
+          ++it;
+      }
+    }
 
     unsigned long m_renderCount;
     unsigned long m_unfinishedRenderCount;
@@ -367,8 +455,10 @@ namespace Luminous
       : Transformer(),
       m_data(new Internal(driver, win))
   {
-    // This requires current OpenGL context
-    initializeOpenGLFunctions();
+    // This requires current OpenGL context. Other drivers, like
+    // RenderDriverHeadless, don't have one.
+    if (m_data->m_driverGL)
+      initializeOpenGLFunctions();
 
     resetTransform();
   }
@@ -492,12 +582,96 @@ namespace Luminous
     if(m_data->m_clipStacks.empty())
       return true;
 
-    return m_data->m_clipStacks.top().isVisible(area);
+    if(m_data->insideVisibleScope()) {
+      ++m_data->m_cullingStatistics.skipped;
+      return true;
+    }
+
+    ++m_data->m_cullingStatistics.tested;
+    bool visible = m_data->m_clipStacks.top().isVisible(area);
+    if(!visible)
+      ++m_data->m_cullingStatistics.culled;
+    return visible;
+  }
+
+  bool RenderContext::isVisible(Valuable::Node::Uuid id, const Nimble::Rectangle & area)
+  {
+    if(m_data->m_clipStacks.empty() || m_data->m_clipStacks.top().stackDepth() == 0 ||
+       m_data->insideVisibleScope())
+      return isVisible(area);
+
+    const Nimble::ClipStack & clipStack = m_data->m_clipStacks.top();
+    const uint64_t clipKey = clipStack.key();
+
+    // The same widget can be rendered in several view widgets and areas, each
+    // of them gets its own entry
+    uint64_t key = m_data->m_viewWidgetPathHashes.empty() ? 0 : m_data->m_viewWidgetPathHashes.back();
+    key = hashCombine(key, reinterpret_cast<uintptr_t>(m_data->m_area));
+    key = hashCombine(key, id);
+
+    auto & item = m_data->m_visibilityCache[key];
+    Internal::VisibilityEntry & entry = item.second;
+    if(item.first == id && entry.clipKey == clipKey && sameRectangle(entry.area, area)) {
+      entry.frameNumber = m_data->m_frameNumber;
+      ++m_data->m_cullingStatistics.skipped;
+      if(!entry.visible)
+        ++m_data->m_cullingStatistics.culled;
+      return entry.visible;
+    }
+
+    item.first = id;
+    entry.area = area;
+    entry.clipKey = clipKey;
+    entry.frameNumber = m_data->m_frameNumber;
+    entry.visible = clipStack.isVisible(area);
+
+    ++m_data->m_cullingStatistics.tested;
+    if(!entry.visible)
+      ++m_data->m_cullingStatistics.culled;
+    return entry.visible;
+  }
+
+  RenderContext::SubtreeVisibility RenderContext::subtreeVisibility(const Nimble::Rectangle & bounds)
+  {
+    if(m_data->m_clipStacks.empty() || m_data->insideVisibleScope()) {
+      ++m_data->m_cullingStatistics.skipped;
+      return SUBTREE_VISIBLE;
+    }
+
+    ++m_data->m_cullingStatistics.tested;
+    const Nimble::ClipStack & clipStack = m_data->m_clipStacks.top();
+    if(!clipStack.isVisible(bounds)) {
+      ++m_data->m_cullingStatistics.culled;
+      return SUBTREE_HIDDEN;
+    }
+    return clipStack.contains(bounds) ? SUBTREE_VISIBLE : SUBTREE_PARTIAL;
+  }
+
+  void RenderContext::pushCullingScope(SubtreeVisibility visibility)
+  {
+    Internal::CullingScope scope;
+    scope.visibility = visibility;
+    scope.clipStackCount = m_data->m_clipStacks.size();
+    scope.clipKey = m_data->m_clipStacks.empty() ? 0 : m_data->m_clipStacks.top().key();
+    m_data->m_cullingScopes.push_back(scope);
+  }
+
+  void RenderContext::popCullingScope()
+  {
+    assert(!m_data->m_cullingScopes.empty());
+    m_data->m_cullingScopes.pop_back();
+  }
+
+  const RenderContext::CullingStatistics & RenderContext::cullingStatistics() const
+  {
+    return m_data->m_cullingStatistics;
   }
 
   void RenderContext::pushViewWidget(Valuable::Node::Uuid id)
   {
     m_data->m_viewWidgetPath.push_back(id);
+    m_data->m_viewWidgetPathHashes.push_back(hashCombine(
+        m_data->m_viewWidgetPathHashes.empty() ? 0 : m_data->m_viewWidgetPathHashes.back(), id));
 
     char buffer[17];
     snprintf(buffer, sizeof(buffer), "%016" PRIx64, id);
@@ -507,6 +681,7 @@ namespace Luminous
   void RenderContext::popViewWidget()
   {
     m_data->m_viewWidgetPath.pop_back();
+    m_data->m_viewWidgetPathHashes.pop_back();
     m_data->m_viewWidgetPathId.chop(16);
   }
 
@@ -804,6 +979,11 @@ namespace Luminous
     assert(data);
     data += buffer->reservedBytes;
     offset = static_cast<unsigned int>(buffer->reservedBytes / vertexSize);
+    if(type == Buffer::UNIFORM && m_data->m_areaReplayState == Internal::AREA_REPLAY_RECORDING) {
+      auto key = std::make_pair(&m_data->m_driverGL->handle(buffer->buffer),
+                                static_cast<unsigned int>(buffer->reservedBytes));
+      m_data->m_recordedUniforms[key] = data;
+    }
     buffer->reservedBytes += vertexSize * maxVertexCount;
     return std::make_pair(data, buffer);
   }
@@ -1631,6 +1811,7 @@ namespace Luminous
 
   StateGL & RenderContext::stateGl()
   {
+    assert(m_data->m_driverGL);
     return m_data->m_driverGL->stateGl();
   }
 
@@ -1641,7 +1822,7 @@ namespace Luminous
 
   void RenderContext::pushFrameBuffer(const FrameBuffer &target)
   {
-    m_data->m_driverGL->pushFrameBuffer(target);
+    m_data->m_driver.pushFrameBuffer(target);
 
     m_data->m_frameBufferStack.push(&target);
 
@@ -1691,7 +1872,7 @@ namespace Luminous
     popClipMaskStack();
 
     m_data->m_renderCalls.pop();
-    m_data->m_driverGL->popFrameBuffer();
+    m_data->m_driver.popFrameBuffer();
   }
 
   void RenderContext::pushBlockObjects(ObjectMask objectMask, bool reset)
@@ -1723,6 +1904,13 @@ namespace Luminous
   {
     m_data->m_frameTime = frameTime;
     m_data->m_frameNumber = frameNumber;
+    m_data->m_cullingStatistics = CullingStatistics();
+    m_data->m_areaReplayState = Internal::AREA_REPLAY_NONE;
+    m_data->m_recordedUniforms.clear();
+    if (m_data->m_driverGL)
+      m_data->m_driverGL->clearRecording();
+    if(frameNumber % s_visibilityCacheFrames == 0)
+      m_data->expireVisibilityCache();
     if(m_data->m_postProcessFilters) {
       m_data->createPostProcessFilters(*this, *m_data->m_postProcessFilters);
       // Reorders the chain is necessary
@@ -1739,7 +1927,7 @@ namespace Luminous
 
     // Push frame buffer attached to back buffer. Don't use the RenderContext API
     // to avoid the guard.
-    m_data->m_driverGL->pushFrameBuffer(m_data->m_finalFrameBuffer);
+    m_data->m_driver.pushFrameBuffer(m_data->m_finalFrameBuffer);
     m_data->m_frameBufferStack.push(&m_data->m_finalFrameBuffer);
 
     // Check if we need an auxiliary frame buffer (save this so we can pop when we are done)
@@ -1751,7 +1939,7 @@ namespace Luminous
       auto & fbos = m_data->m_offScreenFrameBuffers;
       if (fbos.empty())
         m_data->resizeOffScreenFrameBuffers(1);
-      m_data->m_driverGL->pushFrameBuffer(fbos[frameNumber % fbos.size()]);
+      m_data->m_driver.pushFrameBuffer(fbos[frameNumber % fbos.size()]);
       m_data->m_frameBufferStack.push(&fbos[frameNumber % fbos.size()]);
     }
 
@@ -1789,12 +1977,12 @@ namespace Luminous
 
       if (blitFrame != m_data->m_frameNumber) {
         fbos[blitFrame % fbos.size()].setTargetBind(FrameBuffer::BIND_READ);
-        m_data->m_driverGL->pushFrameBuffer(fbos[blitFrame % fbos.size()]);
+        m_data->m_driver.pushFrameBuffer(fbos[blitFrame % fbos.size()]);
       }
 
       // Push window frame buffer
       m_data->m_finalFrameBuffer.setTargetBind(FrameBuffer::BIND_DRAW);
-      m_data->m_driverGL->pushFrameBuffer(m_data->m_finalFrameBuffer);
+      m_data->m_driver.pushFrameBuffer(m_data->m_finalFrameBuffer);
 
       // Blit individual areas from the buffer we are going to swap to the final frame buffer
       for(size_t i = 0; i < m_data->m_window->areaCount(); i++) {
@@ -1802,17 +1990,17 @@ namespace Luminous
         blit(area.viewport(), area.viewport());
       }
 
-      m_data->m_driverGL->popFrameBuffer();
+      m_data->m_driver.popFrameBuffer();
 
       if (blitFrame != m_data->m_frameNumber) {
         fbos[blitFrame % fbos.size()].setTargetBind(FrameBuffer::BIND_DEFAULT);
-        m_data->m_driverGL->popFrameBuffer();
+        m_data->m_driver.popFrameBuffer();
       }
     }
 
     // Pop our auxiliary frame buffer if we have used it
     if(m_data->m_useOffScreenFrameBuffer) {
-      m_data->m_driverGL->popFrameBuffer();
+      m_data->m_driver.popFrameBuffer();
       m_data->m_frameBufferStack.pop();
     }
 
@@ -1832,19 +2020,21 @@ namespace Luminous
     m_data->m_opacityStack.pop();
 
     // Pop the default target
-    m_data->m_driverGL->popFrameBuffer();
+    m_data->m_driver.popFrameBuffer();
     m_data->m_frameBufferStack.pop();
     assert(m_data->m_frameBufferStack.empty());
 
     assert(stackSize() == 1);
 
     assert(m_data->m_clipStacks.size() == 1);
+    assert(m_data->m_cullingScopes.empty());
 
     popClipStack();
 
     // Call glFinish if configured to minimize latency at the expense of
     // throughput.
-    const bool useGLFinish = m_data->m_window->screen()->useGlFinish();
+    const MultiHead * screen = m_data->m_window->screen();
+    const bool useGLFinish = m_data->m_driverGL && screen && screen->useGlFinish();
     if(useGLFinish) {
       // On AMD / Linux / Multi-GPU setup, this is absolute requirement.
       // If we wouldn't call glFinish, it seems that calling swapBuffers
@@ -1868,12 +2058,75 @@ namespace Luminous
   {
     assert(stackSize() == 1);
     assert(transform() == Nimble::Matrix4::IDENTITY);
+
+    const MultiHead::Window * window = m_data->m_window;
+    const MultiHead::Area * area = m_data->m_area;
+    if(m_data->m_areaReplayState == Internal::AREA_REPLAY_NONE && m_data->m_driverGL && window && area &&
+       window->areaReplay() && window->areaCount() > 1) {
+      m_data->m_recordedUniforms.clear();
+      area->viewTransform().transpose(m_data->m_recordedProjMatrix);
+      m_data->m_driverGL->beginRecording(area->viewport());
+      m_data->m_areaReplayState = Internal::AREA_REPLAY_RECORDING;
+    }
   }
 
   void RenderContext::endArea()
   {
     assert(stackSize() == 1);
     assert(transform() == Nimble::Matrix4::IDENTITY);
+
+    if(m_data->m_areaReplayState == Internal::AREA_REPLAY_RECORDING) {
+      bool replayable = m_data->m_driverGL->endRecording();
+      // The projection matrix is replaced when replaying, so every uniform
+      // block needs to start with the view transform of the recorded area.
+      // Blocks with some other projection are from off-screen rendering or
+      // custom uniform blocks.
+      for(auto it = m_data->m_recordedUniforms.begin(); replayable && it != m_data->m_recordedUniforms.end(); ++it)
+        replayable = memcmp(it->second, m_data->m_recordedProjMatrix.data(), sizeof(Nimble::Matrix4f)) == 0;
+      m_data->m_areaReplayState = replayable ? Internal::AREA_REPLAY_READY : Internal::AREA_REPLAY_FAILED;
+    }
+  }
+
+  bool RenderContext::replayArea()
+  {
+    assert(stackSize() == 1);
+
+    const MultiHead::Area * area = m_data->m_area;
+    if(m_data->m_areaReplayState != Internal::AREA_REPLAY_READY || !area)
+      return false;
+
+    Nimble::Matrix4f projMatrix;
+    area->viewTransform().transpose(projMatrix);
+
+    bool ok = m_data->m_driverGL->replayRecording(area->viewport(), [&] (RenderCommandBase & cmd, BufferGL *& uniformBuffer)
+    {
+      auto it = m_data->m_recordedUniforms.find(std::make_pair(uniformBuffer, cmd.uniformOffsetBytes));
+      if(it == m_data->m_recordedUniforms.end())
+        return false;
+
+      unsigned int offset;
+      void * data;
+      SharedBuffer * ubuffer;
+      std::tie(data, ubuffer) = sharedBuffer(cmd.uniformSizeBytes, 1, Buffer::UNIFORM, offset);
+      memcpy(data, it->second, cmd.uniformSizeBytes);
+      memcpy(data, projMatrix.data(), sizeof(projMatrix));
+
+      cmd.uniformOffsetBytes = offset * cmd.uniformSizeBytes;
+      uniformBuffer = &m_data->m_driverGL->handle(ubuffer->buffer);
+      return true;
+    });
+
+    if(!ok) {
+      m_data->m_areaReplayState = Internal::AREA_REPLAY_FAILED;
+      return false;
+    }
+
+    // Restore the viewport and scissor of the caller
+    if(!m_data->m_viewportStack.empty())
+      m_data->m_driver.setViewport(currentViewport());
+    if(!m_data->m_scissorStack.empty())
+      m_data->m_driver.setScissor(currentScissorArea());
+    return true;
   }
 
   void RenderContext::initPostProcess(Luminous::PostProcessFilters & filters)
@@ -2036,8 +2289,10 @@ namespace Luminous
   {
     m_data->initialize();
 
-    int maxSize = 1024;
-    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    // Drivers without OpenGL context use the limit of most desktop GPUs
+    int maxSize = 16384;
+    if (m_data->m_driverGL)
+      glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
     m_data->m_maxTextureSize = maxSize;
   }
 
@@ -2071,7 +2326,7 @@ namespace Luminous
 
   void RenderContext::setDefaultState()
   {
-    m_data->m_driverGL->setDefaultState();
+    m_data->m_driver.setDefaultState();
   }
 
   void RenderContext::pushScissorRect(const Nimble::Recti & scissorArea)
@@ -2106,23 +2361,23 @@ namespace Luminous
 
   void RenderContext::setRenderBuffers(bool colorBuffer, bool depthBuffer, bool stencilBuffer)
   {
-    m_data->m_driverGL->setRenderBuffers(colorBuffer, depthBuffer, stencilBuffer);
+    m_data->m_driver.setRenderBuffers(colorBuffer, depthBuffer, stencilBuffer);
   }
 
   void RenderContext::setBlendMode(const BlendMode & mode)
   {
-    m_data->m_driverGL->setBlendMode(mode);
+    m_data->m_driver.setBlendMode(mode);
   }
 
   void RenderContext::setDepthMode(const DepthMode & mode)
   {
-    m_data->m_driverGL->setDepthMode(mode);
+    m_data->m_driver.setDepthMode(mode);
   }
 
   void RenderContext::setStencilMode(const StencilMode & mode)
   {
     m_data->m_stencilMode = mode;
-    m_data->m_driverGL->setStencilMode(mode);
+    m_data->m_driver.setStencilMode(mode);
   }
 
   StencilMode RenderContext::stencilMode() const
@@ -2132,12 +2387,12 @@ namespace Luminous
 
   void RenderContext::setCullMode(const CullMode& mode)
   {
-    m_data->m_driverGL->setCullMode(mode);
+    m_data->m_driver.setCullMode(mode);
   }
 
   void RenderContext::setDrawBuffers(const std::vector<GLenum> & buffers)
   {
-    m_data->m_driverGL->setDrawBuffers(buffers);
+    m_data->m_driver.setDrawBuffers(buffers);
   }
 
   void RenderContext::setDefaultDrawBuffers()
@@ -2150,17 +2405,17 @@ namespace Luminous
 
   void RenderContext::setFrontFace(FaceWinding winding)
   {
-    m_data->m_driverGL->setFrontFace(winding);
+    m_data->m_driver.setFrontFace(winding);
   }
 
   void RenderContext::enableClipPlanes(const QList<int> & planes)
   {
-    m_data->m_driverGL->enableClipDistance(planes);
+    m_data->m_driver.enableClipDistance(planes);
   }
 
   void RenderContext::disableClipPlanes(const QList<int> & planes)
   {
-    m_data->m_driverGL->disableClipDistance(planes);
+    m_data->m_driver.disableClipDistance(planes);
   }
   ////////////////////////////////////////////////////////////////////////////////
   ////////////////////////////////////////////////////////////////////////////////
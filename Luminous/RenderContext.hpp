@@ -64,6 +64,30 @@ namespace Luminous
       TextStatic
     };
 
+    /// Result of testing the bounds of a whole widget subtree against the
+    /// clip stack, see subtreeVisibility()
+    enum SubtreeVisibility
+    {
+      /// Nothing in the subtree is visible, it can be skipped
+      SUBTREE_HIDDEN,
+      /// The subtree is partially clipped, children need to be tested
+      SUBTREE_PARTIAL,
+      /// The subtree is not clipped at all, children don't need to be tested
+      SUBTREE_VISIBLE
+    };
+
+    /// Visibility test counters, reset in the beginning of every frame
+    struct CullingStatistics
+    {
+      /// Number of visibility tests done against the clip stack
+      uint64_t tested = 0;
+      /// Number of visibility queries answered without testing, either from
+      /// the visibility cache or from a fully visible subtree
+      uint64_t skipped = 0;
+      /// Number of objects and subtrees that were found not visible
+      uint64_t culled = 0;
+    };
+
     /// How are UV coordinates generated for objects
     enum TextureMappingMode
     {
@@ -204,6 +228,24 @@ namespace Luminous
     /// called multiple times per frame depending on configuration.
     void endArea();
 
+    /// Renders the current area by replaying the draw commands that were
+    /// recorded for an earlier area of the same window in this frame. This
+    /// only works if area replay is enabled in the window, see
+    /// MultiHead::Window::areaReplay. The vertex data and the pipeline state
+    /// of the recorded commands are reused, only the view transform,
+    /// viewport and scissor rectangle are changed. Call between beginArea
+    /// and endArea.
+    /// @code
+    /// rc.setWindowArea(&window, &area);
+    /// rc.beginArea();
+    /// if(!rc.replayArea())
+    ///   renderScene(rc);
+    /// rc.endArea();
+    /// @endcode
+    /// @return true if the area was replayed, false if the scene needs to be
+    ///         rendered normally
+    bool replayArea();
+
     /// @cond
 
     void initPostProcess(Luminous::PostProcessFilters & filters);
@@ -270,6 +312,34 @@ namespace Luminous
     /// @return Was the area visible
     bool isVisible(const Nimble::Rectangle & area);
 
+    /// Same as isVisible(area), but the result is cached per object and
+    /// viewWidgetPathId. On the next frames the cached result is used as long
+    /// as the area and the clip stack stay the same, which is the common case
+    /// for widgets that are not moving.
+    /// @param id id of the object, typically the widget id
+    /// @param area Area to check
+    /// @return Was the area visible
+    bool isVisible(Valuable::Node::Uuid id, const Nimble::Rectangle & area);
+
+    /// Tests the bounds of a whole subtree against the clip stack. If the
+    /// subtree is hidden, it doesn't need to be rendered. Otherwise the result
+    /// should be pushed with pushCullingScope while rendering the subtree.
+    /// @param bounds area that contains the whole subtree
+    /// @return visibility of the subtree
+    SubtreeVisibility subtreeVisibility(const Nimble::Rectangle & bounds);
+
+    /// Starts a subtree with the given visibility. While the innermost scope
+    /// is SUBTREE_VISIBLE, isVisible returns true without any testing, unless
+    /// new clip rectangles have been pushed after the scope.
+    /// @param visibility result of subtreeVisibility
+    void pushCullingScope(SubtreeVisibility visibility);
+    /// Ends the subtree started with pushCullingScope
+    void popCullingScope();
+
+    /// Returns the visibility test counters for the current frame. This can be
+    /// used to check how well culling and visibility caching work.
+    const CullingStatistics & cullingStatistics() const;
+
     /// Called by ViewWidget::renderContent before rendering the view scene.
     /// Can be called from other view-type widgets that render a widget
     /// hierarchy manually. This updates viewWidgetPath and viewWidgetPathId.
@@ -1067,6 +1137,25 @@ namespace Luminous
     RenderContext * m_rc;
   };
 
+  /// This class provides a simple guard for culling scopes. It will
+  /// automatically pop the scope in its destructor.
+  class CullingScopeGuard : public Patterns::NotCopyable
+  {
+  public:
+    /// Constructor. Automatically calls RenderContext::pushCullingScope()
+    /// @param r render context
+    /// @param visibility visibility of the subtree
+    CullingScopeGuard(RenderContext & r, RenderContext::SubtreeVisibility visibility)
+      : m_rc(&r) { r.pushCullingScope(visibility); }
+    /// Move constructor
+    CullingScopeGuard(CullingScopeGuard && rhs) : m_rc(rhs.m_rc) { rhs.m_rc = nullptr; }
+    /// Destructor. This function automatically calls RenderContext::popCullingScope()
+    ~CullingScopeGuard() { if(m_rc) m_rc->popCullingScope(); }
+
+  private:
+    RenderContext * m_rc;
+  };
+
   /// This class provides a simple guard for setting the active view transform. It will
   /// automatically pop the transform in its destructor so the user doesn't need to
   /// remember to do it manually. It is equivalent to calling
@@ -151,6 +151,9 @@ namespace Luminous
 
     LUMINOUS_API virtual void setDrawBuffers(const std::vector<GLenum> & buffers) = 0;
 
+    LUMINOUS_API virtual void pushFrameBuffer(const FrameBuffer & target) = 0;
+    LUMINOUS_API virtual void popFrameBuffer() = 0;
+
     LUMINOUS_API virtual void setViewport(const Nimble::Recti & rect) = 0;
     LUMINOUS_API virtual void setScissor(const Nimble::Recti & rect) = 0;
 
@@ -225,6 +225,28 @@ namespace Luminous
     bool m_supportsGL_NVX_gpu_memory_info = false;
     bool m_supportsGL_ATI_meminfo = false;
 
+    /// Render queue segments of one area that can be replayed on the other
+    /// areas of the same window, see RenderContext::replayArea
+    struct Recording
+    {
+      enum SegmentType
+      {
+        /// The pipeline command is executed as such in every area
+        SEGMENT_SHARED,
+        /// Sets the viewport to the area viewport
+        SEGMENT_VIEWPORT,
+        /// Sets the scissor rectangle to the area viewport
+        SEGMENT_SCISSOR
+      };
+
+      bool active = false;
+      bool replayable = false;
+      Nimble::Recti viewport;
+      std::size_t segmentBegin = 0;
+      std::vector<SegmentType> segments;
+    };
+    Recording m_recording;
+
   public:
 
     /// Reset thread statistics
@@ -266,13 +288,38 @@ namespace Luminous
     RenderQueueSegment & currentRenderQueueSegment() { assert(!m_masterRenderQueue.empty()); return m_masterRenderQueue.back(); }
 
     /// Allocate a new render queue segment defined by the given pipeline command
-    void newRenderQueueSegment(PipelineCommand * cmd)
+    void newRenderQueueSegment(PipelineCommand * cmd, Recording::SegmentType type = Recording::SEGMENT_SHARED)
     {
       /// @todo Maybe look into a pool allocator to improve performance. Should profile more
       m_masterRenderQueue.emplace_back(cmd, static_cast<unsigned int>(m_opaqueQueue.size()),
                                        static_cast<unsigned int>(m_translucentQueue.size()));
+      if (m_recording.active)
+        m_recording.segments.push_back(type);
+    }
+
+    /// Viewport and scissor commands can only be replayed if they use the
+    /// viewport of the recorded area, they are replaced with the viewport of
+    /// the replayed area.
+    Recording::SegmentType areaSegment(const Nimble::Recti & rect, Recording::SegmentType type)
+    {
+      if (m_recording.active && (rect.low() != m_recording.viewport.low() ||
+                                 rect.high() != m_recording.viewport.high()))
+        m_recording.replayable = false;
+      return type;
     }
 
+    /// Called for pipeline commands that depend on the area in some other
+    /// way, like frame buffer changes and blits
+    void disableReplay()
+    {
+      m_recording.replayable = false;
+    }
+
+    /// Adds copies of the given render commands to the current segment
+    bool replayCommands(std::vector<std::pair<RenderState, RenderCommandIndex>> & queue,
+                        unsigned int begin, unsigned int end,
+                        const RenderDriverGL::UniformRelocator & relocate);
+
 #if 0
     void debugOutputStats()
     {
@@ -304,6 +351,36 @@ namespace Luminous
 
   /////////////////////////////////////////////////////////////////////////////
 
+  bool RenderDriverGL::D::replayCommands(std::vector<std::pair<RenderState, RenderCommandIndex>> & queue,
+                                         unsigned int begin, unsigned int end,
+                                         const RenderDriverGL::UniformRelocator & relocate)
+  {
+    constexpr auto disabled = std::numeric_limits<unsigned int>::max();
+
+    for (unsigned int i = begin; i < end; ++i) {
+      // Copies, since the queues might be reallocated
+      RenderState state = queue[i].first;
+      RenderCommandIndex idx = queue[i].second;
+
+      if (idx.renderCommandIndex != disabled) {
+        RenderCommand cmd = m_renderCommands[idx.renderCommandIndex];
+        if (!relocate(cmd, state.uniformBuffer))
+          return false;
+        idx.renderCommandIndex = static_cast<unsigned int>(m_renderCommands.size());
+        m_renderCommands.push_back(cmd);
+      } else if (idx.multiDrawCommandIndex != disabled) {
+        // offsets and counts are shared with the original command
+        MultiDrawCommand cmd = m_MultiDrawCommands[idx.multiDrawCommandIndex];
+        if (!relocate(cmd, state.uniformBuffer))
+          return false;
+        idx.multiDrawCommandIndex = static_cast<unsigned int>(m_MultiDrawCommands.size());
+        m_MultiDrawCommands.push_back(cmd);
+      }
+      queue.emplace_back(state, idx);
+    }
+    return true;
+  }
+
   void RenderDriverGL::D::resetStatistics()
   {
     m_frameTimer.start();
@@ -665,6 +742,7 @@ namespace Luminous
 
   void RenderDriverGL::clear(ClearMask mask, const Radiant::ColorPMA & color, double depth, int stencil)
   {
+    m_d->disableReplay();
     m_d->newRenderQueueSegment(new CommandClearGL(*m_d->m_opengl, mask, color, depth, stencil));
   }
 
@@ -857,29 +935,34 @@ namespace Luminous
 
   void RenderDriverGL::setDrawBuffers(const std::vector<GLenum> & buffers)
   {
+    m_d->disableReplay();
     m_d->newRenderQueueSegment(new CommandDrawBuffers(*m_d->m_opengl, buffers));
   }
 
   void RenderDriverGL::setViewport(const Nimble::Recti & rect)
   {
-    m_d->newRenderQueueSegment(new CommandViewportGL(*m_d->m_opengl, rect));
+    m_d->newRenderQueueSegment(new CommandViewportGL(*m_d->m_opengl, rect),
+                               m_d->areaSegment(rect, D::Recording::SEGMENT_VIEWPORT));
   }
 
   void RenderDriverGL::setScissor(const Nimble::Recti & rect)
   {
     m_d->m_opengl->glEnable(GL_SCISSOR_TEST);
     GLERROR("RenderDriverGL::setScissor # glEnable");
-    m_d->newRenderQueueSegment(new CommandScissorGL(*m_d->m_opengl, rect));
+    m_d->newRenderQueueSegment(new CommandScissorGL(*m_d->m_opengl, rect),
+                               m_d->areaSegment(rect, D::Recording::SEGMENT_SCISSOR));
   }
 
   void RenderDriverGL::blit(const Nimble::Recti &src, const Nimble::Recti &dst,
                             Luminous::ClearMask mask, Luminous::Texture::Filter filter)
   {
+    m_d->disableReplay();
     m_d->newRenderQueueSegment(new CommandBlitGL(*m_d->m_opengl, src, dst, mask, filter));
   }
 
   void RenderDriverGL::setRenderBuffers(bool colorBuffer, bool depthBuffer, bool stencilBuffer)
   {
+    m_d->disableReplay();
     m_d->newRenderQueueSegment(new CommandChangeRenderBuffersGL(*m_d->m_opengl, colorBuffer, depthBuffer, stencilBuffer));
   }
 
@@ -1026,6 +1109,7 @@ namespace Luminous
       }
     }
     m_d->m_masterRenderQueue.clear();
+    m_d->m_recording = D::Recording();
     m_d->m_opaqueQueue.clear();
     m_d->m_translucentQueue.clear();
     m_d->m_renderCommands.clear();
@@ -1128,6 +1212,7 @@ namespace Luminous
   {
     FrameBufferGL & rtGL = handle(target);
 
+    m_d->disableReplay();
     m_d->m_fboStack.push(&rtGL);
 
     auto cmd = new CommandChangeFrameBufferGL(*m_d->m_opengl, rtGL);
@@ -1139,6 +1224,7 @@ namespace Luminous
   {
     assert(!m_d->m_fboStack.empty());
 
+    m_d->disableReplay();
     m_d->m_fboStack.pop();
 
     // We might have emptied the stack if this was the default frame buffer
@@ -1153,6 +1239,88 @@ namespace Luminous
     }
   }
 
+  void RenderDriverGL::beginRecording(const Nimble::Recti & viewport)
+  {
+    m_d->m_recording = D::Recording();
+    m_d->m_recording.active = true;
+    m_d->m_recording.replayable = true;
+    m_d->m_recording.viewport = viewport;
+    m_d->m_recording.segmentBegin = m_d->m_masterRenderQueue.size();
+    // Start a new segment, so that all recorded commands are in recorded segments
+    setViewport(viewport);
+  }
+
+  bool RenderDriverGL::endRecording()
+  {
+    if (!m_d->m_recording.active)
+      return false;
+    m_d->m_recording.active = false;
+    return m_d->m_recording.replayable;
+  }
+
+  bool RenderDriverGL::replayRecording(const Nimble::Recti & viewport, const UniformRelocator & relocate)
+  {
+    D::Recording & recording = m_d->m_recording;
+    if (recording.active || !recording.replayable || recording.segments.empty())
+      return false;
+
+    const std::size_t segmentCount = m_d->m_masterRenderQueue.size();
+    const std::size_t opaqueCount = m_d->m_opaqueQueue.size();
+    const std::size_t translucentCount = m_d->m_translucentQueue.size();
+    const std::size_t renderCommandCount = m_d->m_renderCommands.size();
+    const std::size_t multiDrawCommandCount = m_d->m_MultiDrawCommands.size();
+
+    std::shared_ptr<PipelineCommand> viewportCmd, scissorCmd;
+
+    bool ok = true;
+    for (std::size_t i = 0; ok && i < recording.segments.size(); ++i) {
+      std::shared_ptr<PipelineCommand> cmd;
+      if (recording.segments[i] == D::Recording::SEGMENT_VIEWPORT) {
+        if (!viewportCmd)
+          viewportCmd = std::make_shared<CommandViewportGL>(*m_d->m_opengl, viewport);
+        cmd = viewportCmd;
+      } else if (recording.segments[i] == D::Recording::SEGMENT_SCISSOR) {
+        if (!scissorCmd)
+          scissorCmd = std::make_shared<CommandScissorGL>(*m_d->m_opengl, viewport);
+        cmd = scissorCmd;
+      } else {
+        cmd = m_d->m_masterRenderQueue[recording.segmentBegin + i].pipelineCommand;
+      }
+
+      m_d->m_masterRenderQueue.emplace_back(std::move(cmd), static_cast<unsigned int>(m_d->m_opaqueQueue.size()),
+                                            static_cast<unsigned int>(m_d->m_translucentQueue.size()));
+
+      const RenderQueueSegment & recorded = m_d->m_masterRenderQueue[recording.segmentBegin + i];
+      const unsigned int opaqueBegin = recorded.opaqueCmdBegin, opaqueEnd = recorded.opaqueCmdEnd;
+      const unsigned int translucentBegin = recorded.translucentCmdBegin, translucentEnd = recorded.translucentCmdEnd;
+
+      ok = m_d->replayCommands(m_d->m_opaqueQueue, opaqueBegin, opaqueEnd, relocate) &&
+          m_d->replayCommands(m_d->m_translucentQueue, translucentBegin, translucentEnd, relocate);
+
+      RenderQueueSegment & segment = m_d->m_masterRenderQueue.back();
+      segment.opaqueCmdEnd = static_cast<unsigned int>(m_d->m_opaqueQueue.size());
+      segment.translucentCmdEnd = static_cast<unsigned int>(m_d->m_translucentQueue.size());
+    }
+
+    if (!ok) {
+      // Roll back the partial replay, the area needs to be rendered normally
+      m_d->m_masterRenderQueue.erase(m_d->m_masterRenderQueue.begin() + segmentCount,
+                                     m_d->m_masterRenderQueue.end());
+      m_d->m_opaqueQueue.resize(opaqueCount);
+      m_d->m_translucentQueue.resize(translucentCount);
+      m_d->m_renderCommands.resize(renderCommandCount);
+      m_d->m_MultiDrawCommands.resize(multiDrawCommandCount);
+      recording.replayable = false;
+    }
+
+    return ok;
+  }
+
+  void RenderDriverGL::clearRecording()
+  {
+    m_d->m_recording = D::Recording();
+  }
+
   int RenderDriverGL::uniformBufferOffsetAlignment() const
   {
     int alignment;
@@ -22,6 +22,8 @@
 
 #include <Radiant/Flags.hpp>
 
+#include <functional>
+
 namespace Luminous
 {
   class RenderDriverGL : public RenderDriver
@@ -83,8 +85,30 @@ namespace Luminous
     ///       and synchronize (upload) data.
     LUMINOUS_API TextureGL * findHandle(const Texture & texture);
 
-    LUMINOUS_API void pushFrameBuffer(const FrameBuffer & target);
-    LUMINOUS_API void popFrameBuffer();
+    LUMINOUS_API virtual void pushFrameBuffer(const FrameBuffer & target) OVERRIDE;
+    LUMINOUS_API virtual void popFrameBuffer() OVERRIDE;
+
+    /// Relocates the uniform block of a replayed command. Gets a copy of the
+    /// recorded command and the uniform buffer it uses, and should point
+    /// them to a new uniform block. Returns false if that is not possible.
+    typedef std::function<bool(RenderCommandBase & cmd, BufferGL *& uniformBuffer)> UniformRelocator;
+
+    /// Starts recording the render queue of one area for replaying it on the
+    /// other areas of the window, see RenderContext::replayArea. Viewport and
+    /// scissor commands that use the given area viewport are replaced with
+    /// the viewport of the replayed area. Other area dependent commands, like
+    /// frame buffer changes, clears and blits, make the recording unusable.
+    LUMINOUS_API void beginRecording(const Nimble::Recti & viewport);
+    /// @return true if the recorded commands can be replayed
+    LUMINOUS_API bool endRecording();
+    /// Adds copies of the recorded commands to the render queue. The vertex
+    /// data and the pipeline commands are shared with the recorded commands.
+    /// @param viewport viewport and scissor rectangle of the replayed area
+    /// @param relocate called for every copied command
+    /// @return false if nothing was replayed
+    LUMINOUS_API bool replayRecording(const Nimble::Recti & viewport, const UniformRelocator & relocate);
+    /// Discards the recorded commands. This is done automatically in flush.
+    LUMINOUS_API void clearRecording();
 
     /// @todo Add function wrapper(s) for:
     /// * glLogicOp
@@ -0,0 +1,606 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "RenderDriverHeadless.hpp"
+
+#include "Luminous/RenderManager.hpp"
+#include "Luminous/VertexArray.hpp"
+#include "Luminous/Program.hpp"
+#include "Luminous/Texture.hpp"
+#include "Luminous/PixelFormat.hpp"
+
+#include <Radiant/Mutex.hpp>
+#include <Radiant/VectorAllocator.hpp>
+
+#include <folly/executors/ManualExecutor.h>
+
+#include <QRegion>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stack>
+#include <tuple>
+#include <unordered_map>
+
+namespace Luminous
+{
+  namespace
+  {
+    /// Same as RenderState in RenderQueues.hpp, but uses resource ids
+    /// instead of OpenGL handles
+    struct StateKey
+    {
+      RenderResource::Id program = 0;
+      RenderResource::Id vertexArray = 0;
+      RenderResource::Id uniformBuffer = 0;
+      std::array<RenderResource::Id, 8> textures{};
+
+      bool operator<(const StateKey & o) const
+      {
+        return std::tie(program, vertexArray, uniformBuffer, textures) <
+            std::tie(o.program, o.vertexArray, o.uniformBuffer, o.textures);
+      }
+
+      bool operator!=(const StateKey & o) const
+      {
+        return program != o.program || vertexArray != o.vertexArray ||
+            uniformBuffer != o.uniformBuffer || textures != o.textures;
+      }
+    };
+
+    struct Segment
+    {
+      bool hasPipelineCommand = false;
+      RenderDriverHeadless::Command pipelineCommand;
+
+      unsigned int opaqueCmdBegin = 0;
+      unsigned int opaqueCmdEnd = 0;
+      unsigned int translucentCmdBegin = 0;
+      unsigned int translucentCmdEnd = 0;
+    };
+  }
+
+  class RenderDriverHeadless::D
+  {
+  public:
+    D(RenderDriverHeadless & driver) : m_driver(driver) {}
+
+    void record(CommandType type, uint64_t size = 0, RenderResource::Id resource = 0)
+    {
+      if (m_recordCommands)
+        m_commands.push_back({type, size, resource});
+    }
+
+    void newSegment(CommandType type, RenderResource::Id resource = 0)
+    {
+      Segment segment;
+      segment.hasPipelineCommand = true;
+      segment.pipelineCommand = {type, 0, resource};
+      segment.opaqueCmdBegin = segment.opaqueCmdEnd = static_cast<unsigned int>(m_opaqueQueue.size());
+      segment.translucentCmdBegin = segment.translucentCmdEnd = static_cast<unsigned int>(m_translucentQueue.size());
+      m_segments.push_back(segment);
+    }
+
+    Segment & currentSegment()
+    {
+      if (m_segments.empty()) {
+        m_segments.emplace_back();
+        m_segments.back().opaqueCmdBegin = m_segments.back().opaqueCmdEnd =
+            static_cast<unsigned int>(m_opaqueQueue.size());
+        m_segments.back().translucentCmdBegin = m_segments.back().translucentCmdEnd =
+            static_cast<unsigned int>(m_translucentQueue.size());
+      }
+      return m_segments.back();
+    }
+
+    void uploadBuffer(const Buffer & buffer);
+    void uploadTexture(const Texture & texture);
+
+    void createRenderCommand(RenderCommandBase & cmd,
+                             bool & translucent,
+                             const Program & shader,
+                             const VertexArray & vertexArray,
+                             const Buffer & uniformBuffer,
+                             const std::map<QByteArray, const Texture *> * textures,
+                             const std::map<QByteArray, ShaderUniform> * uniforms);
+
+    void queue(bool translucent, RenderCommandIndex idx)
+    {
+      Segment & segment = currentSegment();
+      if (translucent) {
+        m_translucentQueue.emplace_back(m_state, idx);
+        ++segment.translucentCmdEnd;
+      } else {
+        m_opaqueQueue.emplace_back(m_state, idx);
+        ++segment.opaqueCmdEnd;
+      }
+      ++m_frame.renderCommands;
+    }
+
+    void execute(const std::pair<StateKey, RenderCommandIndex> & p, const StateKey *& prevState);
+
+  public:
+    RenderDriverHeadless & m_driver;
+
+    StateKey m_state;
+
+    std::vector<Segment> m_segments;
+    std::vector<RenderCommand> m_renderCommands;
+    std::vector<MultiDrawCommand> m_multiDrawCommands;
+    std::vector<std::pair<StateKey, RenderCommandIndex>> m_opaqueQueue;
+    std::vector<std::pair<StateKey, RenderCommandIndex>> m_translucentQueue;
+    Radiant::VectorAllocator<int> m_multiDrawArrays { 1024 };
+    std::vector<ShaderUniform> m_uniforms;
+
+    std::stack<RenderResource::Id, std::vector<RenderResource::Id>> m_frameBufferStack;
+
+    /// Generations of the uploaded buffers and textures
+    std::unordered_map<RenderResource::Id, int> m_bufferGenerations;
+    std::unordered_map<RenderResource::Id, int> m_textureGenerations;
+    /// CPU memory returned from mapBuffer
+    std::unordered_map<RenderResource::Id, std::vector<char>> m_mappedBuffers;
+
+    /// Resources released from the main thread, removed in preFrame
+    Radiant::Mutex m_releaseQueueMutex;
+    std::vector<RenderResource::Id> m_releaseQueue;
+
+    FrameStatistics m_frame;
+    FrameStatistics m_lastFrame;
+    std::vector<Command> m_commands;
+    bool m_recordCommands = true;
+
+    unsigned int m_gpuId = 0;
+    GLint m_availableMemory = 4 * 1024 * 1024;
+    GLint m_maximumMemory = 4 * 1024 * 1024;
+  };
+
+  void RenderDriverHeadless::D::uploadBuffer(const Buffer & buffer)
+  {
+    const Buffer::DirtyRegion dirtyRegion = buffer.takeDirtyRegion(m_driver.threadIndex());
+
+    auto it = m_bufferGenerations.find(buffer.resourceId());
+    size_t bytes;
+    if (it == m_bufferGenerations.end() || it->second < buffer.generation()) {
+      m_bufferGenerations[buffer.resourceId()] = buffer.generation();
+      bytes = buffer.dataSize();
+    } else {
+      bytes = dirtyRegion.dataEnd - dirtyRegion.dataBegin;
+    }
+
+    if (bytes > 0) {
+      ++m_frame.bufferUploads;
+      m_frame.bufferBytesUploaded += bytes;
+      record(COMMAND_BUFFER_UPLOAD, bytes, buffer.resourceId());
+    }
+  }
+
+  void RenderDriverHeadless::D::uploadTexture(const Texture & texture)
+  {
+    if (!texture.data())
+      return;
+
+    const QRegion dirtyRegion = texture.takeDirtyRegion(m_driver.threadIndex());
+
+    auto it = m_textureGenerations.find(texture.resourceId());
+    size_t bytes = 0;
+    if (it == m_textureGenerations.end() || it->second < texture.generation()) {
+      m_textureGenerations[texture.resourceId()] = texture.generation();
+      bytes = texture.dataSize();
+    } else {
+      const size_t bytesPerPixel = texture.dataFormat().bytesPerPixel();
+      for (const QRect & rect: dirtyRegion.rects())
+        bytes += size_t(rect.width()) * rect.height() * bytesPerPixel;
+    }
+
+    if (bytes > 0) {
+      ++m_frame.textureUploads;
+      m_frame.textureBytesUploaded += bytes;
+      record(COMMAND_TEXTURE_UPLOAD, bytes, texture.resourceId());
+    }
+  }
+
+  void RenderDriverHeadless::D::createRenderCommand(RenderCommandBase & cmd,
+                                                    bool & translucent,
+                                                    const Program & shader,
+                                                    const VertexArray & vertexArray,
+                                                    const Buffer & uniformBuffer,
+                                                    const std::map<QByteArray, const Texture *> * textures,
+                                                    const std::map<QByteArray, ShaderUniform> * uniforms)
+  {
+    cmd.samplersBegin = cmd.samplersEnd = 0;
+    cmd.uniformsBegin = cmd.uniformsEnd = static_cast<unsigned int>(m_uniforms.size());
+
+    m_state.program = shader.resourceId();
+    m_state.vertexArray = vertexArray.resourceId();
+    m_state.uniformBuffer = uniformBuffer.resourceId();
+
+    uploadBuffer(uniformBuffer);
+
+    for (size_t i = 0; i < vertexArray.bindingCount(); ++i) {
+      if (Buffer * buffer = RenderManager::getResource<Buffer>(vertexArray.binding(i).buffer))
+        uploadBuffer(*buffer);
+    }
+    if (Buffer * index = RenderManager::getResource<Buffer>(vertexArray.indexBuffer()))
+      uploadBuffer(*index);
+
+    size_t unit = 0;
+    if (textures != nullptr) {
+      for (auto & p: *textures) {
+        const Texture * texture = p.second;
+        if (!texture->isValid())
+          continue;
+
+        translucent |= texture->translucent();
+        uploadTexture(*texture);
+
+        if (unit < m_state.textures.size())
+          m_state.textures[unit++] = texture->resourceId();
+        ++cmd.samplersEnd;
+      }
+    }
+    std::fill(m_state.textures.begin() + unit, m_state.textures.end(), 0);
+
+    if (uniforms) {
+      for (auto & p: *uniforms) {
+        m_uniforms.push_back(p.second);
+        ++cmd.uniformsEnd;
+      }
+    }
+  }
+
+  void RenderDriverHeadless::D::execute(const std::pair<StateKey, RenderCommandIndex> & p,
+                                        const StateKey *& prevState)
+  {
+    constexpr auto disabled = std::numeric_limits<unsigned int>::max();
+
+    if (!prevState || *prevState != p.first) {
+      ++m_frame.stateChanges;
+      record(COMMAND_STATE_CHANGE, 0, p.first.program);
+    }
+    prevState = &p.first;
+
+    if (p.second.renderCommandIndex != disabled) {
+      const RenderCommand & cmd = m_renderCommands[p.second.renderCommandIndex];
+      ++m_frame.drawCalls;
+      m_frame.primitives += cmd.primitiveCount;
+      record(COMMAND_RENDER, cmd.primitiveCount);
+    } else if (p.second.multiDrawCommandIndex != disabled) {
+      const MultiDrawCommand & cmd = m_multiDrawCommands[p.second.multiDrawCommandIndex];
+      uint64_t primitives = 0;
+      for (int i = 0; i < cmd.drawCount; ++i)
+        primitives += cmd.counts[i];
+      m_frame.drawCalls += cmd.drawCount;
+      m_frame.primitives += primitives;
+      record(COMMAND_MULTI_DRAW, primitives);
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  RenderDriverHeadless::RenderDriverHeadless(GfxDriver & gfxDriver, unsigned int threadIndex)
+    : RenderDriver(gfxDriver, threadIndex)
+    , m_d(new D(*this))
+  {
+  }
+
+  RenderDriverHeadless::~RenderDriverHeadless()
+  {
+    afterFlush().clear();
+    worker().clear();
+  }
+
+  void RenderDriverHeadless::clear(ClearMask, const Radiant::ColorPMA &, double, int)
+  {
+    m_d->newSegment(COMMAND_CLEAR);
+  }
+
+  void RenderDriverHeadless::draw(PrimitiveType, unsigned int, unsigned int primitives)
+  {
+    ++m_d->m_frame.drawCalls;
+    m_d->m_frame.primitives += primitives;
+    m_d->record(COMMAND_DRAW, primitives);
+  }
+
+  void RenderDriverHeadless::drawIndexed(PrimitiveType type, unsigned int offset, unsigned int primitives)
+  {
+    draw(type, offset, primitives);
+  }
+
+  void RenderDriverHeadless::preFrame()
+  {
+    m_d->m_frame = FrameStatistics();
+    m_d->m_commands.clear();
+
+    std::vector<RenderResource::Id> releaseQueue;
+    {
+      Radiant::Guard g(m_d->m_releaseQueueMutex);
+      std::swap(releaseQueue, m_d->m_releaseQueue);
+    }
+    for (RenderResource::Id id: releaseQueue) {
+      m_d->m_bufferGenerations.erase(id);
+      m_d->m_textureGenerations.erase(id);
+      m_d->m_mappedBuffers.erase(id);
+    }
+  }
+
+  void RenderDriverHeadless::postFrame()
+  {
+    worker().run();
+    m_d->m_lastFrame = m_d->m_frame;
+  }
+
+  bool RenderDriverHeadless::initialize()
+  {
+    return true;
+  }
+
+  void RenderDriverHeadless::deInitialize()
+  {
+    m_d->m_bufferGenerations.clear();
+    m_d->m_textureGenerations.clear();
+    m_d->m_mappedBuffers.clear();
+  }
+
+  void RenderDriverHeadless::setDefaultState()
+  {
+  }
+
+  void RenderDriverHeadless::setRenderBuffers(bool, bool, bool)
+  {
+    m_d->newSegment(COMMAND_RENDER_BUFFERS);
+  }
+
+  void * RenderDriverHeadless::mapBuffer(const Buffer & buffer, Buffer::Type, int offset, std::size_t length,
+                                         Radiant::FlagsT<Buffer::MapAccess>)
+  {
+    std::vector<char> & data = m_d->m_mappedBuffers[buffer.resourceId()];
+    size_t size = std::max(buffer.bufferSize(), offset + length);
+    if (data.size() < size)
+      data.resize(size);
+    return data.data() + offset;
+  }
+
+  void RenderDriverHeadless::unmapBuffer(const Buffer & buffer, Buffer::Type, int offset, std::size_t length)
+  {
+    auto it = m_d->m_mappedBuffers.find(buffer.resourceId());
+    if (it == m_d->m_mappedBuffers.end())
+      return;
+
+    if (length == std::size_t(-1))
+      length = it->second.size() - std::min<size_t>(offset, it->second.size());
+
+    ++m_d->m_frame.bufferUploads;
+    m_d->m_frame.bufferBytesUploaded += length;
+    m_d->record(COMMAND_BUFFER_UPLOAD, length, buffer.resourceId());
+  }
+
+  RenderCommand & RenderDriverHeadless::createRenderCommand(bool translucent,
+                                                            const VertexArray & vertexArray,
+                                                            const Buffer & uniformBuffer,
+                                                            const Luminous::Program & shader,
+                                                            const std::map<QByteArray, const Texture *> * textures,
+                                                            const std::map<QByteArray, ShaderUniform> * uniforms)
+  {
+    RenderCommandIndex idx;
+    idx.renderCommandIndex = static_cast<unsigned int>(m_d->m_renderCommands.size());
+    m_d->m_renderCommands.emplace_back();
+    RenderCommand & cmd = m_d->m_renderCommands.back();
+
+    m_d->createRenderCommand(cmd, translucent, shader, vertexArray, uniformBuffer, textures, uniforms);
+    m_d->queue(translucent, idx);
+
+    return cmd;
+  }
+
+  MultiDrawCommand & RenderDriverHeadless::createMultiDrawCommand(
+      bool translucent, int drawCount, const VertexArray & vertexArray,
+      const Buffer & uniformBuffer, const Program & shader,
+      const std::map<QByteArray, const Texture *> * textures,
+      const std::map<QByteArray, ShaderUniform> * uniforms)
+  {
+    RenderCommandIndex idx;
+    idx.multiDrawCommandIndex = static_cast<unsigned int>(m_d->m_multiDrawCommands.size());
+    m_d->m_multiDrawCommands.emplace_back();
+    MultiDrawCommand & cmd = m_d->m_multiDrawCommands.back();
+    cmd.offsets = m_d->m_multiDrawArrays.allocate(drawCount);
+    cmd.counts = m_d->m_multiDrawArrays.allocate(drawCount);
+    cmd.drawCount = drawCount;
+
+    m_d->createRenderCommand(cmd, translucent, shader, vertexArray, uniformBuffer, textures, uniforms);
+    m_d->queue(translucent, idx);
+
+    return cmd;
+  }
+
+  void RenderDriverHeadless::flush()
+  {
+    for (const Segment & segment: m_d->m_segments) {
+      if (segment.hasPipelineCommand) {
+        ++m_d->m_frame.pipelineCommands;
+        m_d->record(segment.pipelineCommand.type, 0, segment.pipelineCommand.resource);
+      }
+
+      const StateKey * prevState = nullptr;
+
+      // Opaque commands are sorted by state and executed in reverse order,
+      // like in RenderDriverGL::flush
+      if (segment.opaqueCmdBegin != segment.opaqueCmdEnd) {
+        auto begin = m_d->m_opaqueQueue.begin();
+        std::stable_sort(begin + segment.opaqueCmdBegin, begin + segment.opaqueCmdEnd,
+                         [] (const std::pair<StateKey, RenderCommandIndex> & a,
+                             const std::pair<StateKey, RenderCommandIndex> & b)
+        {
+          return a.first < b.first;
+        });
+
+        for (auto idx = segment.opaqueCmdEnd; idx-- > segment.opaqueCmdBegin;)
+          m_d->execute(m_d->m_opaqueQueue[idx], prevState);
+
+        prevState = nullptr;
+      }
+
+      for (auto idx = segment.translucentCmdBegin; idx < segment.translucentCmdEnd; ++idx)
+        m_d->execute(m_d->m_translucentQueue[idx], prevState);
+    }
+
+    m_d->m_segments.clear();
+    m_d->m_opaqueQueue.clear();
+    m_d->m_translucentQueue.clear();
+    m_d->m_renderCommands.clear();
+    m_d->m_multiDrawCommands.clear();
+    m_d->m_multiDrawArrays.clear();
+    m_d->m_uniforms.clear();
+
+    afterFlush().run();
+  }
+
+  void RenderDriverHeadless::setBlendMode(const BlendMode &)
+  {
+    m_d->newSegment(COMMAND_BLEND_MODE);
+  }
+
+  void RenderDriverHeadless::setDepthMode(const DepthMode &)
+  {
+    m_d->newSegment(COMMAND_DEPTH_MODE);
+  }
+
+  void RenderDriverHeadless::setStencilMode(const StencilMode &)
+  {
+    m_d->newSegment(COMMAND_STENCIL_MODE);
+  }
+
+  void RenderDriverHeadless::setCullMode(const CullMode &)
+  {
+    m_d->newSegment(COMMAND_CULL_MODE);
+  }
+
+  void RenderDriverHeadless::setFrontFace(FaceWinding)
+  {
+    m_d->newSegment(COMMAND_FRONT_FACE);
+  }
+
+  void RenderDriverHeadless::enableClipDistance(const QList<int> &)
+  {
+    m_d->newSegment(COMMAND_CLIP_DISTANCE);
+  }
+
+  void RenderDriverHeadless::disableClipDistance(const QList<int> &)
+  {
+    m_d->newSegment(COMMAND_CLIP_DISTANCE);
+  }
+
+  void RenderDriverHeadless::setDrawBuffers(const std::vector<GLenum> &)
+  {
+    m_d->newSegment(COMMAND_DRAW_BUFFERS);
+  }
+
+  void RenderDriverHeadless::pushFrameBuffer(const FrameBuffer & target)
+  {
+    m_d->m_frameBufferStack.push(target.resourceId());
+    m_d->newSegment(COMMAND_FRAME_BUFFER, target.resourceId());
+  }
+
+  void RenderDriverHeadless::popFrameBuffer()
+  {
+    assert(!m_d->m_frameBufferStack.empty());
+    m_d->m_frameBufferStack.pop();
+
+    if (!m_d->m_frameBufferStack.empty())
+      m_d->newSegment(COMMAND_FRAME_BUFFER, m_d->m_frameBufferStack.top());
+  }
+
+  void RenderDriverHeadless::setViewport(const Nimble::Recti &)
+  {
+    m_d->newSegment(COMMAND_VIEWPORT);
+  }
+
+  void RenderDriverHeadless::setScissor(const Nimble::Recti &)
+  {
+    m_d->newSegment(COMMAND_SCISSOR);
+  }
+
+  void RenderDriverHeadless::blit(const Nimble::Recti &, const Nimble::Recti &,
+                                  Luminous::ClearMask, Luminous::Texture::Filter)
+  {
+    m_d->newSegment(COMMAND_BLIT);
+  }
+
+  int RenderDriverHeadless::uniformBufferOffsetAlignment() const
+  {
+    // Most common value in desktop OpenGL implementations
+    return 256;
+  }
+
+  bool RenderDriverHeadless::setupSwapGroup(int, int)
+  {
+    return false;
+  }
+
+  void RenderDriverHeadless::setGPUId(unsigned int gpuId)
+  {
+    m_d->m_gpuId = gpuId;
+  }
+
+  unsigned int RenderDriverHeadless::gpuId() const
+  {
+    return m_d->m_gpuId;
+  }
+
+  GLint RenderDriverHeadless::availableGPUMemory() const
+  {
+    return m_d->m_availableMemory;
+  }
+
+  GLint RenderDriverHeadless::maximumGPUMemory() const
+  {
+    return m_d->m_maximumMemory;
+  }
+
+  void RenderDriverHeadless::skipFrameAndReleaseResources()
+  {
+    deInitialize();
+  }
+
+  void RenderDriverHeadless::setGPUMemory(GLint availableKB, GLint maximumKB)
+  {
+    m_d->m_availableMemory = availableKB;
+    m_d->m_maximumMemory = maximumKB;
+  }
+
+  const RenderDriverHeadless::FrameStatistics & RenderDriverHeadless::frameStatistics() const
+  {
+    return m_d->m_frame;
+  }
+
+  const RenderDriverHeadless::FrameStatistics & RenderDriverHeadless::lastFrameStatistics() const
+  {
+    return m_d->m_lastFrame;
+  }
+
+  const std::vector<RenderDriverHeadless::Command> & RenderDriverHeadless::commands() const
+  {
+    return m_d->m_commands;
+  }
+
+  void RenderDriverHeadless::setCommandRecordingEnabled(bool enabled)
+  {
+    m_d->m_recordCommands = enabled;
+    if (!enabled)
+      m_d->m_commands.clear();
+  }
+
+  void RenderDriverHeadless::releaseResource(RenderResource::Id id)
+  {
+    Radiant::Guard g(m_d->m_releaseQueueMutex);
+    m_d->m_releaseQueue.push_back(id);
+  }
+}
@@ -0,0 +1,198 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Luminous/RenderDriver.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Luminous
+{
+  /// Render driver that doesn't need an OpenGL context or a GPU.
+  ///
+  /// The driver builds and sorts the render queues the same way as
+  /// RenderDriverGL, but instead of executing them it records the executed
+  /// commands, buffer and texture uploads and state changes to memory. It
+  /// can be used with RenderContext to measure the CPU cost of scene
+  /// submission, sorting and buffer filling, for example in benchmarks and
+  /// on CI machines without a GPU.
+  ///
+  /// @code
+  /// Luminous::RenderDriverHeadless driver(gfxDriver, 0);
+  /// Luminous::RenderManager::setDrivers({&driver});
+  /// Luminous::RenderContext r(driver, &window);
+  /// r.initialize();
+  /// r.beginFrame(Radiant::TimeStamp::currentTime(), 0);
+  /// // ... render the scene ...
+  /// r.endFrame(0);
+  /// uint64_t drawCalls = driver.lastFrameStatistics().drawCalls;
+  /// @endcode
+  class RenderDriverHeadless : public RenderDriver
+  {
+  public:
+    /// Type of a recorded command
+    enum CommandType
+    {
+      COMMAND_CLEAR,
+      COMMAND_DRAW,
+      COMMAND_RENDER,
+      COMMAND_MULTI_DRAW,
+      COMMAND_FRAME_BUFFER,
+      COMMAND_VIEWPORT,
+      COMMAND_SCISSOR,
+      COMMAND_BLIT,
+      COMMAND_BLEND_MODE,
+      COMMAND_DEPTH_MODE,
+      COMMAND_STENCIL_MODE,
+      COMMAND_CULL_MODE,
+      COMMAND_FRONT_FACE,
+      COMMAND_CLIP_DISTANCE,
+      COMMAND_DRAW_BUFFERS,
+      COMMAND_RENDER_BUFFERS,
+      COMMAND_STATE_CHANGE,
+      COMMAND_BUFFER_UPLOAD,
+      COMMAND_TEXTURE_UPLOAD
+    };
+
+    /// Command in the order it would have been executed on the GPU
+    struct Command
+    {
+      CommandType type;
+      /// Number of primitives for draw commands, number of bytes for uploads
+      uint64_t size;
+      /// Resource id of the uploaded buffer or texture or the frame buffer
+      RenderResource::Id resource;
+    };
+
+    /// Statistics of one frame
+    struct FrameStatistics
+    {
+      /// Number of draw calls, every draw in a multi-draw command is counted
+      uint64_t drawCalls = 0;
+      /// Number of render and multi-draw commands created by RenderContext
+      uint64_t renderCommands = 0;
+      /// Number of vertices or indices drawn
+      uint64_t primitives = 0;
+      /// Number of times the program, vertex array, uniform buffer or
+      /// textures changed between two render commands
+      uint64_t stateChanges = 0;
+      /// Number of pipeline commands, like clears, viewport and blend mode
+      /// changes and frame buffer changes
+      uint64_t pipelineCommands = 0;
+      /// Number of buffer uploads
+      uint64_t bufferUploads = 0;
+      /// Number of bytes uploaded to buffers, including mapped buffers
+      uint64_t bufferBytesUploaded = 0;
+      /// Number of texture uploads
+      uint64_t textureUploads = 0;
+      /// Number of bytes uploaded to textures
+      uint64_t textureBytesUploaded = 0;
+    };
+
+  public:
+    LUMINOUS_API RenderDriverHeadless(GfxDriver & gfxDriver, unsigned int threadIndex);
+    LUMINOUS_API ~RenderDriverHeadless();
+
+    LUMINOUS_API virtual void clear(ClearMask mask, const Radiant::ColorPMA & color, double depth, int stencil) override;
+    LUMINOUS_API virtual void draw(PrimitiveType type, unsigned int offset, unsigned int primitives) override;
+    LUMINOUS_API virtual void drawIndexed(PrimitiveType type, unsigned int offset, unsigned int primitives) override;
+
+    LUMINOUS_API virtual void preFrame() override;
+    LUMINOUS_API virtual void postFrame() override;
+
+    LUMINOUS_API virtual bool initialize() override;
+    LUMINOUS_API virtual void deInitialize() override;
+
+    LUMINOUS_API virtual void setDefaultState() override;
+    LUMINOUS_API virtual void setRenderBuffers(bool colorBuffer, bool depthBuffer, bool stencilBuffer) override;
+
+    LUMINOUS_API virtual void * mapBuffer(const Buffer & buffer, Buffer::Type type, int offset, std::size_t length,
+                                          Radiant::FlagsT<Buffer::MapAccess> access) override;
+    LUMINOUS_API virtual void unmapBuffer(const Buffer & buffer, Buffer::Type type, int offset = 0,
+                                          std::size_t length = std::size_t(-1)) override;
+
+    LUMINOUS_API virtual RenderCommand & createRenderCommand(bool translucent,
+                                                             const VertexArray & vertexArray,
+                                                             const Buffer & uniformBuffer,
+                                                             const Luminous::Program & shader,
+                                                             const std::map<QByteArray, const Texture *> * textures,
+                                                             const std::map<QByteArray, ShaderUniform> * uniforms) override;
+
+    LUMINOUS_API virtual MultiDrawCommand & createMultiDrawCommand(
+        bool translucent,
+        int drawCount,
+        const VertexArray & vertexArray,
+        const Buffer & uniformBuffer,
+        const Luminous::Program & shader,
+        const std::map<QByteArray, const Texture *> * textures,
+        const std::map<QByteArray, ShaderUniform> * uniforms) override;
+
+    LUMINOUS_API virtual void flush() override;
+
+    LUMINOUS_API virtual void setBlendMode(const BlendMode & mode) override;
+    LUMINOUS_API virtual void setDepthMode(const DepthMode & mode) override;
+    LUMINOUS_API virtual void setStencilMode(const StencilMode & mode) override;
+    LUMINOUS_API virtual void setCullMode(const CullMode & mode) override;
+    LUMINOUS_API virtual void setFrontFace(FaceWinding winding) override;
+
+    LUMINOUS_API virtual void enableClipDistance(const QList<int> & planes) override;
+    LUMINOUS_API virtual void disableClipDistance(const QList<int> & planes) override;
+
+    LUMINOUS_API virtual void setDrawBuffers(const std::vector<GLenum> & buffers) override;
+
+    LUMINOUS_API virtual void pushFrameBuffer(const FrameBuffer & target) override;
+    LUMINOUS_API virtual void popFrameBuffer() override;
+
+    LUMINOUS_API virtual void setViewport(const Nimble::Recti & rect) override;
+    LUMINOUS_API virtual void setScissor(const Nimble::Recti & rect) override;
+
+    LUMINOUS_API virtual void blit(const Nimble::Recti & src, const Nimble::Recti & dst,
+                                   Luminous::ClearMask mask = Luminous::CLEARMASK_COLOR_DEPTH,
+                                   Luminous::Texture::Filter filter = Luminous::Texture::FILTER_NEAREST) override;
+
+    LUMINOUS_API virtual int uniformBufferOffsetAlignment() const override;
+
+    LUMINOUS_API virtual bool setupSwapGroup(int group, int screen) override;
+
+    LUMINOUS_API virtual void setGPUId(unsigned int gpuId) override;
+    LUMINOUS_API virtual unsigned int gpuId() const override;
+
+    LUMINOUS_API virtual GLint availableGPUMemory() const override;
+    LUMINOUS_API virtual GLint maximumGPUMemory() const override;
+
+    LUMINOUS_API virtual void skipFrameAndReleaseResources() override;
+
+    /// Sets the values returned from availableGPUMemory and maximumGPUMemory.
+    /// By default the driver has 4 GB of free memory.
+    /// @param availableKB available GPU memory in kilobytes
+    /// @param maximumKB total GPU memory in kilobytes
+    LUMINOUS_API void setGPUMemory(GLint availableKB, GLint maximumKB);
+
+    /// @returns statistics of the frame that is being rendered, reset in preFrame
+    LUMINOUS_API const FrameStatistics & frameStatistics() const;
+    /// @returns statistics of the latest frame finished with postFrame
+    LUMINOUS_API const FrameStatistics & lastFrameStatistics() const;
+
+    /// Commands executed after the latest preFrame call, in execution order.
+    /// Render commands are added when they are executed in flush.
+    LUMINOUS_API const std::vector<Command> & commands() const;
+    /// Enables or disables recording the command list. Statistics are
+    /// always collected. Enabled by default.
+    LUMINOUS_API void setCommandRecordingEnabled(bool enabled);
+
+  private:
+    virtual void releaseResource(RenderResource::Id id) override;
+
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
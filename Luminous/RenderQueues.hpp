@@ -15,6 +15,7 @@
 
 #include "PipelineCommand.hpp"
 
+#include <memory>
 #include <tuple>
 #include <vector>
 
@@ -71,7 +72,16 @@ namespace Luminous
       , translucentCmdEnd(translucentCmdBegin_)
     {}
 
-    std::unique_ptr<PipelineCommand> pipelineCommand;
+    RenderQueueSegment(std::shared_ptr<PipelineCommand> cmd, unsigned int opaqueCmdBegin_, unsigned int translucentCmdBegin_)
+      : pipelineCommand(std::move(cmd))
+      , opaqueCmdBegin(opaqueCmdBegin_)
+      , opaqueCmdEnd(opaqueCmdBegin_)
+      , translucentCmdBegin(translucentCmdBegin_)
+      , translucentCmdEnd(translucentCmdBegin_)
+    {}
+
+    // Shared with the segments that replay the same commands on other areas
+    std::shared_ptr<PipelineCommand> pipelineCommand;
     unsigned int opaqueCmdBegin;
     unsigned int opaqueCmdEnd;
     unsigned int translucentCmdBegin;
@@ -10,6 +10,12 @@
 
 #include "RichTextLayout.hpp"
 
+#include <Luminous/FontCache.hpp>
+
+#include <Radiant/BGThread.hpp>
+#include <Radiant/Task.hpp>
+
+#include <QGlyphRun>
 #include <QTextLayout>
 #include <QTextDocument>
 #include <QTextCursor>
@@ -18,8 +24,92 @@
 #include <QTextList>
 #include <QThread>
 
+#include <atomic>
+#include <climits>
 #include <memory>
 
+namespace
+{
+  /// Glyphs of one QTextBlock relative to the top-left corner of the block.
+  /// Stored as the user data of the block, so the cache lives and dies with
+  /// the block.
+  class BlockGlyphs : public QTextBlockUserData
+  {
+  public:
+    bool isValid(float width, int atlasGeneration) const
+    {
+      return valid && this->width == width && this->atlasGeneration == atlasGeneration &&
+          !glyphs.missingGlyphs;
+    }
+
+    /// Set to false when the contents of the block change
+    bool valid = false;
+    /// Layout width and font atlas generation that were used to generate the glyphs
+    float width = -1.0f;
+    int atlasGeneration = -1;
+    Luminous::TextLayout::GlyphBlock glyphs;
+  };
+
+  /// Glyph runs of one block, resolved from FontCache in the layout thread.
+  /// These don't refer to the document or to QRawFont, so the vertices can be
+  /// generated in BGThread while the document is edited.
+  struct BlockSnapshot
+  {
+    BlockGlyphs * target = nullptr;
+    std::vector<Luminous::TextLayout::ResolvedRun> runs;
+  };
+
+  /// Glyph generation job that runs in BGThread
+  struct GlyphJob
+  {
+    std::vector<BlockSnapshot> blocks;
+    std::vector<Luminous::TextLayout::GlyphBlock> results;
+    float width = 0.0f;
+    int atlasGeneration = 0;
+    /// Show partial results while the job is running. This is only done if
+    /// there was nothing to show before the job started.
+    bool progressive = false;
+    /// Number of blocks that have been processed, results[0, ready) can be
+    /// read in the layout thread
+    std::atomic<int> ready{0};
+    /// Number of results already moved to the blocks, only used in the layout thread
+    int applied = 0;
+    std::atomic<bool> canceled{false};
+  };
+  typedef std::shared_ptr<GlyphJob> GlyphJobPtr;
+
+  /// How many blocks the BGThread task processes in one go
+  const int s_blocksPerTaskStep = 16;
+
+  /// Shapes the block and looks up its glyphs from FontCache. QRawFont is not
+  /// thread-safe with all font engines, so this must be called in the thread
+  /// that owns the document.
+  std::vector<Luminous::TextLayout::ResolvedRun> resolvedRuns(const QTextBlock & block)
+  {
+    std::vector<Luminous::TextLayout::ResolvedRun> runs;
+    const QTextLayout * textLayout = block.layout();
+    /// Must use line count from text layout, not from text block, since when
+    /// we have automatically wrapped lines, these are different
+    const int lineCount = textLayout->lineCount();
+
+    for (auto it = block.begin(), end = block.end(); it != end; ++it) {
+      const QTextFragment frag = it.fragment();
+      if (!frag.isValid())
+        continue;
+      const QTextCharFormat format = frag.charFormat();
+
+      const int pos = frag.position() - block.position();
+
+      for (int i = 0; i < lineCount; ++i) {
+        const QTextLine line = textLayout->lineAt(i);
+        for (const QGlyphRun & glyphRun: line.glyphRuns(pos, frag.length()))
+          runs.push_back(Luminous::TextLayout::resolveGlyphs(glyphRun, format.fontStretch(), &format));
+      }
+    }
+    return runs;
+  }
+}
+
 namespace Luminous
 {
   class RichTextLayout::D : public QObject
@@ -28,10 +118,23 @@ namespace Luminous
 
   public:
     D(RichTextLayout & host);
+    ~D();
 
     void disableHinting();
     QTextDocument & doc();
 
+    BlockGlyphs * blockGlyphs(QTextBlock & block);
+    /// Generates glyphs of all changed blocks in the calling thread
+    void generate(RichTextLayout & host);
+    /// Resolves glyphs of all changed blocks and generates their vertices in BGThread
+    void generateAsync(RichTextLayout & host);
+    /// Moves finished results from the background job to the blocks
+    void applyJobResults();
+    void cancelJob();
+    /// Rebuilds the glyph groups of the host from the per-block glyphs
+    void assemble(RichTextLayout & host);
+    bool generateListBullets(RichTextLayout & host);
+
   public:
     RichTextLayout & m_host;
     std::unique_ptr<QTextDocument> m_doc;
@@ -39,8 +142,17 @@ namespace Luminous
     Radiant::Mutex m_generateMutex;
     QString m_listBullet; // Bullet used in QTextLists
 
+    /// Character range that might have fonts with hinting enabled
+    int m_hintingFrom = 0;
+    int m_hintingTo = INT_MAX;
+
+    bool m_backgroundGeneration = false;
+    GlyphJobPtr m_job;
+
   private Q_SLOTS:
     void changed();
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+    void documentLayoutChanged();
   };
 
   /////////////////////////////////////////////////////////////////////////////
@@ -54,10 +166,19 @@ namespace Luminous
   {
   }
 
+  RichTextLayout::D::~D()
+  {
+    cancelJob();
+  }
+
   void RichTextLayout::D::disableHinting()
   {
+    if (m_hintingFrom > m_hintingTo)
+      return;
+
     QTextCursor cursor(&doc());
-    for (QTextBlock block = doc().begin(); block.isValid(); block = block.next()) {
+    for (QTextBlock block = doc().findBlock(m_hintingFrom);
+         block.isValid() && block.position() <= m_hintingTo; block = block.next()) {
       for (auto it = block.begin(); it != block.end(); ++it) {
         QTextFragment fragment = it.fragment();
         if (!fragment.isValid())
@@ -65,6 +186,9 @@ namespace Luminous
 
         QTextCharFormat fmt = fragment.charFormat();
         QFont font = fmt.font();
+        // Changing the format invalidates the block, so only do it if needed
+        if (font.hintingPreference() == QFont::PreferNoHinting)
+          continue;
         font.setHintingPreference(QFont::PreferNoHinting);
         fmt.setFont(font);
 
@@ -73,6 +197,9 @@ namespace Luminous
         cursor.setCharFormat(fmt);
       }
     }
+
+    m_hintingFrom = INT_MAX;
+    m_hintingTo = -1;
   }
 
   QTextDocument & RichTextLayout::D::doc()
@@ -80,6 +207,11 @@ namespace Luminous
     if (m_doc && m_docThread == QThread::currentThreadId())
       return *m_doc;
 
+    // The block user data is not cloned, so all glyphs are generated again
+    cancelJob();
+    m_hintingFrom = 0;
+    m_hintingTo = INT_MAX;
+
     m_doc.reset(m_doc ? m_doc->clone() : new QTextDocument());
     m_docThread = QThread::currentThreadId();
 
@@ -92,105 +224,155 @@ namespace Luminous
     m_doc->setDefaultFont(font);
 
     connect(m_doc.get(), SIGNAL(contentsChanged()), this, SLOT(changed()), Qt::DirectConnection);
-    connect(m_doc.get(), SIGNAL(documentLayoutChanged()), this, SLOT(changed()), Qt::DirectConnection);
+    connect(m_doc.get(), SIGNAL(contentsChange(int, int, int)),
+            this, SLOT(contentsChange(int, int, int)), Qt::DirectConnection);
+    connect(m_doc.get(), SIGNAL(documentLayoutChanged()), this, SLOT(documentLayoutChanged()), Qt::DirectConnection);
     return *m_doc;
   }
 
-  void RichTextLayout::D::changed()
+  BlockGlyphs * RichTextLayout::D::blockGlyphs(QTextBlock & block)
   {
-    m_host.setLayoutReady(false);
-    if (m_host.autoGenerate() && !m_host.isGenerating())
-      m_host.doGenerateInternal();
+    BlockGlyphs * data = static_cast<BlockGlyphs*>(block.userData());
+    if (!data) {
+      data = new BlockGlyphs();
+      block.setUserData(data);
+    }
+    return data;
   }
 
-  /////////////////////////////////////////////////////////////////////////////
-  /////////////////////////////////////////////////////////////////////////////
-
-  RichTextLayout::RichTextLayout(const Nimble::SizeF & size)
-    : TextLayout(size)
-    , m_d(new D(*this))
+  void RichTextLayout::D::generate(RichTextLayout & host)
   {
-  }
+    const float width = host.maximumSize().width();
+    const int atlasGeneration = FontCache::generation();
 
-  RichTextLayout::~RichTextLayout()
-  {
-    delete m_d;
+    for (QTextBlock block = doc().begin(); block.isValid(); block = block.next()) {
+      BlockGlyphs * data = blockGlyphs(block);
+      if (data->isValid(width, atlasGeneration))
+        continue;
+
+      data->glyphs = TextLayout::GlyphBlock();
+      for (const TextLayout::ResolvedRun & run: resolvedRuns(block))
+        TextLayout::generateGlyphs(data->glyphs, Nimble::Vector2f(0, 0), run);
+      data->width = width;
+      data->atlasGeneration = atlasGeneration;
+      data->valid = true;
+    }
+
+    assemble(host);
   }
 
-  RichTextLayout::RichTextLayout(RichTextLayout && t)
-    : TextLayout(std::move(t))
-    , m_d(t.m_d)
+  void RichTextLayout::D::generateAsync(RichTextLayout & host)
   {
-    t.m_d = nullptr;
+    if (m_job) {
+      const bool done = m_job->ready == static_cast<int>(m_job->blocks.size());
+      if (done || m_job->progressive) {
+        applyJobResults();
+        if (done)
+          m_job.reset();
+        // Keep drawing the previous version until the new one is complete,
+        // unless there was nothing to draw before
+        assemble(host);
+      }
+      return;
+    }
+
+    const float width = host.maximumSize().width();
+    const int atlasGeneration = FontCache::generation();
+
+    auto job = std::make_shared<GlyphJob>();
+    job->width = width;
+    job->atlasGeneration = atlasGeneration;
+    job->progressive = host.groupCount() == 0;
+
+    for (QTextBlock block = doc().begin(); block.isValid(); block = block.next()) {
+      BlockGlyphs * data = blockGlyphs(block);
+      if (data->isValid(width, atlasGeneration))
+        continue;
+      // Mark as invalid so that a partial assemble skips this block
+      data->valid = false;
+      job->blocks.push_back({data, resolvedRuns(block)});
+    }
+
+    if (job->blocks.empty()) {
+      assemble(host);
+      return;
+    }
+
+    job->results.resize(job->blocks.size());
+    m_job = job;
+
+    auto task = std::make_shared<Radiant::FunctionTask>([job] (Radiant::Task & task) {
+      int i = job->ready;
+      const int end = std::min<int>(i + s_blocksPerTaskStep, static_cast<int>(job->blocks.size()));
+      for (; i < end && !job->canceled; ++i) {
+        for (const TextLayout::ResolvedRun & run: job->blocks[i].runs)
+          TextLayout::generateGlyphs(job->results[i], Nimble::Vector2f(0, 0), run);
+        job->ready.store(i + 1, std::memory_order_release);
+      }
+      if (job->canceled || i == static_cast<int>(job->blocks.size()))
+        task.setFinished();
+    });
+    Radiant::BGThread::instance()->addTask(task);
   }
 
-  RichTextLayout & RichTextLayout::operator=(RichTextLayout && t)
+  void RichTextLayout::D::applyJobResults()
   {
-    TextLayout::operator=(std::move(t));
-    std::swap(m_d, t.m_d);
-    return *this;
+    const int ready = m_job->ready.load(std::memory_order_acquire);
+    for (int & i = m_job->applied; i < ready; ++i) {
+      BlockGlyphs * data = m_job->blocks[i].target;
+      data->glyphs = std::move(m_job->results[i]);
+      data->width = m_job->width;
+      data->atlasGeneration = m_job->atlasGeneration;
+      data->valid = true;
+    }
   }
 
-  void RichTextLayout::generateInternal() const
+  void RichTextLayout::D::cancelJob()
   {
-    Radiant::Guard g(m_d->m_generateMutex);
-    RichTextLayout *nonConst = const_cast<RichTextLayout*>(this);
-    if (!isLayoutReady()) {
-      m_d->disableHinting();
-      m_d->doc().setTextWidth(maximumSize().width());
-      // trigger relayout in Qt
-      QSizeF size = m_d->doc().documentLayout()->documentSize();
-      nonConst->setBoundingBox(Nimble::Rectf(0, 0, static_cast<float>(size.width()),
-                                             static_cast<float>(size.height())));
-
-      nonConst->setLayoutReady(true);
-      nonConst->clearGlyphs();
+    if (m_job) {
+      m_job->canceled = true;
+      m_job.reset();
     }
+  }
 
-    if (isComplete())
-      return;
-
-    nonConst->clearGlyphs();
+  void RichTextLayout::D::assemble(RichTextLayout & host)
+  {
+    host.clearGlyphs();
 
     bool missingGlyphs = false;
-    QAbstractTextDocumentLayout * layout = m_d->doc().documentLayout();
+    QAbstractTextDocumentLayout * layout = doc().documentLayout();
 
-    for (QTextBlock block = m_d->doc().begin(); block.isValid(); block = block.next()) {
-      const QTextLayout * textLayout = block.layout();
+    for (QTextBlock block = doc().begin(); block.isValid(); block = block.next()) {
+      const BlockGlyphs * data = static_cast<const BlockGlyphs*>(block.userData());
+      if (!data || !data->valid) {
+        missingGlyphs = true;
+        continue;
+      }
       const QRectF rect = layout->blockBoundingRect(block);
-      /// Must use line count from text layout, not from text block, since when
-      /// we have automatically wrapped lines, these are different
-      const int lineCount = textLayout->lineCount();
-
-      const Nimble::Vector2f layoutLocation(static_cast<float>(rect.left()), static_cast<float>(rect.top()));
-      for (auto it = block.begin(), end = block.end(); it != end; ++it) {
-        const QTextFragment frag = it.fragment();
-        if (!frag.isValid())
-          continue;
-        const QTextCharFormat format = frag.charFormat();
+      host.appendGlyphs(data->glyphs, Nimble::Vector2f(static_cast<float>(rect.left()),
+                                                       static_cast<float>(rect.top())));
+      missingGlyphs |= data->glyphs.missingGlyphs;
+    }
 
-        const int pos = frag.position() - block.position();
+    missingGlyphs |= generateListBullets(host);
 
-        for (int i = 0; i < lineCount; ++i) {
-          const QTextLine line = textLayout->lineAt(i);
-          QList<QGlyphRun> glyphs = line.glyphRuns(pos, frag.length());
+    host.setGlyphsReady(!missingGlyphs);
+  }
 
-          for (const QGlyphRun & glyphRun: glyphs)
-            missingGlyphs |= nonConst->generateGlyphs(layoutLocation, glyphRun,
-                                                      format.fontStretch(), &format);
-        }
-      }
-    }
+  bool RichTextLayout::D::generateListBullets(RichTextLayout & host)
+  {
+    bool missingGlyphs = false;
+    QAbstractTextDocumentLayout * layout = doc().documentLayout();
 
     QList<int> indices;
-    for (const QTextFormat & fmt: m_d->doc().allFormats()) {
+    for (const QTextFormat & fmt: doc().allFormats()) {
       int idx = fmt.objectIndex();
       if (idx >= 0)
         indices << idx;
     }
 
     for (int i: indices) {
-      QTextObject * obj = m_d->doc().object(i);
+      QTextObject * obj = doc().object(i);
       if (!obj) continue;
       QTextList * lst = dynamic_cast<QTextList*>(obj);
       if (!lst) continue;
@@ -201,12 +383,12 @@ namespace Luminous
         QRectF rect = layout->blockBoundingRect(block);
         const bool rtl = block.layout()->textOption().textDirection() == Qt::RightToLeft;
 
-        QTextLayout textLayout(m_d->m_listBullet, block.charFormat().font());
+        QTextLayout textLayout(m_listBullet, block.charFormat().font());
         float size = TextLayout::pointToPixelSize(static_cast<float>(textLayout.font().pointSizeF()));
 
         textLayout.beginLayout();
         QTextLine line = textLayout.createLine();
-        int indent = static_cast<int>(m_d->doc().indentWidth() * fmt.indent());
+        int indent = static_cast<int>(doc().indentWidth() * fmt.indent());
         line.setLineWidth(size);
         line.setPosition(QPointF(0, 0));
         textLayout.endLayout();
@@ -221,11 +403,111 @@ namespace Luminous
         }
 
         Q_FOREACH (const QGlyphRun & glyphRun, textLayout.glyphRuns())
-          missingGlyphs |= nonConst->generateGlyphs(loc, glyphRun, block.charFormat().fontStretch());
+          missingGlyphs |= host.generateGlyphs(loc, glyphRun, block.charFormat().fontStretch());
       }
     }
 
-    nonConst->setGlyphsReady(!missingGlyphs);
+    return missingGlyphs;
+  }
+
+  void RichTextLayout::D::changed()
+  {
+    m_host.setLayoutReady(false);
+    if (m_host.autoGenerate() && !m_host.isGenerating())
+      m_host.doGenerateInternal();
+  }
+
+  void RichTextLayout::D::contentsChange(int position, int /*charsRemoved*/, int charsAdded)
+  {
+    const int end = position + charsAdded;
+    m_hintingFrom = std::min(m_hintingFrom, position);
+    m_hintingTo = std::max(m_hintingTo, end);
+
+    // Only the blocks that were touched by the edit need new glyphs, other
+    // blocks are just moved to their new locations
+    for (QTextBlock block = m_doc->findBlock(position);
+         block.isValid() && block.position() <= end; block = block.next()) {
+      if (auto data = static_cast<BlockGlyphs*>(block.userData()))
+        data->valid = false;
+    }
+
+    // Some of the blocks in the running job might not exist anymore
+    cancelJob();
+  }
+
+  void RichTextLayout::D::documentLayoutChanged()
+  {
+    for (QTextBlock block = m_doc->begin(); block.isValid(); block = block.next()) {
+      if (auto data = static_cast<BlockGlyphs*>(block.userData()))
+        data->valid = false;
+    }
+    cancelJob();
+    changed();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  RichTextLayout::RichTextLayout(const Nimble::SizeF & size)
+    : TextLayout(size)
+    , m_d(new D(*this))
+  {
+  }
+
+  RichTextLayout::~RichTextLayout()
+  {
+    delete m_d;
+  }
+
+  RichTextLayout::RichTextLayout(RichTextLayout && t)
+    : TextLayout(std::move(t))
+    , m_d(t.m_d)
+  {
+    t.m_d = nullptr;
+  }
+
+  RichTextLayout & RichTextLayout::operator=(RichTextLayout && t)
+  {
+    TextLayout::operator=(std::move(t));
+    std::swap(m_d, t.m_d);
+    return *this;
+  }
+
+  void RichTextLayout::generateInternal() const
+  {
+    Radiant::Guard g(m_d->m_generateMutex);
+    RichTextLayout *nonConst = const_cast<RichTextLayout*>(this);
+    if (!isLayoutReady()) {
+      m_d->disableHinting();
+      // Qt only lays out the blocks that have changed
+      m_d->doc().setTextWidth(maximumSize().width());
+      // trigger relayout in Qt
+      QSizeF size = m_d->doc().documentLayout()->documentSize();
+      nonConst->setBoundingBox(Nimble::Rectf(0, 0, static_cast<float>(size.width()),
+                                             static_cast<float>(size.height())));
+
+      nonConst->setLayoutReady(true);
+      // Old glyphs are kept until the new ones are assembled
+      nonConst->setGlyphsReady(false);
+    }
+
+    if (isComplete())
+      return;
+
+    if (m_d->m_backgroundGeneration)
+      m_d->generateAsync(*nonConst);
+    else
+      m_d->generate(*nonConst);
+  }
+
+  void RichTextLayout::setBackgroundGeneration(bool enabled)
+  {
+    m_d->m_backgroundGeneration = enabled;
+  }
+
+  bool RichTextLayout::backgroundGeneration() const
+  {
+    return m_d->m_backgroundGeneration;
   }
 
   QTextDocument & RichTextLayout::document()
@@ -20,6 +20,10 @@ class QTextDocument;
 namespace Luminous
 {
   /// Rich text document layout
+  ///
+  /// Glyphs are cached per paragraph (QTextBlock). When the document is
+  /// edited, only the paragraphs touched by the edit are shaped and
+  /// generated again, the rest are just moved to their new locations.
   class RichTextLayout : public TextLayout
   {
   public:
@@ -39,6 +43,18 @@ namespace Luminous
     /// @return String used as bullet for list elements
     LUMINOUS_API const QString& listBullet() const;
 
+    /// Generate glyph vertices of the changed paragraphs in BGThread. Qt
+    /// still lays out the changed paragraphs and the glyphs are looked up
+    /// from FontCache in the calling thread, since QRawFont can't be used
+    /// from other threads with all font engines. While the glyphs
+    /// are being generated, the previous version of the layout is kept, so
+    /// that the old text can be rendered until the new one is complete. If
+    /// there is no previous version, the paragraphs are shown as they become
+    /// ready. Disabled by default.
+    /// @param enabled true to generate glyphs in the background
+    LUMINOUS_API void setBackgroundGeneration(bool enabled);
+    LUMINOUS_API bool backgroundGeneration() const;
+
   private:
     LUMINOUS_API virtual void generateInternal() const OVERRIDE;
 
@@ -10,9 +10,7 @@
 
 #include "SimpleTextLayout.hpp"
 
-#include <Radiant/BGThread.hpp>
 #include <Radiant/Mutex.hpp>
-#include <Radiant/Task.hpp>
 
 #include <Valuable/StyleValue.hpp>
 #include <Luminous/RenderManager.hpp>
@@ -22,66 +20,16 @@
 #include <QRegExp>
 #include <QThread>
 
+#include <QReadWriteLock>
+
+#include <algorithm>
+#include <atomic>
 #include <unordered_map>
 #include <memory>
-#include <tuple>
+#include <vector>
 
 typedef std::unique_ptr<Luminous::SimpleTextLayout> LayoutPtr;
 
-/// MSVC2010 has something weird going on with tuples and pairs so we use the old-fashioned alternative here
-#if defined (RADIANT_MSVC10)
-struct LayoutCacheKey {
-  LayoutCacheKey(const QString & text, const Nimble::Vector2i & v, const QFont & font, const QTextOption & option, unsigned thread)
-    : text(text), v(v), font(font), option(option), thread(thread)
-  {
-  }
-
-  QString text;
-  Nimble::Vector2i v;
-  QFont font;
-  QTextOption option;
-  unsigned thread;
-};
-
-namespace std
-{
-  template<> struct hash<LayoutCacheKey>
-  {
-    inline size_t operator()(const LayoutCacheKey & tuple) const
-    {
-      std::hash<uint> hasher;
-      return qHash(tuple.text) ^ hasher(tuple.v.x) ^
-        hasher(tuple.v.y) ^ qHash(tuple.font.key()) ^
-        hasher(tuple.option.alignment()) ^ hasher(tuple.thread);
-    }
-  };
-}
-
-bool operator==(const LayoutCacheKey & lhs, const LayoutCacheKey & rhs)
-{
-  return std::hash<LayoutCacheKey>()(lhs) == std::hash<LayoutCacheKey>()(rhs);
-}
-
-#else
-typedef std::tuple<QString, Nimble::Size, QFont, QTextOption, unsigned> LayoutCacheKey;
-
-
-namespace std
-{
-  template<> struct hash<LayoutCacheKey>
-  {
-    inline size_t operator()(const LayoutCacheKey & tuple) const
-    {
-      std::hash<uint> hasher;
-      return qHash(std::get<0>(tuple)) ^ hasher(std::get<1>(tuple).width()) ^
-          hasher(std::get<1>(tuple).height()) ^ qHash(std::get<2>(tuple).key()) ^
-          hasher(std::get<3>(tuple).alignment()) ^ hasher(std::get<4>(tuple));
-    }
-  };
-}
-#endif
-
-
 bool operator==(const QTextOption & o1, const QTextOption & o2)
 {
   return int(o1.alignment()) == int(o2.alignment()) &&
@@ -99,40 +47,136 @@ bool operator==(const QTextOption & o1, const QTextOption & o2)
 
 namespace
 {
+  inline void hashCombine(size_t & seed, size_t value)
+  {
+    seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  }
+
+  /// Cache key with precomputed hash. The hash is calculated once when the
+  /// key is created, lookups only compare the full keys on hash match.
+  struct LayoutCacheKey
+  {
+    LayoutCacheKey(const QString & text, const Nimble::Size & size, const QFont & font,
+                   const QTextOption & option, unsigned thread)
+      : text(text), size(size), font(font), option(option), thread(thread)
+    {
+      hash = qHash(text);
+      hashCombine(hash, size.width());
+      hashCombine(hash, size.height());
+      hashCombine(hash, qHash(font.key()));
+      hashCombine(hash, option.alignment());
+      hashCombine(hash, option.wrapMode());
+      hashCombine(hash, thread);
+    }
+
+    bool operator==(const LayoutCacheKey & o) const
+    {
+      return hash == o.hash && thread == o.thread && size == o.size &&
+          text == o.text && font == o.font && option == o.option;
+    }
+
+    QString text;
+    Nimble::Size size;
+    QFont font;
+    QTextOption option;
+    unsigned thread;
+    size_t hash;
+  };
+
+  struct LayoutCacheKeyHash
+  {
+    inline size_t operator()(const LayoutCacheKey & key) const { return key.hash; }
+  };
+
   struct CachedLayout
   {
     LayoutPtr layout;
-    /// In deciseconds, see Luminous::RenderManager::frameTime
-    int lastUsed = 0;
+    /// Estimated memory usage of the layout
+    size_t bytes = 0;
+    /// In deciseconds, see Luminous::RenderManager::frameTime. Updated
+    /// without the exclusive lock, so it's atomic.
+    std::atomic<int> lastUsed{0};
   };
 
-  /// Cache expiration time in deciseconds (40 seconds)
-  static const int s_cacheExpireTime = 400;
-  /// How often to check for expired cached layouts in seconds
-  static const int s_cacheExpirePollingInterval = 41;
+  /// Layouts used during the last two seconds are never evicted, since
+  /// cachedLayout returns references that are valid at least during the frame.
+  static const int s_minimumLifetime = 20;
 
-  Radiant::Mutex s_layoutCacheMutex;
-  std::unordered_map<LayoutCacheKey, CachedLayout> s_layoutCache;
-  Radiant::TaskPtr s_cacheReleaseTask;
+  /// Number of independently locked cache shards
+  static const int s_shardCount = 16;
 
-  const float s_defaultLineHeight = 1.0f;
-  const float s_defaultLetterSpacing = 1.0f;
-
-  static void clearUnusedLayoutsFromCache()
+  /// The cache is split to shards by the key hash. Lookups to a shard only
+  /// take a read lock, so render threads laying out the same texts don't
+  /// block each other. New entries and eviction need the write lock.
+  struct LayoutCacheShard
   {
-    int threshold = Luminous::RenderManager::lastFrameTime() - s_cacheExpireTime;
-    if (threshold <= 0) return;
+    QReadWriteLock lock;
+    std::unordered_map<LayoutCacheKey, CachedLayout, LayoutCacheKeyHash> layouts;
+    size_t bytes = 0;
 
-    Radiant::Guard g(s_layoutCacheMutex);
-    for (auto it = s_layoutCache.cbegin(); it != s_layoutCache.cend();) {
-      const CachedLayout & cache = it->second;
-      if (cache.lastUsed < threshold) {
-        it = s_layoutCache.erase(it);
-      } else {
-        ++it;
+    /// Earliest time when any entry can be evicted, see evict
+    int nextEviction = 0;
+
+    /// Removes least recently used entries when the shard is over the
+    /// limits. To keep inserts cheap, eviction is done in batches: one scan
+    /// removes entries until the shard is at the low-water mark, 3/4 of the
+    /// limits. Must be called with the write lock.
+    void evict(size_t maxLayouts, size_t maxBytes, int now)
+    {
+      if (layouts.size() <= maxLayouts && bytes <= maxBytes)
+        return;
+
+      // Everything was in use during the last scan, the limits are soft.
+      // Entries only get newer, so nothing can be evicted before this.
+      if (now < nextEviction)
+        return;
+
+      typedef decltype(layouts.begin()) Iterator;
+      std::vector<std::pair<int, Iterator>> candidates;
+      const int evictBefore = now - s_minimumLifetime;
+      int oldestInUse = now;
+      for (auto it = layouts.begin(); it != layouts.end(); ++it) {
+        int lastUsed = it->second.lastUsed.load(std::memory_order_relaxed);
+        if (lastUsed < evictBefore)
+          candidates.emplace_back(lastUsed, it);
+        else
+          oldestInUse = std::min(oldestInUse, lastUsed);
+      }
+
+      std::sort(candidates.begin(), candidates.end(),
+                [] (const std::pair<int, Iterator> & a, const std::pair<int, Iterator> & b) {
+        return a.first < b.first;
+      });
+
+      const size_t lowLayouts = maxLayouts - maxLayouts / 4;
+      const size_t lowBytes = maxBytes - maxBytes / 4;
+      size_t evicted = 0;
+      for (; evicted < candidates.size(); ++evicted) {
+        if (layouts.size() <= lowLayouts && bytes <= lowBytes)
+          break;
+        bytes -= candidates[evicted].second->second.bytes;
+        layouts.erase(candidates[evicted].second);
       }
+
+      if (evicted == candidates.size())
+        nextEviction = oldestInUse + s_minimumLifetime + 1;
     }
+  };
+
+  LayoutCacheShard s_layoutCache[s_shardCount];
+
+  std::atomic<size_t> s_cacheMaxLayouts{4096};
+  std::atomic<size_t> s_cacheMaxBytes{64 << 20};
+
+  /// Rough estimate of the memory used by a layout of the given text,
+  /// including the QTextLayout internals and generated glyphs.
+  size_t estimateLayoutBytes(const QString & text)
+  {
+    return sizeof(Luminous::SimpleTextLayout) + 1024 + size_t(text.size()) * 96;
   }
+
+  const float s_defaultLineHeight = 1.0f;
+  const float s_defaultLetterSpacing = 1.0f;
 }
 
 namespace Luminous
@@ -531,12 +575,17 @@ namespace Luminous
 
   void SimpleTextLayout::clearCache()
   {
-    if (s_cacheReleaseTask) {
-      Radiant::BGThread::instance()->removeTask(s_cacheReleaseTask);
-      s_cacheReleaseTask.reset();
+    for (LayoutCacheShard & shard: s_layoutCache) {
+      QWriteLocker g(&shard.lock);
+      shard.layouts.clear();
+      shard.bytes = 0;
     }
-    Radiant::Guard g(s_layoutCacheMutex);
-    s_layoutCache.clear();
+  }
+
+  void SimpleTextLayout::setCacheLimits(size_t maxLayouts, size_t maxBytes)
+  {
+    s_cacheMaxLayouts = maxLayouts;
+    s_cacheMaxBytes = maxBytes;
   }
 
   const SimpleTextLayout & SimpleTextLayout::cachedLayout(const QString & text,
@@ -544,35 +593,36 @@ namespace Luminous
                                                           const QFont & font,
                                                           const QTextOption & option)
   {
-    SimpleTextLayout * layout;
+    SimpleTextLayout * layout = nullptr;
 
     {
-      /// @todo someone should also delete old layouts..
-#if defined (RADIANT_MSVC10)
-      const auto & key = LayoutCacheKey(text, size.cast<int>(), font, option, RenderManager::threadIndex());
-#else
-      const auto & key = std::make_tuple(text, size.cast<int>(), font, option, RenderManager::threadIndex());
-#endif
-
+      const LayoutCacheKey key(text, size.cast<int>(), font, option, RenderManager::threadIndex());
       const int now = Luminous::RenderManager::frameTime();
-      Radiant::Guard g(s_layoutCacheMutex);
-
-      if (!s_cacheReleaseTask) {
-        s_cacheReleaseTask = std::make_shared<Radiant::FunctionTask>([] (Radiant::Task & task) {
-          clearUnusedLayoutsFromCache();
-          task.scheduleFromNowSecs(s_cacheExpirePollingInterval);
-        });
-        s_cacheReleaseTask->scheduleFromNowSecs(s_cacheExpirePollingInterval);
-        Radiant::BGThread::instance()->addTask(s_cacheReleaseTask);
-      }
 
-      CachedLayout & cache = s_layoutCache[key];
+      LayoutCacheShard & shard = s_layoutCache[key.hash % s_shardCount];
+
+      {
+        QReadLocker g(&shard.lock);
+        auto it = shard.layouts.find(key);
+        if (it != shard.layouts.end()) {
+          it->second.lastUsed.store(now, std::memory_order_relaxed);
+          layout = it->second.layout.get();
+        }
+      }
 
-      if (!cache.layout) {
-        cache.layout.reset(new SimpleTextLayout(text, size, font, option));
+      if (!layout) {
+        QWriteLocker g(&shard.lock);
+        CachedLayout & cache = shard.layouts[key];
+        if (!cache.layout) {
+          cache.layout.reset(new SimpleTextLayout(text, size, font, option));
+          cache.bytes = estimateLayoutBytes(text);
+          shard.bytes += cache.bytes;
+        }
+        cache.lastUsed.store(now, std::memory_order_relaxed);
+        layout = cache.layout.get();
+
+        shard.evict(s_cacheMaxLayouts / s_shardCount, s_cacheMaxBytes / s_shardCount, now);
       }
-      cache.lastUsed = now;
-      layout = cache.layout.get();
     }
 
     layout->generate();
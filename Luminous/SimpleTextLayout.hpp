@@ -71,6 +71,16 @@ namespace Luminous
     LUMINOUS_API const QTextLayout & layout() const;
 
     LUMINOUS_API static void clearCache();
+    /// Sets the limits of the layout cache used by cachedLayout(). When
+    /// either of the limits is exceeded, least recently used layouts are
+    /// evicted. Layouts used during the last two seconds are never evicted,
+    /// so the limits are soft. Defaults are 4096 layouts and 64 MB.
+    /// @param maxLayouts maximum number of cached layouts
+    /// @param maxBytes maximum estimated memory usage of the cached layouts
+    LUMINOUS_API static void setCacheLimits(size_t maxLayouts, size_t maxBytes);
+    /// Returns a layout from a global cache. The cache is shared between all
+    /// threads, but each render thread gets its own layout instances. The
+    /// returned reference is valid at least until the end of the frame.
     LUMINOUS_API static const SimpleTextLayout & cachedLayout(const QString & text,
                                                               const Nimble::SizeF & size,
                                                               const QFont & font,
@@ -29,6 +29,40 @@ bool operator<(QColor a, QColor b)
   return b.isValid();
 }
 
+namespace
+{
+  /// Generates vertices for all glyphs in a resolved run. findGroup is a
+  /// function that returns the group for a texture and a color.
+  template <typename FindGroup>
+  void buildRun(FindGroup findGroup, std::vector<std::pair<Nimble::Rectf, QUrl> > & urls,
+                const Nimble::Vector2f & layoutLocation, const Luminous::TextLayout::ResolvedRun & run)
+  {
+    Nimble::Rectf bb;
+    for (const Luminous::TextLayout::ResolvedRun::Glyph & glyph: run.glyphs) {
+      const Nimble::Vector2f location = glyph.location + layoutLocation;
+      const Nimble::Vector2f & size = glyph.size;
+
+      Luminous::TextLayout::Group & g = findGroup(*glyph.texture, run.color);
+
+      Luminous::TextLayout::Item item;
+      bb.expand(location);
+      bb.expand(location+size);
+      item.vertices[0].location.make(location.x, location.y);
+      item.vertices[1].location.make(location.x+size.x, location.y);
+      item.vertices[2].location.make(location.x, location.y+size.y);
+      item.vertices[3].location.make(location.x+size.x, location.y+size.y);
+      for (int j = 0; j < 4; ++j) {
+        item.vertices[j].texCoord = glyph.uv[j];
+        item.vertices[j].invsize = run.invsize;
+      }
+
+      g.items.push_back(item);
+    }
+    if (!run.anchorHref.isEmpty())
+      urls.push_back(std::make_pair(bb, run.anchorHref));
+  }
+}
+
 namespace Luminous
 {
   class TextLayout::D
@@ -39,7 +73,6 @@ namespace Luminous
     bool generate(const Nimble::Vector2f & location, const QGlyphRun & glyphRun,
                   int stretch, const QTextCharFormat * format);
 
-  protected:
     Group & findGroup(Texture & texture, QColor color);
 
   public:
@@ -79,57 +112,12 @@ namespace Luminous
                                const QGlyphRun & glyphRun, int stretch,
                                const QTextCharFormat * format)
   {
-    bool missingGlyphs = false;
-
-    const QRawFont & font = glyphRun.rawFont();
-    const QVector<quint32> & glyphs = glyphRun.glyphIndexes();
-    const QVector<QPointF> & positions = glyphRun.positions();
-
-    FontCache & cache = FontCache::acquire(font, stretch);
-
-    const float scale = float(font.pixelSize()) / cache.pixelSize();
-    const float invsize = 1.0f / float(font.pixelSize());
-
-    QColor color;
-    if (format)
-      color = format->foreground().color();
-
-    Nimble::Rectf bb;
-    for (int i = 0; i < glyphs.size(); ++i) {
-      const quint32 glyph = glyphs[i];
-
-      FontCache::Glyph * glyphCache = cache.glyph(font, glyph);
-      if (glyphCache) {
-        if (glyphCache->isEmpty())
-          continue;
-
-        const Nimble::Vector2f location = Nimble::Vector2d(positions[i].x(), positions[i].y()).cast<float>() +
-            layoutLocation + glyphCache->location() * scale;
-        const Nimble::Vector2f & size = glyphCache->size() * scale;
-
-        Group & g = findGroup(glyphCache->texture(), color);
-
-        TextLayout::Item item;
-        bb.expand(location);
-        bb.expand(location+size);
-        item.vertices[0].location.make(location.x, location.y);
-        item.vertices[1].location.make(location.x+size.x, location.y);
-        item.vertices[2].location.make(location.x, location.y+size.y);
-        item.vertices[3].location.make(location.x+size.x, location.y+size.y);
-        for (int j = 0; j < 4; ++j) {
-          item.vertices[j].texCoord = glyphCache->uv()[j];
-          item.vertices[j].invsize = invsize;
-        }
-
-        g.items.push_back(item);
-      } else {
-        missingGlyphs = true;
-      }
-    }
-    if (format && !format->anchorHref().isEmpty())
-      m_urls.push_back(std::make_pair(bb, format->anchorHref()));
-
-    return missingGlyphs;
+    auto find = [this] (Texture & texture, QColor color) -> Group & {
+      return findGroup(texture, color);
+    };
+    const ResolvedRun run = resolveGlyphs(glyphRun, stretch, format);
+    buildRun(find, m_urls, layoutLocation, run);
+    return run.missingGlyphs;
   }
 
   TextLayout::Group & TextLayout::D::findGroup(Texture & texture, QColor color)
@@ -287,6 +275,7 @@ namespace Luminous
   {
     m_d->m_groupCache.clear();
     m_d->m_groups.clear();
+    m_d->m_urls.clear();
     m_d->m_glyphsReady = false;
     m_d->m_atlasGeneration = FontCache::generation();
   }
@@ -305,6 +294,84 @@ namespace Luminous
     return m_d->generate(location, glyphRun, stretch, format);
   }
 
+  TextLayout::ResolvedRun TextLayout::resolveGlyphs(const QGlyphRun & glyphRun, int stretch,
+                                                    const QTextCharFormat * format)
+  {
+    ResolvedRun run;
+
+    const QRawFont & font = glyphRun.rawFont();
+    const QVector<quint32> & glyphs = glyphRun.glyphIndexes();
+    const QVector<QPointF> & positions = glyphRun.positions();
+
+    if (glyphs.isEmpty())
+      return run;
+
+    if (format) {
+      run.color = format->foreground().color();
+      run.anchorHref = format->anchorHref();
+    }
+
+    Luminous::FontCache & cache = Luminous::FontCache::acquire(font, stretch);
+
+    const float scale = float(font.pixelSize()) / cache.pixelSize();
+    run.invsize = 1.0f / float(font.pixelSize());
+    run.glyphs.reserve(glyphs.size());
+
+    for (int i = 0; i < glyphs.size(); ++i) {
+      Luminous::FontCache::Glyph * glyphCache = cache.glyph(font, glyphs[i]);
+      if (!glyphCache) {
+        run.missingGlyphs = true;
+        continue;
+      }
+      if (glyphCache->isEmpty())
+        continue;
+
+      ResolvedRun::Glyph glyph;
+      glyph.texture = &glyphCache->texture();
+      glyph.location = Nimble::Vector2d(positions[i].x(), positions[i].y()).cast<float>() +
+          glyphCache->location() * scale;
+      glyph.size = glyphCache->size() * scale;
+      glyph.uv = glyphCache->uv();
+      run.glyphs.push_back(glyph);
+    }
+
+    return run;
+  }
+
+  bool TextLayout::generateGlyphs(GlyphBlock & block, const Nimble::Vector2f & location,
+                                  const ResolvedRun & run)
+  {
+    // Blocks typically have just a few groups, so linear search is enough
+    auto find = [&block] (Texture & texture, QColor color) -> Group & {
+      for (Group & g: block.groups)
+        if (g.texture == &texture && g.color == color)
+          return g;
+      block.groups.emplace_back(texture, color);
+      return block.groups.back();
+    };
+    buildRun(find, block.urls, location, run);
+    block.missingGlyphs |= run.missingGlyphs;
+    return run.missingGlyphs;
+  }
+
+  void TextLayout::appendGlyphs(const GlyphBlock & block, const Nimble::Vector2f & offset)
+  {
+    for (const Group & src: block.groups) {
+      Group & dst = m_d->findGroup(*src.texture, src.color);
+      dst.items.reserve(dst.items.size() + src.items.size());
+      for (Item item: src.items) {
+        for (FontVertex & v: item.vertices)
+          v.location += offset;
+        dst.items.push_back(item);
+      }
+    }
+
+    for (auto url: block.urls) {
+      url.first.move(offset);
+      m_d->m_urls.push_back(url);
+    }
+  }
+
   float TextLayout::pixelToPointSize(float pixelSize)
   {
     // 72 would be the correct value here, but using it would break all existing applications
@@ -48,6 +48,38 @@ namespace Luminous {
       std::vector<TextLayout::Item> items;
     };
 
+    /// Glyphs of a part of the layout, for example of one paragraph. These
+    /// can be generated separately, also in a background thread, and then
+    /// added to the layout with appendGlyphs.
+    struct GlyphBlock
+    {
+      std::vector<Group> groups;
+      std::vector<std::pair<Nimble::Rectf, QUrl> > urls;
+      bool missingGlyphs = false;
+    };
+
+    /// Glyph run with the glyphs already looked up from FontCache, see
+    /// resolveGlyphs. It doesn't refer to any Qt font objects, so the
+    /// vertices can be built from it in any thread.
+    struct ResolvedRun
+    {
+      struct Glyph
+      {
+        Texture * texture = nullptr;
+        /// Top-left corner relative to the run origin
+        Nimble::Vector2f location;
+        Nimble::Vector2f size;
+        std::array<Nimble::Vector2f, 4> uv;
+      };
+
+      std::vector<Glyph> glyphs;
+      float invsize = 0.0f;
+      QColor color;
+      QUrl anchorHref;
+      /// True if some glyphs are not yet available in FontCache
+      bool missingGlyphs = false;
+    };
+
     struct TextRange
     {
       int start = 0;
@@ -116,6 +148,20 @@ namespace Luminous {
                                      const QGlyphRun & glyphRun, int stretch,
                                      const QTextCharFormat * format = nullptr);
 
+    /// Looks up the glyphs of the run from FontCache. This might need to
+    /// generate glyph outlines with the QRawFont of the run, which some Qt
+    /// font engines only allow in the thread that created the font, so this
+    /// must be called in that thread.
+    LUMINOUS_API static ResolvedRun resolveGlyphs(const QGlyphRun & glyphRun, int stretch,
+                                                  const QTextCharFormat * format = nullptr);
+    /// Generates glyphs of a resolved run to the given block instead of this
+    /// layout. This function is thread-safe.
+    /// @return true if some of the glyphs are missing
+    LUMINOUS_API static bool generateGlyphs(GlyphBlock & block, const Nimble::Vector2f & location,
+                                            const ResolvedRun & run);
+    /// Adds glyphs of the block to this layout, moved by the given offset
+    LUMINOUS_API void appendGlyphs(const GlyphBlock & block, const Nimble::Vector2f & offset);
+
   private:
     LUMINOUS_API virtual void generateInternal() const = 0;
 
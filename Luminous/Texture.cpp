@@ -43,6 +43,7 @@ namespace Luminous
     Wrap m_wrap[3] { WRAP_CLAMP, WRAP_CLAMP, WRAP_CLAMP };
     Radiant::ColorPMA m_borderColor {0, 0, 0, 0};
     bool m_mipmapsEnabled = false;
+    CompressOnUpload m_compressOnUpload = COMPRESS_NEVER;
     // Generation number for all glTexParameter-variables, min/magfilter, wrap, border
     int m_paramsGeneration = 0;
   };
@@ -320,6 +321,19 @@ namespace Luminous
     return m_d->m_mipmapsEnabled;
   }
 
+  void Texture::setCompressOnUpload(CompressOnUpload mode)
+  {
+    if (m_d->m_compressOnUpload == mode)
+      return;
+    m_d->m_compressOnUpload = mode;
+    invalidate();
+  }
+
+  Texture::CompressOnUpload Texture::compressOnUpload() const
+  {
+    return m_d->m_compressOnUpload;
+  }
+
   int Texture::paramsGeneration() const
   {
     return m_d->m_paramsGeneration;
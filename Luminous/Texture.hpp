@@ -58,6 +58,21 @@ namespace Luminous
       WRAP_BORDER
     };
 
+    /// Lossy compression of the texture data when it is uploaded to the GPU.
+    /// Only 2D textures with 8-bit RGBA or BGRA data and without mipmaps or
+    /// multi-sampling are compressed. Translucent textures are compressed to
+    /// DXT5 and opaque textures to DXT1, using DxtEncoder.
+    enum CompressOnUpload
+    {
+      /// Upload the data as it is. This is the default.
+      COMPRESS_NEVER,
+      /// Compress the texture if the GPU is running out of memory when the
+      /// texture is created, see TextureGL::setCompressOnUploadMemoryThreshold
+      COMPRESS_WHEN_GPU_MEMORY_LOW,
+      /// Always compress the texture
+      COMPRESS_ALWAYS
+    };
+
     struct DataInfo
     {
       /// See Texture::data
@@ -253,6 +268,15 @@ namespace Luminous
     /// True if automatic GPU mipmap generation is enabled
     LUMINOUS_API bool mipmapsEnabled() const;
 
+    /// Sets when the texture data should be compressed on upload. This is
+    /// meant for dynamic content, like video frames and web views, that
+    /// would otherwise fill the GPU memory. The default is COMPRESS_NEVER.
+    /// @param mode compression mode
+    LUMINOUS_API void setCompressOnUpload(CompressOnUpload mode);
+
+    /// @returns when the texture data is compressed on upload
+    LUMINOUS_API CompressOnUpload compressOnUpload() const;
+
     /// Get the generation number for texture parameters. This is increased
     /// every time border color, wrap mode or min/mag filters are changed
     /// @return generation number, starting from 0
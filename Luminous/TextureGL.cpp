@@ -8,6 +8,7 @@
  * 
  */
 
+#include "DxtEncoder.hpp"
 #include "PixelFormat.hpp"
 #include "RenderDriverGL.hpp"
 #include "Texture.hpp"
@@ -17,6 +18,7 @@
 
 #include <QVector>
 
+#include <algorithm>
 #include <cassert>
 
 namespace
@@ -50,6 +52,14 @@ namespace
     return intFormat;
   }
 
+  /// Can the texture data be compressed with DxtEncoder on upload
+  static bool canCompressOnUpload(const Luminous::Texture & texture)
+  {
+    return texture.compressOnUpload() != Luminous::Texture::COMPRESS_NEVER &&
+        texture.samples() == 0 && !texture.mipmapsEnabled() &&
+        Luminous::DxtEncoder::isSupported(texture.dataFormat());
+  }
+
   static GLenum getWrapMode(Luminous::Texture::Wrap wrapMode)
   {
     switch (wrapMode)
@@ -69,6 +79,7 @@ namespace Luminous
 {
   static TextureGL::UploadMethod s_defaultUploadMethod = TextureGL::METHOD_TEXTURE;
   static bool s_asyncUploadingEnabled = false;
+  static float s_compressOnUploadMemoryThreshold = 0.25f;
 
   TextureGL::TextureGL(StateGL & state)
     : ResourceHandleGL(state)
@@ -109,6 +120,8 @@ namespace Luminous
     , m_dirtyRegion2D(t.m_dirtyRegion2D)
     , m_size(0, 0, 0)
     , m_samples(t.m_samples)
+    , m_uploadCompression(t.m_uploadCompression)
+    , m_compressOnUpload(t.m_compressOnUpload)
   {
   }
 
@@ -122,6 +135,8 @@ namespace Luminous
     m_dirtyRegion2D = t.m_dirtyRegion2D;
     m_size = t.m_size;
     m_samples = t.m_samples;
+    m_uploadCompression = t.m_uploadCompression;
+    m_compressOnUpload = t.m_compressOnUpload;
     return *this;
   }
 
@@ -244,13 +259,16 @@ namespace Luminous
       bool recreate =
           (m_size[0] != texture.width() || m_size[1] != texture.height()) ||
           (m_internalFormat != texture.internalFormat()) ||
-          (m_samples != texture.samples());
+          (m_samples != texture.samples()) ||
+          (m_compressOnUpload != texture.compressOnUpload()) ||
+          (m_uploadCompression != PixelFormat::COMPRESSION_NONE && !canCompressOnUpload(texture));
 
       if(recreate) {
         m_target = 0;
         m_size.make(texture.width(), texture.height(), 1);
         m_internalFormat = texture.internalFormat();
         m_samples = texture.samples();
+        m_compressOnUpload = texture.compressOnUpload();
       } else {
         m_dirtyRegion2D = QRegion(0, 0, texture.width(), texture.height());
       }
@@ -283,6 +301,7 @@ namespace Luminous
 
       // Create a new texture
       GLenum intFormat = internalFormat(texture);
+      m_uploadCompression = compressedFormat ? PixelFormat::COMPRESSION_NONE : chooseUploadCompression(texture);
       if(compressedFormat) {
         m_state.opengl().glCompressedTexImage2D(GL_TEXTURE_2D, 0, intFormat, texture.width(),
                                                 texture.height(), 0, static_cast<GLsizei>(texture.dataSize()),
@@ -290,6 +309,13 @@ namespace Luminous
         GLERROR("TextureGL::upload # glCompressedTexImage2D");
         m_dirtyRegion2D = QRegion();
       }
+      else if(m_uploadCompression != PixelFormat::COMPRESSION_NONE) {
+        // Allocate the compressed texture, the data is compressed and
+        // uploaded together with the dirty region
+        m_state.opengl().glTexImage2D(GL_TEXTURE_2D, 0, m_uploadCompression, texture.width(), texture.height(), 0,
+                                      texture.dataFormat().layout(), texture.dataFormat().type(), nullptr);
+        GLERROR("TextureGL::upload # glTexImage2D");
+      }
       else {
         if(texture.samples() > 0) {
           // The last parameter fixedSampleLocations needs to be true in order
@@ -360,12 +386,13 @@ namespace Luminous
         GLsync createFence = nullptr;
         if (created)
           createFence = m_state.opengl().glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-        m_state.driver().worker().add([this, tex=texture.dataInfo(), mipmaps=texture.mipmapsEnabled(), toUpload, compressedFormat, createFence] {
+        m_state.driver().worker().add([this, tex=texture.dataInfo(), mipmaps=texture.mipmapsEnabled(), toUpload, compressedFormat,
+                                       uploadCompression=m_uploadCompression, createFence] {
           if (createFence)
             m_state.opengl().glWaitSync(createFence, 0, GL_TIMEOUT_IGNORED);
           m_state.opengl().glBindTexture(m_target, m_handle);
           GLERROR("TextureGL::upload2D # glBindTexture");
-          upload2DImpl(tex, toUpload, compressedFormat, mipmaps);
+          upload2DImpl(tex, toUpload, compressedFormat, uploadCompression, mipmaps);
           GLsync fence = m_state.opengl().glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
           {
             QMutexLocker g(&m_asyncUploadMutex);
@@ -392,7 +419,7 @@ namespace Luminous
         if (!bound)
           bind(textureUnit);
 
-        upload2DImpl(texture.dataInfo(), toUpload, compressedFormat, texture.mipmapsEnabled());
+        upload2DImpl(texture.dataInfo(), toUpload, compressedFormat, m_uploadCompression, texture.mipmapsEnabled());
       }
     }
 
@@ -406,7 +433,8 @@ namespace Luminous
   }
 
   void TextureGL::upload2DImpl(const Texture::DataInfo & texture, const QRegion & region,
-                               bool compressedFormat, bool mipmapsEnabled)
+                               bool compressedFormat, PixelFormat::Compression uploadCompression,
+                               bool mipmapsEnabled)
   {
     /// @todo glCompressedTexImage2D, probably needs some alignment
     if(compressedFormat) {
@@ -414,6 +442,8 @@ namespace Luminous
                                                  texture.dataFormat.compression(), static_cast<GLsizei>(texture.dataSize),
                                                  texture.data.get());
       GLERROR("TextureGL::upload # glCompressedTexSubImage2D");
+    } else if(uploadCompression != PixelFormat::COMPRESSION_NONE) {
+      uploadCompressed(texture, region, uploadCompression);
     } else {
       const int lineSizeBytes = texture.lineSizeBytes;
       const int bytesPerPixel = texture.dataFormat.bytesPerPixel();
@@ -446,6 +476,54 @@ namespace Luminous
     }
   }
 
+  void TextureGL::uploadCompressed(const Texture::DataInfo & texture, const QRegion & region,
+                                   PixelFormat::Compression compression)
+  {
+    // Compressed textures can only be updated in whole 4x4 blocks, except
+    // at the right and bottom edges of the texture
+    QRegion blocks;
+    for(const QRect & rect : region.rects()) {
+      const int left = rect.left() & ~3;
+      const int top = rect.top() & ~3;
+      const int right = std::min(texture.size.x, (rect.right() + 4) & ~3);
+      const int bottom = std::min(texture.size.y, (rect.bottom() + 4) & ~3);
+      blocks += QRect(left, top, right - left, bottom - top);
+    }
+
+    // Uploads can happen in the render thread and in the upload worker
+    static thread_local std::vector<uint8_t> s_compressed;
+
+    const int bytesPerPixel = texture.dataFormat.bytesPerPixel();
+    for(const QRect & rect : blocks.rects()) {
+      const char * data = static_cast<const char *>(texture.data.get()) +
+          rect.top() * texture.lineSizeBytes + rect.left() * bytesPerPixel;
+      const std::size_t bytes = DxtEncoder::compressedSize(rect.width(), rect.height(), compression);
+      s_compressed.resize(bytes);
+
+      DxtEncoder::compress(data, rect.width(), rect.height(), texture.lineSizeBytes,
+                           texture.dataFormat, compression, s_compressed.data());
+
+      m_state.opengl().glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, rect.left(), rect.top(), rect.width(), rect.height(),
+                                                 compression, static_cast<GLsizei>(bytes), s_compressed.data());
+      GLERROR("TextureGL::upload # glCompressedTexSubImage2D");
+    }
+  }
+
+  PixelFormat::Compression TextureGL::chooseUploadCompression(const Texture & texture) const
+  {
+    if(!canCompressOnUpload(texture))
+      return PixelFormat::COMPRESSION_NONE;
+
+    if(texture.compressOnUpload() == Texture::COMPRESS_WHEN_GPU_MEMORY_LOW) {
+      const GLint maximum = m_state.driver().maximumGPUMemory();
+      if(maximum <= 0 ||
+         m_state.driver().availableGPUMemory() >= s_compressOnUploadMemoryThreshold * maximum)
+        return PixelFormat::COMPRESSION_NONE;
+    }
+
+    return texture.translucent() ? PixelFormat::COMPRESSED_RGBA_DXT5 : PixelFormat::COMPRESSED_RGB_DXT1;
+  }
+
   void TextureGL::upload3D(const Texture & texture, int textureUnit)
   {
     bool bound = false;
@@ -647,6 +725,16 @@ namespace Luminous
     s_asyncUploadingEnabled = enabled;
   }
 
+  float TextureGL::compressOnUploadMemoryThreshold()
+  {
+    return s_compressOnUploadMemoryThreshold;
+  }
+
+  void TextureGL::setCompressOnUploadMemoryThreshold(float fraction)
+  {
+    s_compressOnUploadMemoryThreshold = fraction;
+  }
+
   void TextureGL::setTexParameters() const
   {
     if(m_samples == 0) {
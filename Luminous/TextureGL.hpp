@@ -104,10 +104,21 @@ namespace Luminous
     LUMINOUS_API static bool isAsyncUploadingEnabled();
     LUMINOUS_API static void setAsyncUploadingEnabled(bool enabled);
 
+    /// Textures that use Texture::COMPRESS_WHEN_GPU_MEMORY_LOW are compressed
+    /// if less than this fraction of the GPU memory is available when the
+    /// texture is created. The default is 0.25. Has no effect if the driver
+    /// can't query the available GPU memory.
+    LUMINOUS_API static float compressOnUploadMemoryThreshold();
+    LUMINOUS_API static void setCompressOnUploadMemoryThreshold(float fraction);
+
   private:
     void upload1D(const Texture & texture, int textureUnit);
     bool upload2D(const Texture & texture, int textureUnit, UploadFlags flags);
-    void upload2DImpl(const Texture::DataInfo& texture, const QRegion & region, bool compressedFormat, bool mipmapsEnabled);
+    void upload2DImpl(const Texture::DataInfo& texture, const QRegion & region, bool compressedFormat,
+                      PixelFormat::Compression uploadCompression, bool mipmapsEnabled);
+    void uploadCompressed(const Texture::DataInfo & texture, const QRegion & region,
+                          PixelFormat::Compression compression);
+    PixelFormat::Compression chooseUploadCompression(const Texture & texture) const;
     void upload3D(const Texture & texture, int textureUnit);
     void uploadData(const PixelFormat & dataFormat, const char * data,
                     const QRect & destRect, unsigned int bytes,
@@ -122,6 +133,9 @@ namespace Luminous
     QRegion m_dirtyRegion2D;
     Nimble::Vector3u m_size;
     unsigned int m_samples;
+    /// Format the texture data is compressed to on upload, see Texture::CompressOnUpload
+    PixelFormat::Compression m_uploadCompression = PixelFormat::COMPRESSION_NONE;
+    Texture::CompressOnUpload m_compressOnUpload = Texture::COMPRESS_NEVER;
 
     Texture::Filter m_minFilter, m_magFilter;
     Texture::Wrap m_wrap[3];
@@ -0,0 +1,591 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "Batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NIMBLE_BATCH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// The library is built for the baseline instruction set, the SIMD kernels
+// are compiled for their own targets and only called if the CPU supports them
+#if defined(NIMBLE_BATCH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NIMBLE_TARGET_SSE2 __attribute__((target("sse2")))
+#define NIMBLE_TARGET_AVX __attribute__((target("avx")))
+#else
+#define NIMBLE_TARGET_SSE2
+#define NIMBLE_TARGET_AVX
+#endif
+
+namespace
+{
+  using namespace Nimble;
+  using namespace Nimble::Batch;
+
+  static_assert(sizeof(Vector2f) == 2 * sizeof(float), "Vector2f needs to be tightly packed");
+  static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Vector3f needs to be tightly packed");
+
+  /// Coefficients of a 2D projective transformation:
+  /// x' = (a*x + b*y + c) / (g*x + h*y + i)
+  /// y' = (d*x + e*y + f) / (g*x + h*y + i)
+  struct Projection2
+  {
+    float a, b, c;
+    float d, e, f;
+    float g, h, i;
+  };
+
+  Projection2 projection2(const Matrix3f & m)
+  {
+    return { m.get(0, 0), m.get(0, 1), m.get(0, 2),
+             m.get(1, 0), m.get(1, 1), m.get(1, 2),
+             m.get(2, 0), m.get(2, 1), m.get(2, 2) };
+  }
+
+  /// Vector2 is interpreted as [x y 0 1], so the third row and column are unused
+  Projection2 projection2(const Matrix4f & m)
+  {
+    return { m.get(0, 0), m.get(0, 1), m.get(0, 3),
+             m.get(1, 0), m.get(1, 1), m.get(1, 3),
+             m.get(3, 0), m.get(3, 1), m.get(3, 3) };
+  }
+
+  InstructionSet detectInstructionSet()
+  {
+#ifdef NIMBLE_BATCH_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    const bool sse2 = info[3] & (1 << 26);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    // The OS also needs to save the YMM registers on context switches
+    if (sse2 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+      return INSTRUCTION_SET_AVX;
+    if (sse2)
+      return INSTRUCTION_SET_SSE2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+      return INSTRUCTION_SET_AVX;
+    if (__builtin_cpu_supports("sse2"))
+      return INSTRUCTION_SET_SSE2;
+#endif
+#endif
+    return INSTRUCTION_SET_SCALAR;
+  }
+
+  const InstructionSet s_supportedInstructionSet = detectInstructionSet();
+  std::atomic<int> s_instructionSet{s_supportedInstructionSet};
+
+  // -------------------------------------------------------------------------
+  // Scalar implementations
+
+  template <bool Affine>
+  void projectScalar(const Projection2 & p, const Vector2f * in, Vector2f * out, size_t count)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      const float x = in[i].x;
+      const float y = in[i].y;
+      const float px = p.a * x + p.b * y + p.c;
+      const float py = p.d * x + p.e * y + p.f;
+      if (Affine) {
+        out[i] = Vector2f(px, py);
+      } else {
+        const float w = p.g * x + p.h * y + p.i;
+        out[i] = Vector2f(px / w, py / w);
+      }
+    }
+  }
+
+  void projectScalar(const Matrix4f & m, const Vector3f * in, Vector3f * out, size_t count)
+  {
+    for (size_t i = 0; i < count; ++i)
+      out[i] = m.project(in[i]);
+  }
+
+  void boundsScalar(const Vector2f * points, size_t count, Vector2f & low, Vector2f & high)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      low.x = std::min(low.x, points[i].x);
+      low.y = std::min(low.y, points[i].y);
+      high.x = std::max(high.x, points[i].x);
+      high.y = std::max(high.y, points[i].y);
+    }
+  }
+
+  /// Separating axis test for two parallelograms. Rectangle axes are unit
+  /// vectors, but they are not orthogonal if the transformation had skew or
+  /// shear, so the separating axes are the edge normals and each shape is
+  /// projected with both of its half-edge vectors. The projections are
+  /// written with cross products: |cross(n, v)| is the length of v projected
+  /// to the normal of the unit vector n.
+  bool intersectsScalar(const Rectangle & a, const Rectangle & b)
+  {
+    const Vector2f d = b.center() - a.center();
+    const Vector2f a0 = a.axis0(), a1 = a.axis1();
+    const Vector2f b0 = b.axis0(), b1 = b.axis1();
+
+    const float ca = std::abs(cross(a0, a1));
+    const float cb = std::abs(cross(b0, b1));
+    const float a0b0 = std::abs(cross(a0, b0));
+    const float a0b1 = std::abs(cross(a0, b1));
+    const float a1b0 = std::abs(cross(a1, b0));
+    const float a1b1 = std::abs(cross(a1, b1));
+
+    if (std::abs(cross(a0, d)) > a.extent1() * ca + b.extent0() * a0b0 + b.extent1() * a0b1)
+      return false;
+    if (std::abs(cross(a1, d)) > a.extent0() * ca + b.extent0() * a1b0 + b.extent1() * a1b1)
+      return false;
+    if (std::abs(cross(b0, d)) > b.extent1() * cb + a.extent0() * a0b0 + a.extent1() * a1b0)
+      return false;
+    if (std::abs(cross(b1, d)) > b.extent0() * cb + a.extent0() * a0b1 + a.extent1() * a1b1)
+      return false;
+    return true;
+  }
+
+  size_t intersectsScalar(const Rectangle & rect, const Rectangle * rects, size_t count, uint8_t * results)
+  {
+    size_t hits = 0;
+    for (size_t i = 0; i < count; ++i) {
+      results[i] = intersectsScalar(rect, rects[i]) ? 1 : 0;
+      hits += results[i];
+    }
+    return hits;
+  }
+
+#ifdef NIMBLE_BATCH_X86
+
+  // -------------------------------------------------------------------------
+  // SSE2 implementations
+
+  /// Two points per iteration, x and y are shuffled to [x0 x0 x1 x1] and
+  /// [y0 y0 y1 y1] so that both output coordinates are computed at once
+  template <bool Affine>
+  NIMBLE_TARGET_SSE2
+  void projectSse2(const Projection2 & p, const Vector2f * in, Vector2f * out, size_t count)
+  {
+    const __m128 col0 = _mm_setr_ps(p.a, p.d, p.a, p.d);
+    const __m128 col1 = _mm_setr_ps(p.b, p.e, p.b, p.e);
+    const __m128 col2 = _mm_setr_ps(p.c, p.f, p.c, p.f);
+    const __m128 wx = _mm_set1_ps(p.g);
+    const __m128 wy = _mm_set1_ps(p.h);
+    const __m128 wc = _mm_set1_ps(p.i);
+
+    const float * src = reinterpret_cast<const float*>(in);
+    float * dst = reinterpret_cast<float*>(out);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+      const __m128 v = _mm_loadu_ps(src + 2 * i);
+      const __m128 xx = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0));
+      const __m128 yy = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1));
+      __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, col0), _mm_mul_ps(yy, col1)), col2);
+      if (!Affine) {
+        const __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, wx), _mm_mul_ps(yy, wy)), wc);
+        r = _mm_div_ps(r, w);
+      }
+      _mm_storeu_ps(dst + 2 * i, r);
+    }
+    projectScalar<Affine>(p, in + i, out + i, count - i);
+  }
+
+  NIMBLE_TARGET_SSE2
+  void projectSse2(const Matrix4f & m, const Vector3f * in, Vector3f * out, size_t count)
+  {
+    const __m128 col0 = _mm_setr_ps(m.get(0, 0), m.get(1, 0), m.get(2, 0), m.get(3, 0));
+    const __m128 col1 = _mm_setr_ps(m.get(0, 1), m.get(1, 1), m.get(2, 1), m.get(3, 1));
+    const __m128 col2 = _mm_setr_ps(m.get(0, 2), m.get(1, 2), m.get(2, 2), m.get(3, 2));
+    const __m128 col3 = _mm_setr_ps(m.get(0, 3), m.get(1, 3), m.get(2, 3), m.get(3, 3));
+
+    alignas(16) float tmp[4];
+    for (size_t i = 0; i < count; ++i) {
+      const __m128 x = _mm_set1_ps(in[i].x);
+      const __m128 y = _mm_set1_ps(in[i].y);
+      const __m128 z = _mm_set1_ps(in[i].z);
+      __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, col0), _mm_mul_ps(y, col1)),
+                            _mm_add_ps(_mm_mul_ps(z, col2), col3));
+      r = _mm_div_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3)));
+      _mm_store_ps(tmp, r);
+      out[i] = Vector3f(tmp[0], tmp[1], tmp[2]);
+    }
+  }
+
+  NIMBLE_TARGET_SSE2
+  void boundsSse2(const Vector2f * points, size_t count, Vector2f & low, Vector2f & high)
+  {
+    const float * src = reinterpret_cast<const float*>(points);
+    __m128 mn = _mm_setr_ps(low.x, low.y, low.x, low.y);
+    __m128 mx = _mm_setr_ps(high.x, high.y, high.x, high.y);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+      const __m128 v = _mm_loadu_ps(src + 2 * i);
+      mn = _mm_min_ps(mn, v);
+      mx = _mm_max_ps(mx, v);
+    }
+    mn = _mm_min_ps(mn, _mm_movehl_ps(mn, mn));
+    mx = _mm_max_ps(mx, _mm_movehl_ps(mx, mx));
+
+    alignas(16) float tmp[4];
+    _mm_store_ps(tmp, mn);
+    low = Vector2f(tmp[0], tmp[1]);
+    _mm_store_ps(tmp, mx);
+    high = Vector2f(tmp[0], tmp[1]);
+
+    boundsScalar(points + i, count - i, low, high);
+  }
+
+  NIMBLE_TARGET_SSE2
+  inline __m128 abs4(__m128 v)
+  {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+  }
+
+  NIMBLE_TARGET_SSE2
+  inline __m128 cross4(__m128 ax, __m128 ay, __m128 bx, __m128 by)
+  {
+    return _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+  }
+
+  NIMBLE_TARGET_SSE2
+  inline __m128 radius4(__m128 e0, __m128 c0, __m128 e1, __m128 c1, __m128 e2, __m128 c2)
+  {
+    return _mm_add_ps(_mm_mul_ps(e0, c0), _mm_add_ps(_mm_mul_ps(e1, c1), _mm_mul_ps(e2, c2)));
+  }
+
+  /// Four rectangles per iteration, the rectangles are transposed to one
+  /// register per field
+  NIMBLE_TARGET_SSE2
+  size_t intersectsSse2(const Rectangle & rect, const Rectangle * rects, size_t count, uint8_t * results)
+  {
+    const __m128 ox = _mm_set1_ps(rect.center().x), oy = _mm_set1_ps(rect.center().y);
+    const __m128 a0x = _mm_set1_ps(rect.axis0().x), a0y = _mm_set1_ps(rect.axis0().y);
+    const __m128 a1x = _mm_set1_ps(rect.axis1().x), a1y = _mm_set1_ps(rect.axis1().y);
+    const __m128 ea0 = _mm_set1_ps(rect.extent0()), ea1 = _mm_set1_ps(rect.extent1());
+    const __m128 ca = _mm_set1_ps(std::abs(cross(rect.axis0(), rect.axis1())));
+
+    size_t hits = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+      const Rectangle * r = rects + i;
+#define NIMBLE_LANES(expr) _mm_setr_ps(r[0].expr, r[1].expr, r[2].expr, r[3].expr)
+      const __m128 dx = _mm_sub_ps(NIMBLE_LANES(center().x), ox);
+      const __m128 dy = _mm_sub_ps(NIMBLE_LANES(center().y), oy);
+      const __m128 b0x = NIMBLE_LANES(axis0().x), b0y = NIMBLE_LANES(axis0().y);
+      const __m128 b1x = NIMBLE_LANES(axis1().x), b1y = NIMBLE_LANES(axis1().y);
+      const __m128 eb0 = NIMBLE_LANES(extent0()), eb1 = NIMBLE_LANES(extent1());
+#undef NIMBLE_LANES
+
+      const __m128 cb = abs4(cross4(b0x, b0y, b1x, b1y));
+      const __m128 a0b0 = abs4(cross4(a0x, a0y, b0x, b0y));
+      const __m128 a0b1 = abs4(cross4(a0x, a0y, b1x, b1y));
+      const __m128 a1b0 = abs4(cross4(a1x, a1y, b0x, b0y));
+      const __m128 a1b1 = abs4(cross4(a1x, a1y, b1x, b1y));
+
+      __m128 sep = _mm_cmpgt_ps(abs4(cross4(a0x, a0y, dx, dy)), radius4(ea1, ca, eb0, a0b0, eb1, a0b1));
+      sep = _mm_or_ps(sep, _mm_cmpgt_ps(abs4(cross4(a1x, a1y, dx, dy)), radius4(ea0, ca, eb0, a1b0, eb1, a1b1)));
+      sep = _mm_or_ps(sep, _mm_cmpgt_ps(abs4(cross4(b0x, b0y, dx, dy)), radius4(eb1, cb, ea0, a0b0, ea1, a1b0)));
+      sep = _mm_or_ps(sep, _mm_cmpgt_ps(abs4(cross4(b1x, b1y, dx, dy)), radius4(eb0, cb, ea0, a0b1, ea1, a1b1)));
+
+      const int mask = _mm_movemask_ps(sep);
+      for (int k = 0; k < 4; ++k) {
+        results[i + k] = (mask >> k) & 1 ? 0 : 1;
+        hits += results[i + k];
+      }
+    }
+    return hits + intersectsScalar(rect, rects + i, count - i, results + i);
+  }
+
+  // -------------------------------------------------------------------------
+  // AVX implementations
+
+  /// Four points per iteration, moveldup / movehdup give [x0 x0 x1 x1 ...]
+  /// and [y0 y0 y1 y1 ...] directly
+  template <bool Affine>
+  NIMBLE_TARGET_AVX
+  void projectAvx(const Projection2 & p, const Vector2f * in, Vector2f * out, size_t count)
+  {
+    const __m256 col0 = _mm256_setr_ps(p.a, p.d, p.a, p.d, p.a, p.d, p.a, p.d);
+    const __m256 col1 = _mm256_setr_ps(p.b, p.e, p.b, p.e, p.b, p.e, p.b, p.e);
+    const __m256 col2 = _mm256_setr_ps(p.c, p.f, p.c, p.f, p.c, p.f, p.c, p.f);
+    const __m256 wx = _mm256_set1_ps(p.g);
+    const __m256 wy = _mm256_set1_ps(p.h);
+    const __m256 wc = _mm256_set1_ps(p.i);
+
+    const float * src = reinterpret_cast<const float*>(in);
+    float * dst = reinterpret_cast<float*>(out);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+      const __m256 v = _mm256_loadu_ps(src + 2 * i);
+      const __m256 xx = _mm256_moveldup_ps(v);
+      const __m256 yy = _mm256_movehdup_ps(v);
+      __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xx, col0), _mm256_mul_ps(yy, col1)), col2);
+      if (!Affine) {
+        const __m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xx, wx), _mm256_mul_ps(yy, wy)), wc);
+        r = _mm256_div_ps(r, w);
+      }
+      _mm256_storeu_ps(dst + 2 * i, r);
+    }
+    projectScalar<Affine>(p, in + i, out + i, count - i);
+  }
+
+  /// Two points per iteration, one in each 128-bit lane
+  NIMBLE_TARGET_AVX
+  void projectAvx(const Matrix4f & m, const Vector3f * in, Vector3f * out, size_t count)
+  {
+    const __m256 col0 = _mm256_setr_ps(m.get(0, 0), m.get(1, 0), m.get(2, 0), m.get(3, 0),
+                                       m.get(0, 0), m.get(1, 0), m.get(2, 0), m.get(3, 0));
+    const __m256 col1 = _mm256_setr_ps(m.get(0, 1), m.get(1, 1), m.get(2, 1), m.get(3, 1),
+                                       m.get(0, 1), m.get(1, 1), m.get(2, 1), m.get(3, 1));
+    const __m256 col2 = _mm256_setr_ps(m.get(0, 2), m.get(1, 2), m.get(2, 2), m.get(3, 2),
+                                       m.get(0, 2), m.get(1, 2), m.get(2, 2), m.get(3, 2));
+    const __m256 col3 = _mm256_setr_ps(m.get(0, 3), m.get(1, 3), m.get(2, 3), m.get(3, 3),
+                                       m.get(0, 3), m.get(1, 3), m.get(2, 3), m.get(3, 3));
+
+    alignas(32) float tmp[8];
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+      const Vector3f & p0 = in[i];
+      const Vector3f & p1 = in[i + 1];
+      const __m256 x = _mm256_setr_ps(p0.x, p0.x, p0.x, p0.x, p1.x, p1.x, p1.x, p1.x);
+      const __m256 y = _mm256_setr_ps(p0.y, p0.y, p0.y, p0.y, p1.y, p1.y, p1.y, p1.y);
+      const __m256 z = _mm256_setr_ps(p0.z, p0.z, p0.z, p0.z, p1.z, p1.z, p1.z, p1.z);
+      __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, col0), _mm256_mul_ps(y, col1)),
+                               _mm256_add_ps(_mm256_mul_ps(z, col2), col3));
+      r = _mm256_div_ps(r, _mm256_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3)));
+      _mm256_store_ps(tmp, r);
+      out[i] = Vector3f(tmp[0], tmp[1], tmp[2]);
+      out[i + 1] = Vector3f(tmp[4], tmp[5], tmp[6]);
+    }
+    projectScalar(m, in + i, out + i, count - i);
+  }
+
+  NIMBLE_TARGET_AVX
+  void boundsAvx(const Vector2f * points, size_t count, Vector2f & low, Vector2f & high)
+  {
+    const float * src = reinterpret_cast<const float*>(points);
+    __m256 mn = _mm256_setr_ps(low.x, low.y, low.x, low.y, low.x, low.y, low.x, low.y);
+    __m256 mx = _mm256_setr_ps(high.x, high.y, high.x, high.y, high.x, high.y, high.x, high.y);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+      const __m256 v = _mm256_loadu_ps(src + 2 * i);
+      mn = _mm256_min_ps(mn, v);
+      mx = _mm256_max_ps(mx, v);
+    }
+
+    __m128 mn4 = _mm_min_ps(_mm256_castps256_ps128(mn), _mm256_extractf128_ps(mn, 1));
+    __m128 mx4 = _mm_max_ps(_mm256_castps256_ps128(mx), _mm256_extractf128_ps(mx, 1));
+    mn4 = _mm_min_ps(mn4, _mm_movehl_ps(mn4, mn4));
+    mx4 = _mm_max_ps(mx4, _mm_movehl_ps(mx4, mx4));
+
+    alignas(16) float tmp[4];
+    _mm_store_ps(tmp, mn4);
+    low = Vector2f(tmp[0], tmp[1]);
+    _mm_store_ps(tmp, mx4);
+    high = Vector2f(tmp[0], tmp[1]);
+
+    boundsScalar(points + i, count - i, low, high);
+  }
+
+  NIMBLE_TARGET_AVX
+  inline __m256 abs8(__m256 v)
+  {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+  }
+
+  NIMBLE_TARGET_AVX
+  inline __m256 cross8(__m256 ax, __m256 ay, __m256 bx, __m256 by)
+  {
+    return _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+  }
+
+  NIMBLE_TARGET_AVX
+  inline __m256 radius8(__m256 e0, __m256 c0, __m256 e1, __m256 c1, __m256 e2, __m256 c2)
+  {
+    return _mm256_add_ps(_mm256_mul_ps(e0, c0), _mm256_add_ps(_mm256_mul_ps(e1, c1), _mm256_mul_ps(e2, c2)));
+  }
+
+  NIMBLE_TARGET_AVX
+  inline __m256 greater8(__m256 a, __m256 b)
+  {
+    return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+  }
+
+  NIMBLE_TARGET_AVX
+  size_t intersectsAvx(const Rectangle & rect, const Rectangle * rects, size_t count, uint8_t * results)
+  {
+    const __m256 ox = _mm256_set1_ps(rect.center().x), oy = _mm256_set1_ps(rect.center().y);
+    const __m256 a0x = _mm256_set1_ps(rect.axis0().x), a0y = _mm256_set1_ps(rect.axis0().y);
+    const __m256 a1x = _mm256_set1_ps(rect.axis1().x), a1y = _mm256_set1_ps(rect.axis1().y);
+    const __m256 ea0 = _mm256_set1_ps(rect.extent0()), ea1 = _mm256_set1_ps(rect.extent1());
+    const __m256 ca = _mm256_set1_ps(std::abs(cross(rect.axis0(), rect.axis1())));
+
+    size_t hits = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      const Rectangle * r = rects + i;
+#define NIMBLE_LANES(expr) _mm256_setr_ps(r[0].expr, r[1].expr, r[2].expr, r[3].expr, \
+                                          r[4].expr, r[5].expr, r[6].expr, r[7].expr)
+      const __m256 dx = _mm256_sub_ps(NIMBLE_LANES(center().x), ox);
+      const __m256 dy = _mm256_sub_ps(NIMBLE_LANES(center().y), oy);
+      const __m256 b0x = NIMBLE_LANES(axis0().x), b0y = NIMBLE_LANES(axis0().y);
+      const __m256 b1x = NIMBLE_LANES(axis1().x), b1y = NIMBLE_LANES(axis1().y);
+      const __m256 eb0 = NIMBLE_LANES(extent0()), eb1 = NIMBLE_LANES(extent1());
+#undef NIMBLE_LANES
+
+      const __m256 cb = abs8(cross8(b0x, b0y, b1x, b1y));
+      const __m256 a0b0 = abs8(cross8(a0x, a0y, b0x, b0y));
+      const __m256 a0b1 = abs8(cross8(a0x, a0y, b1x, b1y));
+      const __m256 a1b0 = abs8(cross8(a1x, a1y, b0x, b0y));
+      const __m256 a1b1 = abs8(cross8(a1x, a1y, b1x, b1y));
+
+      __m256 sep = greater8(abs8(cross8(a0x, a0y, dx, dy)), radius8(ea1, ca, eb0, a0b0, eb1, a0b1));
+      sep = _mm256_or_ps(sep, greater8(abs8(cross8(a1x, a1y, dx, dy)), radius8(ea0, ca, eb0, a1b0, eb1, a1b1)));
+      sep = _mm256_or_ps(sep, greater8(abs8(cross8(b0x, b0y, dx, dy)), radius8(eb1, cb, ea0, a0b0, ea1, a1b0)));
+      sep = _mm256_or_ps(sep, greater8(abs8(cross8(b1x, b1y, dx, dy)), radius8(eb0, cb, ea0, a0b1, ea1, a1b1)));
+
+      const int mask = _mm256_movemask_ps(sep);
+      for (int k = 0; k < 8; ++k) {
+        results[i + k] = (mask >> k) & 1 ? 0 : 1;
+        hits += results[i + k];
+      }
+    }
+    return hits + intersectsScalar(rect, rects + i, count - i, results + i);
+  }
+
+#endif // NIMBLE_BATCH_X86
+
+  inline InstructionSet currentSet()
+  {
+    return static_cast<InstructionSet>(s_instructionSet.load(std::memory_order_relaxed));
+  }
+
+  template <bool Affine>
+  void projectDispatch(const Projection2 & p, const Vector2f * in, Vector2f * out, size_t count)
+  {
+#ifdef NIMBLE_BATCH_X86
+    switch (currentSet()) {
+    case INSTRUCTION_SET_AVX:
+      projectAvx<Affine>(p, in, out, count);
+      return;
+    case INSTRUCTION_SET_SSE2:
+      projectSse2<Affine>(p, in, out, count);
+      return;
+    default:
+      break;
+    }
+#endif
+    projectScalar<Affine>(p, in, out, count);
+  }
+}
+
+namespace Nimble
+{
+  namespace Batch
+  {
+    InstructionSet instructionSet()
+    {
+      return currentSet();
+    }
+
+    InstructionSet supportedInstructionSet()
+    {
+      return s_supportedInstructionSet;
+    }
+
+    void setInstructionSet(InstructionSet set)
+    {
+      s_instructionSet = std::min(set, s_supportedInstructionSet);
+    }
+
+    void project(const Matrix3f & m, const Vector2f * in, Vector2f * out, size_t count)
+    {
+      projectDispatch<false>(projection2(m), in, out, count);
+    }
+
+    void transformAffine(const Matrix3f & m, const Vector2f * in, Vector2f * out, size_t count)
+    {
+      projectDispatch<true>(projection2(m), in, out, count);
+    }
+
+    void project(const Matrix4f & m, const Vector2f * in, Vector2f * out, size_t count)
+    {
+      projectDispatch<false>(projection2(m), in, out, count);
+    }
+
+    void project(const Matrix4f & m, const Vector3f * in, Vector3f * out, size_t count)
+    {
+#ifdef NIMBLE_BATCH_X86
+      switch (currentSet()) {
+      case INSTRUCTION_SET_AVX:
+        projectAvx(m, in, out, count);
+        return;
+      case INSTRUCTION_SET_SSE2:
+        projectSse2(m, in, out, count);
+        return;
+      default:
+        break;
+      }
+#endif
+      projectScalar(m, in, out, count);
+    }
+
+    Rectf boundingBox(const Vector2f * points, size_t count)
+    {
+      if (count == 0)
+        return Rectf();
+
+      Vector2f low = points[0];
+      Vector2f high = points[0];
+
+#ifdef NIMBLE_BATCH_X86
+      switch (currentSet()) {
+      case INSTRUCTION_SET_AVX:
+        boundsAvx(points, count, low, high);
+        return Rectf(low, high);
+      case INSTRUCTION_SET_SSE2:
+        boundsSse2(points, count, low, high);
+        return Rectf(low, high);
+      default:
+        break;
+      }
+#endif
+      boundsScalar(points, count, low, high);
+      return Rectf(low, high);
+    }
+
+    size_t intersects(const Rectangle & rect, const Rectangle * rects, size_t count, uint8_t * results)
+    {
+#ifdef NIMBLE_BATCH_X86
+      switch (currentSet()) {
+      case INSTRUCTION_SET_AVX:
+        return intersectsAvx(rect, rects, count, results);
+      case INSTRUCTION_SET_SSE2:
+        return intersectsSse2(rect, rects, count, results);
+      default:
+        break;
+      }
+#endif
+      return intersectsScalar(rect, rects, count, results);
+    }
+  }
+}
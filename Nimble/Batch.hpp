@@ -0,0 +1,83 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+#include "Matrix3.hpp"
+#include "Matrix4.hpp"
+#include "Rect.hpp"
+#include "Rectangle.hpp"
+#include "Vector2.hpp"
+#include "Vector3.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Nimble
+{
+  /// Geometry kernels that process arrays of points or rectangles at a time.
+  ///
+  /// The transformation functions give the same results as calling
+  /// Matrix3T::project or Matrix4T::project in a loop, but use SSE2 or AVX
+  /// when available.
+  /// The implementation is selected at run time based on the CPU. On
+  /// non-x86 platforms the scalar implementation is always used.
+  ///
+  /// Input and output arrays may be the same array, but may not otherwise
+  /// overlap. No alignment is required.
+  ///
+  /// ClipStack::isVisible and Rectangle::transform use these kernels.
+  namespace Batch
+  {
+    enum InstructionSet
+    {
+      INSTRUCTION_SET_SCALAR,
+      INSTRUCTION_SET_SSE2,
+      INSTRUCTION_SET_AVX
+    };
+
+    /// Returns the instruction set that is currently used
+    NIMBLE_API InstructionSet instructionSet();
+
+    /// Returns the best instruction set supported by this CPU
+    NIMBLE_API InstructionSet supportedInstructionSet();
+
+    /// Overrides the used instruction set. This is meant for benchmarking and
+    /// debugging, the value is clamped to supportedInstructionSet().
+    NIMBLE_API void setInstructionSet(InstructionSet set);
+
+    /// out[i] = m.project(in[i])
+    NIMBLE_API void project(const Matrix3f & m, const Vector2f * in, Vector2f * out, size_t count);
+
+    /// Same as project, but assumes that the last row of m is [0 0 1], so
+    /// there is no perspective division. Use this for normal 2D widget
+    /// transformations.
+    NIMBLE_API void transformAffine(const Matrix3f & m, const Vector2f * in, Vector2f * out, size_t count);
+
+    /// out[i] = m.project(in[i]), the input vectors are interpreted as [x y 0 1]
+    NIMBLE_API void project(const Matrix4f & m, const Vector2f * in, Vector2f * out, size_t count);
+
+    /// out[i] = m.project(in[i])
+    NIMBLE_API void project(const Matrix4f & m, const Vector3f * in, Vector3f * out, size_t count);
+
+    /// Returns the axis-aligned bounding box of the points, or an empty
+    /// rectangle if count is zero.
+    NIMBLE_API Rectf boundingBox(const Vector2f * points, size_t count);
+
+    /// Tests rect against all rectangles in rects using the separating axis
+    /// theorem. Gives the same results as Rectangle::intersects, also for
+    /// rectangles with skewed axes made by transformations with shear.
+    /// @param results results[i] is set to 1 if rect intersects rects[i], otherwise 0
+    /// @return number of intersecting rectangles
+    NIMBLE_API size_t intersects(const Rectangle & rect, const Rectangle * rects, size_t count,
+                                 uint8_t * results);
+  }
+}
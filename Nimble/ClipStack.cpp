@@ -9,9 +9,48 @@
  */
 
 #include "ClipStack.hpp"
+#include "Batch.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
+namespace
+{
+  inline uint64_t mix(uint64_t h, uint64_t v)
+  {
+    // splitmix64 finalizer
+    h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+  }
+
+  inline uint64_t mix(uint64_t h, float f)
+  {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return mix(h, static_cast<uint64_t>(bits));
+  }
+
+  uint64_t rectangleKey(uint64_t h, const Nimble::Rectangle & r)
+  {
+    h = mix(h, r.center().x);
+    h = mix(h, r.center().y);
+    h = mix(h, r.axis0().x);
+    h = mix(h, r.axis0().y);
+    h = mix(h, r.axis1().x);
+    h = mix(h, r.axis1().y);
+    h = mix(h, r.extent0());
+    h = mix(h, r.extent1());
+    // Zero is reserved for the empty stack
+    return h ? h : 1;
+  }
+}
+
 namespace Nimble
 {
 
@@ -20,31 +59,37 @@ class ClipStack::D
 public:
   struct StackItem
   {
-    Nimble::Rectangle m_rectangle;
     Nimble::Rect m_compoundedBoundingBox;
+    uint64_t m_key;
   };
 
   typedef std::vector<StackItem> Stack;
   Stack m_stack;
+  /// Rectangles of the stack items, stored separately so that they can be
+  /// tested with Batch::intersects
+  std::vector<Nimble::Rectangle> m_rectangles;
 
   void push(const Rectangle & r)
   {
     StackItem si;
 
-    si.m_rectangle = r;
-
-    if(m_stack.empty())
+    if(m_stack.empty()) {
       si.m_compoundedBoundingBox = r.boundingBox();
-    else
+      si.m_key = rectangleKey(0, r);
+    } else {
       si.m_compoundedBoundingBox = m_stack.back().m_compoundedBoundingBox.intersection(r.boundingBox());
+      si.m_key = rectangleKey(m_stack.back().m_key, r);
+    }
 
     m_stack.push_back(si);
+    m_rectangles.push_back(r);
   }
 
   void pop()
   {
     assert(m_stack.empty() == false);
     m_stack.pop_back();
+    m_rectangles.pop_back();
   }
 };
 
@@ -91,14 +136,36 @@ bool ClipStack::isVisible(const Rectangle &r) const
   if (r.extent0() <= 0.f || r.extent1() <= 0.f)
     return false;
 
-  auto bb = r.boundingBox();
-  for(D::Stack::reverse_iterator it = m_d->m_stack.rbegin(); it != m_d->m_stack.rend(); ++it) {
-    if(!it->m_compoundedBoundingBox.intersects(bb))
+  // The compounded bounding box of the top item is inside all the others
+  if(!m_d->m_stack.back().m_compoundedBoundingBox.intersects(r.boundingBox()))
+    return false;
+
+  // Test the top of the stack first, it's the most likely to clip r
+  const Rectangle * rects = m_d->m_rectangles.data();
+  uint8_t results[32];
+  for(size_t end = m_d->m_rectangles.size(); end > 0;) {
+    const size_t count = std::min<size_t>(end, sizeof(results));
+    end -= count;
+    if(Batch::intersects(r, rects + end, count, results) != count)
       return false;
+  }
 
-    const D::StackItem & si = *it;
+  return true;
+}
+
+bool ClipStack::contains(const Rectangle & r) const
+{
+  if(m_d->m_stack.empty())
+    return true;
 
-    if(!si.m_rectangle.intersects(r))
+  // If the bounding box isn't inside the compounded bounding box, some part
+  // of r is clipped by at least one rectangle
+  auto bb = r.boundingBox();
+  if(!m_d->m_stack.back().m_compoundedBoundingBox.contains(bb))
+    return false;
+
+  for(auto it = m_d->m_rectangles.rbegin(); it != m_d->m_rectangles.rend(); ++it) {
+    if(!it->contains(r))
       return false;
   }
 
@@ -110,13 +177,11 @@ bool ClipStack::isVisible(const Nimble::Vector2 & p) const
   if(m_d->m_stack.empty())
     return true;
 
-  for(D::Stack::reverse_iterator it = m_d->m_stack.rbegin(); it != m_d->m_stack.rend(); ++it) {
-    if(!it->m_compoundedBoundingBox.contains(p))
+  for(size_t i = m_d->m_stack.size(); i-- > 0;) {
+    if(!m_d->m_stack[i].m_compoundedBoundingBox.contains(p))
       return false;
 
-    const D::StackItem & si = *it;
-
-    if(!si.m_rectangle.contains(p))
+    if(!m_d->m_rectangles[i].contains(p))
       return false;
   }
 
@@ -131,6 +196,14 @@ Rect ClipStack::boundingBox() const
   return m_d->m_stack.back().m_compoundedBoundingBox;
 }
 
+uint64_t ClipStack::key() const
+{
+  if(m_d->m_stack.empty())
+    return 0;
+
+  return m_d->m_stack.back().m_key;
+}
+
 size_t ClipStack::stackDepth() const
 {
   return m_d->m_stack.size();
@@ -138,8 +211,8 @@ size_t ClipStack::stackDepth() const
 
 Rectangle ClipStack::stackRectangle(size_t index) const
 {
-  assert(index < m_d->m_stack.size());
-  return m_d->m_stack.at(index).m_rectangle;
+  assert(index < m_d->m_rectangles.size());
+  return m_d->m_rectangles.at(index);
 }
 
 }
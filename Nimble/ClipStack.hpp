@@ -14,6 +14,8 @@
 #include "Export.hpp"
 #include "Rectangle.hpp"
 
+#include <cstdint>
+
 namespace Nimble
 {
   /// This class provides an implementation of a clipping stack. The stack is
@@ -53,11 +55,22 @@ namespace Nimble
     /// @param p point to check
     /// @return true if the point is visible: otherwise false
     bool isVisible(const Nimble::Vector2 & p) const;
+    /// Check if the given rectangle is fully visible, i.e. it is inside every
+    /// rectangle in the stack.
+    /// @param r rectangle to check
+    /// @return true if nothing of r is clipped
+    bool contains(const Nimble::Rectangle & r) const;
 
     /// Get the bounding box encompassing all the rectangles in the clipstack.
     /// @return bounding box of all rectangles
     Nimble::Rect boundingBox() const;
 
+    /// Get a key that identifies the contents of the stack. Stacks with the
+    /// same rectangles have the same key even if they are different objects,
+    /// so the key can be used to cache visibility results across frames.
+    /// @return key of the stack, or zero if the stack is empty
+    uint64_t key() const;
+
     /// Get the depth of the clip stack. Returns the number of rectangles in the stack.
     /// @return depth of the stack
     size_t stackDepth() const;
@@ -3,6 +3,7 @@ include(../setup.pri)
 HEADERS += Export.hpp \
     LineIntersection.hpp \
     Circle.hpp
+HEADERS += Batch.hpp
 HEADERS += Frame4.hpp
 HEADERS += ClipStack.hpp
 HEADERS += SmoothingFilter.hpp
@@ -31,6 +32,7 @@ HEADERS += Vector3.hpp
 HEADERS += Vector4.hpp
 HEADERS += ClipRegion.hpp
 
+SOURCES += Batch.cpp
 SOURCES += ClipStack.cpp \
     Circle.cpp
 SOURCES += KeyStone.cpp
@@ -9,6 +9,7 @@
  */
 
 #include "Rectangle.hpp"
+#include "Batch.hpp"
 
 #include <numeric>
 
@@ -210,9 +211,7 @@ namespace Nimble
   void Rectangle::transform(const Nimble::Matrix3 &m)
   {
     std::array<Nimble::Vector2, 4> vertex = computeCorners();
-
-    for(size_t i = 0; i < 4; i++)
-      vertex[i] = m.project(vertex[i]);
+    Batch::project(m, vertex.data(), vertex.data(), vertex.size());
 
     /// We have now transformed all the four corners. Now calculate minimum
     /// bounding rectangle for those points by taking one edge of the rectangle
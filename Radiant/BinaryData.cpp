@@ -23,6 +23,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <atomic>
+#include <new>
+#include <utility>
+
 #ifdef _MSC_VER
 #define strtoll _strtoi64
 #endif
@@ -63,28 +67,159 @@ namespace Radiant {
   const int32_t BinaryData::STRING_MARKER = makeMarker(',', 's', '\0', '\0');
   const int32_t BinaryData::BLOB_MARKER   = makeMarker(',', 'b', '\0', '\0');
 
+  /// Arena allocations are done from blocks of this size
+  static const size_t s_arenaBlockSize = 64 * 1024;
+  /// Bigger buffers are always allocated from the heap
+  static const size_t s_maxArenaAllocation = s_arenaBlockSize / 4;
+  /// Space reserved for ArenaBlock in the beginning of each block, keeps
+  /// the data 16-byte aligned
+  static const size_t s_arenaHeaderSize = 64;
+
+  /// Block of memory in the per-thread arena. Buffers are allocated linearly
+  /// from the block, and each buffer holds a reference to its block. The
+  /// thread arena holds one reference to its current block. Once all other
+  /// references are gone, the arena can start reusing the block from the
+  /// beginning.
+  struct BinaryData::ArenaBlock
+  {
+    std::atomic<int> refs{1};
+    size_t used = 0;
+    size_t size = 0;
+
+    char * data() { return reinterpret_cast<char*>(this) + s_arenaHeaderSize; }
+
+    void unref()
+    {
+      if (--refs == 0) {
+        this->~ArenaBlock();
+        free(this);
+      }
+    }
+
+    static ArenaBlock * create(size_t size)
+    {
+      static_assert(sizeof(ArenaBlock) <= s_arenaHeaderSize, "ArenaBlock header too large");
+      void * mem = malloc(s_arenaHeaderSize + size);
+      auto block = new (mem) ArenaBlock();
+      block->size = size;
+      return block;
+    }
+
+    struct Arena
+    {
+      ~Arena() { if (current) current->unref(); }
+      bool enabled = false;
+      ArenaBlock * current = nullptr;
+    };
+
+    static Arena & threadArena()
+    {
+      thread_local Arena arena;
+      return arena;
+    }
+
+    /// Allocates memory from the arena of the calling thread
+    /// @param[out] ptr allocated memory
+    /// @return block that owns the memory, with a reference added
+    static ArenaBlock * allocate(size_t bytes, char *& ptr)
+    {
+      Arena & arena = threadArena();
+      bytes = (bytes + 15) & ~size_t(15);
+
+      ArenaBlock * block = arena.current;
+      // Only the arena has a reference to the block, and since only this
+      // thread allocates from it, the whole block can be reused
+      if (block && block->refs.load() == 1)
+        block->used = 0;
+
+      if (!block || block->used + bytes > block->size) {
+        if (block)
+          block->unref();
+        block = arena.current = create(s_arenaBlockSize);
+      }
+
+      ptr = block->data() + block->used;
+      block->used += bytes;
+      ++block->refs;
+      return block;
+    }
+  };
+
   BinaryData::BinaryData()
     : m_current(0),
     m_total(0),
-    m_size(0),
-    m_shared(false),
-    m_buf(0)
+    m_size(INLINE_CAPACITY),
+    m_storage(STORAGE_INLINE),
+    m_buf(m_inline),
+    m_block(nullptr)
   {}
 
   BinaryData::BinaryData(const BinaryData & that)
     : m_current(0),
     m_total(0),
-    m_size(0),
-    m_shared(false),
-    m_buf(0)
+    m_size(INLINE_CAPACITY),
+    m_storage(STORAGE_INLINE),
+    m_buf(m_inline),
+    m_block(nullptr)
   {
     *this = that;
   }
 
+  BinaryData::BinaryData(BinaryData && that)
+    : m_current(0),
+    m_total(0),
+    m_size(INLINE_CAPACITY),
+    m_storage(STORAGE_INLINE),
+    m_buf(m_inline),
+    m_block(nullptr)
+  {
+    *this = std::move(that);
+  }
+
   BinaryData::~BinaryData()
   {
-    if(!m_shared)
-      free(m_buf);
+    release();
+  }
+
+  BinaryData & BinaryData::operator=(BinaryData && that)
+  {
+    if(this == &that)
+      return *this;
+
+    if(that.m_storage == STORAGE_INLINE) {
+      // Small enough to just copy
+      *this = that;
+    } else {
+      release();
+      m_current = that.m_current;
+      m_total = that.m_total;
+      m_size = that.m_size;
+      m_storage = that.m_storage;
+      m_buf = that.m_buf;
+      m_block = that.m_block;
+
+      that.m_storage = STORAGE_INLINE;
+      that.m_buf = that.m_inline;
+      that.m_size = INLINE_CAPACITY;
+      that.m_block = nullptr;
+    }
+    that.clear();
+    return *this;
+  }
+
+  void BinaryData::setThreadArenaEnabled(bool enabled)
+  {
+    ArenaBlock::Arena & arena = ArenaBlock::threadArena();
+    arena.enabled = enabled;
+    if(!enabled && arena.current) {
+      arena.current->unref();
+      arena.current = nullptr;
+    }
+  }
+
+  bool BinaryData::isThreadArenaEnabled()
+  {
+    return ArenaBlock::threadArena().enabled;
   }
 
   void BinaryData::writeFloat32(float v)
@@ -220,13 +355,13 @@ namespace Radiant {
 
     if(marker == FLOAT_MARKER)
       return getRef<float>();
-    else if(marker == DOUBLE_MARKER)
+    else if(marker == DOUBLE_MARKER && available(8))
       return getRef<double>();
     else if(marker == INT32_MARKER)
       return float(getRef<int32_t>());
-    else if(marker == INT64_MARKER)
+    else if(marker == INT64_MARKER && available(8))
       return float(getRef<int64_t>());
-    else if (marker == STRING_MARKER) {
+    else if (marker == STRING_MARKER && isStringTerminated()) {
       const char * source = & m_buf[m_current];
       m_current += (unsigned) stringSpace(source);
       return QByteArray(source).toFloat(ok);
@@ -254,13 +389,13 @@ namespace Radiant {
 
     if(marker == FLOAT_MARKER)
       return getRef<float>();
-    else if(marker == DOUBLE_MARKER)
+    else if(marker == DOUBLE_MARKER && available(8))
       return getRef<double>();
     else if(marker == INT32_MARKER)
       return float(getRef<int32_t>());
-    else if(marker == INT64_MARKER)
+    else if(marker == INT64_MARKER && available(8))
       return float(getRef<int64_t>());
-    else if (marker == STRING_MARKER) {
+    else if (marker == STRING_MARKER && isStringTerminated()) {
       const char * source = & m_buf[m_current];
       m_current += (unsigned) stringSpace(source);
       return QByteArray(source).toDouble(ok);
@@ -295,7 +430,7 @@ namespace Radiant {
       return Nimble::Math::Round(getRef<float>());
     else if(marker == DOUBLE_MARKER && available(8))
       return Nimble::Math::Round(getRef<double>());
-    else if (marker == STRING_MARKER) {
+    else if (marker == STRING_MARKER && isStringTerminated()) {
       const char * source = & m_buf[m_current];
       char * end = (char *) source;
       long d = strtol(m_buf + m_current, & end, 10);
@@ -331,15 +466,15 @@ namespace Radiant {
 
     int32_t marker = getRef<int32_t>();
 
-    if(marker == INT64_MARKER)
+    if(marker == INT64_MARKER && available(8))
       return getRef<int64_t>();
     else if(marker == INT32_MARKER)
       return getRef<int32_t>();
     else if(marker == FLOAT_MARKER)
       return Nimble::Math::Round(getRef<float>());
-    else if(marker == DOUBLE_MARKER)
+    else if(marker == DOUBLE_MARKER && available(8))
       return Nimble::Math::Round(getRef<double>());
-    else if (marker == STRING_MARKER) {
+    else if (marker == STRING_MARKER && isStringTerminated()) {
       const char * source = & m_buf[m_current];
       char * end = (char *) source;
       long long d = strtoll(m_buf + m_current, & end, 10);
@@ -378,7 +513,7 @@ namespace Radiant {
 
     if(marker == TS_MARKER && available(8))
       return TimeStamp(getRef<int64_t>());
-    else if (marker == STRING_MARKER && available(10)) {
+    else if (marker == STRING_MARKER && available(10) && isStringTerminated()) {
       const char * source = & m_buf[m_current];
       DateTime dt;
       bool dtok = dt.fromString(source);
@@ -405,7 +540,7 @@ namespace Radiant {
 
     int32_t marker = getRef<int32_t>();
 
-    if(marker != STRING_MARKER) {
+    if(marker != STRING_MARKER || !isStringTerminated()) {
       skipParameter(marker);
       return false;
     }
@@ -435,7 +570,7 @@ namespace Radiant {
 
     int32_t marker = getRef<int32_t>();
 
-    if(marker == STRING_MARKER) {
+    if(marker == STRING_MARKER && isStringTerminated()) {
       str = QString::fromUtf8(m_buf + m_current);
       skipParameter(marker);
     } else {
@@ -455,7 +590,7 @@ namespace Radiant {
 
     int32_t marker = getRef<int32_t>();
 
-    if(marker == STRING_MARKER) {
+    if(marker == STRING_MARKER && isStringTerminated()) {
       str = m_buf + m_current;
       skipParameter(marker);
     } else {
@@ -479,6 +614,12 @@ namespace Radiant {
       return false;
     }
 
+    if(!availableBlob()) {
+      unavailable("BinaryData::readBlob");
+      m_current = m_total;
+      return false;
+    }
+
     int32_t recv = getRef<int32_t>();
 
     const char * source = & m_buf[m_current];
@@ -504,6 +645,12 @@ namespace Radiant {
       return false;
     }
 
+    if(!availableBlob()) {
+      unavailable("BinaryData::readBlob");
+      m_current = m_total;
+      return false;
+    }
+
     int32_t recv = getRef<int32_t>();
 
     const char * source = & m_buf[m_current];
@@ -533,6 +680,12 @@ namespace Radiant {
       return -1;
     }
 
+    if(!availableBlob()) {
+      unavailable("BinaryData::readBlobPtr");
+      m_current = m_total;
+      return -1;
+    }
+
     int32_t recv = getRef<int32_t>();
 
     ptr = &m_buf[m_current];
@@ -592,7 +745,7 @@ namespace Radiant {
 
       return Nimble::Vector2f(r.x, r.y);
     }
-    else if(marker == STRING_MARKER) {
+    else if(marker == STRING_MARKER && isStringTerminated()) {
       BD_STR_TO_VEC(Nimble::Vector2f, 2, ok);
     }
     else {
@@ -626,7 +779,7 @@ namespace Radiant {
 
       return Nimble::Vector3f(r.x, r.y, r.z);
     }
-    else if(marker == STRING_MARKER) {
+    else if(marker == STRING_MARKER && isStringTerminated()) {
       BD_STR_TO_VEC(Nimble::Vector3f, 3, ok);
     }
     else {
@@ -714,10 +867,10 @@ namespace Radiant {
 
     int32_t marker = getRef<int32_t>();
 
-    if(marker == VECTOR4I_MARKER) {
+    if(marker == VECTOR4I_MARKER && available(16)) {
       return getRef<Nimble::Vector4i>();
     }
-    else if(marker == VECTOR4F_MARKER) {
+    else if(marker == VECTOR4F_MARKER && available(16)) {
       Nimble::Vector4f r = getRef<Nimble::Vector4f>();
 
       return Nimble::Vector4i(r.x, r.y, r.z, r.w);
@@ -746,15 +899,15 @@ namespace Radiant {
 
     int32_t marker = getRef<int32_t>();
 
-    if(marker == VECTOR4I_MARKER) {
+    if(marker == VECTOR4I_MARKER && available(16)) {
       Nimble::Vector4i r = getRef<Nimble::Vector4i>();
 
       return Nimble::Vector4f(r.x, r.y, r.z, r.w);
     }
-    else if(marker == VECTOR4F_MARKER) {
+    else if(marker == VECTOR4F_MARKER && available(16)) {
       return getRef<Nimble::Vector4f>();
     }
-    else if(marker == STRING_MARKER) {
+    else if(marker == STRING_MARKER && isStringTerminated()) {
       BD_STR_TO_VEC(Nimble::Vector4f, 4, ok);
     }
     else {
@@ -822,7 +975,7 @@ namespace Radiant {
       return false;
     }
 
-    if(m_size < s) {
+    if(m_size < s + 8) {
       if(s > 500000000) { // Not more than 500 MB at once, please
         Radiant::error("BinaryData::read # Attempting extraordinary read (%d bytes)", s);
         return false;
@@ -830,7 +983,9 @@ namespace Radiant {
       ensure(s + 8);
     }
 
-    memset(&m_buf[0], 0, m_size);
+    // Terminate the data, so that reading a corrupted string can't go past
+    // the received bytes
+    memset(&m_buf[s], 0, 8);
 
     n = 0;
     while (s > 0) {
@@ -860,32 +1015,60 @@ namespace Radiant {
 
   void BinaryData::linkTo(void * data, int capacity)
   {
-    if(!m_shared && m_buf)
-      free(m_buf);
+    release();
 
     m_buf = (char *) data;
     m_size = capacity;
-    m_shared = true;
+    m_storage = STORAGE_SHARED;
   }
 
   void BinaryData::ensure(size_t bytes)
   {
     size_t need = m_current + bytes;
     if(need > m_size) {
-      if(m_shared)
+      if(m_storage == STORAGE_SHARED)
         fatal("BinaryData::ensure # Sharing data, cannot ensure required space");
 
-      m_size = (unsigned) (need + 128 + need / 16);
-      m_buf = (char *) realloc(m_buf, m_size);
+      grow(need + 128 + need / 16);
     }
     m_total = (unsigned) (m_current + bytes);
   }
 
-  void BinaryData::clear()
+  void BinaryData::grow(size_t capacity)
   {
-    rewind();
+    char * buf = nullptr;
+    ArenaBlock * block = nullptr;
+
+    if(capacity <= s_maxArenaAllocation && ArenaBlock::threadArena().enabled) {
+      block = ArenaBlock::allocate(capacity, buf);
+    } else if(m_storage == STORAGE_HEAP) {
+      m_buf = (char *) realloc(m_buf, capacity);
+      m_size = (unsigned) capacity;
+      return;
+    } else {
+      buf = (char *) malloc(capacity);
+    }
+
+    memcpy(buf, m_buf, m_size);
+    release();
+
+    m_buf = buf;
+    m_block = block;
+    m_size = (unsigned) capacity;
+    m_storage = block ? STORAGE_ARENA : STORAGE_HEAP;
+  }
+
+  void BinaryData::release()
+  {
+    if(m_storage == STORAGE_HEAP)
+      free(m_buf);
+    else if(m_storage == STORAGE_ARENA)
+      m_block->unref();
 
-    memset(data(), 0, m_size);
+    m_storage = STORAGE_INLINE;
+    m_buf = m_inline;
+    m_size = INLINE_CAPACITY;
+    m_block = nullptr;
   }
 
   bool BinaryData::saveToFile(const char * filename) const
@@ -944,15 +1127,37 @@ namespace Radiant {
             marker == VECTOR2I_MARKER)
       m_current += 8;
     else if(marker == STRING_MARKER) {
-      const char * str = & m_buf[m_current];
-      m_current += (unsigned) stringSpace(str);
+      if(isStringTerminated()) {
+        const char * str = & m_buf[m_current];
+        m_current += (unsigned) stringSpace(str);
+      } else {
+        m_current = m_total;
+      }
     }
     else if(marker == BLOB_MARKER) {
-      int n = getRef<int32_t>();
-      m_current += n;
+      if(availableBlob()) {
+        int n = getRef<int32_t>();
+        m_current += n;
+      } else {
+        m_current = m_total;
+      }
     }
   }
 
+  bool BinaryData::isStringTerminated() const
+  {
+    return m_current < m_total && memchr(m_buf + m_current, 0, m_total - m_current) != nullptr;
+  }
+
+  bool BinaryData::availableBlob() const
+  {
+    if(!available(sizeof(int32_t)))
+      return false;
+    int32_t n;
+    memcpy(&n, m_buf + m_current, sizeof(n));
+    return n >= 0 && available(sizeof(int32_t) + static_cast<unsigned>(n));
+  }
+
   size_t BinaryData::stringSpace(const char * str) const
   {
     size_t len = strlen(str) + 1;
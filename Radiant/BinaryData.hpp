@@ -65,6 +65,11 @@ namespace Radiant {
       \b Reading functions set the optional bool argument "ok" to true
       if the operation is successful and to false if it fails.
 
+      \b Memory: Payloads up to INLINE_CAPACITY bytes are stored inside the
+      object itself, so typical event and control messages never touch the
+      heap. Larger buffers are allocated from the heap, or from a per-thread
+      arena if it has been enabled with setThreadArenaEnabled().
+
   */
 
   class RADIANT_API BinaryData
@@ -84,11 +89,17 @@ namespace Radiant {
     static const int32_t STRING_MARKER;
     static const int32_t BLOB_MARKER;
 
+    /// Number of bytes that can be stored without any memory allocations
+    static constexpr unsigned INLINE_CAPACITY = 128;
+
   public:
     /// Constructs empty data container
     BinaryData();
     /// Copy constructor
     BinaryData(const BinaryData & );
+    /// Move constructor, takes over the buffer of the other object if it
+    /// is not stored inline
+    BinaryData(BinaryData && that);
     /// Destructor
     ~BinaryData();
 
@@ -324,14 +335,33 @@ namespace Radiant {
     /// Ensure that at least required amount of bytes is available
     /// @param bytes
     void ensure(size_t bytes);
-    /// Rewind the buffer and fill it with zeroes
-    void clear();
+    /// Rewinds the buffer and marks it empty. The allocated memory is kept
+    /// for reuse and the old contents are not overwritten.
+    void clear() { m_current = 0; m_total = 0; }
+
+    /// Number of bytes that can be written without reallocating the buffer
+    inline unsigned capacity() const { return m_size; }
 
     /// Copy a buffer object
     /// @param that Buffer to assign
     /// @return Reference to this
     inline BinaryData & operator = (const BinaryData & that)
     { rewind(); append(that); m_current = that.m_current; return * this;}
+    /// Move a buffer object
+    /// @param that Buffer to assign, will be empty after this
+    /// @return Reference to this
+    BinaryData & operator = (BinaryData && that);
+
+    /// Enables or disables the arena allocator for the calling thread.
+    /// When enabled, buffers that outgrow the inline storage are allocated
+    /// from a thread-local arena instead of the heap. This is meant for
+    /// threads that build lots of short-lived messages. The buffers can
+    /// still be freely moved to and destroyed in other threads, but a
+    /// long-lived buffer keeps its whole arena block (64 kB) allocated.
+    /// Disabled by default.
+    static void setThreadArenaEnabled(bool enabled);
+    /// @return true if the arena allocator is enabled for the calling thread
+    static bool isThreadArenaEnabled();
     /// Saves this buffer to the given file
     /// @param filename Name of the target file
     /// @return True if write was succesful, false otherwise
@@ -355,16 +385,40 @@ namespace Radiant {
     { return (m_current + bytes) <= m_total; }
     void skipParameter(int marker);
     size_t stringSpace(const char * str) const;
+    /// True if there is a zero-terminated string at the read position. The
+    /// data is not always followed by zeros (see linkTo), so this must be
+    /// checked before any string function is used on it.
+    bool isStringTerminated() const;
+    /// True if the blob size at the read position is valid and the blob fits
+    bool availableBlob() const;
 
     void unavailable(const char * func) const;
 
+    // reallocates m_buf to have at least the given capacity
+    void grow(size_t capacity);
+    // releases m_buf and switches back to inline storage
+    void release();
+
+    struct ArenaBlock;
+
+    enum Storage : uint8_t
+    {
+      STORAGE_INLINE,
+      STORAGE_HEAP,
+      STORAGE_ARENA,
+      STORAGE_SHARED
+    };
+
     unsigned m_current;
     // number of bytes used in the buffer
     unsigned m_total;
     // number of bytes allocated, the capacity of m_buf
     unsigned m_size;
-    bool     m_shared;
+    Storage  m_storage;
     char    *m_buf;
+    // arena block that owns m_buf with STORAGE_ARENA
+    ArenaBlock * m_block;
+    alignas(8) char m_inline[INLINE_CAPACITY];
   };
 
   template <> inline float BinaryData::read(bool * ok)            { return readFloat32(ok); }
@@ -252,6 +252,29 @@ namespace Radiant
       return Reader(*this, m_buffer.data() + m_reader, count);
     }
 
+    /// Copies max count elements to output without consuming them. Can be
+    /// called only from the reader thread.
+    /// @param offset number of elements to skip from the beginning of the buffer
+    /// @returns number of elements written to output, less than count if the
+    ///          buffer doesn't have enough data
+    int peek(T* output, int count, int offset = 0) const
+    {
+      const int capacity = static_cast<int>(m_buffer.size());
+
+      count = std::min<int>(count, m_size - offset);
+      if (count <= 0)
+        return 0;
+
+      const int start = (m_reader + offset) % capacity;
+      const int part1 = std::min(count, capacity - start);
+      const int part2 = count - part1;
+
+      if (part1) std::copy_n(m_buffer.data() + start, part1, output);
+      if (part2) std::copy_n(m_buffer.data(), part2, output + part1);
+
+      return count;
+    }
+
     /// Returns the number of elements in the buffer. Can be called from all threads.
     int size() const
     {
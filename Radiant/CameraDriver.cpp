@@ -25,6 +25,7 @@
 #endif
 
 #include <Radiant/Trace.hpp>
+#include <Radiant/VideoCameraSynthetic.hpp>
 
 namespace Radiant
 {
@@ -73,6 +74,8 @@ namespace Radiant
 #ifdef CAMERA_DRIVER_1394
       registerDriver(new CameraDriver1394());
 #endif
+
+      registerDriver(new CameraDriverSynthetic());
     }
 
     DriverMap::iterator it = m_drivers.find(driverName);
@@ -0,0 +1,422 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "FramedStream.hpp"
+
+#include "BinaryData.hpp"
+#include "BinaryStream.hpp"
+#include "SocketWrapper.hpp"
+#include "TCPSocket.hpp"
+#include "Timer.hpp"
+#include "Trace.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <optional>
+
+#include "BlockRingBuffer.hpp"
+
+#ifndef RADIANT_WINDOWS
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+
+namespace
+{
+  /// Same limit as in BinaryData::read
+  const uint32_t s_defaultMaxMessageSize = 500000000;
+}
+
+namespace Radiant
+{
+  class FramedWriter::D
+  {
+  public:
+    D(BinaryStream & stream, int maxBatchBytes)
+      : m_stream(stream)
+      , m_maxBatchBytes(maxBatchBytes)
+    {}
+
+    bool flushCopy();
+#ifndef RADIANT_WINDOWS
+    bool flushGather(int fd);
+#endif
+
+  public:
+    BinaryStream & m_stream;
+    const int m_maxBatchBytes;
+    int m_writeTimeoutMs = 5000;
+
+    /// Length prefix of each message
+    std::vector<int32_t> m_headers;
+    std::vector<const char *> m_payloads;
+    int m_pendingBytes = 0;
+
+    std::vector<char> m_scratch;
+  };
+
+  bool FramedWriter::D::flushCopy()
+  {
+    m_scratch.resize(m_pendingBytes);
+    char * out = m_scratch.data();
+    for (size_t i = 0; i < m_headers.size(); ++i) {
+      memcpy(out, &m_headers[i], sizeof(int32_t));
+      out += sizeof(int32_t);
+      memcpy(out, m_payloads[i], m_headers[i]);
+      out += m_headers[i];
+    }
+    return m_stream.write(m_scratch.data(), m_pendingBytes) == m_pendingBytes;
+  }
+
+#ifndef RADIANT_WINDOWS
+  bool FramedWriter::D::flushGather(int fd)
+  {
+    std::vector<iovec> iov;
+    iov.reserve(m_headers.size() * 2);
+    for (size_t i = 0; i < m_headers.size(); ++i) {
+      iov.push_back({&m_headers[i], sizeof(int32_t)});
+      if (m_headers[i] > 0)
+        iov.push_back({const_cast<char*>(m_payloads[i]), static_cast<size_t>(m_headers[i])});
+    }
+
+    Radiant::Timer timer;
+    size_t index = 0;
+    while (index < iov.size()) {
+      const int count = static_cast<int>(std::min<size_t>(iov.size() - index, IOV_MAX));
+      ssize_t written = ::writev(fd, iov.data() + index, count);
+      if (written < 0) {
+        const int err = SocketWrapper::err();
+        if (err == EINTR)
+          continue;
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+          // Non-blocking socket, wait until there is room in the send buffer
+          int waitMs = -1;
+          if (m_writeTimeoutMs >= 0) {
+            waitMs = m_writeTimeoutMs - static_cast<int>(timer.time() * 1000.0);
+            if (waitMs <= 0) {
+              Radiant::error("FramedWriter::flush # Timed out after %d ms waiting for the socket",
+                             m_writeTimeoutMs);
+              return false;
+            }
+          }
+          struct pollfd pfd;
+          pfd.fd = fd;
+          pfd.events = POLLOUT;
+          pfd.revents = 0;
+          SocketWrapper::poll(&pfd, 1, waitMs);
+          continue;
+        }
+        Radiant::error("FramedWriter::flush # writev failed: %s", SocketWrapper::strerror(err));
+        return false;
+      }
+
+      while (written > 0) {
+        if (static_cast<size_t>(written) >= iov[index].iov_len) {
+          written -= iov[index].iov_len;
+          ++index;
+        } else {
+          iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + written;
+          iov[index].iov_len -= written;
+          written = 0;
+        }
+      }
+    }
+    return true;
+  }
+#endif
+
+  FramedWriter::FramedWriter(BinaryStream & stream, int maxBatchBytes)
+    : m_d(new D(stream, maxBatchBytes))
+  {
+  }
+
+  FramedWriter::~FramedWriter()
+  {
+    flush();
+  }
+
+  bool FramedWriter::write(const BinaryData & msg)
+  {
+    return write(msg.data(), msg.pos());
+  }
+
+  bool FramedWriter::write(const void * data, int bytes)
+  {
+    if (bytes < 0) {
+      Radiant::error("FramedWriter::write # Invalid message size %d", bytes);
+      return false;
+    }
+
+    m_d->m_headers.push_back(bytes);
+    m_d->m_payloads.push_back(static_cast<const char*>(data));
+    m_d->m_pendingBytes += static_cast<int>(sizeof(int32_t)) + bytes;
+
+    if (m_d->m_pendingBytes >= m_d->m_maxBatchBytes)
+      return flush();
+    return true;
+  }
+
+  bool FramedWriter::flush()
+  {
+    if (m_d->m_headers.empty())
+      return true;
+
+    bool ok;
+#ifndef RADIANT_WINDOWS
+    auto socket = dynamic_cast<TCPSocket*>(&m_d->m_stream);
+    if (socket && socket->fd() >= 0)
+      ok = m_d->flushGather(socket->fd());
+    else
+#endif
+      ok = m_d->flushCopy();
+
+    m_d->m_headers.clear();
+    m_d->m_payloads.clear();
+    m_d->m_pendingBytes = 0;
+    return ok;
+  }
+
+  void FramedWriter::setWriteTimeout(int timeoutMs)
+  {
+    m_d->m_writeTimeoutMs = timeoutMs;
+  }
+
+  int FramedWriter::writeTimeout() const
+  {
+    return m_d->m_writeTimeoutMs;
+  }
+
+  int FramedWriter::pendingMessages() const
+  {
+    return static_cast<int>(m_d->m_headers.size());
+  }
+
+  int FramedWriter::pendingBytes() const
+  {
+    return m_d->m_pendingBytes;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  class FramedReader::D
+  {
+  public:
+    D(BinaryStream & stream, int bufferSize)
+      : m_stream(stream)
+      , m_ring(bufferSize)
+    {}
+
+    /// Reads available data from the stream to the ring buffer
+    /// @param waitMs how long to wait for data, negative waits forever
+    /// @return true if something was read
+    bool fill(int waitMs);
+    /// Takes a complete message of the given size from the ring buffer
+    void extract(BinaryData & msg, uint32_t size);
+    /// Continues reading a message that doesn't fit to the ring buffer
+    bool readLarge(BinaryData & msg, const Radiant::Timer & timer, int timeoutMs);
+
+    int remainingMs(const Radiant::Timer & timer, int timeoutMs) const
+    {
+      if (timeoutMs < 0)
+        return -1;
+      return std::max(0, timeoutMs - static_cast<int>(timer.time() * 1000.0));
+    }
+
+  public:
+    BinaryStream & m_stream;
+    BlockRingBuffer<char> m_ring;
+    /// Holds the data of the previously returned message. It's consumed from
+    /// the ring buffer when this is reset.
+    std::optional<BlockRingBuffer<char>::Reader> m_current;
+
+    /// Messages that wrap around the ring buffer or don't fit in it
+    std::vector<char> m_scratch;
+    uint32_t m_largeSize = 0;
+    uint32_t m_largeFilled = 0;
+    bool m_readingLarge = false;
+
+    uint32_t m_maxMessageSize = s_defaultMaxMessageSize;
+  };
+
+  bool FramedReader::D::fill(int waitMs)
+  {
+    if (m_ring.size() == m_ring.capacity())
+      return false;
+
+    if (waitMs < 0) {
+      while (!m_stream.isPendingInput(1000000)) {
+        if (!m_stream.isOpen())
+          return false;
+      }
+    } else if (!m_stream.isPendingInput(waitMs * 1000)) {
+      return false;
+    }
+
+    bool gotData = false;
+    // The free space can be split in two by the end of the buffer
+    for (int i = 0; i < 2; ++i) {
+      auto writer = m_ring.write(m_ring.capacity());
+      const int space = writer.size();
+      if (space == 0)
+        break;
+
+      int bytes = m_stream.read(writer.data(), space, false);
+      writer.setSize(std::max(0, bytes));
+      if (bytes <= 0)
+        break;
+      gotData = true;
+      if (bytes < space)
+        break;
+    }
+    return gotData;
+  }
+
+  void FramedReader::D::extract(BinaryData & msg, uint32_t size)
+  {
+    const int bytes = static_cast<int>(size);
+    {
+      auto reader = m_ring.read(bytes);
+      if (reader.size() == bytes && bytes > 0) {
+        msg.linkTo(reader.data(), bytes);
+        m_current.emplace(std::move(reader));
+      } else {
+        // The message wraps around the end of the ring buffer
+        m_scratch.resize(std::max(1, bytes));
+        std::copy_n(reader.data(), reader.size(), m_scratch.data());
+        const int part1 = reader.size();
+        {
+          // Consumes the first part
+          auto consumed = std::move(reader);
+        }
+        m_ring.read(m_scratch.data() + part1, bytes - part1);
+        msg.linkTo(m_scratch.data(), bytes);
+      }
+    }
+    msg.setTotal(size);
+    msg.rewind();
+  }
+
+  bool FramedReader::D::readLarge(BinaryData & msg, const Radiant::Timer & timer, int timeoutMs)
+  {
+    m_largeFilled += m_ring.read(m_scratch.data() + m_largeFilled, m_largeSize - m_largeFilled);
+
+    while (m_largeFilled < m_largeSize) {
+      const int waitMs = remainingMs(timer, timeoutMs);
+      if (waitMs < 0) {
+        while (!m_stream.isPendingInput(1000000)) {
+          if (!m_stream.isOpen())
+            return false;
+        }
+      } else if (!m_stream.isPendingInput(waitMs * 1000)) {
+        return false;
+      }
+
+      int bytes = m_stream.read(m_scratch.data() + m_largeFilled, m_largeSize - m_largeFilled, false);
+      if (bytes <= 0)
+        return false;
+      m_largeFilled += bytes;
+    }
+
+    msg.linkTo(m_scratch.data(), m_largeSize);
+    msg.setTotal(m_largeSize);
+    msg.rewind();
+    m_readingLarge = false;
+    return true;
+  }
+
+  FramedReader::FramedReader(BinaryStream & stream, int bufferSize)
+    : m_d(new D(stream, bufferSize))
+  {
+  }
+
+  FramedReader::~FramedReader()
+  {
+  }
+
+  bool FramedReader::read(BinaryData & msg, int timeoutMs)
+  {
+    // The previous message is not used anymore
+    m_d->m_current.reset();
+
+    Radiant::Timer timer;
+
+    if (m_d->m_readingLarge)
+      return m_d->readLarge(msg, timer, timeoutMs);
+
+    for (;;) {
+      uint32_t size = 0;
+      if (m_d->m_ring.peek(reinterpret_cast<char*>(&size), sizeof(size)) == sizeof(size)) {
+        if (size > m_d->m_maxMessageSize) {
+          Radiant::error("FramedReader::read # Invalid message size %u, closing the stream", size);
+          m_d->m_stream.close();
+          return false;
+        }
+
+        if (size + sizeof(size) > static_cast<size_t>(m_d->m_ring.capacity())) {
+          m_d->m_ring.consume(sizeof(size));
+          m_d->m_scratch.resize(size);
+          m_d->m_largeSize = size;
+          m_d->m_largeFilled = 0;
+          m_d->m_readingLarge = true;
+          return m_d->readLarge(msg, timer, timeoutMs);
+        }
+
+        if (static_cast<size_t>(m_d->m_ring.size()) >= size + sizeof(size)) {
+          m_d->m_ring.consume(sizeof(size));
+          m_d->extract(msg, size);
+          return true;
+        }
+      }
+
+      if (!m_d->fill(m_d->remainingMs(timer, timeoutMs)))
+        return false;
+    }
+  }
+
+  bool FramedReader::hasMessage() const
+  {
+    // The previous message is still in the buffer until the next read
+    const int previous = m_d->m_current ? m_d->m_current->size() : 0;
+
+    uint32_t size = 0;
+    if (m_d->m_readingLarge ||
+        m_d->m_ring.peek(reinterpret_cast<char*>(&size), sizeof(size), previous) != sizeof(size))
+      return false;
+    return static_cast<size_t>(m_d->m_ring.size() - previous) >= size + sizeof(size);
+  }
+
+  void FramedReader::setMaxMessageSize(uint32_t bytes)
+  {
+    m_d->m_maxMessageSize = bytes;
+  }
+
+  size_t FramedReader::parse(const char * data, size_t size, const MessageCallback & callback)
+  {
+    size_t pos = 0;
+    BinaryData msg;
+
+    while (size - pos >= sizeof(uint32_t)) {
+      uint32_t bytes;
+      memcpy(&bytes, data + pos, sizeof(bytes));
+      if (size - pos - sizeof(bytes) < bytes)
+        break;
+
+      msg.linkTo(const_cast<char*>(data + pos + sizeof(bytes)), bytes);
+      msg.setTotal(bytes);
+      msg.rewind();
+      callback(msg);
+
+      pos += sizeof(bytes) + bytes;
+    }
+
+    return pos;
+  }
+}
@@ -0,0 +1,132 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+
+#include <Patterns/NotCopyable.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Radiant
+{
+  class BinaryData;
+  class BinaryStream;
+
+  /// Writes BinaryData messages to a stream in batches.
+  ///
+  /// The wire format is the same as with BinaryData::write: a 32-bit length
+  /// followed by the message, so the messages can be read with
+  /// BinaryData::read or FramedReader.
+  ///
+  /// Messages are not copied, they are collected to a batch that is written
+  /// with one writev call when flush() is called or when the batch is full.
+  /// With streams other than TCPSocket the batch is copied to one buffer and
+  /// written with one write call.
+  class RADIANT_API FramedWriter : public Patterns::NotCopyable
+  {
+  public:
+    /// @param stream stream to write to, typically a TCPSocket
+    /// @param maxBatchBytes the batch is flushed automatically when it
+    ///        contains more than this many bytes
+    FramedWriter(BinaryStream & stream, int maxBatchBytes = 64 * 1024);
+    /// Flushes the remaining messages
+    ~FramedWriter();
+
+    /// Adds a message to the batch. The message is not copied, so it needs
+    /// to stay alive and unmodified until the next flush.
+    /// @param msg message, bytes from zero to msg.pos() are sent
+    /// @return false if an automatic flush failed
+    bool write(const BinaryData & msg);
+    /// @copydoc write(const BinaryData&)
+    /// Negative sizes are rejected.
+    bool write(const void * data, int bytes);
+
+    /// Writes all queued messages to the stream
+    /// @return true if everything was written. After a failure the stream
+    ///         may have a partial message, and should be closed.
+    bool flush();
+
+    /// Sets the maximum time one flush waits for room in the send buffer
+    /// of a non-blocking socket. The default is 5000 ms.
+    /// @param timeoutMs timeout in milliseconds, negative waits forever
+    void setWriteTimeout(int timeoutMs);
+    int writeTimeout() const;
+
+    /// Number of messages waiting for flush
+    int pendingMessages() const;
+    /// Number of bytes waiting for flush, including the length prefixes
+    int pendingBytes() const;
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+
+  /// Reads length-prefixed BinaryData messages from a stream.
+  ///
+  /// Data is read from the stream in big chunks to a ring buffer, so a
+  /// batch of small messages usually needs only one read call. Messages are
+  /// given as BinaryData views to the ring buffer memory without copying,
+  /// see BinaryData::linkTo. Messages that wrap around the end of the ring
+  /// buffer or are bigger than it are copied to a separate buffer.
+  ///
+  /// Unlike BinaryData::read, the views are not followed by zero padding.
+  /// BinaryData readers check that strings are terminated and that blobs fit
+  /// inside BinaryData::total(), so malformed messages are rejected instead
+  /// of reading past the message.
+  class RADIANT_API FramedReader : public Patterns::NotCopyable
+  {
+  public:
+    /// Called for every parsed message
+    typedef std::function<void (BinaryData & msg)> MessageCallback;
+
+    /// @param stream stream to read from, typically a TCPSocket
+    /// @param bufferSize size of the ring buffer in bytes
+    FramedReader(BinaryStream & stream, int bufferSize = 1024 * 1024);
+    ~FramedReader();
+
+    /// Reads the next message.
+    /// @param[out] msg linked to the message data. The data is valid until
+    ///             the next call to read or until this object is destroyed.
+    /// @param timeoutMs maximum time to wait for a message. Negative value
+    ///                  waits forever, zero doesn't block at all.
+    /// @return true if a message was read
+    bool read(BinaryData & msg, int timeoutMs = -1);
+
+    /// Returns true if a full message is already in the buffer, so read()
+    /// doesn't need to touch the stream
+    bool hasMessage() const;
+
+    /// Sets the maximum accepted message size. Bigger length prefixes are
+    /// considered a protocol error and the stream is closed. The default is
+    /// 500 MB, the same as with BinaryData::read.
+    void setMaxMessageSize(uint32_t bytes);
+
+    /// Parses messages from a memory buffer, for example from
+    /// ReactorConnection data callback. Messages are linked to the buffer
+    /// without copying. There is no message size limit here, incomplete
+    /// messages are limited by ReactorConnection::setMaxPendingInput.
+    /// @param data buffer that contains zero or more messages
+    /// @param size size of the buffer in bytes
+    /// @param callback called for every complete message
+    /// @return number of bytes consumed, the remaining bytes are an
+    ///         incomplete message
+    static size_t parse(const char * data, size_t size, const MessageCallback & callback);
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
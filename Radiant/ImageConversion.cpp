@@ -37,6 +37,8 @@ namespace Radiant {
     else if(sourceFmt == IMAGE_GRAYSCALE) {
       if(targetFmt == IMAGE_RGB)
         grayscaleToRGB(source, target);
+      else if(targetFmt == IMAGE_RGBA)
+        grayscaleToRGBA(source, target);
       else
         ok = false;
     }
@@ -85,6 +87,14 @@ namespace Radiant {
     else if(sourceFmt == IMAGE_RGB) {
       if(targetFmt == IMAGE_GRAYSCALE)
         RGBToGrayscale(source, target);
+      else if(targetFmt == IMAGE_RGBA)
+        RGBToRGBA(source, target);
+      else
+        ok = false;
+    }
+    else if(sourceFmt == IMAGE_BGR) {
+      if(targetFmt == IMAGE_RGBA)
+        RGBToRGBA(source, target);
       else
         ok = false;
     }
@@ -617,6 +627,33 @@ namespace Radiant {
     }
   }
 
+  void ImageConversion::grayscaleToRGBA
+      (const VideoImage * source, VideoImage * target)
+  {
+    long w = source->m_width;
+    long h = source->m_height;
+
+    target->m_width  = w;
+    target->m_height = h;
+    target->m_format = IMAGE_RGBA;
+    target->m_planes[0].m_type = PLANE_RGBA;
+
+    for(long y = 0; y < h; y++) {
+
+      const uchar * src = source->m_planes[0].line(y);
+      uchar * dest = target->m_planes[0].line(y);
+
+      for(long x = 0; x < w; x++) {
+        uchar tmp = src[x];
+        dest[0] = tmp;
+        dest[1] = tmp;
+        dest[2] = tmp;
+        dest[3] = 0xFF;
+        dest += 4;
+      }
+    }
+  }
+
   void ImageConversion::RGBToGrayscale
       (const VideoImage * source, VideoImage * target)
   {
@@ -645,6 +682,37 @@ namespace Radiant {
     }
   }
 
+  void ImageConversion::RGBToRGBA
+      (const VideoImage * source, VideoImage * target)
+  {
+    long w = source->m_width;
+    long h = source->m_height;
+
+    target->m_width  = w;
+    target->m_height = h;
+    target->m_format = IMAGE_RGBA;
+    target->m_planes[0].m_type = PLANE_RGBA;
+
+    // BGR is converted by swapping the red and blue channels
+    const int r = source->m_format == IMAGE_BGR ? 2 : 0;
+    const int b = 2 - r;
+
+    for(long y = 0; y < h; y++) {
+
+      const uchar * src = source->m_planes[0].line(y);
+      uchar * dest = target->m_planes[0].line(y);
+
+      for(long x = 0; x < w; x++) {
+        dest[0] = src[r];
+        dest[1] = src[1];
+        dest[2] = src[b];
+        dest[3] = 0xFF;
+        src += 3;
+        dest += 4;
+      }
+    }
+  }
+
   void ImageConversion::bayerToRGB(const VideoImage * source, VideoImage * target)
   {
     long lw = source->m_planes[0].m_linesize;
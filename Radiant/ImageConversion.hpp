@@ -64,7 +64,13 @@ namespace Radiant {
     /// @copydoc YUV411PToRGB
     static void grayscaleToRGB(const VideoImage * source, VideoImage * target);
     /// @copydoc YUV411PToRGB
+    static void grayscaleToRGBA(const VideoImage * source, VideoImage * target);
+    /// @copydoc YUV411PToRGB
     static void RGBToGrayscale(const VideoImage * source, VideoImage * target);
+    /// Convert RGB or BGR image to RGBA
+    /// @param source source image
+    /// @param[out] target target image
+    static void RGBToRGBA(const VideoImage * source, VideoImage * target);
 
     /// @copydoc YUV411PToRGB
     static void bayerToRGB(const VideoImage * source, VideoImage * target);
@@ -45,6 +45,7 @@ HEADERS += DateTime.hpp
 HEADERS += Directory.hpp
 HEADERS += Export.hpp
 HEADERS += FileUtils.hpp
+HEADERS += FramedStream.hpp
 HEADERS += Grid.hpp
 HEADERS += ImageConversion.hpp
 HEADERS += IODefs.hpp
@@ -70,6 +71,7 @@ HEADERS += StringUtils.hpp
 HEADERS += SocketUtilPosix.hpp
 HEADERS += TCPServerSocket.hpp
 HEADERS += TCPSocket.hpp
+HEADERS += SocketReactor.hpp
 HEADERS += Thread.hpp
 HEADERS += TimeStamp.hpp
 HEADERS += Trace.hpp
@@ -77,8 +79,10 @@ HEADERS += Types.hpp
 HEADERS += TouchEvent.hpp
 HEADERS += VideoImage.hpp
 HEADERS += VideoInput.hpp
+HEADERS += VideoCaptureQueue.hpp
 HEADERS += WatchDog.hpp
 HEADERS += VideoCamera.hpp
+HEADERS += VideoCameraSynthetic.hpp
 HEADERS += SocketWrapper.hpp
 HEADERS += Singleton.hpp
 HEADERS += VideoCamera1394.hpp
@@ -130,6 +134,7 @@ SOURCES += DateTime.cpp
 SOURCES += DirectoryCommon.cpp
 SOURCES += DirectoryQt.cpp
 SOURCES += FileUtils.cpp
+SOURCES += FramedStream.cpp
 SOURCES += ImageConversion.cpp
 SOURCES += KeyEvent.cpp
 SOURCES += Log.cpp
@@ -141,6 +146,8 @@ SOURCES += TimeStamp.cpp
 SOURCES += Trace.cpp
 SOURCES += VideoImage.cpp
 SOURCES += VideoInput.cpp
+SOURCES += VideoCaptureQueue.cpp
+SOURCES += VideoCameraSynthetic.cpp
 SOURCES += WatchDog.cpp
 SOURCES += Singleton.cpp
 SOURCES += TCPServerSocketPosix.cpp
@@ -182,6 +189,7 @@ ios {
 
 }
 linux*:SOURCES += DeviceMonitor.cpp
+linux*:SOURCES += SocketReactor.cpp
 
 enable-folly {
   HEADERS += ThreadPoolExecutor.hpp
@@ -0,0 +1,896 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "SocketReactor.hpp"
+
+#if defined(RADIANT_LINUX)
+
+#include "Mutex.hpp"
+#include "TCPServerSocket.hpp"
+#include "TCPSocket.hpp"
+#include "Thread.hpp"
+#include "Trace.hpp"
+
+#include <QString>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+  const size_t s_defaultMaxPendingOutput = 64 * 1024 * 1024;
+  const size_t s_defaultMaxPendingInput = 64 * 1024 * 1024;
+  /// Minimum free space in the input buffer for one recv call
+  const size_t s_readChunk = 64 * 1024;
+  /// Maximum number of recv calls per readable event, so that one busy
+  /// connection doesn't starve the others in the same thread
+  const int s_maxReadsPerEvent = 4;
+  /// Maximum number of buffers in one sendmsg call
+  const int s_maxIov = 64;
+
+  bool setNonBlocking(int fd)
+  {
+    int flags = ::fcntl(fd, F_GETFL);
+    return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+  }
+
+  uint32_t toEpoll(uint32_t events)
+  {
+    uint32_t res = 0;
+    if (events & Radiant::SocketReactor::EVENT_READABLE)
+      res |= EPOLLIN;
+    if (events & Radiant::SocketReactor::EVENT_WRITABLE)
+      res |= EPOLLOUT;
+    return res;
+  }
+
+  uint32_t fromEpoll(uint32_t events)
+  {
+    uint32_t res = 0;
+    if (events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP))
+      res |= Radiant::SocketReactor::EVENT_READABLE;
+    if (events & EPOLLOUT)
+      res |= Radiant::SocketReactor::EVENT_WRITABLE;
+    if (events & (EPOLLERR | EPOLLHUP))
+      res |= Radiant::SocketReactor::EVENT_ERROR;
+    return res;
+  }
+
+  /// Sends buffers with one system call.
+  /// @return number of bytes sent, zero if the socket buffer is full or -1 on error
+  ssize_t sendIov(int fd, iovec * iov, int count)
+  {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    for (;;) {
+      ssize_t sent = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (sent >= 0)
+        return sent;
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      Radiant::warning("SocketReactor # Failed to send to socket %d: %s", fd, strerror(errno));
+      return -1;
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  /// One epoll instance and the thread that waits on it
+  class ReactorLoop : public Radiant::Thread
+  {
+  public:
+    struct Entry
+    {
+      std::function<void (uint32_t events)> handler;
+      /// Keeps the connection alive while it's registered
+      Radiant::ReactorConnectionPtr connection;
+    };
+    typedef std::shared_ptr<Entry> EntryPtr;
+
+    ReactorLoop(int index)
+      : Radiant::Thread(QString("SocketReactor #%1").arg(index))
+    {
+      m_epoll = epoll_create1(EPOLL_CLOEXEC);
+      if (m_epoll < 0)
+        Radiant::error("SocketReactor # epoll_create1 failed: %s", strerror(errno));
+
+      m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (m_wakeup < 0)
+        Radiant::error("SocketReactor # eventfd failed: %s", strerror(errno));
+
+      epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = m_wakeup;
+      if (m_epoll >= 0 && m_wakeup >= 0)
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+    }
+
+    ~ReactorLoop()
+    {
+      if (m_wakeup >= 0)
+        ::close(m_wakeup);
+      if (m_epoll >= 0)
+        ::close(m_epoll);
+    }
+
+    bool add(int fd, uint32_t events, EntryPtr entry)
+    {
+      {
+        Radiant::Guard g(m_mutex);
+        m_entries[fd] = entry;
+      }
+
+      epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = events;
+      ev.data.fd = fd;
+      if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        Radiant::warning("SocketReactor # Failed to add socket %d: %s", fd, strerror(errno));
+        Radiant::Guard g(m_mutex);
+        m_entries.erase(fd);
+        return false;
+      }
+      return true;
+    }
+
+    bool modify(int fd, uint32_t events)
+    {
+      epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = events;
+      ev.data.fd = fd;
+      return epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev) == 0;
+    }
+
+    void remove(int fd)
+    {
+      epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+
+      // Release the entry outside the lock, it might own the last reference
+      // to a connection
+      EntryPtr entry;
+      Radiant::Guard g(m_mutex);
+      auto it = m_entries.find(fd);
+      if (it != m_entries.end()) {
+        entry = std::move(it->second);
+        m_entries.erase(it);
+      }
+    }
+
+    /// Runs func in the loop thread
+    void post(std::function<void ()> func)
+    {
+      {
+        Radiant::Guard g(m_mutex);
+        m_posted.push_back(std::move(func));
+      }
+      wake();
+    }
+
+    void stop()
+    {
+      m_running = false;
+      wake();
+    }
+
+    /// Runs the functions that were posted but not run before the loop
+    /// stopped. Call only after the thread has finished.
+    void runPosted()
+    {
+      std::vector<std::function<void ()>> posted;
+      {
+        Radiant::Guard g(m_mutex);
+        std::swap(posted, m_posted);
+      }
+      for (auto & func: posted)
+        func();
+    }
+
+    std::vector<EntryPtr> takeEntries()
+    {
+      std::vector<EntryPtr> entries;
+      Radiant::Guard g(m_mutex);
+      for (auto & p: m_entries)
+        entries.push_back(std::move(p.second));
+      m_entries.clear();
+      return entries;
+    }
+
+  protected:
+    virtual void childLoop() override
+    {
+      std::vector<epoll_event> events(64);
+      std::vector<std::function<void ()>> posted;
+
+      while (m_running) {
+        int count = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0) {
+          if (errno == EINTR)
+            continue;
+          Radiant::error("SocketReactor # epoll_wait failed: %s", strerror(errno));
+          break;
+        }
+
+        for (int i = 0; i < count && m_running; ++i) {
+          const int fd = events[i].data.fd;
+          if (fd == m_wakeup) {
+            uint64_t value;
+            while (::read(m_wakeup, &value, sizeof(value)) > 0) {}
+            {
+              Radiant::Guard g(m_mutex);
+              std::swap(posted, m_posted);
+            }
+            for (auto & func: posted)
+              func();
+            posted.clear();
+            continue;
+          }
+
+          EntryPtr entry;
+          {
+            Radiant::Guard g(m_mutex);
+            auto it = m_entries.find(fd);
+            if (it != m_entries.end())
+              entry = it->second;
+          }
+          if (entry)
+            entry->handler(events[i].events);
+        }
+      }
+    }
+
+  private:
+    void wake()
+    {
+      uint64_t one = 1;
+      if (::write(m_wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        Radiant::warning("SocketReactor # Failed to wake up reactor thread: %s", strerror(errno));
+    }
+
+  private:
+    int m_epoll = -1;
+    int m_wakeup = -1;
+    std::atomic<bool> m_running{true};
+
+    Radiant::Mutex m_mutex;
+    std::unordered_map<int, EntryPtr> m_entries;
+    std::vector<std::function<void ()>> m_posted;
+  };
+}
+
+namespace Radiant
+{
+  class ReactorConnection::D
+  {
+  public:
+    D(ReactorConnection & host, TCPSocket && socket)
+      : m_host(host)
+      , m_socket(std::move(socket))
+      , m_fd(m_socket.fd())
+    {}
+
+    void handleEvents(uint32_t events);
+    void readInput();
+    void flushOutput();
+    void closeNow();
+
+    /// Moves the output queue forward by sent bytes. m_mutex must be locked.
+    void consumeOutput(size_t sent);
+
+  public:
+    ReactorConnection & m_host;
+    TCPSocket m_socket;
+    const int m_fd;
+    std::atomic<bool> m_open{true};
+
+    /// Protects everything below, except the input buffer that is only used
+    /// in the reactor thread
+    mutable Radiant::Mutex m_mutex;
+    ReactorLoop * m_loop = nullptr;
+
+    std::deque<QByteArray> m_output;
+    /// Number of bytes already sent from m_output.front()
+    size_t m_outputOffset = 0;
+    size_t m_pendingOutput = 0;
+    size_t m_maxPendingOutput = s_defaultMaxPendingOutput;
+    /// True if EPOLLOUT is enabled
+    bool m_wantWrite = false;
+
+    DataCallback m_onData;
+    WritableCallback m_onWritable;
+    ClosedCallback m_onClosed;
+
+    std::vector<char> m_input;
+    size_t m_inputBegin = 0;
+    size_t m_inputEnd = 0;
+    /// These are read from other threads, the input buffer itself is not
+    std::atomic<size_t> m_pendingInput{0};
+    std::atomic<size_t> m_maxPendingInput{s_defaultMaxPendingInput};
+
+    std::atomic<uint64_t> m_rxBytes{0};
+    std::atomic<uint64_t> m_txBytes{0};
+  };
+
+  void ReactorConnection::D::handleEvents(uint32_t events)
+  {
+    if (events & (EPOLLIN | EPOLLRDHUP))
+      readInput();
+    if (m_open && (events & EPOLLOUT))
+      flushOutput();
+    // Readable data is read before reacting to errors, recv will report the
+    // actual error or end of stream
+    if (m_open && (events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN))
+      closeNow();
+  }
+
+  void ReactorConnection::D::readInput()
+  {
+    bool closed = false;
+
+    for (int i = 0; i < s_maxReadsPerEvent; ++i) {
+      if (m_inputBegin > 0) {
+        std::memmove(m_input.data(), m_input.data() + m_inputBegin, m_inputEnd - m_inputBegin);
+        m_inputEnd -= m_inputBegin;
+        m_inputBegin = 0;
+      }
+      if (m_input.size() - m_inputEnd < s_readChunk)
+        m_input.resize(m_inputEnd + s_readChunk);
+
+      const size_t space = m_input.size() - m_inputEnd;
+      ssize_t bytes = ::recv(m_fd, m_input.data() + m_inputEnd, space, MSG_DONTWAIT);
+      if (bytes > 0) {
+        m_inputEnd += bytes;
+        m_rxBytes += bytes;
+        if (static_cast<size_t>(bytes) < space)
+          break;
+      } else if (bytes == 0) {
+        closed = true;
+        break;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          Radiant::warning("ReactorConnection # Failed to read from socket %d: %s", m_fd, strerror(errno));
+          closed = true;
+        }
+        break;
+      }
+    }
+
+    if (m_inputEnd > m_inputBegin) {
+      DataCallback onData;
+      {
+        Radiant::Guard g(m_mutex);
+        onData = m_onData;
+      }
+      const size_t available = m_inputEnd - m_inputBegin;
+      // Without a callback there is nobody to consume the data
+      const size_t used = onData ? onData(m_host, m_input.data() + m_inputBegin, available) : available;
+      m_inputBegin += std::min(used, available);
+      if (m_inputBegin == m_inputEnd)
+        m_inputBegin = m_inputEnd = 0;
+
+      const size_t pending = m_inputEnd - m_inputBegin;
+      m_pendingInput = pending;
+      if (!closed && pending > m_maxPendingInput) {
+        Radiant::error("ReactorConnection # Socket %d has %zu bytes of unconsumed input, "
+                       "the limit is %zu bytes. Closing the connection",
+                       m_fd, pending, m_maxPendingInput.load());
+        closed = true;
+      }
+    }
+
+    if (closed)
+      closeNow();
+  }
+
+  void ReactorConnection::D::consumeOutput(size_t sent)
+  {
+    m_pendingOutput -= sent;
+    while (sent > 0) {
+      const size_t left = m_output.front().size() - m_outputOffset;
+      if (sent < left) {
+        m_outputOffset += sent;
+        return;
+      }
+      sent -= left;
+      m_outputOffset = 0;
+      m_output.pop_front();
+    }
+  }
+
+  void ReactorConnection::D::flushOutput()
+  {
+    bool failed = false;
+    bool drained = false;
+    WritableCallback onWritable;
+
+    {
+      Radiant::Guard g(m_mutex);
+      iovec iov[s_maxIov];
+      while (!m_output.empty()) {
+        int count = 0;
+        size_t requested = 0;
+        for (auto it = m_output.begin(); it != m_output.end() && count < s_maxIov; ++it, ++count) {
+          const size_t offset = count == 0 ? m_outputOffset : 0;
+          iov[count].iov_base = const_cast<char*>(it->constData()) + offset;
+          iov[count].iov_len = it->size() - offset;
+          requested += iov[count].iov_len;
+        }
+
+        ssize_t sent = sendIov(m_fd, iov, count);
+        if (sent < 0) {
+          failed = true;
+          break;
+        }
+        m_txBytes += sent;
+        consumeOutput(sent);
+        if (static_cast<size_t>(sent) < requested)
+          break;
+      }
+
+      if (!failed && m_output.empty() && m_wantWrite) {
+        m_wantWrite = false;
+        if (m_loop)
+          m_loop->modify(m_fd, EPOLLIN | EPOLLRDHUP);
+        drained = true;
+        onWritable = m_onWritable;
+      }
+    }
+
+    if (failed)
+      closeNow();
+    else if (drained && onWritable)
+      onWritable(m_host);
+  }
+
+  void ReactorConnection::D::closeNow()
+  {
+    if (!m_open.exchange(false))
+      return;
+
+    // Removing the connection from the loop can release the last reference
+    auto self = m_host.shared_from_this();
+
+    ReactorLoop * loop = nullptr;
+    ClosedCallback onClosed;
+    {
+      Radiant::Guard g(m_mutex);
+      std::swap(loop, m_loop);
+      m_output.clear();
+      m_outputOffset = 0;
+      m_pendingOutput = 0;
+      onClosed = std::move(m_onClosed);
+      m_onClosed = nullptr;
+      m_onData = nullptr;
+      m_onWritable = nullptr;
+    }
+
+    if (loop)
+      loop->remove(m_fd);
+    m_socket.close();
+
+    if (onClosed)
+      onClosed(m_host);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  ReactorConnection::ReactorConnection(TCPSocket && socket)
+    : m_d(new D(*this, std::move(socket)))
+  {
+  }
+
+  ReactorConnection::~ReactorConnection()
+  {
+  }
+
+  void ReactorConnection::setDataCallback(DataCallback callback)
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    m_d->m_onData = std::move(callback);
+  }
+
+  void ReactorConnection::setWritableCallback(WritableCallback callback)
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    m_d->m_onWritable = std::move(callback);
+  }
+
+  void ReactorConnection::setClosedCallback(ClosedCallback callback)
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    m_d->m_onClosed = std::move(callback);
+  }
+
+  bool ReactorConnection::write(const void * data, size_t bytes)
+  {
+    QByteArray buffer(static_cast<const char*>(data), static_cast<int>(bytes));
+    return write(&buffer, 1);
+  }
+
+  bool ReactorConnection::write(const QByteArray & data)
+  {
+    return write(&data, 1);
+  }
+
+  bool ReactorConnection::write(const QByteArray * buffers, size_t count)
+  {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+      total += buffers[i].size();
+
+    bool failed = false;
+    {
+      Radiant::Guard g(m_d->m_mutex);
+      if (!m_d->m_open)
+        return false;
+      if (total == 0)
+        return true;
+      if (m_d->m_pendingOutput + total > m_d->m_maxPendingOutput)
+        return false;
+
+      size_t first = 0;
+      size_t offset = 0;
+
+      if (m_d->m_output.empty()) {
+        // Nothing queued, try to send everything right away
+        iovec iov[s_maxIov];
+        int iovCount = 0;
+        for (size_t i = 0; i < count && iovCount < s_maxIov; ++i) {
+          if (buffers[i].isEmpty())
+            continue;
+          iov[iovCount].iov_base = const_cast<char*>(buffers[i].constData());
+          iov[iovCount].iov_len = buffers[i].size();
+          ++iovCount;
+        }
+
+        ssize_t sent = sendIov(m_d->m_fd, iov, iovCount);
+        if (sent < 0) {
+          failed = true;
+        } else {
+          m_d->m_txBytes += sent;
+          size_t left = sent;
+          while (first < count && left >= static_cast<size_t>(buffers[first].size())) {
+            left -= buffers[first].size();
+            ++first;
+          }
+          offset = left;
+        }
+      }
+
+      if (!failed) {
+        for (size_t i = first; i < count; ++i) {
+          if (buffers[i].isEmpty())
+            continue;
+          if (m_d->m_output.empty())
+            m_d->m_outputOffset = i == first ? offset : 0;
+          m_d->m_output.push_back(buffers[i]);
+          m_d->m_pendingOutput += buffers[i].size() - (i == first ? offset : 0);
+        }
+
+        if (!m_d->m_output.empty() && !m_d->m_wantWrite && m_d->m_loop) {
+          m_d->m_wantWrite = true;
+          m_d->m_loop->modify(m_d->m_fd, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+        }
+      }
+    }
+
+    if (failed)
+      close();
+    return !failed;
+  }
+
+  size_t ReactorConnection::pendingOutput() const
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    return m_d->m_pendingOutput;
+  }
+
+  void ReactorConnection::setMaxPendingOutput(size_t bytes)
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    m_d->m_maxPendingOutput = bytes;
+  }
+
+  size_t ReactorConnection::maxPendingOutput() const
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    return m_d->m_maxPendingOutput;
+  }
+
+  size_t ReactorConnection::pendingInput() const
+  {
+    return m_d->m_pendingInput;
+  }
+
+  void ReactorConnection::setMaxPendingInput(size_t bytes)
+  {
+    m_d->m_maxPendingInput = bytes;
+  }
+
+  size_t ReactorConnection::maxPendingInput() const
+  {
+    return m_d->m_maxPendingInput;
+  }
+
+  void ReactorConnection::close()
+  {
+    if (!m_d->m_open)
+      return;
+
+    ReactorLoop * loop;
+    {
+      Radiant::Guard g(m_d->m_mutex);
+      loop = m_d->m_loop;
+    }
+
+    if (loop) {
+      auto self = shared_from_this();
+      loop->post([self] { self->m_d->closeNow(); });
+    } else {
+      m_d->closeNow();
+    }
+  }
+
+  bool ReactorConnection::isOpen() const
+  {
+    return m_d->m_open;
+  }
+
+  int ReactorConnection::fd() const
+  {
+    return m_d->m_fd;
+  }
+
+  uint64_t ReactorConnection::rxBytes() const
+  {
+    return m_d->m_rxBytes;
+  }
+
+  uint64_t ReactorConnection::txBytes() const
+  {
+    return m_d->m_txBytes;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  class SocketReactor::D
+  {
+  public:
+    ReactorLoop & nextLoop()
+    {
+      return *m_loops[m_nextLoop++ % m_loops.size()];
+    }
+
+    void registerConnection(const ReactorConnectionPtr & connection);
+    void acceptConnections(int fd, const AcceptCallback & onAccept);
+
+  public:
+    std::vector<std::unique_ptr<ReactorLoop>> m_loops;
+    std::atomic<unsigned int> m_nextLoop{0};
+
+    Radiant::Mutex m_mutex;
+    /// Listening sockets and watched file descriptors
+    std::unordered_map<int, ReactorLoop*> m_registered;
+    /// Listening sockets, owned by the reactor
+    std::set<int> m_listeners;
+  };
+
+  void SocketReactor::D::registerConnection(const ReactorConnectionPtr & connection)
+  {
+    ReactorLoop & loop = nextLoop();
+    ReactorConnection::D & c = *connection->m_d;
+
+    auto entry = std::make_shared<ReactorLoop::Entry>();
+    entry->connection = connection;
+    entry->handler = [&c] (uint32_t events) { c.handleEvents(events); };
+
+    bool ok;
+    {
+      Radiant::Guard g(c.m_mutex);
+      if (!c.m_open)
+        return;
+      c.m_loop = &loop;
+      // Data written in the init callback might still be queued
+      c.m_wantWrite = !c.m_output.empty();
+      ok = loop.add(c.m_fd, EPOLLIN | EPOLLRDHUP | (c.m_wantWrite ? EPOLLOUT : 0), entry);
+      if (!ok)
+        c.m_loop = nullptr;
+    }
+
+    if (!ok)
+      c.closeNow();
+  }
+
+  void SocketReactor::D::acceptConnections(int fd, const AcceptCallback & onAccept)
+  {
+    for (;;) {
+      int client = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (client < 0) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          Radiant::warning("SocketReactor # Failed to accept connection: %s", strerror(errno));
+        break;
+      }
+
+      ReactorConnectionPtr connection(new ReactorConnection(TCPSocket(client)));
+      if (onAccept)
+        onAccept(connection);
+      registerConnection(connection);
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  DEFINE_SINGLETON(SocketReactor)
+
+  SocketReactor::SocketReactor(int threads)
+    : m_d(new D())
+  {
+    for (int i = 0; i < std::max(1, threads); ++i) {
+      m_d->m_loops.emplace_back(new ReactorLoop(i));
+      m_d->m_loops.back()->run();
+    }
+  }
+
+  SocketReactor::~SocketReactor()
+  {
+    for (auto & loop: m_d->m_loops) {
+      loop->stop();
+      loop->waitEnd();
+      // Closes of stopped listeners and connections might still be queued
+      loop->runPosted();
+    }
+
+    for (int fd: m_d->m_listeners)
+      ::close(fd);
+
+    for (auto & loop: m_d->m_loops) {
+      for (auto & entry: loop->takeEntries()) {
+        if (entry->connection) {
+          // takeEntries already removed it from the loop
+          {
+            Radiant::Guard g(entry->connection->m_d->m_mutex);
+            entry->connection->m_d->m_loop = nullptr;
+          }
+          entry->connection->m_d->closeNow();
+        }
+      }
+    }
+  }
+
+  int SocketReactor::threadCount() const
+  {
+    return static_cast<int>(m_d->m_loops.size());
+  }
+
+  int SocketReactor::listen(TCPServerSocket & server, AcceptCallback onAccept)
+  {
+    const int fd = server.takeSocket();
+    if (fd < 0) {
+      Radiant::warning("SocketReactor::listen # Server socket is not open");
+      return -1;
+    }
+
+    if (!setNonBlocking(fd)) {
+      Radiant::warning("SocketReactor::listen # Failed to make socket non-blocking: %s", strerror(errno));
+      ::close(fd);
+      return -1;
+    }
+
+    ReactorLoop & loop = m_d->nextLoop();
+    auto entry = std::make_shared<ReactorLoop::Entry>();
+    D * d = m_d.get();
+    entry->handler = [d, fd, onAccept] (uint32_t) { d->acceptConnections(fd, onAccept); };
+
+    Radiant::Guard g(m_d->m_mutex);
+    if (!loop.add(fd, EPOLLIN, entry)) {
+      ::close(fd);
+      return -1;
+    }
+    m_d->m_registered[fd] = &loop;
+    m_d->m_listeners.insert(fd);
+    return fd;
+  }
+
+  void SocketReactor::stopListening(int listenerId)
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    if (!m_d->m_listeners.erase(listenerId))
+      return;
+
+    auto it = m_d->m_registered.find(listenerId);
+    if (it == m_d->m_registered.end()) {
+      ::close(listenerId);
+      return;
+    }
+
+    // The loop thread might be accepting connections from the socket right
+    // now. Close it in the loop thread like connections are closed, so that
+    // the fd number can't be reused while it's still in use.
+    ReactorLoop * loop = it->second;
+    m_d->m_registered.erase(it);
+    loop->remove(listenerId);
+    loop->post([listenerId] { ::close(listenerId); });
+  }
+
+  ReactorConnectionPtr SocketReactor::add(TCPSocket && socket, AcceptCallback init)
+  {
+    if (socket.fd() < 0)
+      return nullptr;
+
+    if (!setNonBlocking(socket.fd())) {
+      Radiant::warning("SocketReactor::add # Failed to make socket non-blocking: %s", strerror(errno));
+      return nullptr;
+    }
+
+    ReactorConnectionPtr connection(new ReactorConnection(std::move(socket)));
+    if (init)
+      init(connection);
+    m_d->registerConnection(connection);
+    return connection;
+  }
+
+  bool SocketReactor::watch(int fd, uint32_t events, ReadyCallback callback)
+  {
+    if (fd < 0 || !callback)
+      return false;
+
+    ReactorLoop & loop = m_d->nextLoop();
+    auto entry = std::make_shared<ReactorLoop::Entry>();
+    entry->handler = [fd, callback] (uint32_t epollEvents) { callback(fd, fromEpoll(epollEvents)); };
+
+    Radiant::Guard g(m_d->m_mutex);
+    if (m_d->m_registered.count(fd)) {
+      Radiant::warning("SocketReactor::watch # %d is already registered", fd);
+      return false;
+    }
+    if (!loop.add(fd, toEpoll(events), entry))
+      return false;
+    m_d->m_registered[fd] = &loop;
+    return true;
+  }
+
+  void SocketReactor::unwatch(int fd)
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    if (m_d->m_listeners.count(fd))
+      return;
+
+    auto it = m_d->m_registered.find(fd);
+    if (it != m_d->m_registered.end()) {
+      it->second->remove(fd);
+      m_d->m_registered.erase(it);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,220 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+#include "Platform.hpp"
+
+#if defined(RADIANT_LINUX)
+
+#include "Singleton.hpp"
+
+#include <Patterns/NotCopyable.hpp>
+
+#include <QByteArray>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace Radiant
+{
+  class SocketReactor;
+  class TCPServerSocket;
+  class TCPSocket;
+
+  /// TCP connection driven by SocketReactor. The socket is non-blocking and
+  /// owned by the connection. All callbacks of one connection are called from
+  /// the same reactor thread, never concurrently.
+  ///
+  /// Received data is collected to a per-connection input buffer and given to
+  /// the data callback. Written data is sent immediately if the socket accepts
+  /// it, the rest is queued to a per-connection output buffer and sent when
+  /// the socket becomes writable.
+  class RADIANT_API ReactorConnection : public std::enable_shared_from_this<ReactorConnection>,
+                                        public Patterns::NotCopyable
+  {
+  public:
+    /// Called when new data has been received.
+    /// @param data all received data that hasn't been consumed yet
+    /// @param size size of data in bytes
+    /// @return number of bytes consumed from the beginning of data. The rest
+    ///         is kept in the input buffer and given again when more data
+    ///         arrives, which makes it easy to parse messages that are split
+    ///         to several packets.
+    typedef std::function<size_t (ReactorConnection & connection, const char * data, size_t size)> DataCallback;
+    /// Called from the reactor thread when the output buffer has been fully
+    /// sent after being non-empty
+    typedef std::function<void (ReactorConnection & connection)> WritableCallback;
+    /// Called once when the connection is closed, either by the peer, because
+    /// of a socket error or by calling close()
+    typedef std::function<void (ReactorConnection & connection)> ClosedCallback;
+
+    ~ReactorConnection();
+
+    /// Sets the data callback. Set callbacks in SocketReactor::AcceptCallback
+    /// or SocketReactor::add initialization callback to not miss any events.
+    void setDataCallback(DataCallback callback);
+    void setWritableCallback(WritableCallback callback);
+    void setClosedCallback(ClosedCallback callback);
+
+    /// Sends data or queues it for sending. This function never blocks and
+    /// can be called from any thread.
+    /// @param data data to send, copied to the output buffer if needed
+    /// @param bytes size of data in bytes
+    /// @return false if the connection is closed or maxPendingOutput would be exceeded
+    bool write(const void * data, size_t bytes);
+    /// @copydoc write(const void*,size_t)
+    /// Queued data is not copied, only the reference count of data is increased.
+    bool write(const QByteArray & data);
+    /// Gathering write, all buffers are sent with one system call if the
+    /// socket has enough buffer space. Queued buffers are not copied.
+    /// @param buffers buffers to send in order
+    /// @param count number of buffers
+    /// @return false if the connection is closed or maxPendingOutput would be exceeded
+    bool write(const QByteArray * buffers, size_t count);
+
+    /// Number of bytes queued for sending
+    size_t pendingOutput() const;
+
+    /// Sets the maximum number of bytes in the output buffer. Writes that
+    /// would exceed the limit fail. The default is 64 MB.
+    void setMaxPendingOutput(size_t bytes);
+    size_t maxPendingOutput() const;
+
+    /// Number of received bytes that the data callback hasn't consumed yet
+    size_t pendingInput() const;
+
+    /// Sets the maximum number of unconsumed bytes in the input buffer. If
+    /// the data callback leaves more than this in the buffer, the peer is
+    /// sending messages that are too large or faster than they can be
+    /// handled, and the connection is closed. The default is 64 MB.
+    void setMaxPendingInput(size_t bytes);
+    size_t maxPendingInput() const;
+
+    /// Closes the connection without sending queued data. The closed
+    /// callback is called from the reactor thread.
+    void close();
+
+    /// Returns true until the connection is closed
+    bool isOpen() const;
+
+    /// @cond
+    int fd() const;
+    /// @endcond
+
+    /// Number of bytes received through the connection
+    uint64_t rxBytes() const;
+    /// Number of bytes sent through the connection
+    uint64_t txBytes() const;
+
+  private:
+    friend class SocketReactor;
+    ReactorConnection(TCPSocket && socket);
+
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+  typedef std::shared_ptr<ReactorConnection> ReactorConnectionPtr;
+
+  /// Drives many non-blocking sockets from one or few threads using epoll.
+  ///
+  /// TCPSocket and TCPServerSocket have blocking APIs, so serving many
+  /// clients with them requires a thread per connection. With SocketReactor
+  /// listening sockets and connections are registered to a reactor, which
+  /// calls callbacks when there are new connections or data.
+  ///
+  /// Callbacks are called from the reactor threads, so they should not block.
+  /// Heavy processing should be moved to BGThread.
+  ///
+  /// @code
+  /// Radiant::TCPServerSocket server;
+  /// server.open("0.0.0.0", 3333, 128);
+  /// auto reactor = Radiant::SocketReactor::instance();
+  /// reactor->listen(server, [] (const Radiant::ReactorConnectionPtr & c) {
+  ///   c->setDataCallback([] (Radiant::ReactorConnection & c, const char * data, size_t size) {
+  ///     c.write(data, size);
+  ///     return size;
+  ///   });
+  /// });
+  /// @endcode
+  ///
+  /// This class is only available on Linux.
+  class RADIANT_API SocketReactor : public Patterns::NotCopyable
+  {
+    DECLARE_SINGLETON(SocketReactor);
+
+  public:
+    /// Called for new connections before any data callbacks. The callbacks
+    /// of the connection should be set here.
+    typedef std::function<void (const ReactorConnectionPtr & connection)> AcceptCallback;
+    /// Called when a watched file descriptor is ready
+    /// @param fd file descriptor
+    /// @param events bitmask of Event values
+    typedef std::function<void (int fd, uint32_t events)> ReadyCallback;
+
+    enum Event
+    {
+      EVENT_READABLE = 1 << 0,
+      EVENT_WRITABLE = 1 << 1,
+      EVENT_ERROR    = 1 << 2
+    };
+
+    /// Creates a new reactor.
+    /// @param threads number of epoll threads. Each connection is assigned to
+    ///        one thread.
+    SocketReactor(int threads = 1);
+    /// Stops the reactor threads and closes all connections and listening
+    /// sockets. Closed callbacks are called from the calling thread.
+    ~SocketReactor();
+
+    /// Number of reactor threads
+    int threadCount() const;
+
+    /// Starts accepting connections from the server socket. The reactor takes
+    /// the ownership of the listening socket, see TCPServerSocket::takeSocket.
+    /// @param server open server socket
+    /// @param onAccept called from a reactor thread for every new connection
+    /// @return listener id that can be given to stopListening, or -1 on error
+    int listen(TCPServerSocket & server, AcceptCallback onAccept);
+
+    /// Stops accepting connections and closes the listening socket
+    /// @param listenerId return value of listen
+    void stopListening(int listenerId);
+
+    /// Adds a connected socket to the reactor
+    /// @param socket open socket, moved to the connection
+    /// @param init called from this thread before the connection is
+    ///        registered, so the callbacks can be set without missing data
+    /// @return new connection, or null if the socket wasn't open
+    ReactorConnectionPtr add(TCPSocket && socket, AcceptCallback init = nullptr);
+
+    /// Calls the callback when the file descriptor is ready. This can be used
+    /// for example with UDPSocket::fd(). The reactor doesn't take the
+    /// ownership of fd and doesn't change its blocking mode, so the callback
+    /// should use non-blocking reads.
+    /// @param fd file descriptor to watch
+    /// @param events bitmask of EVENT_READABLE and EVENT_WRITABLE
+    /// @param callback called from a reactor thread as long as the fd is ready
+    /// @return true on success
+    bool watch(int fd, uint32_t events, ReadyCallback callback);
+
+    /// Stops watching fd. If this is called from another thread, a callback
+    /// that is already running will still finish after this returns.
+    void unwatch(int fd);
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
+
+#endif
@@ -0,0 +1,357 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "VideoCameraSynthetic.hpp"
+
+#include "Condition.hpp"
+#include "Mutex.hpp"
+#include "Sleep.hpp"
+#include "Timer.hpp"
+#include "Trace.hpp"
+
+#include <cmath>
+
+namespace Radiant
+{
+  class VideoCameraSynthetic::D
+  {
+  public:
+    void render();
+
+  public:
+    VideoImage m_image;
+
+    uint64_t m_euid = 0;
+    float m_fps = 30.0f;
+    int m_timeoutMs = 1000;
+
+    bool m_open = false;
+    bool m_started = false;
+
+    Radiant::Timer m_clock;
+    /// Number of the next frame
+    uint64_t m_next = 0;
+
+    bool m_trigger = false;
+    int m_pendingTriggers = 0;
+    Radiant::Mutex m_triggerMutex;
+    Radiant::Condition m_triggerCond;
+  };
+
+  void VideoCameraSynthetic::D::render()
+  {
+    // Diagonal gradient that moves a few pixels every frame, with a vertical
+    // bar that sweeps across the image once every 256 frames
+    const int w = m_image.m_width;
+    const int h = m_image.m_height;
+    const int shift = static_cast<int>(m_next * 4);
+    const int bar = static_cast<int>((m_next % 256) * w / 256);
+
+    const ImageFormat fmt = m_image.m_format;
+
+    if(fmt == IMAGE_GRAYSCALE || fmt == IMAGE_YUV_420P || fmt == IMAGE_YUV_422P) {
+      for(int y = 0; y < h; ++y) {
+        uint8_t * line = m_image.m_planes[0].line(y);
+        for(int x = 0; x < w; ++x)
+          line[x] = static_cast<uint8_t>(x + y + shift);
+        if(bar < w)
+          line[bar] = 0xFF;
+      }
+
+      if(fmt != IMAGE_GRAYSCALE) {
+        const int cw = w / 2;
+        const int ch = fmt == IMAGE_YUV_420P ? h / 2 : h;
+        for(int y = 0; y < ch; ++y) {
+          uint8_t * u = m_image.m_planes[1].line(y);
+          uint8_t * v = m_image.m_planes[2].line(y);
+          for(int x = 0; x < cw; ++x) {
+            u[x] = static_cast<uint8_t>(96 + ((x + shift) & 63));
+            v[x] = static_cast<uint8_t>(96 + ((y + shift) & 63));
+          }
+        }
+      }
+    } else {
+      const int channels = (fmt == IMAGE_RGBA || fmt == IMAGE_BGRA) ? 4 : 3;
+      const bool bgr = fmt == IMAGE_BGR || fmt == IMAGE_BGRA;
+      for(int y = 0; y < h; ++y) {
+        uint8_t * p = m_image.m_planes[0].line(y);
+        for(int x = 0; x < w; ++x) {
+          const uint8_t r = x == bar ? 0xFF : static_cast<uint8_t>(x + shift);
+          const uint8_t g = static_cast<uint8_t>(y + shift);
+          const uint8_t b = static_cast<uint8_t>(x ^ y);
+          p[0] = bgr ? b : r;
+          p[1] = g;
+          p[2] = bgr ? r : b;
+          if(channels == 4)
+            p[3] = 0xFF;
+          p += channels;
+        }
+      }
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  VideoCameraSynthetic::VideoCameraSynthetic(CameraDriver * driver)
+    : VideoCamera(driver)
+    , m_d(new D())
+  {
+  }
+
+  VideoCameraSynthetic::~VideoCameraSynthetic()
+  {
+    close();
+  }
+
+  const VideoImage * VideoCameraSynthetic::captureImage()
+  {
+    if(!m_d->m_started)
+      return nullptr;
+
+    if(m_d->m_trigger) {
+      Radiant::Guard g(m_d->m_triggerMutex);
+      unsigned int timeout = static_cast<unsigned int>(m_d->m_timeoutMs);
+      while(m_d->m_pendingTriggers == 0) {
+        if(!m_d->m_triggerCond.wait2(m_d->m_triggerMutex, timeout))
+          return nullptr;
+      }
+      --m_d->m_pendingTriggers;
+    } else if(m_d->m_fps > 0.0f) {
+      const double elapsed = m_d->m_clock.time();
+      const uint64_t current = static_cast<uint64_t>(elapsed * m_d->m_fps);
+
+      if(current < m_d->m_next) {
+        const double wait = m_d->m_next / m_d->m_fps - elapsed;
+        if(wait * 1000.0 > m_d->m_timeoutMs) {
+          Radiant::Sleep::sleepMs(static_cast<uint32_t>(m_d->m_timeoutMs));
+          return nullptr;
+        }
+        Radiant::Sleep::sleepSome(wait);
+      } else {
+        // Frames that were not captured in time are lost, like with real cameras
+        m_d->m_next = current;
+      }
+    }
+
+    m_d->render();
+    ++m_d->m_next;
+
+    return &m_d->m_image;
+  }
+
+  int VideoCameraSynthetic::width() const
+  {
+    return m_d->m_image.m_width;
+  }
+
+  int VideoCameraSynthetic::height() const
+  {
+    return m_d->m_image.m_height;
+  }
+
+  float VideoCameraSynthetic::fps() const
+  {
+    return m_d->m_fps;
+  }
+
+  ImageFormat VideoCameraSynthetic::imageFormat() const
+  {
+    return m_d->m_image.m_format;
+  }
+
+  unsigned int VideoCameraSynthetic::size() const
+  {
+    unsigned int bytes = 0;
+    for(int i = 0; i < 4; ++i) {
+      Nimble::Vector2i area = VideoImage::planeSize(m_d->m_image.m_format, m_d->m_image.m_width,
+                                                    m_d->m_image.m_height, i);
+      bytes += static_cast<unsigned int>(area.x * area.y);
+    }
+    return bytes;
+  }
+
+  bool VideoCameraSynthetic::open(uint64_t euid, int width, int height, ImageFormat fmt,
+                                  FrameRate framerate)
+  {
+    if(fmt == IMAGE_UNKNOWN)
+      fmt = IMAGE_YUV_420P;
+
+    if(fmt != IMAGE_GRAYSCALE && fmt != IMAGE_RGB && fmt != IMAGE_BGR &&
+       fmt != IMAGE_RGBA && fmt != IMAGE_BGRA && fmt != IMAGE_YUV_420P &&
+       fmt != IMAGE_YUV_422P) {
+      Radiant::error("VideoCameraSynthetic::open # Unsupported image format %s",
+                     VideoImage::formatName(fmt));
+      return false;
+    }
+
+    if(width <= 0 || height <= 0) {
+      width = 640;
+      height = 480;
+    }
+
+    close();
+
+    m_d->m_image.allocateMemory(fmt, width, height, 32);
+    m_d->m_euid = euid;
+    m_d->m_fps = framerate == FPS_IGNORE ? 30.0f : asFloat(framerate);
+    m_d->m_open = true;
+    return true;
+  }
+
+  bool VideoCameraSynthetic::openFormat7(uint64_t cameraeuid, Nimble::Recti roi, float fps, int)
+  {
+    if(!open(cameraeuid, roi.width(), roi.height(), IMAGE_GRAYSCALE, FPS_IGNORE))
+      return false;
+    setFps(fps);
+    return true;
+  }
+
+  void VideoCameraSynthetic::getFeatures(std::vector<CameraFeature> * features)
+  {
+    features->clear();
+  }
+
+  void VideoCameraSynthetic::setFeature(FeatureType, float)
+  {
+  }
+
+  void VideoCameraSynthetic::setFeatureRaw(FeatureType, int32_t)
+  {
+  }
+
+  bool VideoCameraSynthetic::setCaptureTimeout(int ms)
+  {
+    m_d->m_timeoutMs = ms;
+    return true;
+  }
+
+  bool VideoCameraSynthetic::enableTrigger(TriggerSource src)
+  {
+    if(src != TRIGGER_SOURCE_SOFTWARE)
+      return false;
+    Radiant::Guard g(m_d->m_triggerMutex);
+    m_d->m_trigger = true;
+    m_d->m_pendingTriggers = 0;
+    return true;
+  }
+
+  bool VideoCameraSynthetic::setTriggerMode(TriggerMode mode)
+  {
+    return mode == TRIGGER_MODE_0;
+  }
+
+  bool VideoCameraSynthetic::setTriggerPolarity(TriggerPolarity)
+  {
+    return true;
+  }
+
+  bool VideoCameraSynthetic::disableTrigger()
+  {
+    Radiant::Guard g(m_d->m_triggerMutex);
+    m_d->m_trigger = false;
+    m_d->m_triggerCond.wakeAll();
+    return true;
+  }
+
+  void VideoCameraSynthetic::sendSoftwareTrigger()
+  {
+    Radiant::Guard g(m_d->m_triggerMutex);
+    ++m_d->m_pendingTriggers;
+    m_d->m_triggerCond.wakeAll();
+  }
+
+  bool VideoCameraSynthetic::start()
+  {
+    if(!m_d->m_open)
+      return false;
+    m_d->m_clock.start();
+    m_d->m_next = 0;
+    m_d->m_started = true;
+    return true;
+  }
+
+  bool VideoCameraSynthetic::stop()
+  {
+    m_d->m_started = false;
+    return true;
+  }
+
+  bool VideoCameraSynthetic::close()
+  {
+    stop();
+    if(m_d->m_open) {
+      m_d->m_image.freeMemory();
+      m_d->m_image.reset();
+      m_d->m_open = false;
+    }
+    return true;
+  }
+
+  uint64_t VideoCameraSynthetic::uid()
+  {
+    return m_d->m_euid;
+  }
+
+  VideoCamera::CameraInfo VideoCameraSynthetic::cameraInfo()
+  {
+    CameraInfo info;
+    info.m_euid64 = static_cast<int64_t>(m_d->m_euid);
+    info.m_vendor = "MultiTouch";
+    info.m_model = "Synthetic camera";
+    info.m_driver = "synthetic";
+    return info;
+  }
+
+  int VideoCameraSynthetic::framesBehind() const
+  {
+    if(!m_d->m_started || m_d->m_trigger || m_d->m_fps <= 0.0f)
+      return 0;
+    const uint64_t current = static_cast<uint64_t>(m_d->m_clock.time() * m_d->m_fps);
+    return current < m_d->m_next ? 0 : static_cast<int>(current - m_d->m_next + 1);
+  }
+
+  void VideoCameraSynthetic::setFps(float fps)
+  {
+    m_d->m_fps = fps;
+    if(m_d->m_started && fps > 0.0f) {
+      m_d->m_clock.start();
+      m_d->m_next = 0;
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  CameraDriverSynthetic::CameraDriverSynthetic(int cameraCount)
+    : m_cameraCount(cameraCount)
+  {
+  }
+
+  CameraDriverSynthetic::~CameraDriverSynthetic()
+  {
+  }
+
+  size_t CameraDriverSynthetic::queryCameras(std::vector<VideoCamera::CameraInfo> & cameras)
+  {
+    for(int i = 0; i < m_cameraCount; ++i) {
+      VideoCamera::CameraInfo info;
+      info.m_euid64 = i + 1;
+      info.m_vendor = "MultiTouch";
+      info.m_model = "Synthetic camera";
+      info.m_driver = driverName();
+      cameras.push_back(info);
+    }
+    return static_cast<size_t>(m_cameraCount);
+  }
+
+  VideoCamera * CameraDriverSynthetic::createCamera()
+  {
+    return new VideoCameraSynthetic(this);
+  }
+}
@@ -0,0 +1,96 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "CameraDriver.hpp"
+#include "VideoCamera.hpp"
+
+#include <memory>
+
+namespace Radiant
+{
+  /// Camera that generates a moving test pattern at the requested frame
+  /// rate. Useful for testing and benchmarking video capture code without
+  /// camera hardware.
+  ///
+  /// Supported formats are IMAGE_GRAYSCALE, IMAGE_RGB, IMAGE_BGR,
+  /// IMAGE_RGBA, IMAGE_BGRA, IMAGE_YUV_420P and IMAGE_YUV_422P. The default
+  /// format is IMAGE_YUV_420P. Camera features are accepted but ignored.
+  class RADIANT_API VideoCameraSynthetic : public VideoCamera
+  {
+  public:
+    VideoCameraSynthetic(CameraDriver * driver);
+    virtual ~VideoCameraSynthetic();
+
+    /// Waits until the next frame is due and renders it
+    /// @return the frame, or null if the camera isn't started or the
+    ///         capture timeout was exceeded
+    virtual const Radiant::VideoImage * captureImage() override;
+
+    virtual int width() const override;
+    virtual int height() const override;
+    virtual float fps() const override;
+    virtual ImageFormat imageFormat() const override;
+    virtual unsigned int size() const override;
+
+    /// @param euid any id, given back in cameraInfo and uid
+    /// @param framerate FPS_IGNORE means 30 frames per second
+    virtual bool open(uint64_t euid, int width, int height, ImageFormat fmt = IMAGE_UNKNOWN,
+                      FrameRate framerate = FPS_IGNORE) override;
+    virtual bool openFormat7(uint64_t cameraeuid, Nimble::Recti roi, float fps, int mode) override;
+
+    virtual void getFeatures(std::vector<CameraFeature> * features) override;
+    virtual void setFeature(FeatureType id, float value) override;
+    virtual void setFeatureRaw(FeatureType id, int32_t value) override;
+    virtual bool setCaptureTimeout(int ms) override;
+
+    /// Only TRIGGER_SOURCE_SOFTWARE is supported. When the trigger is
+    /// enabled, a frame is generated for every sendSoftwareTrigger call.
+    virtual bool enableTrigger(TriggerSource src) override;
+    virtual bool setTriggerMode(TriggerMode mode) override;
+    virtual bool setTriggerPolarity(TriggerPolarity polarity) override;
+    virtual bool disableTrigger() override;
+    virtual void sendSoftwareTrigger() override;
+
+    virtual bool start() override;
+    virtual bool stop() override;
+    virtual bool close() override;
+
+    virtual uint64_t uid() override;
+    virtual CameraInfo cameraInfo() override;
+    virtual int framesBehind() const override;
+
+    /// Sets the frame rate in frames per second. Arbitrary rates are
+    /// supported, zero or negative value generates frames as fast as they
+    /// are captured.
+    void setFps(float fps);
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+
+  /// Driver for VideoCameraSynthetic, registered with the name "synthetic"
+  class RADIANT_API CameraDriverSynthetic : public CameraDriver
+  {
+  public:
+    /// @param cameraCount number of cameras returned by queryCameras
+    CameraDriverSynthetic(int cameraCount = 1);
+    virtual ~CameraDriverSynthetic();
+
+    virtual size_t queryCameras(std::vector<VideoCamera::CameraInfo> & cameras) override;
+    virtual VideoCamera * createCamera() override;
+    virtual QString driverName() const override { return "synthetic"; }
+
+  private:
+    int m_cameraCount;
+  };
+}
@@ -0,0 +1,456 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "VideoCaptureQueue.hpp"
+
+#include "Condition.hpp"
+#include "ImageConversion.hpp"
+#include "Mutex.hpp"
+#include "Sleep.hpp"
+#include "Task.hpp"
+#include "Thread.hpp"
+#include "Timer.hpp"
+#include "Trace.hpp"
+#include "VideoInput.hpp"
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace Radiant
+{
+  namespace
+  {
+    /// Life cycle of a frame buffer. Transitions are done with atomic
+    /// compare-and-swap, so the capture thread, conversion tasks and the
+    /// consumer never touch the same buffer at the same time.
+    enum SlotState
+    {
+      /// Unused, can be filled by the capture thread
+      SLOT_FREE,
+      /// Capture thread is copying an image to the buffer
+      SLOT_FILLING,
+      /// Conversion task is running
+      SLOT_CONVERTING,
+      /// Ready to be acquired. If the ring position of the slot is behind
+      /// the read position, the frame was dropped and the buffer can be
+      /// filled again.
+      SLOT_READY,
+      /// Acquired by the consumer
+      SLOT_IN_USE
+    };
+
+    struct Slot
+    {
+      ~Slot()
+      {
+        image.freeMemory();
+        rgba.freeMemory();
+      }
+
+      VideoImage image;
+      VideoImage rgba;
+      VideoCaptureQueue::Frame frame;
+      /// Position of this frame in the ring
+      uint64_t index = 0;
+      /// Index of this buffer in VideoCaptureQueue::D::m_slots
+      int buffer = 0;
+      std::atomic<int> state{SLOT_FREE};
+    };
+
+    class CaptureThread : public Radiant::Thread
+    {
+    public:
+      CaptureThread(std::function<void ()> loop)
+        : Radiant::Thread("VideoCaptureQueue")
+        , m_loop(std::move(loop))
+      {}
+
+    protected:
+      virtual void childLoop() override
+      {
+        m_loop();
+      }
+
+    private:
+      std::function<void ()> m_loop;
+    };
+  }
+
+  class VideoCaptureQueue::D
+  {
+  public:
+    D(VideoInput & input, int bufferCount, OverflowPolicy policy)
+      : m_input(input)
+      , m_policy(policy)
+    {
+      const size_t count = static_cast<size_t>(std::max(1, bufferCount));
+      m_slots.resize(count);
+      m_ring.reset(new std::atomic<int>[count]);
+      for(size_t i = 0; i < count; ++i) {
+        m_slots[i].reset(new Slot());
+        m_slots[i]->buffer = static_cast<int>(i);
+        m_ring[i] = static_cast<int>(i);
+      }
+    }
+
+    void captureLoop();
+    /// Reserves a free buffer for the next frame, or returns null if the
+    /// queue was stopped
+    Slot * reserve();
+    /// Finds a buffer that is free or holds a dropped frame
+    Slot * tryReserve();
+    /// Buffer at ring position i
+    Slot & slotAt(uint64_t i) const
+    {
+      return *m_slots[static_cast<size_t>(m_ring[i % m_slots.size()].load(std::memory_order_acquire))];
+    }
+    bool copy(const VideoImage & source, Slot & slot);
+    void convert(Slot & slot);
+
+    Slot * tryAcquire();
+    bool frontReady() const;
+
+    void waitForSlot()
+    {
+      // Short timeout, since the state transitions themselves are not done
+      // while holding the mutex
+      Radiant::Guard g(m_waitMutex);
+      m_slotCond.wait(m_waitMutex, 10);
+    }
+
+  public:
+    VideoInput & m_input;
+    const OverflowPolicy m_policy;
+    bool m_convert = false;
+    int m_alignment = 32;
+
+    std::vector<std::unique_ptr<Slot>> m_slots;
+    /// Buffer index of each ring position. The ring order is separate from
+    /// the buffers, so a buffer held by the consumer is simply skipped when
+    /// the capture thread looks for a buffer to fill.
+    std::unique_ptr<std::atomic<int>[]> m_ring;
+
+    /// Ring position of the next frame to be acquired. Advanced by the
+    /// consumer, or by the capture thread when it drops the oldest frame.
+    std::atomic<uint64_t> m_read{0};
+    /// Ring position of the next captured frame, advanced only by the
+    /// capture thread
+    std::atomic<uint64_t> m_write{0};
+
+    std::atomic<bool> m_running{false};
+    std::atomic<int> m_conversions{0};
+
+    std::atomic<uint64_t> m_captured{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_converted{0};
+
+    bool m_copyFailed = false;
+    std::atomic<bool> m_conversionFailed{false};
+
+    Radiant::Mutex m_waitMutex;
+    /// Signaled when a frame becomes available
+    Radiant::Condition m_frameCond;
+    /// Signaled when a buffer is released or a conversion finishes
+    Radiant::Condition m_slotCond;
+
+    std::unique_ptr<CaptureThread> m_thread;
+  };
+
+  void VideoCaptureQueue::D::captureLoop()
+  {
+    while(m_running) {
+      const VideoImage * image = m_input.captureImage();
+      if(!image) {
+        // Capture timeout, or the input is not started yet
+        Radiant::Sleep::sleepMs(1);
+        continue;
+      }
+
+      const Radiant::TimeStamp timestamp = Radiant::TimeStamp::currentTime();
+      const uint64_t frameNumber = m_captured++;
+      const uint64_t w = m_write.load(std::memory_order_relaxed);
+
+      Slot * slot = reserve();
+      if(!slot) {
+        m_input.doneImage();
+        ++m_dropped;
+        continue;
+      }
+
+      const bool ok = copy(*image, *slot);
+      // The driver can deliver the next image while this one is processed
+      m_input.doneImage();
+
+      if(!ok) {
+        slot->state = SLOT_FREE;
+        ++m_dropped;
+        continue;
+      }
+
+      slot->index = w;
+      slot->frame.image = &slot->image;
+      slot->frame.rgba = nullptr;
+      slot->frame.timestamp = timestamp;
+      slot->frame.frameNumber = frameNumber;
+
+      m_ring[w % m_slots.size()].store(slot->buffer, std::memory_order_release);
+
+      if(m_convert && !m_conversionFailed) {
+        slot->state = SLOT_CONVERTING;
+        ++m_conversions;
+        SingleShotTask::run([this, slot] { convert(*slot); });
+      } else {
+        slot->state.store(SLOT_READY, std::memory_order_release);
+      }
+
+      m_write.store(w + 1, std::memory_order_release);
+      m_frameCond.wakeAll(m_waitMutex);
+    }
+  }
+
+  Slot * VideoCaptureQueue::D::tryReserve()
+  {
+    const uint64_t r = m_read.load(std::memory_order_acquire);
+    for(auto & ptr: m_slots) {
+      Slot & slot = *ptr;
+      int state = slot.state.load(std::memory_order_acquire);
+      // A ready frame behind the read position was dropped. Buffers that
+      // are in use or still converting are skipped.
+      if(state == SLOT_FREE || (state == SLOT_READY && slot.index < r)) {
+        if(slot.state.compare_exchange_strong(state, SLOT_FILLING))
+          return &slot;
+      }
+    }
+    return nullptr;
+  }
+
+  Slot * VideoCaptureQueue::D::reserve()
+  {
+    while(m_running) {
+      if(Slot * slot = tryReserve())
+        return slot;
+
+      if(m_policy == DROP_OLDEST) {
+        // Drop the oldest queued frame so that its buffer can be reused.
+        // If it is still being converted, wait for the conversion instead
+        // of dropping the newer frames behind it.
+        uint64_t r = m_read.load(std::memory_order_acquire);
+        if(r < m_write.load(std::memory_order_relaxed) &&
+           slotAt(r).state.load(std::memory_order_acquire) == SLOT_READY) {
+          if(m_read.compare_exchange_strong(r, r + 1))
+            ++m_dropped;
+          continue;
+        }
+      }
+
+      waitForSlot();
+    }
+    return nullptr;
+  }
+
+  bool VideoCaptureQueue::D::copy(const VideoImage & source, Slot & slot)
+  {
+    if(!slot.image.allocateMemory(source, static_cast<size_t>(m_alignment)) ||
+       !slot.image.copyData(source)) {
+      if(!m_copyFailed) {
+        Radiant::error("VideoCaptureQueue # Unsupported image format %s",
+                       VideoImage::formatName(source.m_format));
+        m_copyFailed = true;
+      }
+      return false;
+    }
+    return true;
+  }
+
+  void VideoCaptureQueue::D::convert(Slot & slot)
+  {
+    const VideoImage & image = slot.image;
+    if(slot.rgba.allocateMemory(IMAGE_RGBA, image.width(), image.height(),
+                                static_cast<size_t>(m_alignment)) &&
+       ImageConversion::convert(&image, &slot.rgba)) {
+      slot.frame.rgba = &slot.rgba;
+      ++m_converted;
+    } else {
+      // Don't try again for every frame
+      m_conversionFailed = true;
+    }
+
+    slot.state.store(SLOT_READY, std::memory_order_release);
+    m_frameCond.wakeAll(m_waitMutex);
+
+    Radiant::Guard g(m_waitMutex);
+    --m_conversions;
+    m_slotCond.wakeAll();
+  }
+
+  Slot * VideoCaptureQueue::D::tryAcquire()
+  {
+    for(;;) {
+      uint64_t r = m_read.load(std::memory_order_acquire);
+      if(r >= m_write.load(std::memory_order_acquire))
+        return nullptr;
+
+      Slot & slot = slotAt(r);
+      int expected = SLOT_READY;
+      // Fails if the oldest frame is still being converted
+      if(!slot.state.compare_exchange_strong(expected, SLOT_IN_USE))
+        return nullptr;
+
+      // The buffer may have been recycled for a newer frame after r was
+      // dropped, in which case the read position has moved as well
+      if(slot.index == r && m_read.compare_exchange_strong(r, r + 1)) {
+        m_slotCond.wakeAll(m_waitMutex);
+        return &slot;
+      }
+
+      // The capture thread dropped this frame meanwhile
+      slot.state.store(SLOT_READY, std::memory_order_release);
+    }
+  }
+
+  bool VideoCaptureQueue::D::frontReady() const
+  {
+    const uint64_t r = m_read.load(std::memory_order_acquire);
+    if(r >= m_write.load(std::memory_order_acquire))
+      return false;
+    return slotAt(r).state.load(std::memory_order_acquire) == SLOT_READY;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  VideoCaptureQueue::VideoCaptureQueue(VideoInput & input, int bufferCount,
+                                       OverflowPolicy policy)
+    : m_d(new D(input, bufferCount, policy))
+  {
+  }
+
+  VideoCaptureQueue::~VideoCaptureQueue()
+  {
+    stop();
+  }
+
+  void VideoCaptureQueue::setConvertToRGBA(bool convert)
+  {
+    m_d->m_convert = convert;
+  }
+
+  bool VideoCaptureQueue::convertToRGBA() const
+  {
+    return m_d->m_convert;
+  }
+
+  void VideoCaptureQueue::setAlignment(int alignment)
+  {
+    m_d->m_alignment = alignment;
+  }
+
+  void VideoCaptureQueue::start()
+  {
+    if(m_d->m_running)
+      return;
+
+    // Allocate the buffers beforehand if the input already knows the format
+    const ImageFormat fmt = m_d->m_input.imageFormat();
+    const int w = m_d->m_input.width();
+    const int h = m_d->m_input.height();
+    if(w > 0 && h > 0 && fmt != IMAGE_UNKNOWN) {
+      for(auto & slot: m_d->m_slots) {
+        slot->image.allocateMemory(fmt, w, h, static_cast<size_t>(m_d->m_alignment));
+        if(m_d->m_convert)
+          slot->rgba.allocateMemory(IMAGE_RGBA, w, h, static_cast<size_t>(m_d->m_alignment));
+      }
+    }
+
+    m_d->m_conversionFailed = false;
+    m_d->m_running = true;
+    D * d = m_d.get();
+    m_d->m_thread.reset(new CaptureThread([d] { d->captureLoop(); }));
+    m_d->m_thread->run();
+  }
+
+  void VideoCaptureQueue::stop()
+  {
+    if(!m_d->m_thread)
+      return;
+
+    m_d->m_running = false;
+    m_d->m_slotCond.wakeAll(m_d->m_waitMutex);
+    m_d->m_thread->waitEnd();
+    m_d->m_thread.reset();
+
+    Radiant::Guard g(m_d->m_waitMutex);
+    while(m_d->m_conversions > 0)
+      m_d->m_slotCond.wait(m_d->m_waitMutex, 10);
+    m_d->m_frameCond.wakeAll();
+  }
+
+  bool VideoCaptureQueue::isRunning() const
+  {
+    return m_d->m_running;
+  }
+
+  const VideoCaptureQueue::Frame * VideoCaptureQueue::acquireFrame(int timeoutMs)
+  {
+    Radiant::Timer timer;
+
+    for(;;) {
+      if(Slot * slot = m_d->tryAcquire())
+        return &slot->frame;
+
+      // Nothing more is coming
+      if(!m_d->m_running && m_d->m_conversions == 0 && !m_d->frontReady())
+        return nullptr;
+
+      int waitMs = 100;
+      if(timeoutMs >= 0) {
+        const int remaining = timeoutMs - static_cast<int>(timer.time() * 1000.0);
+        if(remaining <= 0)
+          return nullptr;
+        waitMs = std::min(waitMs, remaining);
+      }
+
+      Radiant::Guard g(m_d->m_waitMutex);
+      if(!m_d->frontReady())
+        m_d->m_frameCond.wait(m_d->m_waitMutex, static_cast<unsigned long>(waitMs));
+    }
+  }
+
+  void VideoCaptureQueue::releaseFrame(const Frame * frame)
+  {
+    if(!frame)
+      return;
+
+    for(auto & slot: m_d->m_slots) {
+      if(&slot->frame == frame) {
+        slot->state.store(SLOT_FREE, std::memory_order_release);
+        m_d->m_slotCond.wakeAll(m_d->m_waitMutex);
+        return;
+      }
+    }
+    Radiant::error("VideoCaptureQueue::releaseFrame # Unknown frame %p", frame);
+  }
+
+  int VideoCaptureQueue::framesAvailable() const
+  {
+    const uint64_t r = m_d->m_read.load();
+    const uint64_t w = m_d->m_write.load();
+    return w > r ? static_cast<int>(w - r) : 0;
+  }
+
+  VideoCaptureQueue::Statistics VideoCaptureQueue::statistics() const
+  {
+    Statistics stats;
+    stats.captured = m_d->m_captured;
+    stats.dropped = m_d->m_dropped;
+    stats.converted = m_d->m_converted;
+    return stats;
+  }
+}
@@ -0,0 +1,140 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+#include "TimeStamp.hpp"
+
+#include <Patterns/NotCopyable.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace Radiant
+{
+  class VideoImage;
+  class VideoInput;
+
+  /// Asynchronous capture pipeline for VideoInput.
+  ///
+  /// VideoInput::captureImage gives one image at a time, and the image
+  /// needs to be released with VideoInput::doneImage before the next one
+  /// can be captured. If the same thread also processes the image, any
+  /// processing that takes longer than one frame time makes the driver drop
+  /// frames.
+  ///
+  /// VideoCaptureQueue captures images in a separate thread and copies them
+  /// to a fixed number of pre-allocated, aligned frame buffers. The driver
+  /// buffer is released immediately after the copy. Optionally the frames
+  /// are converted to RGBA in BGThread, several frames in parallel. Frames
+  /// are given to the consumer in capture order.
+  ///
+  /// The frames form a lock-free ring of buffer indices between the capture
+  /// thread and one consumer thread, so a buffer held by the consumer never
+  /// blocks the ones after it. Locks are only used for sleeping when the consumer
+  /// waits for a frame or the capture thread waits for a free buffer.
+  ///
+  /// @code
+  /// Radiant::VideoCaptureQueue queue(*camera, 4);
+  /// queue.setConvertToRGBA(true);
+  /// camera->start();
+  /// queue.start();
+  /// while(running) {
+  ///   if(auto frame = queue.acquireFrame(100)) {
+  ///     upload(*frame->rgba);
+  ///     queue.releaseFrame(frame);
+  ///   }
+  /// }
+  /// queue.stop();
+  /// @endcode
+  class RADIANT_API VideoCaptureQueue : public Patterns::NotCopyable
+  {
+  public:
+    /// What to do when all buffers are full
+    enum OverflowPolicy
+    {
+      /// Drop the oldest frame that is not in use. The consumer always
+      /// gets the latest frames, which is usually what interactive
+      /// applications want.
+      DROP_OLDEST,
+      /// Wait until the consumer releases a frame. The driver may drop
+      /// frames while waiting.
+      BLOCK
+    };
+
+    /// Captured frame
+    struct Frame
+    {
+      /// Copy of the captured image in the native format of the input
+      const VideoImage * image = nullptr;
+      /// The image converted to RGBA, null if conversion is disabled or the
+      /// image format can't be converted
+      const VideoImage * rgba = nullptr;
+      /// Time when the image was received from the input
+      Radiant::TimeStamp timestamp;
+      /// Running number of captured frames, including dropped frames
+      uint64_t frameNumber = 0;
+    };
+
+    struct Statistics
+    {
+      /// Number of frames captured from the input
+      uint64_t captured = 0;
+      /// Number of captured frames that were never given to the consumer
+      uint64_t dropped = 0;
+      /// Number of frames converted to RGBA
+      uint64_t converted = 0;
+    };
+
+    /// @param input video input to capture from. The input needs to be open
+    ///        and started before the first frame is captured.
+    /// @param bufferCount number of frame buffers
+    /// @param policy what to do when all buffers are full
+    VideoCaptureQueue(VideoInput & input, int bufferCount = 4,
+                      OverflowPolicy policy = DROP_OLDEST);
+    /// Stops the capture thread
+    ~VideoCaptureQueue();
+
+    /// Enables conversion to RGBA. Call before start.
+    void setConvertToRGBA(bool convert);
+    bool convertToRGBA() const;
+
+    /// Sets the alignment of the frame buffers and their lines in bytes.
+    /// The default is 32. Call before start.
+    void setAlignment(int alignment);
+
+    /// Starts the capture thread
+    void start();
+    /// Stops the capture thread and waits for the conversions to finish.
+    /// Frames that are already captured can still be acquired.
+    void stop();
+    bool isRunning() const;
+
+    /// Returns the oldest captured frame. Can be called from one consumer
+    /// thread at a time.
+    /// @param timeoutMs maximum time to wait, negative waits until a frame
+    ///        is available or the queue is stopped
+    /// @return frame or null on timeout. The frame needs to be given back
+    ///         with releaseFrame.
+    const Frame * acquireFrame(int timeoutMs = -1);
+    /// Gives the buffer of the frame back to the capture thread
+    void releaseFrame(const Frame * frame);
+
+    /// Number of frames that are captured but not yet acquired
+    int framesAvailable() const;
+
+    Statistics statistics() const;
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
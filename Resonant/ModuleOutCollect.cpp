@@ -49,7 +49,10 @@ namespace Resonant {
     channelsOut = 0;
 
     channelsIn = (int) m_map.size();
-    m_channels = m_host->audioLoop()->outChannels();
+    // Without an audio loop the network is processed offline, for example
+    // in benchmarks, default to stereo output in that case
+    AudioLoop * audioLoop = m_host->audioLoop();
+    m_channels = audioLoop ? audioLoop->outChannels() : 2;
 
     /* For debugging purposes you can override (=expand) the number of
        output channels. */
@@ -15,6 +15,7 @@
 
 #include "DSPNetwork.hpp"
 #include "AudioFileHandler.hpp"
+#include "SampleResampler.hpp"
 
 #include <Nimble/Math.hpp>
 
@@ -25,6 +26,7 @@
 
 #include <sndfile.h>
 #include <cassert>
+#include <cmath>
 
 namespace Resonant {
 
@@ -173,93 +175,6 @@ namespace Resonant {
   ///////////////////////////////////////////////////////////////////
   ///////////////////////////////////////////////////////////////////
 
-  class ModuleSamplePlayer::Sample::Internal
-  {
-  public:
-    Internal()
-    { memset( & m_info, 0, sizeof(m_info)); }
-
-    SF_INFO m_info;
-  };
-
-  ModuleSamplePlayer::Sample::Sample()
-  {
-    //info("ModuleSamplePlayer::Sample::Sample # %p", this);
-    m_d = new Internal();
-  }
-
-  ModuleSamplePlayer::Sample::~Sample()
-  {
-    //info("ModuleSamplePlayer::Sample::~Sample # %p", this);
-
-    delete m_d;
-  }
-
-  const float * ModuleSamplePlayer::Sample::buf(unsigned i) const
-  {
-    return & m_data[i * m_d->m_info.channels];
-  }
-
-  bool ModuleSamplePlayer::Sample::load(const char * filename,
-                                        const char * name)
-  {
-    if(!Radiant::FileUtils::fileReadable(filename))
-      return false;
-
-    m_name = name;
-
-    memset(&m_d->m_info, 0, sizeof(m_d->m_info));
-
-    SNDFILE * sndf = AudioFileHandler::open(filename, SFM_READ, & m_d->m_info);
-
-    if(!sndf)
-      return false;
-
-    m_data.resize(m_d->m_info.channels * m_d->m_info.frames);
-    if(!m_data.empty())
-      memset( & m_data[0], 0, m_data.size() * sizeof(float));
-
-    size_t block = 1000;
-
-    size_t pos = 0;
-
-    while(pos < static_cast<size_t> (m_d->m_info.frames)) {
-      size_t get = std::min((size_t) (m_d->m_info.frames - pos), block);
-      size_t n = get * m_d->m_info.channels;
-
-      sf_read_float(sndf, & m_data[pos * m_d->m_info.channels], n);
-
-      pos += get;
-    }
-
-    sf_close(sndf);
-
-    Radiant::debug
-        ("ModuleSamplePlayer::Sample::load # %s from %s %d frames %d channels",
-         filename, name, (int) m_d->m_info.frames, (int) m_d->m_info.channels);
-
-    return true;
-  }
-
-  unsigned ModuleSamplePlayer::Sample::available(unsigned pos) const
-  {
-    // pos /=m_d->m_info.channels;
-    return (pos < m_d->m_info.frames) ? m_d->m_info.frames - pos : 0;
-  }
-
-  unsigned ModuleSamplePlayer::Sample::channels() const
-  {
-    return m_d->m_info.channels;
-  }
-
-  unsigned ModuleSamplePlayer::Sample::frames() const
-  {
-    return m_d->m_info.frames;
-  }
-
-  /////////////////////////////////////////////////////////////////////////////
-  /////////////////////////////////////////////////////////////////////////////
-
   bool ModuleSamplePlayer::SampleVoice::synthesize(float ** out, int n, ModuleSamplePlayer * host)
   {
     if(m_startTime > host->time()) {
@@ -269,6 +184,8 @@ namespace Resonant {
       return m_state == WAITING_FOR_SAMPLE;
     }
 
+    m_sample->prefetch(m_position);
+
     unsigned avail = m_sample->available(m_position);
 
     if((int) avail > n)
@@ -285,39 +202,30 @@ namespace Resonant {
     }
 
     float * b1 = out[m_targetChannel];
-    Nimble::Rampd gain = m_gain;
     Nimble::Rampd pitch = m_relPitch;
 
     bool more;
 
     int chans = m_sample->channels();
     int sampleChannel = chans == 1 ? 0 : m_sampleChannel;
-    float onePerChans = 1.f / chans;
+
+    // Voice output before gain, mixed to the output channel at the end
+    const float * voice = nullptr;
+    int rendered = 0;
 
     if(avail == 0) {
       more = false;
     }
     else if(pitch == 1.0f && !pitch.left()) {
-      // downmix all channels to mono
-      if (sampleChannel == -1) {
-        const float * src = m_sample->buf(m_position);
-
-        for (unsigned i = 0; i < avail; i++) {
-          float mix = 0;
-          for (const float * end = src + chans; src < end; ++src)
-            mix += *src;
-          *b1++ += mix * onePerChans * static_cast<float>(gain.value());
-          gain.update();
-        }
+      if(chans == 1) {
+        // Mix straight from the sample data
+        voice = m_sample->buf(m_position);
       } else {
-        const float * src = m_sample->buf(m_position) + sampleChannel;
-
-        for(unsigned i = 0; i < avail; i++) {
-          *b1++ += *src * static_cast<float>(gain.value());
-          src += chans;
-          gain.update();
-        }
+        float * dst = host->voiceBuffer(n);
+        host->deinterleave(*m_sample, sampleChannel, m_position, avail, dst);
+        voice = dst;
       }
+      rendered = avail;
 
       m_position += avail;
       m_dpos = m_position;
@@ -325,42 +233,23 @@ namespace Resonant {
       more = (int) avail == n;
     }
     else {
+      const SampleResampler & resampler = host->resampler();
+
       double dpos = m_dpos;
       double dmax = m_sample->frames() - 1;
 
-      if (sampleChannel == -1) {
-        const float * src = m_sample->buf(0);
-
-        for (int i = 0 ; i < n && dpos < dmax; i++) {
-          int base = (int) dpos;
-          double w2 = dpos - (double) base;
-
-          float mixa = 0.f, mixb = 0.f;
-          for (int ch = 0; ch < chans; ++ch) {
-            mixa += src[base * chans + ch];
-            mixb += src[(base+1) * chans + ch];
-          }
-
-          *b1++ += gain * onePerChans *
-              float((mixa * (1.0 - w2) + mixb * w2));
-          dpos += pitch;
-          gain.update();
-          pitch.update();
-        }
-      } else {
-        const float * src = m_sample->buf(0) + sampleChannel;
+      // Gather all source frames that this block might touch
+      const double maxPitch = std::max(pitch.value(), pitch.target());
+      const int margin = resampler.margin(maxPitch);
+      const long first = long(dpos) - margin;
+      const int count = int(std::ceil(n * std::max(maxPitch, 0.0))) + 2 * margin + 1;
 
-        for(int i = 0 ; i < n && dpos < dmax; i++) {
+      float * window = host->windowBuffer(count);
+      host->deinterleave(*m_sample, sampleChannel, first, count, window);
 
-          int base = (int) dpos;
-          double w2 = dpos - (double) base;
-          *b1++ += gain *
-              float((src[base * chans] * (1.0 - w2) + src[(base+1) * chans] * w2));
-          dpos += pitch;
-          gain.update();
-          pitch.update();
-        }
-      }
+      float * dst = host->voiceBuffer(n);
+      rendered = resampler.render(window, first, dpos, dmax, pitch, dst, n);
+      voice = dst;
 
       m_dpos = dpos;
       m_position = static_cast<unsigned>(dpos);
@@ -369,7 +258,8 @@ namespace Resonant {
       more = dpos < dmax;
     }
 
-    m_gain = gain;
+    if(rendered > 0)
+      SampleResampler::mixRamped(b1, voice, rendered, m_gain);
 
     if(m_finishCounter > 0 && (m_finishCounter - n) <= 0) {
 
@@ -706,16 +596,16 @@ namespace Resonant {
 
           debugResonant("ModuleSamplePlayer::BGLoader::childLoop # Something");
 
-          std::shared_ptr<Sample> s(new Sample);
+          std::shared_ptr<Sample> s = m_host->m_bank->load(QString::fromStdString(it.m_name));
 
           bool good = true;
 
-          if(!s->load(it.m_name.c_str(), it.m_name.c_str())) {
+          if(!s) {
             Radiant::error("ModuleSamplePlayer::BGLoader::childLoop # Could not load "
                            "\"%s\"", it.m_name.c_str());
             good = false;
           }
-          else if(!m_host->addSample(s)) {
+          else if(!m_host->addSample(QByteArray::fromStdString(it.m_name), s)) {
             Radiant::error("ModuleSamplePlayer::BGLoader::childLoop # Could not add "
                            "\"%s\"", it.m_name.c_str());
             good = false;
@@ -758,7 +648,8 @@ namespace Resonant {
   /////////////////////////////////////////////////////////////////////////////
 
   ModuleSamplePlayer::ModuleSamplePlayer()
-    : m_channels(1)
+    : m_resamplingQuality(SampleResampler::QUALITY_MEDIUM)
+    , m_channels(1)
     , m_active(0)
     , m_masterGain(1.0f)
     , m_userNoteIdCounter(1)
@@ -767,7 +658,7 @@ namespace Resonant {
     m_voiceptrs.resize(m_voices.size());
     if(!m_voiceptrs.empty())
       memset( & m_voiceptrs[0], 0, m_voiceptrs.size() * sizeof(SampleVoice *));
-    m_samples.resize(2048);
+    m_bank = SampleBank::instance();
 
     m_loader = new BGLoader(this);
   }
@@ -819,9 +710,9 @@ namespace Resonant {
       SampleVoice & voice = m_voices[voiceind];
       m_voiceptrs[m_active] = & voice;
 
-      int sampleind = findSample(buf);
+      std::shared_ptr<Sample> sample = findSample(buf);
 
-      if(sampleind < 0) {
+      if(!sample) {
         debugResonant("ModuleSamplePlayer::eventProcess # No sample \"%s\"", buf);
 
         m_loader->addLoadable(buf, & voice);
@@ -829,8 +720,7 @@ namespace Resonant {
         // return;
       }
 
-      voice.init(this, sampleind >= 0 ?
-                   m_samples[sampleind] : std::shared_ptr<Sample>(), data);
+      voice.init(this, sample, data);
       m_active++;
 
       debugResonant("ModuleSamplePlayer::eventProcess # Started sample %s (%d/%ld)",
@@ -889,11 +779,8 @@ namespace Resonant {
         i++;
     }
 
-    for(i = 0; i < m_channels; i++) {
-      float * ptr = out[i];
-      for(float * sentinel = ptr + n; ptr < sentinel; ptr++)
-        *ptr *= m_masterGain;
-    }
+    for(i = 0; i < m_channels; i++)
+      SampleResampler::scale(out[i], n, m_masterGain);
 
 
     /* for(i = 0; i < m_channels; i++)
@@ -1277,6 +1164,73 @@ namespace Resonant {
     return pan->locationToChannel(location);
   }
 
+  void ModuleSamplePlayer::setResamplingQuality(SampleResampler::Quality quality)
+  {
+    m_resamplingQuality = quality;
+  }
+
+  SampleResampler::Quality ModuleSamplePlayer::resamplingQuality() const
+  {
+    return m_resamplingQuality;
+  }
+
+  const SampleResampler & ModuleSamplePlayer::resampler() const
+  {
+    return SampleResampler::get(m_resamplingQuality);
+  }
+
+  float * ModuleSamplePlayer::voiceBuffer(int n)
+  {
+    if(m_voiceBuffer.size() < size_t(n))
+      m_voiceBuffer.resize(n);
+    return m_voiceBuffer.data();
+  }
+
+  float * ModuleSamplePlayer::windowBuffer(int n)
+  {
+    if(m_windowBuffer.size() < size_t(n))
+      m_windowBuffer.resize(n);
+    return m_windowBuffer.data();
+  }
+
+  void ModuleSamplePlayer::deinterleave(const Sample & sample, int sampleChannel,
+                                        long first, int count, float * dst)
+  {
+    const long frames = sample.frames();
+    const int chans = sample.channels();
+
+    // Frames outside of the sample are silent
+    int i = 0;
+    for(; i < count && first + i < 0; ++i)
+      dst[i] = 0.0f;
+
+    const int last = int(std::min<long>(count, frames - first));
+
+    if(i < last) {
+      const float * src = sample.buf(first + i);
+      if(sampleChannel == -1) {
+        // downmix all channels to mono
+        const float onePerChans = 1.f / chans;
+        for(; i < last; ++i) {
+          float mix = 0;
+          for(const float * end = src + chans; src < end; ++src)
+            mix += *src;
+          dst[i] = mix * onePerChans;
+        }
+      } else if(chans == 1) {
+        memcpy(dst + i, src, (last - i) * sizeof(float));
+        i = last;
+      } else {
+        src += sampleChannel;
+        for(; i < last; ++i, src += chans)
+          dst[i] = *src;
+      }
+    }
+
+    for(; i < count; ++i)
+      dst[i] = 0.0f;
+  }
+
   int ModuleSamplePlayer::findFreeVoice()
   {
     for(unsigned i = 0; i < m_voices.size(); i++) {
@@ -1286,28 +1240,24 @@ namespace Resonant {
     return -1;
   }
 
-  int ModuleSamplePlayer::findSample(const char * name)
+  std::shared_ptr<ModuleSamplePlayer::Sample> ModuleSamplePlayer::findSample(const char * name)
   {
-    for(unsigned i = 0; i < m_samples.size(); i++) {
-      Sample * s = m_samples[i].get();
-
-      if(s)
-        if(s->name() == name)
-          return i;
-    }
-
-    return -1;
+    Radiant::Guard g(m_samplesMutex);
+    return m_samples.value(QByteArray::fromRawData(name, int(strlen(name))));
   }
 
   void ModuleSamplePlayer::loadSamples()
   {
-    m_samples.clear();
+    QHash<QByteArray, std::shared_ptr<Sample> > samples;
 
     for(std::list<SampleInfo>::iterator it = m_sampleList.begin(); it != m_sampleList.end(); ++it) {
-      std::shared_ptr<Sample> s(new Sample());
-      if(s->load((*it).m_filename.toUtf8().data(), (*it).m_name.toUtf8().data()))
-        m_samples.push_back(s);
+      std::shared_ptr<Sample> s = m_bank->load((*it).m_filename);
+      if(s)
+        samples[(*it).m_name.toUtf8()] = s;
     }
+
+    Radiant::Guard g(m_samplesMutex);
+    m_samples.swap(samples);
   }
 
   void ModuleSamplePlayer::stopSampleInternal(Radiant::BinaryData &data)
@@ -1357,18 +1307,13 @@ namespace Resonant {
     }
   }
 
-  bool ModuleSamplePlayer::addSample(std::shared_ptr<Sample> s)
+  bool ModuleSamplePlayer::addSample(const QByteArray & name, std::shared_ptr<Sample> s)
   {
-    for(unsigned i = 0; i < m_samples.size(); i++) {
-      if(!m_samples[i]) {
-        m_samples[i] = s;
-        return true;
-      }
-      debugResonant("ModuleSamplePlayer::addSample # m_samples[%u] = %p",
-                    i, m_samples[i].get());
-    }
-
-    return false;
+    // The bank shares samples between different paths to the same file, so
+    // s->name() might not be the name this player uses
+    Radiant::Guard g(m_samplesMutex);
+    m_samples[name] = s;
+    return true;
   }
 
   void ModuleSamplePlayer::dropVoice(size_t i)
@@ -20,8 +20,12 @@
 #include <Radiant/Condition.hpp>
 
 #include <Resonant/Module.hpp>
+#include <Resonant/SampleBank.hpp>
+#include <Resonant/SampleResampler.hpp>
 
+#include <atomic>
 #include <list>
+#include <QHash>
 #include <QString>
 #include <vector>
 
@@ -42,9 +46,10 @@ namespace Resonant {
       <B>Memory management:</B> The samples (aka audio files)
       are read from the disk as they are needed. The samples are loaded when they
       are first used. To force the loading of a particular sample, you can
-      play the sample with zero volume. Samples are never dropped away from the
-      RAM which may cause memory usage issues if the application is using a lot
-      sound files.
+      play the sample with zero volume. The decoded samples are shared with
+      all other sample players through SampleBank, which also caches them on
+      disk and streams long samples. A player keeps its samples loaded for as
+      long as it exists.
   */
   class RESONANT_API ModuleSamplePlayer : public Module
   {
@@ -312,6 +317,11 @@ namespace Resonant {
     void setSamplePlayHead(const NoteInfo & info, float playHeadTimeSeconds, float interpolationTimeSeconds = 0.02f);
     void setSampleLooping(const NoteInfo & info, bool looping);
 
+    /// Interpolation quality used for voices that are not played at the
+    /// original pitch. The default is SampleResampler::QUALITY_MEDIUM.
+    void setResamplingQuality(SampleResampler::Quality quality);
+    SampleResampler::Quality resamplingQuality() const;
+
     /** Sets the master gain */
     void setMasterGain(float gain) { m_masterGain = gain; }
 
@@ -329,8 +339,18 @@ namespace Resonant {
 
     bool addSample(const char * filename, const char * name);
 
+    const SampleResampler & resampler() const;
+
+    /* Scratch buffers for voice rendering, only used from the audio thread */
+    float * voiceBuffer(int n);
+    float * windowBuffer(int n);
+
+    /* Copies count frames starting from first to a mono buffer */
+    static void deinterleave(const SampleBank::Sample & sample, int sampleChannel,
+                             long first, int count, float * dst);
+
     int findFreeVoice();
-    int findSample(const char * );
+    std::shared_ptr<SampleBank::Sample> findSample(const char * );
 
     void loadSamples();
     void stopSampleInternal(Radiant::BinaryData & data);
@@ -343,33 +363,8 @@ namespace Resonant {
       QString m_filename;
     };
 
-    /* This class holds audio sample data in RAM. */
-    class Sample : public Patterns::NotCopyable
-    {
-    public:
-      Sample();
-      ~Sample();
-
-      bool load(const char * filename, const char * name);
-
-      inline const std::vector<float> & data() const { return m_data; }
-      const float * buf(unsigned i) const;
-
-      const QString & name() const { return m_name; }
-      /** Number of samples available */
-      unsigned available(unsigned pos) const;
-      unsigned channels() const;
-      unsigned frames() const;
-
-    private:
-      class Internal;
-
-      Internal * m_d;
-
-      std::vector<float> m_data;
-
-      QString m_name;
-    };
+    /* Audio sample data, shared between all players. */
+    typedef SampleBank::Sample Sample;
 
     /* This class controls the playback of a sample. */
     class SampleVoice
@@ -498,7 +493,7 @@ namespace Resonant {
       volatile bool m_continue;
     };
 
-    bool addSample(std::shared_ptr<Sample> s);
+    bool addSample(const QByteArray & name, std::shared_ptr<Sample> s);
 
     void dropVoice(size_t index);
 
@@ -506,12 +501,19 @@ namespace Resonant {
 
     std::list<SampleInfo> m_sampleList;
 
-    std::vector<std::shared_ptr<Sample> > m_samples;
+    std::shared_ptr<SampleBank> m_bank;
+    /* Samples used by this player, protected by m_samplesMutex */
+    QHash<QByteArray, std::shared_ptr<Sample> > m_samples;
+    Radiant::Mutex m_samplesMutex;
 
     std::vector<SampleVoice> m_voices;
     std::vector<SampleVoice *> m_voiceptrs;
     std::map<int, NoteInfoInternalPtr> m_infos;
 
+    std::atomic<SampleResampler::Quality> m_resamplingQuality;
+    std::vector<float> m_voiceBuffer;
+    std::vector<float> m_windowBuffer;
+
     size_t m_channels;
     size_t m_active;
 
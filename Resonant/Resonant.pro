@@ -13,6 +13,8 @@ HEADERS += Module.hpp
 HEADERS += ModuleOutCollect.hpp
 HEADERS += ModulePanner.hpp
 HEADERS += ModuleSamplePlayer.hpp
+HEADERS += SampleBank.hpp
+HEADERS += SampleResampler.hpp
 HEADERS += Resonant.hpp
 HEADERS += SoundRectangle.hpp
 
@@ -26,6 +28,8 @@ SOURCES += ModuleGain.cpp
 SOURCES += ModuleOutCollect.cpp
 SOURCES += ModulePanner.cpp
 SOURCES += ModuleSamplePlayer.cpp
+SOURCES += SampleBank.cpp
+SOURCES += SampleResampler.cpp
 SOURCES += SoundRectangle.cpp
 
 enable-port-audio {
@@ -0,0 +1,420 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "SampleBank.hpp"
+
+#include "AudioFileHandler.hpp"
+#include "Resonant.hpp"
+
+#include <Radiant/CacheManager.hpp>
+#include <Radiant/Condition.hpp>
+#include <Radiant/Trace.hpp>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+
+#include <sndfile.h>
+
+#include <cstring>
+#include <vector>
+
+#ifdef RADIANT_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  /// Increase this if the cache file format changes
+  const int s_sampleCacheVersion = 1;
+
+  const char s_magic[4] = { 'M', 'S', 'P', 'C' };
+
+  /// Header of the raw PCM cache file, followed by frames * channels floats
+  struct CacheHeader
+  {
+    char magic[4];
+    uint32_t channels;
+    uint32_t sampleRate;
+    uint32_t reserved;
+    uint64_t frames;
+  };
+  static_assert(sizeof(CacheHeader) == 24, "CacheHeader must be packed");
+
+  /// Streaming samples are read ahead in chunks of this many seconds
+  const unsigned s_prefetchChunkFrames = 44100 * 2;
+  /// Decode block size when converting the file to PCM
+  const sf_count_t s_decodeBlockFrames = 4096;
+
+  /// Bank key of the file, so that the same file reached through different
+  /// relative paths or symlinks is only loaded once
+  QString key(const QString & filename)
+  {
+    QFileInfo info(filename);
+    QString path = info.canonicalFilePath();
+    // Non-existing files have no canonical path
+    return path.isEmpty() ? info.absoluteFilePath() : path;
+  }
+}
+
+namespace Resonant
+{
+  class SampleBank::Sample::D
+  {
+  public:
+    /// Memory-mapped cache file, if the sample was mapped
+    QFile m_file;
+    uchar * m_map = nullptr;
+    size_t m_mapSize = 0;
+    /// Heap storage, used when the disk cache is not available
+    std::vector<float> m_heap;
+  };
+
+  class SampleBank::D
+  {
+  public:
+    SampleBank::SamplePtr loadMapped(const QString & filename, const QString & name);
+    SampleBank::SamplePtr mapCache(const QString & cacheFile, const QString & name);
+    SampleBank::SamplePtr loadHeap(const QString & filename, const QString & name);
+    bool writeCache(const QString & filename, const QString & cacheFile);
+    void pageIn(const SampleBank::Sample & sample);
+
+  public:
+    mutable Radiant::Mutex m_mutex;
+    Radiant::Condition m_loadingCond;
+    /// Keyed by the canonical path of the file, see key()
+    QHash<QString, std::weak_ptr<SampleBank::Sample>> m_samples;
+    /// Samples that are currently being loaded by some thread
+    QSet<QString> m_loading;
+
+    std::atomic<size_t> m_streamingThreshold{16 << 20};
+    std::atomic<bool> m_diskCacheEnabled{true};
+
+    QString m_cacheDir;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  SampleBank::Sample::Sample()
+    : m_d(new D())
+  {
+  }
+
+  SampleBank::Sample::~Sample()
+  {
+    if(m_d->m_map)
+      m_d->m_file.unmap(m_d->m_map);
+  }
+
+  bool SampleBank::Sample::isMapped() const
+  {
+    return m_d->m_map != nullptr;
+  }
+
+  void SampleBank::Sample::prefetch(unsigned frame) const
+  {
+    if(!m_streaming)
+      return;
+
+    const int chunk = static_cast<int>(frame / s_prefetchChunkFrames);
+    int old = m_prefetchedChunk.load(std::memory_order_relaxed);
+    if(old == chunk || !m_prefetchedChunk.compare_exchange_strong(old, chunk))
+      return;
+
+#ifdef RADIANT_UNIX
+    // Read ahead the current and the next chunk. madvise only schedules the
+    // read, it doesn't block until the pages are in memory.
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t chunkBytes = size_t(s_prefetchChunkFrames) * m_channels * sizeof(float);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(buf(chunk * s_prefetchChunkFrames));
+    uintptr_t end = std::min(begin + 2 * chunkBytes, reinterpret_cast<uintptr_t>(buf(m_frames)));
+    begin = begin / pageSize * pageSize;
+    if(end > begin)
+      madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#endif
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  bool SampleBank::D::writeCache(const QString & filename, const QString & cacheFile)
+  {
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE * sndf = AudioFileHandler::open(filename, SFM_READ, &info);
+    if(!sndf)
+      return false;
+
+    QSaveFile file(cacheFile);
+    if(!file.open(QSaveFile::WriteOnly)) {
+      Radiant::warning("SampleBank # Failed to open %s for writing: %s",
+                       cacheFile.toUtf8().data(), file.errorString().toUtf8().data());
+      sf_close(sndf);
+      return false;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.channels = info.channels;
+    header.sampleRate = info.samplerate;
+    header.reserved = 0;
+    header.frames = info.frames;
+
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+
+    // Decode in blocks, so that we never need to hold the whole file in memory
+    std::vector<float> block(s_decodeBlockFrames * info.channels);
+    sf_count_t pos = 0;
+    while(ok && pos < info.frames) {
+      sf_count_t get = std::min(info.frames - pos, s_decodeBlockFrames);
+      sf_count_t got = sf_readf_float(sndf, block.data(), get);
+      if(got < get)
+        std::fill(block.begin() + got * info.channels, block.begin() + get * info.channels, 0.0f);
+      const qint64 bytes = get * info.channels * sizeof(float);
+      ok = file.write(reinterpret_cast<const char*>(block.data()), bytes) == bytes;
+      pos += get;
+    }
+
+    sf_close(sndf);
+
+    if(ok)
+      ok = file.commit();
+    else
+      file.cancelWriting();
+
+    if(!ok)
+      Radiant::warning("SampleBank # Failed to write sample cache %s", cacheFile.toUtf8().data());
+
+    return ok;
+  }
+
+  void SampleBank::D::pageIn(const SampleBank::Sample & sample)
+  {
+    // Touch every page so that the audio thread never needs to wait for the disk
+    const size_t stride = 4096 / sizeof(float);
+    const size_t count = sample.bytes() / sizeof(float);
+    const float * data = sample.buf(0);
+    volatile float sink = 0.0f;
+    for(size_t i = 0; i < count; i += stride)
+      sink = sink + data[i];
+    (void)sink;
+  }
+
+  SampleBank::SamplePtr SampleBank::D::loadMapped(const QString & filename, const QString & name)
+  {
+    auto cacheMgr = Radiant::CacheManager::instance();
+    QString cacheDir;
+    {
+      Radiant::Guard g(m_mutex);
+      if(m_cacheDir.isEmpty())
+        m_cacheDir = cacheMgr->createCacheDir(QString("samples.%1").arg(s_sampleCacheVersion));
+      cacheDir = m_cacheDir;
+    }
+
+    Radiant::CacheManager::CacheItem item = cacheMgr->cacheItem(cacheDir, filename, QString(), "pcm");
+    if(item.isValid) {
+      if(auto sample = mapCache(item.path, name))
+        return sample;
+      // The cache file is corrupted, decode the file again
+      QFile::remove(item.path);
+    }
+
+    if(!writeCache(filename, item.path))
+      return nullptr;
+
+    return mapCache(item.path, name);
+  }
+
+  SampleBank::SamplePtr SampleBank::D::mapCache(const QString & cacheFile, const QString & name)
+  {
+    SampleBank::SamplePtr sample(new SampleBank::Sample());
+    QFile & file = sample->m_d->m_file;
+    file.setFileName(cacheFile);
+    if(!file.open(QFile::ReadOnly))
+      return nullptr;
+
+    CacheHeader header;
+    if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+       memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.channels == 0) {
+      Radiant::warning("SampleBank # Invalid sample cache file %s", cacheFile.toUtf8().data());
+      return nullptr;
+    }
+
+    const size_t dataBytes = size_t(header.frames) * header.channels * sizeof(float);
+    if(size_t(file.size()) < sizeof(header) + dataBytes) {
+      Radiant::warning("SampleBank # Truncated sample cache file %s", cacheFile.toUtf8().data());
+      return nullptr;
+    }
+
+    if(dataBytes > 0) {
+      sample->m_d->m_mapSize = sizeof(header) + dataBytes;
+      sample->m_d->m_map = file.map(0, sample->m_d->m_mapSize);
+      if(!sample->m_d->m_map)
+        return nullptr;
+      sample->m_data = reinterpret_cast<const float*>(sample->m_d->m_map + sizeof(header));
+    }
+
+    sample->m_name = name;
+    sample->m_channels = header.channels;
+    sample->m_frames = static_cast<unsigned>(header.frames);
+    sample->m_sampleRate = header.sampleRate;
+    sample->m_streaming = dataBytes > m_streamingThreshold;
+
+    if(sample->m_streaming)
+      sample->prefetch(0);
+    else
+      pageIn(*sample);
+
+    return sample;
+  }
+
+  SampleBank::SamplePtr SampleBank::D::loadHeap(const QString & filename, const QString & name)
+  {
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE * sndf = AudioFileHandler::open(filename, SFM_READ, &info);
+    if(!sndf)
+      return nullptr;
+
+    SampleBank::SamplePtr sample(new SampleBank::Sample());
+    std::vector<float> & data = sample->m_d->m_heap;
+    data.resize(size_t(info.channels) * info.frames, 0.0f);
+
+    sf_count_t pos = 0;
+    while(pos < info.frames) {
+      sf_count_t get = std::min(info.frames - pos, s_decodeBlockFrames);
+      sf_readf_float(sndf, data.data() + pos * info.channels, get);
+      pos += get;
+    }
+
+    sf_close(sndf);
+
+    sample->m_name = name;
+    sample->m_data = data.data();
+    sample->m_channels = info.channels;
+    sample->m_frames = static_cast<unsigned>(info.frames);
+    sample->m_sampleRate = info.samplerate;
+
+    return sample;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  SampleBank::SampleBank()
+    : m_d(new D())
+  {
+  }
+
+  SampleBank::~SampleBank()
+  {
+  }
+
+  SampleBank::SamplePtr SampleBank::find(const QString & filename) const
+  {
+    const QString path = key(filename);
+    Radiant::Guard g(m_d->m_mutex);
+    return m_d->m_samples.value(path).lock();
+  }
+
+  SampleBank::SamplePtr SampleBank::load(const QString & filename)
+  {
+    const QString path = key(filename);
+
+    {
+      Radiant::Guard g(m_d->m_mutex);
+      for(;;) {
+        if(auto sample = m_d->m_samples.value(path).lock())
+          return sample;
+        if(!m_d->m_loading.contains(path))
+          break;
+        // Some other thread is already decoding the same file
+        m_d->m_loadingCond.wait(m_d->m_mutex);
+      }
+      m_d->m_loading.insert(path);
+    }
+
+    SamplePtr sample;
+    if(m_d->m_diskCacheEnabled)
+      sample = m_d->loadMapped(path, filename);
+    if(!sample)
+      sample = m_d->loadHeap(path, filename);
+
+    if(sample) {
+      debugResonant("SampleBank::load # %s %u frames %u channels%s%s",
+                    filename.toUtf8().data(), sample->frames(), sample->channels(),
+                    sample->isMapped() ? " mapped" : "",
+                    sample->isStreaming() ? " streaming" : "");
+    }
+
+    Radiant::Guard g(m_d->m_mutex);
+    m_d->m_loading.remove(path);
+    if(sample)
+      m_d->m_samples[path] = sample;
+
+    // Drop entries of samples that no player is using anymore
+    for(auto it = m_d->m_samples.begin(); it != m_d->m_samples.end();) {
+      if(it->expired())
+        it = m_d->m_samples.erase(it);
+      else
+        ++it;
+    }
+
+    m_d->m_loadingCond.wakeAll();
+
+    return sample;
+  }
+
+  size_t SampleBank::streamingThresholdBytes() const
+  {
+    return m_d->m_streamingThreshold;
+  }
+
+  void SampleBank::setStreamingThresholdBytes(size_t bytes)
+  {
+    m_d->m_streamingThreshold = bytes;
+  }
+
+  bool SampleBank::isDiskCacheEnabled() const
+  {
+    return m_d->m_diskCacheEnabled;
+  }
+
+  void SampleBank::setDiskCacheEnabled(bool enabled)
+  {
+    m_d->m_diskCacheEnabled = enabled;
+  }
+
+  int SampleBank::sampleCount() const
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    int count = 0;
+    for(auto & weak: m_d->m_samples)
+      if(!weak.expired())
+        ++count;
+    return count;
+  }
+
+  size_t SampleBank::totalBytes() const
+  {
+    Radiant::Guard g(m_d->m_mutex);
+    size_t bytes = 0;
+    for(auto & weak: m_d->m_samples)
+      if(auto sample = weak.lock())
+        bytes += sample->bytes();
+    return bytes;
+  }
+
+  DEFINE_SINGLETON(SampleBank)
+}
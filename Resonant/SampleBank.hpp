@@ -0,0 +1,139 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+
+#include <Patterns/NotCopyable.hpp>
+
+#include <Radiant/Singleton.hpp>
+
+#include <QString>
+
+#include <atomic>
+#include <memory>
+
+namespace Resonant
+{
+  /// Process-wide store of decoded audio samples.
+  ///
+  /// All ModuleSamplePlayer instances share their samples through this bank,
+  /// so the same audio file is only decoded and kept in memory once. The bank
+  /// itself only holds weak references: a sample is released once the last
+  /// player that uses it lets go of it.
+  ///
+  /// Decoded PCM data is written to the disk cache (see Radiant::CacheManager)
+  /// as raw 32-bit float files. The cache files are memory-mapped, which means
+  /// that the next time the same file is loaded, no decoding is needed and the
+  /// data is paged in directly from the cache. If the cache is not writable,
+  /// the sample is decoded to the heap instead.
+  ///
+  /// Samples that are larger than streamingThresholdBytes() are streamed from
+  /// the mapped cache file: only the region around the playhead needs to be
+  /// resident, the rest of the file is read ahead as the playback progresses.
+  /// Smaller samples are fully paged in already when they are loaded.
+  ///
+  /// All functions in this class are thread-safe.
+  class RESONANT_API SampleBank
+  {
+    DECLARE_SINGLETON(SampleBank);
+
+  public:
+    /// Decoded, read-only audio sample. The data is interleaved 32-bit float.
+    class RESONANT_API Sample : public Patterns::NotCopyable
+    {
+    public:
+      ~Sample();
+
+      /// Name of the sample, the filename it was first loaded with
+      const QString & name() const { return m_name; }
+
+      /// Number of channels in the sample
+      unsigned channels() const { return m_channels; }
+      /// Number of frames in the sample
+      unsigned frames() const { return m_frames; }
+      /// Original sample rate of the file
+      int sampleRate() const { return m_sampleRate; }
+
+      /// Number of frames available starting from the given frame
+      unsigned available(unsigned pos) const { return pos < m_frames ? m_frames - pos : 0; }
+
+      /// Pointer to the interleaved data of the given frame
+      const float * buf(unsigned frame) const { return m_data + size_t(frame) * m_channels; }
+
+      /// Size of the decoded data in bytes
+      size_t bytes() const { return size_t(m_frames) * m_channels * sizeof(float); }
+
+      /// True if the sample data is memory-mapped from the disk cache
+      bool isMapped() const;
+      /// True if the sample is streamed from the disk cache
+      bool isStreaming() const { return m_streaming; }
+
+      /// Makes sure that the data following the given frame is being read
+      /// from the disk. This is cheap to call from the audio thread, it only
+      /// issues a read-ahead request when the playhead enters a new chunk of
+      /// a streaming sample. Does nothing for samples that are not streamed.
+      void prefetch(unsigned frame) const;
+
+    private:
+      friend class SampleBank;
+      Sample();
+
+      class D;
+      std::unique_ptr<D> m_d;
+
+      QString m_name;
+      const float * m_data = nullptr;
+      unsigned m_channels = 0;
+      unsigned m_frames = 0;
+      int m_sampleRate = 0;
+      bool m_streaming = false;
+      mutable std::atomic<int> m_prefetchedChunk{-1};
+    };
+    typedef std::shared_ptr<Sample> SamplePtr;
+
+  public:
+    ~SampleBank();
+
+    /// Returns a sample that is already loaded, or null if the sample is not
+    /// in the bank. Samples are identified by the canonical path of the
+    /// file, so different paths to the same file return the same sample.
+    /// Does not load anything.
+    SamplePtr find(const QString & filename) const;
+
+    /// Returns the sample for the given file, loading it if necessary. This
+    /// might take a long time if the file needs to be decoded, so this
+    /// should not be called from the audio thread.
+    /// @param filename audio file to load
+    /// @return loaded sample or null if the file could not be loaded
+    SamplePtr load(const QString & filename);
+
+    /// Samples larger than this are streamed from the disk cache instead of
+    /// keeping them fully resident in RAM. The default is 16 MB.
+    size_t streamingThresholdBytes() const;
+    void setStreamingThresholdBytes(size_t bytes);
+
+    /// Use the disk cache for decoded samples. Enabled by default.
+    bool isDiskCacheEnabled() const;
+    void setDiskCacheEnabled(bool enabled);
+
+    /// Number of samples currently alive in the bank
+    int sampleCount() const;
+    /// Total size of the decoded data of all live samples
+    size_t totalBytes() const;
+
+  private:
+    SampleBank();
+
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
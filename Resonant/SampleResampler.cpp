@@ -0,0 +1,267 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "SampleResampler.hpp"
+
+#include <Nimble/Math.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RESONANT_RESAMPLER_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+  /// Number of filter phases between two source frames
+  const int PHASES = 256;
+
+  double sinc(double x)
+  {
+    if(std::abs(x) < 1e-9)
+      return 1.0;
+    x *= Nimble::Math::PI;
+    return std::sin(x) / x;
+  }
+
+  /// Blackman window, u in [-1, 1]
+  double blackman(double u)
+  {
+    if(std::abs(u) >= 1.0)
+      return 0.0;
+    return 0.42 + 0.5 * std::cos(Nimble::Math::PI * u) + 0.08 * std::cos(Nimble::Math::TWO_PI * u);
+  }
+
+  inline float dot(const float * a, const float * b, int n)
+  {
+#ifdef RESONANT_RESAMPLER_SSE
+    // n is always a multiple of four
+    __m128 sum = _mm_setzero_ps();
+    for(int i = 0; i < n; i += 4)
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0.0f;
+    for(int i = 0; i < n; ++i)
+      sum += a[i] * b[i];
+    return sum;
+#endif
+  }
+
+  /// dst[i] += src[i] * (gain + i * step)
+  void mixRamp(float * dst, const float * src, int n, float gain, float step)
+  {
+    int i = 0;
+#ifdef RESONANT_RESAMPLER_SSE
+    __m128 g = _mm_setr_ps(gain, gain + step, gain + 2.0f * step, gain + 3.0f * step);
+    const __m128 inc = _mm_set1_ps(4.0f * step);
+    for(; i + 4 <= n; i += 4) {
+      __m128 d = _mm_loadu_ps(dst + i);
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+      _mm_storeu_ps(dst + i, d);
+      g = _mm_add_ps(g, inc);
+    }
+#endif
+    for(; i < n; ++i)
+      dst[i] += src[i] * (gain + i * step);
+  }
+}
+
+namespace Resonant
+{
+  SampleResampler::SampleResampler(Quality quality)
+    : m_quality(quality)
+    , m_taps(0)
+  {
+    double cutoff = 1.0;
+    if(quality == QUALITY_LOW) {
+      m_taps = 8;
+      cutoff = 0.86;
+    } else if(quality == QUALITY_MEDIUM) {
+      m_taps = 16;
+      cutoff = 0.92;
+    } else if(quality == QUALITY_HIGH) {
+      m_taps = 32;
+      cutoff = 0.96;
+    }
+
+    if(m_taps == 0)
+      return;
+
+    const int half = m_taps / 2;
+
+    auto kernel = [=] (double x) {
+      return cutoff * sinc(cutoff * x) * blackman(x / half);
+    };
+
+    m_table.resize((PHASES + 1) * m_taps);
+    for(int p = 0; p <= PHASES; ++p) {
+      const double frac = p / double(PHASES);
+      float * row = &m_table[p * m_taps];
+      double sum = 0.0;
+      for(int j = 0; j < m_taps; ++j) {
+        row[j] = float(kernel((j - half + 1) - frac));
+        sum += row[j];
+      }
+      // Normalize each phase separately to avoid DC ripple
+      for(int j = 0; j < m_taps; ++j)
+        row[j] = float(row[j] / sum);
+    }
+
+    m_kernel.resize(half * PHASES + 2);
+    for(size_t i = 0; i < m_kernel.size(); ++i)
+      m_kernel[i] = float(kernel(i / double(PHASES)));
+  }
+
+  const SampleResampler & SampleResampler::get(Quality quality)
+  {
+    static const SampleResampler s_linear(QUALITY_LINEAR);
+    static const SampleResampler s_low(QUALITY_LOW);
+    static const SampleResampler s_medium(QUALITY_MEDIUM);
+    static const SampleResampler s_high(QUALITY_HIGH);
+
+    switch(quality) {
+    case QUALITY_LOW: return s_low;
+    case QUALITY_MEDIUM: return s_medium;
+    case QUALITY_HIGH: return s_high;
+    default: return s_linear;
+    }
+  }
+
+  int SampleResampler::margin(double pitch) const
+  {
+    if(m_taps == 0)
+      return 2;
+    const double scale = Nimble::Math::Clamp(pitch, 1.0, MAX_DECIMATION);
+    return int(std::ceil(m_taps / 2 * scale)) + 2;
+  }
+
+  float SampleResampler::interpolate(const float * window, long windowFirst, double pos) const
+  {
+    const long base = long(std::floor(pos));
+    const double phase = (pos - base) * PHASES;
+    const int p = int(phase);
+    const float t = float(phase - p);
+
+    const float * src = window + (base - m_taps / 2 + 1 - windowFirst);
+    const float * row = &m_table[p * m_taps];
+
+    const float a = dot(src, row, m_taps);
+    const float b = dot(src, row + m_taps, m_taps);
+    return a + (b - a) * t;
+  }
+
+  float SampleResampler::interpolateDecimated(const float * window, long windowFirst,
+                                              double pos, double scale) const
+  {
+    // Stretch the kernel by the pitch, so that the cut-off frequency moves
+    // down to the Nyquist frequency of the output
+    const double reach = m_taps / 2 * scale;
+    const long first = long(std::floor(pos - reach)) + 1;
+    const long last = long(std::floor(pos + reach));
+    const double invScale = PHASES / scale;
+    const int kernelSize = int(m_kernel.size()) - 1;
+
+    float sum = 0.0f;
+    float weights = 0.0f;
+    for(long k = first; k <= last; ++k) {
+      const double x = std::abs(k - pos) * invScale;
+      const int i = int(x);
+      if(i >= kernelSize)
+        continue;
+      const float t = float(x - i);
+      const float w = m_kernel[i] + (m_kernel[i + 1] - m_kernel[i]) * t;
+      sum += window[k - windowFirst] * w;
+      weights += w;
+    }
+
+    return weights > 0.0f ? sum / weights : 0.0f;
+  }
+
+  int SampleResampler::render(const float * window, long windowFirst, double & pos, double end,
+                              Nimble::Rampd & pitch, float * out, int n) const
+  {
+    int i = 0;
+
+    if(m_taps == 0) {
+      for(; i < n && pos < end; ++i) {
+        const long base = long(pos);
+        const float w2 = float(pos - base);
+        const float a = window[base - windowFirst];
+        const float b = window[base + 1 - windowFirst];
+        out[i] = a + (b - a) * w2;
+        pos += pitch;
+        pitch.update();
+      }
+      return i;
+    }
+
+    for(; i < n && pos < end; ++i) {
+      const double rate = pitch.value();
+      if(rate > 1.0)
+        out[i] = interpolateDecimated(window, windowFirst, pos, std::min(rate, MAX_DECIMATION));
+      else
+        out[i] = interpolate(window, windowFirst, pos);
+      pos += rate;
+      pitch.update();
+    }
+
+    return i;
+  }
+
+  void SampleResampler::mixRamped(float * dst, const float * src, int n, Nimble::Rampd & gain)
+  {
+    int i = 0;
+    if(gain.left() > 0) {
+      const int rampLength = std::min<int>(n, gain.left());
+      const float step = float((gain.target() - gain.value()) / gain.left());
+      mixRamp(dst, src, rampLength, float(gain.value()), step);
+      gain.update(rampLength);
+      i = rampLength;
+    }
+
+    if(i < n)
+      mix(dst + i, src + i, n - i, float(gain.value()));
+  }
+
+  void SampleResampler::mix(float * dst, const float * src, int n, float gain)
+  {
+    if(gain == 0.0f)
+      return;
+
+    int i = 0;
+#ifdef RESONANT_RESAMPLER_SSE
+    const __m128 g = _mm_set1_ps(gain);
+    for(; i + 4 <= n; i += 4) {
+      __m128 d = _mm_loadu_ps(dst + i);
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+      _mm_storeu_ps(dst + i, d);
+    }
+#endif
+    for(; i < n; ++i)
+      dst[i] += src[i] * gain;
+  }
+
+  void SampleResampler::scale(float * buffer, int n, float gain)
+  {
+    int i = 0;
+#ifdef RESONANT_RESAMPLER_SSE
+    const __m128 g = _mm_set1_ps(gain);
+    for(; i + 4 <= n; i += 4)
+      _mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), g));
+#endif
+    for(; i < n; ++i)
+      buffer[i] *= gain;
+  }
+}
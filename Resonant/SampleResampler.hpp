@@ -0,0 +1,100 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+
+#include <Nimble/Ramp.hpp>
+
+#include <vector>
+
+namespace Resonant
+{
+  /// Band-limited resampler for pitched sample playback.
+  ///
+  /// The resampler uses a polyphase windowed-sinc filter. When the signal is
+  /// played back faster than the original rate (pitch > 1), the filter is
+  /// widened so that the cut-off follows the new Nyquist frequency, which
+  /// keeps high pitched notes free of aliasing.
+  ///
+  /// Resampler instances are immutable and shared, use get() to access them.
+  class RESONANT_API SampleResampler
+  {
+  public:
+    /// Interpolation quality. Higher quality costs more CPU per voice.
+    enum Quality
+    {
+      /// Linear interpolation, not band-limited
+      QUALITY_LINEAR,
+      /// 8-tap windowed sinc
+      QUALITY_LOW,
+      /// 16-tap windowed sinc
+      QUALITY_MEDIUM,
+      /// 32-tap windowed sinc
+      QUALITY_HIGH
+    };
+
+    /// Largest pitch that is band-limited properly. Above this the filter
+    /// width is clamped to keep the CPU cost bounded.
+    static constexpr double MAX_DECIMATION = 4.0;
+
+    /// Returns the shared resampler for the given quality. The filter tables
+    /// are built on the first call.
+    static const SampleResampler & get(Quality quality);
+
+    Quality quality() const { return m_quality; }
+
+    /// Number of source frames that are needed on each side of the read
+    /// position for the given pitch.
+    int margin(double pitch) const;
+
+    /// Resamples a mono signal.
+    /// @param window source signal, window[0] is the source frame at index
+    ///        windowFirst. The window must cover all frames in
+    ///        [floor(pos) - margin, floor(pos) + n * pitch + margin] where pitch
+    ///        is the largest pitch during this block. Frames outside of the
+    ///        actual sample must be zeros.
+    /// @param windowFirst source frame index of window[0]
+    /// @param[in,out] pos fractional source read position
+    /// @param end rendering stops when pos reaches this
+    /// @param[in,out] pitch playback rate ramp, updated once per output sample
+    /// @param out output buffer
+    /// @param n maximum number of output samples
+    /// @return number of samples written to out
+    int render(const float * window, long windowFirst, double & pos, double end,
+               Nimble::Rampd & pitch, float * out, int n) const;
+
+    /// Mixes src to dst while applying the gain ramp: dst[i] += src[i] * gain.
+    /// The ramp is advanced by n steps.
+    static void mixRamped(float * dst, const float * src, int n, Nimble::Rampd & gain);
+
+    /// Mixes src to dst with a constant gain: dst[i] += src[i] * gain.
+    static void mix(float * dst, const float * src, int n, float gain);
+
+    /// Scales buffer in-place: buffer[i] *= gain.
+    static void scale(float * buffer, int n, float gain);
+
+  private:
+    SampleResampler(Quality quality);
+
+    float interpolate(const float * window, long windowFirst, double pos) const;
+    float interpolateDecimated(const float * window, long windowFirst, double pos, double scale) const;
+
+    Quality m_quality;
+    /// Number of filter taps
+    int m_taps;
+    /// Filter coefficients, (PHASES + 1) rows of m_taps coefficients
+    std::vector<float> m_table;
+    /// Continuous half of the kernel sampled at PHASES steps per frame,
+    /// used when the filter is widened
+    std::vector<float> m_kernel;
+  };
+}
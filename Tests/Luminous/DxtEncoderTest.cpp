@@ -0,0 +1,415 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Luminous/DxtEncoder.hpp>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+  /// 8-bit RGBA image, 4 bytes per pixel without padding
+  struct Pixels
+  {
+    Pixels(int width, int height)
+      : width(width), height(height), data(size_t(width) * height * 4)
+    {}
+
+    uint8_t * pixel(int x, int y) { return data.data() + (size_t(y) * width + x) * 4; }
+    const uint8_t * pixel(int x, int y) const { return data.data() + (size_t(y) * width + x) * 4; }
+
+    void set(int x, int y, int r, int g, int b, int a)
+    {
+      uint8_t * p = pixel(x, y);
+      p[0] = uint8_t(r);
+      p[1] = uint8_t(g);
+      p[2] = uint8_t(b);
+      p[3] = uint8_t(a);
+    }
+
+    int width;
+    int height;
+    std::vector<uint8_t> data;
+  };
+
+  uint16_t readU16(const uint8_t * src)
+  {
+    return uint16_t(src[0] | (src[1] << 8));
+  }
+
+  void fromRgb565(uint16_t v, int c[3])
+  {
+    const int r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+  }
+
+  /// Decodes the 8-byte color part of a block, the same way as the GPU.
+  /// The 3-color mode is used only in DXT1, DXT3 and DXT5 blocks are always
+  /// decoded in the 4-color mode.
+  void decodeColor(const uint8_t * src, bool allowThreeColor, uint8_t out[16][4])
+  {
+    const uint16_t v0 = readU16(src);
+    const uint16_t v1 = readU16(src + 2);
+    int palette[4][4];
+    fromRgb565(v0, palette[0]);
+    fromRgb565(v1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+
+    for (int c = 0; c < 3; ++c) {
+      if (v0 > v1 || !allowThreeColor) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+      } else {
+        palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+        palette[3][c] = 0;
+      }
+    }
+    if (v0 <= v1 && allowThreeColor)
+      palette[3][3] = 0;
+
+    const uint32_t indices = uint32_t(src[4]) | (uint32_t(src[5]) << 8) |
+        (uint32_t(src[6]) << 16) | (uint32_t(src[7]) << 24);
+    for (int i = 0; i < 16; ++i)
+      for (int c = 0; c < 4; ++c)
+        out[i][c] = uint8_t(palette[(indices >> (i * 2)) & 3][c]);
+  }
+
+  void decodeAlphaDxt5(const uint8_t * src, uint8_t out[16][4])
+  {
+    int palette[8] = { src[0], src[1] };
+    for (int i = 2; i < 8; ++i) {
+      if (src[0] > src[1])
+        palette[i] = ((8 - i) * src[0] + (i - 1) * src[1]) / 7;
+      else if (i < 6)
+        palette[i] = ((6 - i) * src[0] + (i - 1) * src[1]) / 5;
+      else
+        palette[i] = i == 6 ? 0 : 255;
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; ++i)
+      bits |= uint64_t(src[2 + i]) << (i * 8);
+    for (int i = 0; i < 16; ++i)
+      out[i][3] = uint8_t(palette[(bits >> (i * 3)) & 7]);
+  }
+
+  void decodeAlphaDxt3(const uint8_t * src, uint8_t out[16][4])
+  {
+    for (int i = 0; i < 16; ++i) {
+      const int a = (src[i / 2] >> ((i & 1) * 4)) & 0xf;
+      out[i][3] = uint8_t(a * 17);
+    }
+  }
+
+  Pixels decode(const std::vector<uint8_t> & compressed, int width, int height,
+                Luminous::PixelFormat::Compression compression)
+  {
+    const bool dxt1 = compression == Luminous::PixelFormat::COMPRESSED_RGB_DXT1 ||
+        compression == Luminous::PixelFormat::COMPRESSED_RGBA_DXT1;
+    Pixels out(width, height);
+    const uint8_t * src = compressed.data();
+    uint8_t block[16][4];
+
+    for (int by = 0; by < height; by += 4) {
+      for (int bx = 0; bx < width; bx += 4) {
+        if (dxt1) {
+          decodeColor(src, true, block);
+          // Without alpha, index 3 of the 3-color mode is black
+          if (compression == Luminous::PixelFormat::COMPRESSED_RGB_DXT1)
+            for (auto & pixel: block)
+              pixel[3] = 255;
+          src += 8;
+        } else {
+          decodeColor(src + 8, false, block);
+          if (compression == Luminous::PixelFormat::COMPRESSED_RGBA_DXT5)
+            decodeAlphaDxt5(src, block);
+          else
+            decodeAlphaDxt3(src, block);
+          src += 16;
+        }
+
+        for (int y = 0; y < 4 && by + y < height; ++y)
+          for (int x = 0; x < 4 && bx + x < width; ++x)
+            for (int c = 0; c < 4; ++c)
+              out.pixel(bx + x, by + y)[c] = block[y * 4 + x][c];
+      }
+    }
+    return out;
+  }
+
+  std::vector<uint8_t> compress(const Pixels & pixels, Luminous::PixelFormat::Compression compression,
+                                const Luminous::PixelFormat & format = Luminous::PixelFormat::rgbaUByte())
+  {
+    std::vector<uint8_t> out(Luminous::DxtEncoder::compressedSize(pixels.width, pixels.height, compression));
+    const bool ok = Luminous::DxtEncoder::compress(pixels.data.data(), pixels.width, pixels.height,
+                                                   pixels.width * 4, format, compression, out.data());
+    return ok ? out : std::vector<uint8_t>();
+  }
+
+  /// Root mean square error of the given channels, in 8-bit units
+  double rmse(const Pixels & a, const Pixels & b, int firstChannel, int channels)
+  {
+    double sum = 0;
+    for (int y = 0; y < a.height; ++y) {
+      for (int x = 0; x < a.width; ++x) {
+        for (int c = firstChannel; c < firstChannel + channels; ++c) {
+          const double d = double(a.pixel(x, y)[c]) - double(b.pixel(x, y)[c]);
+          sum += d * d;
+        }
+      }
+    }
+    return std::sqrt(sum / (double(a.width) * a.height * channels));
+  }
+
+  /// Opaque image with a smooth gradient in two directions, and some noise
+  /// that makes the channels partially uncorrelated
+  Pixels gradient(int width, int height)
+  {
+    Pixels pixels(width, height);
+    uint32_t seed = 1;
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        seed = seed * 1664525u + 1013904223u;
+        const int noise = int(seed >> 29);
+        pixels.set(x, y, std::min(255, x * 4), std::min(255, y * 4),
+                   std::max(0, std::min(255, 255 - (x + y) * 2 + noise)), 255);
+      }
+    }
+    return pixels;
+  }
+
+  /// Gradient image that is opaque on the left half and transparent on the right
+  Pixels alphaEdge(int width, int height)
+  {
+    Pixels pixels(width, height);
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x)
+        pixels.set(x, y, 32 + x * 8, 200 - y * 8, 100, x < width / 2 ? 255 : 0);
+    return pixels;
+  }
+}
+
+SUITE(DxtEncoder)
+{
+  TEST(FlatColor)
+  {
+    const Luminous::PixelFormat::Compression compressions[] = {
+      Luminous::PixelFormat::COMPRESSED_RGB_DXT1, Luminous::PixelFormat::COMPRESSED_RGBA_DXT1,
+      Luminous::PixelFormat::COMPRESSED_RGBA_DXT3, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5
+    };
+
+    Pixels pixels(8, 8);
+    for (int y = 0; y < 8; ++y)
+      for (int x = 0; x < 8; ++x)
+        pixels.set(x, y, 90, 160, 37, 255);
+
+    for (auto compression: compressions) {
+      const std::vector<uint8_t> compressed = compress(pixels, compression);
+      CHECK(!compressed.empty());
+      if (compressed.empty())
+        continue;
+      const Pixels decoded = decode(compressed, 8, 8, compression);
+      // Only the 565 quantization error remains
+      for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+          CHECK(std::abs(decoded.pixel(x, y)[0] - 90) <= 4);
+          CHECK(std::abs(decoded.pixel(x, y)[1] - 160) <= 2);
+          CHECK(std::abs(decoded.pixel(x, y)[2] - 37) <= 4);
+          CHECK_EQUAL(255, int(decoded.pixel(x, y)[3]));
+        }
+      }
+    }
+  }
+
+  TEST(Gradient)
+  {
+    const Pixels pixels = gradient(64, 64);
+    const Luminous::PixelFormat::Compression compressions[] = {
+      Luminous::PixelFormat::COMPRESSED_RGB_DXT1, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5
+    };
+    for (auto compression: compressions) {
+      const std::vector<uint8_t> compressed = compress(pixels, compression);
+      CHECK(!compressed.empty());
+      if (compressed.empty())
+        continue;
+      const Pixels decoded = decode(compressed, 64, 64, compression);
+      CHECK(rmse(pixels, decoded, 0, 3) < 4.0);
+      CHECK_EQUAL(0.0, rmse(pixels, decoded, 3, 1));
+    }
+  }
+
+  TEST(AlphaEdge)
+  {
+    const Pixels pixels = alphaEdge(16, 16);
+
+    const std::vector<uint8_t> dxt5 = compress(pixels, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5);
+    const std::vector<uint8_t> dxt3 = compress(pixels, Luminous::PixelFormat::COMPRESSED_RGBA_DXT3);
+    CHECK(!dxt5.empty() && !dxt3.empty());
+    if (dxt5.empty() || dxt3.empty())
+      return;
+
+    // Both alpha values are exactly representable
+    const Pixels decoded5 = decode(dxt5, 16, 16, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5);
+    const Pixels decoded3 = decode(dxt3, 16, 16, Luminous::PixelFormat::COMPRESSED_RGBA_DXT3);
+    CHECK_EQUAL(0.0, rmse(pixels, decoded5, 3, 1));
+    CHECK_EQUAL(0.0, rmse(pixels, decoded3, 3, 1));
+    CHECK(rmse(pixels, decoded5, 0, 3) < 7.0);
+
+    // DXT5 alpha with intermediate values
+    Pixels ramp(16, 16);
+    for (int y = 0; y < 16; ++y)
+      for (int x = 0; x < 16; ++x)
+        ramp.set(x, y, 128, 128, 128, x * 17);
+    const std::vector<uint8_t> rampDxt5 = compress(ramp, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5);
+    if (!rampDxt5.empty())
+      CHECK(rmse(ramp, decode(rampDxt5, 16, 16, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5), 3, 1) < 3.0);
+  }
+
+  TEST(PunchThroughAlpha)
+  {
+    const Pixels pixels = alphaEdge(16, 16);
+    const std::vector<uint8_t> compressed = compress(pixels, Luminous::PixelFormat::COMPRESSED_RGBA_DXT1);
+    CHECK(!compressed.empty());
+    if (compressed.empty())
+      return;
+
+    const Pixels decoded = decode(compressed, 16, 16, Luminous::PixelFormat::COMPRESSED_RGBA_DXT1);
+    CHECK_EQUAL(0.0, rmse(pixels, decoded, 3, 1));
+
+    // Compare the colors of the opaque pixels only
+    double sum = 0;
+    int count = 0;
+    for (int y = 0; y < 16; ++y) {
+      for (int x = 0; x < 8; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          const double d = double(pixels.pixel(x, y)[c]) - double(decoded.pixel(x, y)[c]);
+          sum += d * d;
+          ++count;
+        }
+      }
+    }
+    CHECK(std::sqrt(sum / count) < 7.0);
+  }
+
+  TEST(Dxt1ModeSelection)
+  {
+    // On both block rows the first block is opaque, the second one mixed
+    // and the third one transparent. Red decreases when green increases,
+    // so the end points are on the anti-diagonal of the bounding box.
+    Pixels pixels(12, 8);
+    for (int y = 0; y < 8; ++y)
+      for (int x = 0; x < 12; ++x)
+        pixels.set(x, y, 255 - x * 4 - y * 8, x * 8 + y * 16, 100,
+                   x < 4 ? 255 : x < 8 ? ((x + y) % 2) * 255 : 0);
+
+    const Luminous::PixelFormat::Compression compressions[] = {
+      Luminous::PixelFormat::COMPRESSED_RGB_DXT1, Luminous::PixelFormat::COMPRESSED_RGBA_DXT1
+    };
+    for (auto compression: compressions) {
+      const bool punchThrough = compression == Luminous::PixelFormat::COMPRESSED_RGBA_DXT1;
+      const std::vector<uint8_t> compressed = compress(pixels, compression);
+      CHECK_EQUAL(size_t(6 * 8), compressed.size());
+      if (compressed.empty())
+        continue;
+
+      for (int block = 0; block < 6; ++block) {
+        const uint8_t * src = compressed.data() + block * 8;
+        const uint16_t v0 = readU16(src);
+        const uint16_t v1 = readU16(src + 2);
+        const uint32_t indices = uint32_t(src[4]) | (uint32_t(src[5]) << 8) |
+            (uint32_t(src[6]) << 16) | (uint32_t(src[7]) << 24);
+        const bool opaque = block % 3 == 0;
+
+        if (punchThrough && !opaque) {
+          // 3-color mode, transparent pixels use index 3 and only them
+          CHECK(v0 <= v1);
+          const int bx = (block % 3) * 4, by = (block / 3) * 4;
+          for (int i = 0; i < 16; ++i) {
+            const bool transparent = pixels.pixel(bx + i % 4, by + i / 4)[3] < 128;
+            CHECK_EQUAL(transparent, ((indices >> (i * 2)) & 3) == 3);
+          }
+        } else {
+          // 4-color mode, or a single color with all indices zero, which
+          // decodes the same in both modes
+          CHECK(v0 > v1 || (v0 == v1 && indices == 0));
+        }
+      }
+    }
+  }
+
+  TEST(BgraInput)
+  {
+    const Pixels rgba = gradient(32, 16);
+    Pixels bgra = rgba;
+    for (int y = 0; y < bgra.height; ++y) {
+      for (int x = 0; x < bgra.width; ++x) {
+        uint8_t * p = bgra.pixel(x, y);
+        std::swap(p[0], p[2]);
+      }
+    }
+
+    const Luminous::PixelFormat::Compression compressions[] = {
+      Luminous::PixelFormat::COMPRESSED_RGB_DXT1, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5
+    };
+    for (auto compression: compressions) {
+      const std::vector<uint8_t> fromRgba = compress(rgba, compression);
+      const std::vector<uint8_t> fromBgra = compress(bgra, compression, Luminous::PixelFormat::bgraUByte());
+      CHECK(!fromRgba.empty());
+      CHECK(fromRgba == fromBgra);
+    }
+
+    // Other source formats are rejected
+    CHECK(!Luminous::DxtEncoder::isSupported(Luminous::PixelFormat::rgbUByte()));
+    CHECK(compress(rgba, Luminous::PixelFormat::COMPRESSED_RGB_DXT1,
+                   Luminous::PixelFormat::rgbUByte()).empty());
+  }
+
+  TEST(PartialEdgeBlocks)
+  {
+    // 2x2 blocks, the right and bottom ones are partial
+    const Pixels pixels = gradient(7, 5);
+    CHECK_EQUAL(size_t(4 * 16), Luminous::DxtEncoder::compressedSize(7, 5, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5));
+    CHECK_EQUAL(size_t(4 * 8), Luminous::DxtEncoder::compressedSize(7, 5, Luminous::PixelFormat::COMPRESSED_RGB_DXT1));
+
+    const Luminous::PixelFormat::Compression compressions[] = {
+      Luminous::PixelFormat::COMPRESSED_RGB_DXT1, Luminous::PixelFormat::COMPRESSED_RGBA_DXT5
+    };
+    for (auto compression: compressions) {
+      const std::vector<uint8_t> compressed = compress(pixels, compression);
+      CHECK(!compressed.empty());
+      if (compressed.empty())
+        continue;
+      const Pixels decoded = decode(compressed, 7, 5, compression);
+      CHECK(rmse(pixels, decoded, 0, 3) < 4.0);
+      CHECK_EQUAL(0.0, rmse(pixels, decoded, 3, 1));
+    }
+
+    // The padding repeats the edge pixels, so a partial block of a single
+    // color is still a flat block
+    Pixels flat(5, 6);
+    for (int y = 0; y < 6; ++y)
+      for (int x = 0; x < 5; ++x)
+        flat.set(x, y, x < 4 ? 0 : 255, 255, 255, 255);
+    const std::vector<uint8_t> compressed = compress(flat, Luminous::PixelFormat::COMPRESSED_RGB_DXT1);
+    CHECK(!compressed.empty());
+    if (!compressed.empty()) {
+      const uint8_t * rightBottom = compressed.data() + 3 * 8;
+      CHECK_EQUAL(readU16(rightBottom), readU16(rightBottom + 2));
+      CHECK_EQUAL(0.0, rmse(flat, decode(compressed, 5, 6, Luminous::PixelFormat::COMPRESSED_RGB_DXT1), 0, 4));
+    }
+  }
+}
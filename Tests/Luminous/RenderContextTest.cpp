@@ -0,0 +1,181 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Luminous/GfxDriver.hpp>
+#include <Luminous/MultiHead.hpp>
+#include <Luminous/RenderContext.hpp>
+#include <Luminous/RenderDriverHeadless.hpp>
+#include <Luminous/RenderManager.hpp>
+
+#include <Radiant/TimeStamp.hpp>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <memory>
+
+namespace
+{
+  /// Render context of the first window of a full HD configuration, using
+  /// RenderDriverHeadless so that no GPU is needed
+  class HeadlessRenderer : public Luminous::GfxDriver
+  {
+  public:
+    HeadlessRenderer()
+      : m_driver(*this, 0)
+    {
+      m_multiHead.createFullHDConfig();
+      Luminous::RenderManager::setDrivers({&m_driver});
+      Luminous::RenderManager::setThreadIndex(0);
+      m_driver.setCommandRecordingEnabled(false);
+      m_context.reset(new Luminous::RenderContext(m_driver, &m_multiHead.window(0)));
+      m_context->initialize();
+    }
+
+    ~HeadlessRenderer()
+    {
+      m_context.reset();
+      Luminous::RenderManager::setDrivers({});
+    }
+
+    virtual Luminous::RenderContext & renderContext(unsigned int) override { return *m_context; }
+    virtual unsigned int renderThreadCount() const override { return 1; }
+    virtual Luminous::RenderDriver & renderDriver(unsigned int) override { return m_driver; }
+
+    Luminous::RenderContext & context() { return *m_context; }
+
+    void beginFrame()
+    {
+      const auto & window = m_multiHead.window(0);
+      const auto & area = window.area(0);
+      m_context->beginFrame(Radiant::TimeStamp::currentTime(), m_frame);
+      m_context->setWindowArea(&window, &area);
+      m_driver.setViewport(area.viewport());
+      m_context->beginArea();
+      m_context->pushViewTransform(area.viewTransform());
+    }
+
+    void endFrame()
+    {
+      m_context->popViewTransform();
+      m_context->endArea();
+      m_context->endFrame(m_frame++);
+    }
+
+  private:
+    Luminous::MultiHead m_multiHead;
+    Luminous::RenderDriverHeadless m_driver;
+    std::unique_ptr<Luminous::RenderContext> m_context;
+    unsigned int m_frame = 0;
+  };
+
+  /// Clip rectangle and test areas, all rotated by the same angle. The
+  /// areas are sheared, so their axes are not orthogonal.
+  struct Scene
+  {
+    Scene()
+    {
+      const Nimble::Matrix3f rotation = Nimble::Matrix3f::makeRotation(0.5f);
+      const Nimble::Matrix3f shear(1.f, 1.f, 0.f,
+                                   0.f, 1.f, 0.f,
+                                   0.f, 0.f, 1.f);
+      clip = Nimble::Rectangle(Nimble::SizeF(100.f, 100.f),
+                               rotation * Nimble::Matrix3f::makeTranslation(50.f, 50.f));
+      // Only one corner of this parallelogram is inside the clip rectangle
+      corner = Nimble::Rectangle(Nimble::SizeF(200.f, 200.f),
+                                 rotation * Nimble::Matrix3f::makeTranslation(-175.f, -50.f) * shear);
+      inside = Nimble::Rectangle(Nimble::SizeF(20.f, 20.f),
+                                 rotation * Nimble::Matrix3f::makeTranslation(50.f, 50.f) * shear);
+      outside = Nimble::Rectangle(Nimble::SizeF(200.f, 200.f),
+                                  rotation * Nimble::Matrix3f::makeTranslation(-400.f, -50.f) * shear);
+    }
+
+    Nimble::Rectangle clip;
+    Nimble::Rectangle corner;
+    Nimble::Rectangle inside;
+    Nimble::Rectangle outside;
+  };
+}
+
+SUITE(RenderContext)
+{
+  TEST(IsVisibleTransformedArea)
+  {
+    HeadlessRenderer renderer;
+    Luminous::RenderContext & r = renderer.context();
+    const Scene scene;
+    CHECK(scene.clip.intersects(scene.corner));
+
+    renderer.beginFrame();
+    {
+      Luminous::ClipGuard clip(r, scene.clip);
+      CHECK(r.isVisible(scene.corner));
+      CHECK(r.isVisible(scene.inside));
+      CHECK(!r.isVisible(scene.outside));
+    }
+    renderer.endFrame();
+  }
+
+  TEST(VisibilityCacheTransformedArea)
+  {
+    HeadlessRenderer renderer;
+    Luminous::RenderContext & r = renderer.context();
+    const Scene scene;
+
+    for (int frame = 0; frame < 3; ++frame) {
+      renderer.beginFrame();
+      {
+        Luminous::ClipGuard clip(r, scene.clip);
+        CHECK(r.isVisible(1, scene.corner));
+        CHECK(r.isVisible(2, scene.inside));
+        CHECK(!r.isVisible(3, scene.outside));
+
+        const auto & stats = r.cullingStatistics();
+        CHECK_EQUAL(1u, stats.culled);
+        // The first frame tests everything, later frames use the cache
+        CHECK_EQUAL(frame == 0 ? 3u : 0u, stats.tested);
+        CHECK_EQUAL(frame == 0 ? 0u : 3u, stats.skipped);
+      }
+      renderer.endFrame();
+    }
+
+    // Moving the hidden object into the clip rectangle invalidates its
+    // cached result
+    renderer.beginFrame();
+    {
+      Luminous::ClipGuard clip(r, scene.clip);
+      CHECK(r.isVisible(3, scene.corner));
+      CHECK_EQUAL(1u, r.cullingStatistics().tested);
+    }
+    renderer.endFrame();
+  }
+
+  TEST(SubtreeVisibilityTransformedArea)
+  {
+    HeadlessRenderer renderer;
+    Luminous::RenderContext & r = renderer.context();
+    const Scene scene;
+
+    renderer.beginFrame();
+    {
+      Luminous::ClipGuard clip(r, scene.clip);
+      CHECK_EQUAL(int(Luminous::RenderContext::SUBTREE_PARTIAL), int(r.subtreeVisibility(scene.corner)));
+      CHECK_EQUAL(int(Luminous::RenderContext::SUBTREE_VISIBLE), int(r.subtreeVisibility(scene.inside)));
+      CHECK_EQUAL(int(Luminous::RenderContext::SUBTREE_HIDDEN), int(r.subtreeVisibility(scene.outside)));
+
+      // Inside a partially visible subtree the children are still tested
+      {
+        Luminous::CullingScopeGuard scope(r, r.subtreeVisibility(scene.corner));
+        CHECK(r.isVisible(scene.corner));
+        CHECK(!r.isVisible(scene.outside));
+      }
+    }
+    renderer.endFrame();
+  }
+}
@@ -0,0 +1,156 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Nimble/Batch.hpp>
+#include <Nimble/ClipStack.hpp>
+#include <Nimble/Rectangle.hpp>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+  /// Restores the instruction set when going out of scope
+  class InstructionSetGuard
+  {
+  public:
+    InstructionSetGuard() : m_set(Nimble::Batch::instructionSet()) {}
+    ~InstructionSetGuard() { Nimble::Batch::setInstructionSet(m_set); }
+
+  private:
+    Nimble::Batch::InstructionSet m_set;
+  };
+
+  const Nimble::Batch::InstructionSet s_sets[] = {
+    Nimble::Batch::INSTRUCTION_SET_SCALAR,
+    Nimble::Batch::INSTRUCTION_SET_SSE2,
+    Nimble::Batch::INSTRUCTION_SET_AVX
+  };
+
+  /// Random widget-like rectangles. With shear, the transformation makes
+  /// parallelograms that don't have orthogonal axes.
+  class RandomRectangles
+  {
+  public:
+    RandomRectangles(bool shear) : m_shear(shear), m_rng(1) {}
+
+    Nimble::Rectangle next()
+    {
+      std::uniform_real_distribution<float> location(-100.f, 100.f);
+      std::uniform_real_distribution<float> size(1.f, 60.f);
+      std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+      std::uniform_real_distribution<float> shear(-2.f, 2.f);
+
+      Nimble::Matrix3f m = Nimble::Matrix3f::makeTranslation(location(m_rng), location(m_rng)) *
+          Nimble::Matrix3f::makeRotation(angle(m_rng));
+      if (m_shear)
+        m = m * Nimble::Matrix3f(1.f, shear(m_rng), 0.f,
+                                 0.5f * shear(m_rng), 1.f, 0.f,
+                                 0.f, 0.f, 1.f);
+      return Nimble::Rectangle(Nimble::SizeF(size(m_rng), size(m_rng)), m);
+    }
+
+  private:
+    bool m_shear;
+    std::mt19937 m_rng;
+  };
+
+  /// Compares Batch::intersects to Rectangle::intersects with all
+  /// supported instruction sets. 13 rectangles per call so that both the
+  /// SIMD loops and the scalar tails are used.
+  void checkConsistency(UnitTest::TestResults & testResults_, const UnitTest::TestDetails & m_details,
+                        bool shear)
+  {
+    InstructionSetGuard guard;
+    for (Nimble::Batch::InstructionSet set: s_sets) {
+      if (set > Nimble::Batch::supportedInstructionSet())
+        continue;
+      Nimble::Batch::setInstructionSet(set);
+
+      RandomRectangles random(shear);
+      int hits = 0;
+      int errors = 0;
+      for (int i = 0; i < 2000; ++i) {
+        const Nimble::Rectangle rect = random.next();
+        std::vector<Nimble::Rectangle> rects;
+        for (int j = 0; j < 13; ++j)
+          rects.push_back(random.next());
+
+        uint8_t results[13];
+        const size_t count = Nimble::Batch::intersects(rect, rects.data(), rects.size(), results);
+
+        size_t expectedCount = 0;
+        for (size_t j = 0; j < rects.size(); ++j) {
+          const bool expected = rect.intersects(rects[j]);
+          expectedCount += expected;
+          errors += expected != (results[j] == 1);
+        }
+        errors += count != expectedCount;
+        hits += static_cast<int>(expectedCount);
+      }
+      // Both outcomes need to be common for the test to mean anything
+      CHECK(hits > 2000);
+      CHECK(hits < 2000 * 12);
+      CHECK_EQUAL(0, errors);
+    }
+  }
+}
+
+SUITE(Batch)
+{
+  TEST(IntersectsMatchesRectangle)
+  {
+    checkConsistency(testResults_, m_details, false);
+  }
+
+  TEST(IntersectsMatchesRectangleSheared)
+  {
+    checkConsistency(testResults_, m_details, true);
+  }
+
+  TEST(IntersectsShearedNearMiss)
+  {
+    // Unit square and a sheared parallelogram whose corner (0.25, 0.5) is
+    // inside the square. The axes of the parallelogram are 45 degrees
+    // apart, so projecting it with its extents as radii misses the corner.
+    const Nimble::Rectangle square(Nimble::Rectf(0.f, 0.f, 1.f, 1.f));
+    const Nimble::Matrix3f m = Nimble::Matrix3f::makeTranslation(-1.75f, -0.5f) *
+        Nimble::Matrix3f(1.f, 1.f, 0.f,
+                         0.f, 1.f, 0.f,
+                         0.f, 0.f, 1.f);
+    const Nimble::Rectangle sheared(Nimble::SizeF(2.f, 2.f), m);
+    CHECK(square.intersects(sheared));
+
+    InstructionSetGuard guard;
+    for (Nimble::Batch::InstructionSet set: s_sets) {
+      if (set > Nimble::Batch::supportedInstructionSet())
+        continue;
+      Nimble::Batch::setInstructionSet(set);
+      std::vector<Nimble::Rectangle> rects(9, sheared);
+      uint8_t results[9];
+      CHECK_EQUAL(9u, Nimble::Batch::intersects(square, rects.data(), rects.size(), results));
+      CHECK_EQUAL(1u, Nimble::Batch::intersects(sheared, &square, 1, results));
+    }
+  }
+
+  TEST(ClipStackSheared)
+  {
+    const Nimble::Matrix3f m = Nimble::Matrix3f::makeTranslation(-1.75f, -0.5f) *
+        Nimble::Matrix3f(1.f, 1.f, 0.f,
+                         0.f, 1.f, 0.f,
+                         0.f, 0.f, 1.f);
+    Nimble::ClipStack stack;
+    stack.push(Nimble::Rectangle(Nimble::SizeF(2.f, 2.f), m));
+    CHECK(stack.isVisible(Nimble::Rectangle(Nimble::Rectf(0.f, 0.f, 1.f, 1.f))));
+    CHECK(!stack.isVisible(Nimble::Rectangle(Nimble::Rectf(5.f, 5.f, 6.f, 6.f))));
+  }
+}
@@ -0,0 +1,16 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <UnitTest++/MultiTactionTestRunner.h>
+
+int main(int argc, char ** argv)
+{
+  return UnitTest::runTests(argc, argv);
+}
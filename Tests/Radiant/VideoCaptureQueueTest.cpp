@@ -0,0 +1,147 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Radiant/Sleep.hpp>
+#include <Radiant/Timer.hpp>
+#include <Radiant/VideoCaptureQueue.hpp>
+#include <Radiant/VideoImage.hpp>
+#include <Radiant/VideoInput.hpp>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <atomic>
+#include <vector>
+
+namespace
+{
+  /// Grayscale input where the first pixel of each image is the running
+  /// number of the image
+  class CountingInput : public Radiant::VideoInput
+  {
+  public:
+    CountingInput()
+    {
+      m_image.allocateMemory(Radiant::IMAGE_GRAYSCALE, s_width, s_height, 16);
+      m_image.zero();
+    }
+
+    ~CountingInput()
+    {
+      m_image.freeMemory();
+    }
+
+    virtual const Radiant::VideoImage * captureImage() override
+    {
+      Radiant::Sleep::sleepMs(1);
+      m_image.m_planes[0].m_data[0] = static_cast<unsigned char>(m_count++);
+      return &m_image;
+    }
+
+    virtual int width() const override { return s_width; }
+    virtual int height() const override { return s_height; }
+    virtual float fps() const override { return 1000.f; }
+    virtual Radiant::ImageFormat imageFormat() const override { return Radiant::IMAGE_GRAYSCALE; }
+    virtual unsigned int size() const override { return s_width * s_height; }
+    virtual bool start() override { return true; }
+    virtual bool stop() override { return true; }
+    virtual bool close() override { return true; }
+
+  private:
+    static const int s_width = 16;
+    static const int s_height = 4;
+    Radiant::VideoImage m_image;
+    std::atomic<uint64_t> m_count{0};
+  };
+
+  unsigned char firstPixel(const Radiant::VideoCaptureQueue::Frame & frame)
+  {
+    return frame.image->m_planes[0].m_data[0];
+  }
+
+  void waitForCaptures(const Radiant::VideoCaptureQueue & queue, uint64_t count)
+  {
+    Radiant::Timer timer;
+    while(queue.statistics().captured < count && timer.time() < 10.0)
+      Radiant::Sleep::sleepMs(1);
+  }
+}
+
+SUITE(VideoCaptureQueue)
+{
+  TEST(BlockKeepsAllFramesInOrder)
+  {
+    CountingInput input;
+    Radiant::VideoCaptureQueue queue(input, 3, Radiant::VideoCaptureQueue::BLOCK);
+    queue.start();
+
+    for(uint64_t i = 0; i < 50; ++i) {
+      const Radiant::VideoCaptureQueue::Frame * frame = queue.acquireFrame(5000);
+      CHECK(frame);
+      if(!frame)
+        break;
+      CHECK_EQUAL(i, frame->frameNumber);
+      CHECK_EQUAL(static_cast<int>(i & 0xff), static_cast<int>(firstPixel(*frame)));
+      queue.releaseFrame(frame);
+    }
+
+    queue.stop();
+    // Only the image captured while stopping may be dropped
+    CHECK(queue.statistics().dropped <= 1);
+  }
+
+  TEST(DropOldestWhileHoldingFrame)
+  {
+    CountingInput input;
+    Radiant::VideoCaptureQueue queue(input, 4, Radiant::VideoCaptureQueue::DROP_OLDEST);
+    queue.start();
+
+    // Hold the first frame while the producer fills and recycles the
+    // rest of the buffers many times over
+    const Radiant::VideoCaptureQueue::Frame * held = queue.acquireFrame(5000);
+    CHECK(held);
+    if(!held) {
+      queue.stop();
+      return;
+    }
+    const uint64_t heldNumber = held->frameNumber;
+    const unsigned char heldPixel = firstPixel(*held);
+
+    waitForCaptures(queue, heldNumber + 100);
+    queue.stop();
+
+    // The held buffer was never overwritten
+    CHECK_EQUAL(heldNumber, held->frameNumber);
+    CHECK_EQUAL(static_cast<int>(heldPixel), static_cast<int>(firstPixel(*held)));
+
+    // The remaining buffers hold the newest frames. Dropping the new frames
+    // instead would leave the queue with the frames captured right after
+    // the held one.
+    const Radiant::VideoCaptureQueue::Statistics stats = queue.statistics();
+    CHECK(stats.captured >= heldNumber + 100);
+    CHECK_EQUAL(3, queue.framesAvailable());
+
+    std::vector<uint64_t> numbers;
+    while(const Radiant::VideoCaptureQueue::Frame * frame = queue.acquireFrame(0)) {
+      CHECK_EQUAL(static_cast<int>(frame->frameNumber & 0xff), static_cast<int>(firstPixel(*frame)));
+      numbers.push_back(frame->frameNumber);
+      queue.releaseFrame(frame);
+    }
+    queue.releaseFrame(held);
+
+    CHECK_EQUAL(3u, numbers.size());
+    if(numbers.size() == 3) {
+      CHECK_EQUAL(numbers[0] + 1, numbers[1]);
+      CHECK_EQUAL(numbers[1] + 1, numbers[2]);
+      // The image captured while stopping may be dropped
+      CHECK(numbers[2] + 2 >= stats.captured);
+    }
+    CHECK_EQUAL(stats.captured, stats.dropped + 4);
+  }
+}
@@ -0,0 +1,541 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Valuable/AttributeBool.hpp>
+#include <Valuable/AttributeColor.hpp>
+#include <Valuable/AttributeContainer.hpp>
+#include <Valuable/AttributeEnum.hpp>
+#include <Valuable/AttributeFlags.hpp>
+#include <Valuable/AttributeFloat.hpp>
+#include <Valuable/AttributeFrame.hpp>
+#include <Valuable/AttributeInt.hpp>
+#include <Valuable/AttributeLocation.hpp>
+#include <Valuable/AttributeMatrix.hpp>
+#include <Valuable/AttributeRect.hpp>
+#include <Valuable/AttributeSize.hpp>
+#include <Valuable/AttributeSpline.hpp>
+#include <Valuable/AttributeString.hpp>
+#include <Valuable/AttributeStringList.hpp>
+#include <Valuable/AttributeStringMap.hpp>
+#include <Valuable/AttributeStyleValue.hpp>
+#include <Valuable/AttributeTimeStamp.hpp>
+#include <Valuable/AttributeVector.hpp>
+#include <Valuable/AttributeVectorContainer.hpp>
+#include <Valuable/BinaryArchive.hpp>
+#include <Valuable/Node.hpp>
+
+#include <Radiant/Trace.hpp>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <cstring>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace
+{
+  enum class Mode
+  {
+    OFF,
+    ON,
+    AUTO
+  };
+
+  enum Flag
+  {
+    FLAG_NONE = 0,
+    FLAG_A    = 1 << 0,
+    FLAG_B    = 1 << 1,
+    FLAG_C    = 1 << 2
+  };
+  MULTI_FLAGS(Flag)
+  typedef Radiant::FlagsT<Flag> Flags;
+
+  Valuable::EnumNames s_modes = {{"off", int(Mode::OFF)},
+                                 {"on", int(Mode::ON)},
+                                 {"auto", int(Mode::AUTO)}};
+
+  Valuable::FlagNames s_flags = {{"flag-a", FLAG_A, false},
+                                 {"flag-b", FLAG_B, false},
+                                 {"flag-c", FLAG_C, false}};
+
+  /// Node with one attribute of every type, all with default values
+  class Everything : public Valuable::Node
+  {
+  public:
+    Everything(Valuable::Node * host = nullptr, const QByteArray & name = "everything")
+      : Node(host, name)
+      , m_bool(this, "bool", false)
+      , m_int32(this, "int32", 0)
+      , m_uint32(this, "uint32", 0)
+      , m_int64(this, "int64", 0)
+      , m_uint64(this, "uint64", 0)
+      , m_float(this, "float", 0.f)
+      , m_string(this, "string")
+      , m_stringList(this, "string-list")
+      , m_stringMap(this, "string-map")
+      , m_vector2i(this, "vector2i")
+      , m_vector3i(this, "vector3i")
+      , m_vector4i(this, "vector4i")
+      , m_vector2f(this, "vector2f")
+      , m_vector3f(this, "vector3f")
+      , m_vector4f(this, "vector4f")
+      , m_location(this, "location")
+      , m_color(this, "color", Radiant::ColorPMA())
+      , m_rectf(this, "rectf")
+      , m_rectd(this, "rectd")
+      , m_recti(this, "recti")
+      , m_matrix2f(this, "matrix2f")
+      , m_matrix3f(this, "matrix3f")
+      , m_matrix4f(this, "matrix4f")
+      , m_frame(this, "frame")
+      , m_sizef(this, "sizef", "sizef-width", "sizef-height")
+      , m_sizei(this, "sizei", "sizei-width", "sizei-height")
+      , m_timeStamp(this, "time-stamp")
+      , m_styleValue(this, "style-value")
+      , m_mode(this, "mode", s_modes, Mode::OFF)
+      , m_flags(this, "flags", s_flags)
+      , m_spline(this, "spline")
+      , m_intList(this, "int-list")
+      , m_pointVector(this, "point-vector")
+      , m_doubleMap(this, "double-map")
+      , m_floatVector(this, "float-vector")
+    {}
+
+    /// Sets a non-default value to every attribute, values are exactly
+    /// representable as floats so that the XML archive doesn't round them.
+    void setValues()
+    {
+      m_bool = true;
+      m_int32 = -123456;
+      m_uint32 = 4000000000u;
+      m_int64 = -(int64_t(1) << 40);
+      m_uint64 = uint64_t(1) << 63;
+      m_float = 0.375f;
+      m_string = QString::fromUtf8("Ääkköset & <xml> \"quotes\"");
+      m_stringList = QStringList() << "first" << "" << "third item";
+      QMap<QString, QString> map;
+      map["key"] = "value";
+      map["empty"] = "";
+      m_stringMap = map;
+      m_vector2i = Nimble::Vector2i(-1, 2);
+      m_vector3i = Nimble::Vector3i(3, -4, 5);
+      m_vector4i = Nimble::Vector4i(6, 7, -8, 9);
+      m_vector2f = Nimble::Vector2f(0.5f, -1.25f);
+      m_vector3f = Nimble::Vector3f(2.f, 4.5f, -8.75f);
+      m_vector4f = Nimble::Vector4f(0.125f, 16.f, -32.5f, 64.f);
+      m_location = Nimble::Vector2f(100.f, 200.5f);
+      m_color = Radiant::ColorPMA(0.25f, 0.5f, 0.75f, 1.f);
+      m_rectf = Nimble::Rectf(1.5f, 2.5f, 10.f, 20.f);
+      m_rectd = Nimble::Rectd(-1.0, -2.0, 3.25, 4.5);
+      m_recti = Nimble::Recti(-10, -20, 30, 40);
+      m_matrix2f = Nimble::Matrix2f(1.f, 2.f, 3.f, 4.f);
+      m_matrix3f = Nimble::Matrix3f::makeTranslation(5.f, -6.f) * Nimble::Matrix3f::makeScale(2.f, 0.5f);
+      m_matrix4f = Nimble::Matrix4f::makeTranslation(1.f, 2.f, 3.f);
+      m_frame = Nimble::Frame4f(1.f, 2.f, 3.f, 4.f);
+      m_sizef = Nimble::SizeF(640.f, 480.5f);
+      m_sizei = Nimble::SizeI(1920, 1080);
+      m_timeStamp = Radiant::TimeStamp(int64_t(1) << 45);
+      m_styleValue = Valuable::StyleValue(12.5f, Valuable::Attribute::VU_PXS);
+      m_mode = Mode::AUTO;
+      m_flags = FLAG_A | FLAG_C;
+      m_spline.insert(0.f, 0.25f);
+      m_spline.insert(0.5f, 0.75f);
+      m_spline.insert(1.f, 1.f);
+      *m_intList = {1, -2, 3};
+      *m_pointVector = {Nimble::Vector2f(1.f, 2.f), Nimble::Vector2f(-3.f, 4.5f)};
+      *m_doubleMap = {{"one", 1.0}, {"half", 0.5}};
+      m_floatVector = {0.25f, -0.5f, 1024.f};
+    }
+
+  private:
+    Valuable::AttributeBool m_bool;
+    Valuable::AttributeInt32 m_int32;
+    Valuable::AttributeUInt32 m_uint32;
+    Valuable::AttributeInt64 m_int64;
+    Valuable::AttributeUInt64 m_uint64;
+    Valuable::AttributeFloat m_float;
+    Valuable::AttributeString m_string;
+    Valuable::AttributeStringList m_stringList;
+    Valuable::AttributeStringMap m_stringMap;
+    Valuable::AttributeVector2i m_vector2i;
+    Valuable::AttributeVector3i m_vector3i;
+    Valuable::AttributeVector4i m_vector4i;
+    Valuable::AttributeVector2f m_vector2f;
+    Valuable::AttributeVector3f m_vector3f;
+    Valuable::AttributeVector4f m_vector4f;
+    Valuable::AttributeLocation2f m_location;
+    Valuable::AttributeColor m_color;
+    Valuable::AttributeRectf m_rectf;
+    Valuable::AttributeRectd m_rectd;
+    Valuable::AttributeRecti m_recti;
+    Valuable::AttributeMatrix2f m_matrix2f;
+    Valuable::AttributeMatrix3f m_matrix3f;
+    Valuable::AttributeMatrix4f m_matrix4f;
+    Valuable::AttributeFrame m_frame;
+    Valuable::AttributeSizeF m_sizef;
+    Valuable::AttributeSizeI m_sizei;
+    Valuable::AttributeTimeStamp m_timeStamp;
+    Valuable::AttributeStyleValue m_styleValue;
+    Valuable::AttributeT<Mode> m_mode;
+    Valuable::AttributeT<Flags> m_flags;
+    Valuable::AttributeSpline m_spline;
+    Valuable::AttributeContainer<std::list<int>> m_intList;
+    Valuable::AttributeContainer<std::vector<Nimble::Vector2f>> m_pointVector;
+    Valuable::AttributeContainer<std::map<QString, double>> m_doubleMap;
+    Valuable::AttributeVectorContainer<float> m_floatVector;
+  };
+
+  /// Tree with nested nodes, so that the archives have child elements on
+  /// several levels
+  class Tree
+  {
+  public:
+    Tree()
+      : m_child(&m_root, "child")
+      , m_grandChild(&m_child, "grand-child")
+    {}
+
+    void setValues()
+    {
+      m_child.setValues();
+      m_grandChild.setValues();
+    }
+
+    Valuable::Node & root() { return m_root; }
+
+  private:
+    Valuable::Node m_root;
+    Everything m_child;
+    Everything m_grandChild;
+  };
+
+  /// Drops all trace messages while in scope, the corrupted archives in the
+  /// tests are expected to print errors
+  class SilentTrace
+  {
+  public:
+    SilentTrace()
+      : m_filter(Radiant::Trace::addFilter([] (Radiant::Trace::Message &) { return true; },
+                                           Radiant::Trace::Filter::ORDER_BEGIN))
+    {}
+
+    ~SilentTrace()
+    {
+      Radiant::Trace::removeFilter(m_filter);
+    }
+
+  private:
+    Radiant::Trace::FilterPtr m_filter;
+  };
+
+  QByteArray writeArchive(const Valuable::Node & node)
+  {
+    Valuable::BinaryArchive archive;
+    archive.setRoot(node.serialize(archive));
+    QByteArray buffer;
+    archive.writeToMem(buffer);
+    return buffer;
+  }
+
+  /// Reads every part of the element, this must not crash even if the
+  /// archive was corrupted
+  int walk(const Valuable::ArchiveElement & element)
+  {
+    int elements = 1;
+    element.name();
+    element.get();
+    element.get("type");
+    double values[4];
+    element.getValues(Valuable::ArchiveValueType::DOUBLE, values, 4);
+    for (Valuable::ArchiveElement::Iterator it = element.children(); it; ++it)
+      elements += walk(*it);
+    return elements;
+  }
+
+  /// Writes values to a single element and reads it back from a binary archive
+  QByteArray writeValues(Valuable::ArchiveValueType type, const void * values, int count)
+  {
+    Valuable::BinaryArchive archive;
+    Valuable::ArchiveElement elem = archive.createElement("values");
+    elem.setValues(type, values, count);
+    archive.setRoot(elem);
+    QByteArray buffer;
+    archive.writeToMem(buffer);
+    return buffer;
+  }
+}
+
+SUITE(BinaryArchive)
+{
+  TEST(RoundTripAllAttributeTypes)
+  {
+    Tree source;
+    source.setValues();
+
+    QByteArray xml;
+    CHECK(source.root().saveToMemoryXML(xml));
+
+    // XML -> binary
+    Tree fromXml;
+    CHECK(fromXml.root().loadFromMemoryXML(xml));
+    QByteArray binary;
+    CHECK(fromXml.root().saveToMemoryBinary(binary));
+    CHECK(Valuable::BinaryArchive::isBinaryArchive(binary));
+
+    // Binary -> XML
+    Tree fromBinary;
+    CHECK(fromBinary.root().loadFromMemoryBinary(binary));
+    QByteArray xml2;
+    CHECK(fromBinary.root().saveToMemoryXML(xml2));
+
+    CHECK_EQUAL(xml.constData(), xml2.constData());
+
+    // Serializing the deserialized tree gives the same binary archive
+    QByteArray binary2;
+    CHECK(fromBinary.root().saveToMemoryBinary(binary2));
+    CHECK(binary == binary2);
+  }
+
+  TEST(RoundTripElementsAndAttributes)
+  {
+    Valuable::BinaryArchive archive;
+    Valuable::ArchiveElement root = archive.createElement("root");
+    root.add("empty", "");
+    root.add("text", QString::fromUtf8("Ääkköset"));
+    for (int i = 0; i < 3; ++i) {
+      Valuable::ArchiveElement child = archive.createElement("child");
+      child.add("index", QString::number(i));
+      child.set(QString("content %1").arg(i));
+      root.add(child);
+    }
+    archive.setRoot(root);
+
+    QByteArray buffer;
+    CHECK(archive.writeToMem(buffer));
+
+    Valuable::BinaryArchive read;
+    CHECK(read.readFromMem(buffer));
+    Valuable::ArchiveElement readRoot = read.root();
+    CHECK(!readRoot.isNull());
+    CHECK_EQUAL("root", readRoot.name().toUtf8().constData());
+    CHECK_EQUAL("", readRoot.get("empty").toUtf8().constData());
+    CHECK_EQUAL("Ääkköset", readRoot.get("text").toUtf8().constData());
+    CHECK(readRoot.get("missing").isNull());
+
+    int index = 0;
+    for (Valuable::ArchiveElement::Iterator it = readRoot.children(); it; ++it, ++index) {
+      CHECK_EQUAL("child", (*it).name().toUtf8().constData());
+      CHECK_EQUAL(index, (*it).get("index").toInt());
+      CHECK_EQUAL(QString("content %1").arg(index).toUtf8().constData(), (*it).get().toUtf8().constData());
+    }
+    CHECK_EQUAL(3, index);
+  }
+
+  TEST(EmptyArchive)
+  {
+    Valuable::BinaryArchive archive;
+    QByteArray buffer;
+    CHECK(archive.writeToMem(buffer));
+
+    Valuable::BinaryArchive read;
+    CHECK(read.readFromMem(buffer));
+    CHECK(read.root().isNull());
+  }
+
+  TEST(ValueConversions)
+  {
+    const int32_t ints[] = {-7, 0, 123456};
+    const int64_t longs[] = {-(int64_t(1) << 40), 1, int64_t(1) << 52};
+    const float floats[] = {0.5f, -2.75f, 3.f};
+    const double doubles[] = {1.5, -2.25, 1e10};
+
+    Valuable::BinaryArchive archive;
+
+    CHECK(archive.readFromMem(writeValues(Valuable::ArchiveValueType::INT32, ints, 3)));
+    {
+      const Valuable::ArchiveElement e = archive.root();
+      CHECK_EQUAL("-7 0 123456", e.get().toUtf8().constData());
+      int64_t l[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::INT64, l, 3));
+      CHECK_EQUAL(-7, l[0]);
+      CHECK_EQUAL(123456, l[2]);
+      double d[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::DOUBLE, d, 3));
+      CHECK_EQUAL(-7.0, d[0]);
+      CHECK_EQUAL(123456.0, d[2]);
+    }
+
+    CHECK(archive.readFromMem(writeValues(Valuable::ArchiveValueType::INT64, longs, 3)));
+    {
+      const Valuable::ArchiveElement e = archive.root();
+      CHECK_EQUAL("-1099511627776 1 4503599627370496", e.get().toUtf8().constData());
+      double d[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::DOUBLE, d, 3));
+      CHECK_EQUAL(double(longs[0]), d[0]);
+      CHECK_EQUAL(double(longs[2]), d[2]);
+      int32_t i[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::INT32, i, 3));
+      CHECK_EQUAL(1, i[1]);
+    }
+
+    CHECK(archive.readFromMem(writeValues(Valuable::ArchiveValueType::FLOAT, floats, 3)));
+    {
+      const Valuable::ArchiveElement e = archive.root();
+      CHECK_EQUAL("0.5 -2.75 3", e.get().toUtf8().constData());
+      double d[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::DOUBLE, d, 3));
+      CHECK_EQUAL(-2.75, d[1]);
+      int32_t i[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::INT32, i, 3));
+      CHECK_EQUAL(0, i[0]);
+      CHECK_EQUAL(-2, i[1]);
+      CHECK_EQUAL(3, i[2]);
+    }
+
+    CHECK(archive.readFromMem(writeValues(Valuable::ArchiveValueType::DOUBLE, doubles, 3)));
+    {
+      const Valuable::ArchiveElement e = archive.root();
+      CHECK_EQUAL("1.5 -2.25 10000000000", e.get().toUtf8().constData());
+      float f[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::FLOAT, f, 3));
+      CHECK_EQUAL(1.5f, f[0]);
+      CHECK_EQUAL(-2.25f, f[1]);
+      int64_t l[3];
+      CHECK(e.getValues(Valuable::ArchiveValueType::INT64, l, 3));
+      CHECK_EQUAL(int64_t(10000000000), l[2]);
+
+      // The count must match exactly
+      double d[4];
+      CHECK(!e.getValues(Valuable::ArchiveValueType::DOUBLE, d, 2));
+      CHECK(!e.getValues(Valuable::ArchiveValueType::DOUBLE, d, 4));
+      CHECK(!e.getValues(Valuable::ArchiveValueType::DOUBLE, d, -1));
+    }
+
+    // Zero values is a valid array
+    CHECK(archive.readFromMem(writeValues(Valuable::ArchiveValueType::FLOAT, nullptr, 0)));
+    CHECK(archive.root().getValues(Valuable::ArchiveValueType::FLOAT, nullptr, 0));
+    CHECK_EQUAL("", archive.root().get().toUtf8().constData());
+
+    // String content can't be read as values
+    {
+      Valuable::BinaryArchive strings;
+      Valuable::ArchiveElement e = strings.createElement("text");
+      e.set("1 2 3");
+      strings.setRoot(e);
+      QByteArray buffer;
+      CHECK(strings.writeToMem(buffer));
+      CHECK(strings.readFromMem(buffer));
+      int32_t i[3];
+      CHECK(!strings.root().getValues(Valuable::ArchiveValueType::INT32, i, 3));
+      CHECK_EQUAL("1 2 3", strings.root().get().toUtf8().constData());
+    }
+  }
+
+  TEST(ModifyReadElement)
+  {
+    const float floats[] = {1.f, 2.f};
+    Valuable::BinaryArchive archive;
+    CHECK(archive.readFromMem(writeValues(Valuable::ArchiveValueType::FLOAT, floats, 2)));
+
+    Valuable::ArchiveElement e = archive.root();
+    const int32_t ints[] = {4, 5, 6};
+    CHECK(e.setValues(Valuable::ArchiveValueType::INT32, ints, 3));
+    e.add("added", "yes");
+
+    QByteArray buffer;
+    CHECK(archive.writeToMem(buffer));
+    Valuable::BinaryArchive read;
+    CHECK(read.readFromMem(buffer));
+    CHECK_EQUAL("4 5 6", read.root().get().toUtf8().constData());
+    CHECK_EQUAL("yes", read.root().get("added").toUtf8().constData());
+  }
+
+  TEST(RejectTruncatedInput)
+  {
+    Tree tree;
+    tree.setValues();
+    const QByteArray buffer = writeArchive(tree.root());
+    CHECK(buffer.size() > 0);
+
+    Valuable::BinaryArchive archive;
+    CHECK(archive.readFromMem(buffer));
+
+    SilentTrace silent;
+    for (int size = 0; size < buffer.size(); ++size) {
+      Valuable::BinaryArchive truncated;
+      if (truncated.readFromMem(buffer.left(size))) {
+        CHECK_EQUAL(buffer.size(), size);
+        break;
+      }
+    }
+  }
+
+  TEST(RejectCorruptHeader)
+  {
+    Tree tree;
+    tree.setValues();
+    const QByteArray buffer = writeArchive(tree.root());
+    SilentTrace silent;
+
+    QByteArray magic = buffer;
+    magic[0] = 'x';
+    CHECK(!Valuable::BinaryArchive::isBinaryArchive(magic));
+    CHECK(!Valuable::BinaryArchive().readFromMem(magic));
+
+    QByteArray version = buffer;
+    uint32_t v;
+    std::memcpy(&v, version.constData() + 8, sizeof(v));
+    ++v;
+    std::memcpy(version.data() + 8, &v, sizeof(v));
+    CHECK(!Valuable::BinaryArchive::isBinaryArchive(version));
+    CHECK(!Valuable::BinaryArchive().readFromMem(version));
+
+    for (uint64_t offset: {uint64_t(0), uint64_t(buffer.size()), ~uint64_t(0), ~uint64_t(0) - 2}) {
+      QByteArray table = buffer;
+      std::memcpy(table.data() + 16, &offset, sizeof(offset));
+      CHECK(!Valuable::BinaryArchive().readFromMem(table));
+    }
+
+    CHECK(!Valuable::BinaryArchive().readFromMem(QByteArray()));
+    CHECK(!Valuable::BinaryArchive().readFromMem(QByteArray(64, '\0')));
+  }
+
+  TEST(CorruptInputDoesNotCrash)
+  {
+    Tree tree;
+    tree.setValues();
+    const QByteArray buffer = writeArchive(tree.root());
+    SilentTrace silent;
+
+    // Every byte is replaced with a few patterns that break sizes, string
+    // ids and value types. The archive is either rejected or it can be
+    // fully read and deserialized.
+    const char patterns[] = {'\0', '\x01', '\x7f', '\x80', '\xff'};
+    for (int i = 0; i < buffer.size(); ++i) {
+      for (char pattern: patterns) {
+        if (buffer[i] == pattern)
+          continue;
+        QByteArray corrupt = buffer;
+        corrupt[i] = pattern;
+
+        Valuable::BinaryArchive archive;
+        if (!archive.readFromMem(corrupt))
+          continue;
+        if (archive.root().isNull())
+          continue;
+        CHECK(walk(archive.root()) > 0);
+        Tree target;
+        target.root().deserialize(archive.root());
+      }
+    }
+  }
+}
@@ -0,0 +1,236 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include <Valuable/AttributeFloat.hpp>
+#include <Valuable/AttributeString.hpp>
+#include <Valuable/BinaryArchive.hpp>
+#include <Valuable/Node.hpp>
+#include <Valuable/TransitionManager.hpp>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <memory>
+#include <vector>
+
+namespace
+{
+  class Item : public Valuable::Node
+  {
+  public:
+    Item(Valuable::Node * host = nullptr, const QByteArray & name = "item")
+      : Node(host, name)
+      , m_opacity(this, "opacity", 1.f)
+      , m_text(this, "text", "default")
+    {}
+
+    virtual QByteArray type() const override { return "item"; }
+
+    Valuable::AttributeFloat m_opacity;
+    Valuable::AttributeString m_text;
+  };
+
+  /// Creates items for new child elements, like the classes that
+  /// implement readElement usually do
+  class ItemList : public Valuable::Node
+  {
+  public:
+    Item * item(const QByteArray & name)
+    {
+      return dynamic_cast<Item*>(attribute(name));
+    }
+
+  protected:
+    virtual bool readElement(const Valuable::ArchiveElement & element) override
+    {
+      if (element.get("type") != "item")
+        return false;
+      m_items.emplace_back(new Item(this, element.name().toUtf8()));
+      return m_items.back()->deserialize(element);
+    }
+
+  private:
+    std::vector<std::unique_ptr<Item>> m_items;
+  };
+
+  /// Writes the changes made after the generation and advances the
+  /// generation. Returns an empty buffer if nothing has changed.
+  QByteArray writeChanges(const Valuable::Node & source, uint64_t & generation)
+  {
+    const uint64_t next = Valuable::Attribute::currentGeneration();
+    Valuable::BinaryArchive archive;
+    Valuable::ArchiveElement patch = source.serializeChanges(archive, generation);
+    generation = next;
+
+    QByteArray buffer;
+    if (!patch.isNull()) {
+      archive.setRoot(patch);
+      archive.writeToMem(buffer);
+    }
+    return buffer;
+  }
+
+  bool applyChanges(Valuable::Node & target, const QByteArray & buffer)
+  {
+    Valuable::BinaryArchive archive;
+    return archive.readFromMem(buffer) && !archive.root().isNull() &&
+        target.applyChanges(archive.root());
+  }
+
+  /// Copies the changes of source made after the generation to target
+  bool sync(const Valuable::Node & source, Valuable::Node & target, uint64_t & generation)
+  {
+    const QByteArray buffer = writeChanges(source, generation);
+    return buffer.isEmpty() || applyChanges(target, buffer);
+  }
+}
+
+SUITE(NodeChanges)
+{
+  TEST(SetValue)
+  {
+    Item source, target;
+    uint64_t generation = 0;
+    CHECK(sync(source, target, generation));
+
+    source.m_opacity = 0.5f;
+    source.m_text = "changed";
+    CHECK(sync(source, target, generation));
+    CHECK_EQUAL(0.5f, target.m_opacity.value());
+    CHECK(target.m_text == "changed");
+
+    // Nothing has changed since the previous patch
+    CHECK(writeChanges(source, generation).isEmpty());
+
+    // Only the changed attribute is included
+    target.m_text = "local";
+    source.m_opacity = 0.25f;
+    CHECK(sync(source, target, generation));
+    CHECK_EQUAL(0.25f, target.m_opacity.value());
+    CHECK(target.m_text == "local");
+  }
+
+  TEST(ClearValue)
+  {
+    Item source, target;
+    uint64_t generation = 0;
+    source.m_opacity = 0.5f;
+    CHECK(sync(source, target, generation));
+    CHECK(target.m_opacity.isValueDefinedOnLayer(Valuable::Attribute::USER));
+
+    source.m_opacity.clearValue(Valuable::Attribute::USER);
+    CHECK(sync(source, target, generation));
+    CHECK(!target.m_opacity.isValueDefinedOnLayer(Valuable::Attribute::USER));
+    CHECK_EQUAL(1.f, target.m_opacity.value());
+  }
+
+  TEST(ClearValueInCompletePatch)
+  {
+    Item source, target;
+    uint64_t generation = 0;
+    source.m_opacity = 0.5f;
+    CHECK(sync(source, target, generation));
+
+    // Adding an attribute makes the next patch complete, cleared values
+    // still need to be cleared on the receiving side
+    source.m_opacity.clearValue(Valuable::Attribute::USER);
+    Valuable::AttributeFloat sourceExtra(&source, "extra", 0.f);
+    Valuable::AttributeFloat targetExtra(&target, "extra", 0.f);
+    CHECK(sync(source, target, generation));
+    CHECK(!target.m_opacity.isValueDefinedOnLayer(Valuable::Attribute::USER));
+    CHECK_EQUAL(1.f, target.m_opacity.value());
+  }
+
+  TEST(RemoveAttribute)
+  {
+    Valuable::Node sourceRoot, targetRoot;
+    std::unique_ptr<Valuable::AttributeFloat> sourceExtra(new Valuable::AttributeFloat(&sourceRoot, "extra", 0.f));
+    std::unique_ptr<Valuable::AttributeFloat> targetExtra(new Valuable::AttributeFloat(&targetRoot, "extra", 0.f));
+    Valuable::AttributeFloat sourceKept(&sourceRoot, "kept", 0.f);
+    Valuable::AttributeFloat targetKept(&targetRoot, "kept", 0.f);
+
+    uint64_t generation = 0;
+    *sourceExtra = 2.f;
+    CHECK(sync(sourceRoot, targetRoot, generation));
+    CHECK_EQUAL(2.f, targetExtra->value());
+
+    sourceExtra.reset();
+    CHECK(sync(sourceRoot, targetRoot, generation));
+    CHECK(!targetRoot.attribute("extra"));
+    CHECK(!targetExtra->host());
+    CHECK(targetRoot.attribute("kept") == &targetKept);
+  }
+
+  TEST(AddAndRemoveChildNode)
+  {
+    Valuable::Node sourceRoot, targetRoot;
+    uint64_t generation = 0;
+    CHECK(sync(sourceRoot, targetRoot, generation));
+
+    // A plain Node doesn't know how to create children, so the receiver
+    // creates plain nodes for them
+    auto child = new Valuable::Node(&sourceRoot, "child");
+    new Valuable::Node(child, "grand-child");
+    CHECK(sync(sourceRoot, targetRoot, generation));
+
+    auto targetChild = dynamic_cast<Valuable::Node*>(targetRoot.attribute("child"));
+    CHECK(targetChild);
+    if (targetChild)
+      CHECK(dynamic_cast<Valuable::Node*>(targetChild->attribute("grand-child")));
+
+    delete child;
+    CHECK(sync(sourceRoot, targetRoot, generation));
+    CHECK(!targetRoot.attribute("child"));
+  }
+
+  TEST(AddChildWithReadElement)
+  {
+    ItemList source, target;
+    uint64_t generation = 0;
+    CHECK(sync(source, target, generation));
+
+    Item item(&source, "first");
+    item.m_opacity = 0.5f;
+    item.m_text = "new";
+    CHECK(sync(source, target, generation));
+
+    Item * created = target.item("first");
+    CHECK(created);
+    if (created) {
+      CHECK_EQUAL(0.5f, created->m_opacity.value());
+      CHECK(created->m_text == "new");
+    }
+
+    item.m_opacity = 0.25f;
+    CHECK(sync(source, target, generation));
+    if (created)
+      CHECK_EQUAL(0.25f, created->m_opacity.value());
+  }
+
+  TEST(Transition)
+  {
+    Item source, target;
+    source.m_opacity.setTransitionParameters(Valuable::TransitionParameters(1.f));
+    uint64_t generation = 0;
+    CHECK(sync(source, target, generation));
+
+    // The patch has the target value, not the animated one
+    source.m_opacity = 0.f;
+    Valuable::TransitionManager::updateAll(0.25f);
+    CHECK(sync(source, target, generation));
+    CHECK_EQUAL(0.f, target.m_opacity.value());
+
+    // Animation frames are not changes
+    Valuable::TransitionManager::updateAll(0.25f);
+    Valuable::TransitionManager::updateAll(0.25f);
+    CHECK(writeChanges(source, generation).isEmpty());
+
+    source.m_opacity.setTransitionParameters(Valuable::TransitionParameters());
+  }
+}
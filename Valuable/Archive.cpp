@@ -17,6 +17,16 @@ namespace Valuable
   {
   }
 
+  bool ArchiveElementImpl::setValues(ArchiveValueType, const void *, int)
+  {
+    return false;
+  }
+
+  bool ArchiveElementImpl::getValues(ArchiveValueType, void *, int) const
+  {
+    return false;
+  }
+
   //////////////////////////////////////////////////////////////////////////
 
   ArchiveIteratorImpl::~ArchiveIteratorImpl()
@@ -99,6 +109,18 @@ namespace Valuable
     return m_impl->get();
   }
 
+  bool ArchiveElement::setValues(ArchiveValueType type, const void * values, int count)
+  {
+    assert(m_impl);
+    return m_impl->setValues(type, values, count);
+  }
+
+  bool ArchiveElement::getValues(ArchiveValueType type, void * values, int count) const
+  {
+    assert(m_impl);
+    return m_impl->getValues(type, values, count);
+  }
+
   QString ArchiveElement::name() const
   {
     assert(m_impl);
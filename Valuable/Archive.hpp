@@ -16,6 +16,7 @@
 #include "Export.hpp"
 
 #include <cassert>
+#include <cstdint>
 
 namespace Valuable
 {
@@ -23,6 +24,16 @@ namespace Valuable
   class ArchiveElement;
   class ArchiveIterator;
 
+  /// Numeric value types that archives can store natively, without
+  /// converting them to strings. See ArchiveElement::setValues.
+  enum class ArchiveValueType : uint8_t
+  {
+    INT32 = 1,
+    INT64 = 2,
+    FLOAT = 3,
+    DOUBLE = 4
+  };
+
   /**
    * Options that define the behaviour of the (de)serialize() methods.
    */
@@ -101,6 +112,23 @@ namespace Valuable
     /// @return The contents of the element
     virtual QString get() const = 0;
 
+    /// Writes the element contents as an array of numbers. The default
+    /// implementation doesn't support native values and returns false, in
+    /// which case the caller should use set(const QString &) instead.
+    /// @param type Type of the values
+    /// @param values Pointer to count values of the given type
+    /// @param count Number of values
+    /// @return True if the values were stored
+    virtual bool setValues(ArchiveValueType type, const void * values, int count);
+    /// Reads the element contents that were written with setValues. Values
+    /// are converted to the requested type if needed.
+    /// @param type Requested value type
+    /// @param[out] values Pointer to count values of the given type
+    /// @param count Number of values
+    /// @return False if the element doesn't have exactly count native
+    ///         values, in which case the caller should parse get() instead
+    virtual bool getValues(ArchiveValueType type, void * values, int count) const;
+
     /// Reads the element name
     /// @return The name of the element
     virtual QString name() const = 0;
@@ -214,6 +242,11 @@ namespace Valuable
     /// @return The contents of the element
     QString get() const;
 
+    /// @copydoc ArchiveElementImpl::setValues
+    bool setValues(ArchiveValueType type, const void * values, int count);
+    /// @copydoc ArchiveElementImpl::getValues
+    bool getValues(ArchiveValueType type, void * values, int count) const;
+
     /// Reads the element name
     /// @return The name of the element
     QString name() const;
@@ -230,6 +263,7 @@ namespace Valuable
     const DOMElement * xml() const;
 
   private:
+    friend class BinaryArchive;
     std::shared_ptr<ArchiveElementImpl> m_impl;
   };
 
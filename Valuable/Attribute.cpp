@@ -19,6 +19,10 @@
 #include <Radiant/Mutex.hpp>
 #include <Radiant/ThreadChecks.hpp>
 
+#include <QSet>
+
+#include <atomic>
+
 #ifdef MULTI_DOCUMENTER
 std::list<Valuable::Attribute::Doc> Valuable::Attribute::doc;
 #endif
@@ -47,15 +51,13 @@ namespace Valuable
 
   Attribute::Attribute()
   : m_host(0),
-    m_ownerShorthand(nullptr),
-    m_listenersId(0)
+    m_ownerShorthand(nullptr)
   {}
 
   Attribute::Attribute(Node * host, const QByteArray & name)
     : m_host(0),
       m_ownerShorthand(nullptr),
-      m_name(name),
-      m_listenersId(0)
+      m_name(internName(name))
 #ifdef ENABLE_THREAD_CHECKS
     , m_ownerThread(host ? host->m_ownerThread : nullptr)
 #endif
@@ -66,7 +68,7 @@ namespace Valuable
       Radiant::fatal("Attribute::Attribute # host = this! # check your code");
 
     if(host) {
-      host->addAttribute(name, this);
+      host->addAttribute(m_name, this);
 #ifdef MULTI_DOCUMENTER
       doc.push_back(Doc());
       Doc & d = doc.back();
@@ -82,7 +84,7 @@ namespace Valuable
     , m_ownerShorthand(o.m_ownerShorthand)
     , m_name(std::move(o.m_name))
     , m_listeners(std::move(o.m_listeners))
-    , m_listenersId(o.m_listenersId)
+    , m_changeGeneration(o.m_changeGeneration)
 #ifdef ENABLE_THREAD_CHECKS
     , m_ownerThread(o.m_ownerThread)
 #endif
@@ -99,7 +101,7 @@ namespace Valuable
     m_name = std::move(o.m_name);
     m_ownerShorthand = o.m_ownerShorthand;
     m_listeners = std::move(o.m_listeners);
-    m_listenersId = o.m_listenersId;
+    m_changeGeneration = o.m_changeGeneration;
 #ifdef ENABLE_THREAD_CHECKS
     m_ownerThread = o.m_ownerThread;
 #endif
@@ -129,10 +131,11 @@ namespace Valuable
 
   void Attribute::setName(const QByteArray & s)
   {
+    QByteArray name = internName(s);
     if(host())
-      host()->attributeRenamed(m_name, s);
+      host()->attributeRenamed(m_name, name);
 
-    m_name = s;
+    m_name = std::move(name);
   }
 
   QByteArray Attribute::path() const
@@ -243,14 +246,64 @@ namespace Valuable
                      Radiant::StringUtils::type(*this).data(), name().data());
   }
 
+  void Attribute::collectMemoryUsage(AttributeMemoryUsage & usage) const
+  {
+    ++usage.attributes;
+    usage.bytes += sizeof(Attribute);
+    if (m_listeners) {
+      ++usage.listenerStorage;
+      usage.listeners += m_listeners->map.size();
+      // QMap nodes have the key, value and three pointers
+      usage.bytes += sizeof(Listeners) + m_listeners->map.size() *
+          (sizeof(long) + sizeof(AttributeListener) + 3 * sizeof(void*));
+    }
+  }
+
+  static std::atomic<uint64_t> s_generation{0};
+
+  uint64_t Attribute::currentGeneration()
+  {
+    return s_generation.load(std::memory_order_relaxed);
+  }
+
+  uint64_t Attribute::nextGeneration()
+  {
+    return s_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  QByteArray Attribute::internName(const QByteArray & name)
+  {
+    if (name.isEmpty())
+      return name;
+
+    static Radiant::Mutex s_mutex;
+    static QSet<QByteArray> s_names;
+
+    Radiant::Guard g(s_mutex);
+    auto it = s_names.find(name);
+    if (it == s_names.end()) {
+      // Make a deep copy, the name might be created with QByteArray::fromRawData
+      it = s_names.insert(QByteArray(name.data(), name.size()));
+    }
+    return *it;
+  }
+
   void Attribute::emitChange()
+  {
+    markChanged();
+    emitChangeListeners();
+  }
+
+  void Attribute::emitChangeListeners()
   {
     REQUIRE_THREAD(m_ownerThread);
+    if (!m_listeners)
+      return;
     // Radiant::trace("Attribute::emitChange # '%s'", m_name.data());
     // We use Q_FOREACH here because the callback functions might
     // remove themselves from the listeners. Since Q_FOREACH makes a
     // copy of the containers this doesn't present a problem
-    Q_FOREACH(const AttributeListener & l, m_listeners) {
+    Q_FOREACH(const AttributeListener & l, m_listeners->map) {
       if(l.role & CHANGE_ROLE) {
         l.func();
       }
@@ -260,25 +313,29 @@ namespace Valuable
   void Attribute::emitDelete()
   {
     //Radiant::trace("Attribute::emitDelete");
+    if (!m_listeners)
+      return;
     // We use Q_FOREACH here because the callback functions might
     // remove themselves from the listeners. Since Q_FOREACH makes a
     // copy of the containers this doesn't present a problem
-    Q_FOREACH(const AttributeListener & l, m_listeners) {
+    Q_FOREACH(const AttributeListener & l, m_listeners->map) {
       if(l.role & DELETE_ROLE) {
         l.func();
       }
       if(l.listener) l.listener->m_attributeListening.remove(this);
     }
-    m_listeners.clear();
+    m_listeners->map.clear();
   }
 
   void Attribute::emitHostChange()
   {
+    if (!m_listeners)
+      return;
     // Radiant::trace("Attribute::emitChange # '%s'", m_name.data());
     // We use Q_FOREACH here because the callback functions might
     // remove themselves from the listeners. Since Q_FOREACH makes a
     // copy of the containers this doesn't present a problem
-    Q_FOREACH(const AttributeListener & l, m_listeners) {
+    Q_FOREACH(const AttributeListener & l, m_listeners->map) {
       if(l.role & HOST_CHANGE_ROLE) {
         l.func();
       }
@@ -307,8 +364,10 @@ namespace Valuable
       return -1;
     }
 
-    long id = m_listenersId++;
-    m_listeners[id] = AttributeListener(func, role, listener);
+    if (!m_listeners)
+      m_listeners.reset(new Listeners());
+    long id = m_listeners->nextId++;
+    m_listeners->map[id] = AttributeListener(func, role, listener);
     if(listener) listener->m_attributeListening << this;
     return id;
   }
@@ -321,20 +380,24 @@ namespace Valuable
   bool Attribute::removeListener(Node * listener, int role)
   {
     REQUIRE_THREAD(m_ownerThread);
+    if (!m_listeners)
+      return false;
+
     bool erasedAnything = false;
 
     QList<Node*> listeners;
-    for(QMap<long, AttributeListener>::iterator it = m_listeners.begin(); it != m_listeners.end(); ) {
+    QMap<long, AttributeListener> & map = m_listeners->map;
+    for(QMap<long, AttributeListener>::iterator it = map.begin(); it != map.end(); ) {
       if((it->role & role) && (!listener || listener == it->listener)) {
         if(it->listener) listeners << it->listener;
-        it = m_listeners.erase(it);
+        it = map.erase(it);
         erasedAnything = true;
       } else ++it;
     }
 
     for(Node * listener : listeners) {
       bool found = false;
-      for(const AttributeListener & l : m_listeners)
+      for(const AttributeListener & l : map)
         if(l.listener == listener) { found = true; break; }
       if(!found)
         listener->m_attributeListening.remove(this);
@@ -346,18 +409,21 @@ namespace Valuable
   bool Attribute::removeListener(long id)
   {
     REQUIRE_THREAD(m_ownerThread);
-    QMap<long, AttributeListener>::iterator it = m_listeners.find(id);
-    if(it == m_listeners.end()) return false;
+    if (!m_listeners) return false;
+    QMap<long, AttributeListener>::iterator it = m_listeners->map.find(id);
+    if(it == m_listeners->map.end()) return false;
     if(it->listener) it->listener->m_attributeListening.remove(this);
-    m_listeners.erase(it);
+    m_listeners->map.erase(it);
     return true;
   }
 
   bool Attribute::hasListener(Node * listener, int role) const
   {
     REQUIRE_THREAD(m_ownerThread);
+    if (!m_listeners)
+      return false;
 
-    for (const AttributeListener & attrListener: m_listeners) {
+    for (const AttributeListener & attrListener: m_listeners->map) {
       if ((attrListener.role & role) && (!listener || listener == attrListener.listener)) {
         return true;
       }
@@ -369,7 +435,7 @@ namespace Valuable
   bool Attribute::hasListener(long id) const
   {
     REQUIRE_THREAD(m_ownerThread);
-    return m_listeners.find(id) != m_listeners.end();
+    return m_listeners && m_listeners->map.contains(id);
   }
 
   bool Attribute::isChanged() const
@@ -38,7 +38,9 @@
 #include <QList>
 #include <QMap>
 
+#include <cstdint>
 #include <functional>
+#include <memory>
 
 // new behavior: elements of array 'array' will be default initialized
 #if RADIANT_WINDOWS
@@ -106,6 +108,23 @@ namespace Valuable
   };
 
 
+  /// Approximate memory usage of a group of attributes, see Node::memoryUsage
+  struct AttributeMemoryUsage
+  {
+    /// Number of attributes
+    size_t attributes = 0;
+    /// Number of attributes that have allocated storage for non-default layers
+    size_t layerStorage = 0;
+    /// Number of attributes that have allocated storage for listeners
+    size_t listenerStorage = 0;
+    /// Total number of attribute listeners
+    size_t listeners = 0;
+    /// Bytes used by the attribute objects and their layer and listener
+    /// storage. Memory owned by the values, like string contents, and
+    /// memory of the names, which are shared, is not included.
+    size_t bytes = 0;
+  };
+
   /** The base class for value objects.
 
       Typical child classes include some POD (plain old data) elements
@@ -188,7 +207,8 @@ namespace Valuable
 
     /// Returns the name of the object.
     const QByteArray & name() const { return m_name; }
-    /// Sets the name of the object
+    /// Sets the name of the object. Names are interned, all attributes with
+    /// the same name share the same name buffer.
     void setName(const QByteArray & s);
     /// Returns the path (separated by '/'s) from the root
     QByteArray path() const;
@@ -396,10 +416,39 @@ namespace Valuable
 
     virtual void setTransitionParameters(TransitionParameters params);
 
+    /// Adds the memory used by this attribute to usage.
+    /// Nodes also add the memory used by their attributes.
+    virtual void collectMemoryUsage(AttributeMemoryUsage & usage) const;
+
+    /// Returns a shared copy of the name. Attribute names are stored once
+    /// in a process-wide table and never released.
+    static QByteArray internName(const QByteArray & name);
+
+    /// Every change to any attribute gets a new generation number from a
+    /// process-wide counter. Store the current generation when saving a
+    /// Node and give it to Node::serializeChanges later to get only the
+    /// attributes that have changed after the save.
+    /// @returns the generation of the latest change of any attribute
+    static uint64_t currentGeneration();
+
+    /// @returns the generation of the latest change of this attribute, or
+    ///          zero if the attribute hasn't changed after it was created
+    uint64_t changeGeneration() const { return m_changeGeneration; }
+
     /// Invokes the change valueChanged function of all listeners
     virtual void emitChange();
 
   protected:
+    /// Marks the attribute changed with a new generation number
+    void markChanged() { m_changeGeneration = nextGeneration(); }
+
+    /// Increments and returns the process-wide generation counter
+    static uint64_t nextGeneration();
+
+    /// Invokes the change listeners without marking the attribute changed.
+    /// Used for intermediate values, like transition animation frames, that
+    /// are not serialized.
+    void emitChangeListeners();
 
     /// Invokes the change valueDeleted function of all listeners
     virtual void emitDelete();
@@ -423,8 +472,15 @@ namespace Valuable
       int role;
       Node * listener;
     };
-    QMap<long, AttributeListener> m_listeners;
-    long m_listenersId;
+    /// Most attributes never have listeners, so the listener map is
+    /// allocated on the first addListener call.
+    struct Listeners
+    {
+      QMap<long, AttributeListener> map;
+      long nextId = 0;
+    };
+    std::unique_ptr<Listeners> m_listeners;
+    uint64_t m_changeGeneration = 0;
 
     friend class Node;
 
@@ -448,12 +504,10 @@ namespace Valuable
       : Attribute(host, name),
       m_transition(nullptr),
       m_currentValue(v),
+      m_defaultValue(v),
       m_currentLayer(DEFAULT),
-      m_values(),
-      m_valueSet()
+      m_valueSet(1 << DEFAULT)
     {
-      m_values[DEFAULT] = v;
-      m_valueSet[DEFAULT] = true;
 #ifdef MULTI_DOCUMENTER
       Doc & d = doc.back();
       XMLArchive archive;
@@ -468,11 +522,10 @@ namespace Valuable
       : Attribute(),
       m_transition(nullptr),
       m_currentValue(),
+      m_defaultValue(),
       m_currentLayer(DEFAULT),
-      m_values(),
-      m_valueSet()
+      m_valueSet(1 << DEFAULT)
     {
-      m_valueSet[DEFAULT] = true;
     }
 
     virtual ~AttributeBaseT() {
@@ -489,13 +542,13 @@ namespace Valuable
     inline const T * operator->() const { return &value(); }
 
     /// The default value (the value given in constructor) of the Attribute.
-    inline const T & defaultValue() const { return m_values[DEFAULT]; }
+    inline const T & defaultValue() const { return m_defaultValue; }
 
     /// @param layer layer to use
     /// @returns attribute value on given layer
     inline const T & value(Layer layer) const {
       if(layer == CURRENT_VALUE) return value();
-      return m_values[layer == CURRENT_LAYER ? currentLayer() : layer];
+      return layerValue(layer == CURRENT_LAYER ? currentLayer() : layer);
     }
 
     /// @returns attribute active value
@@ -516,10 +569,11 @@ namespace Valuable
       if (layer >= CURRENT_LAYER) layer = currentLayer();
       bool top = layer >= m_currentLayer;
       bool sendSignal = top && (differs(m_currentValue, t) ||
-                                (m_transition && differs(m_values[m_currentLayer], t)));
+                                (m_transition && differs(layerValue(m_currentLayer), t)));
       if(top) m_currentLayer = layer;
-      m_values[layer] = t;
-      m_valueSet[layer] = true;
+      layerValueRef(layer) = t;
+      m_valueSet |= 1 << layer;
+      markChanged();
       if (sendSignal) this->emitChange();
     }
 
@@ -548,20 +602,21 @@ namespace Valuable
     {
       assert(layer > DEFAULT);
       if (layer >= CURRENT_LAYER) layer = currentLayer();
-      m_valueSet[layer] = false;
+      m_valueSet &= ~(1 << layer);
+      markChanged();
       if(m_currentLayer == layer) {
-        assert(m_valueSet[DEFAULT]);
+        assert(m_valueSet & (1 << DEFAULT));
         int l = int(layer) - 1;
-        while(!m_valueSet[l]) --l;
+        while(!(m_valueSet & (1 << l))) --l;
         m_currentLayer = Layer(l);
-        if(differs(m_values[l], m_values[layer]))
+        if(differs(layerValue(l), layerValue(layer)))
           this->emitChange();
       }
     }
 
     virtual void setAsDefaults() OVERRIDE
     {
-      if (!m_valueSet[USER])
+      if (!(m_valueSet & (1 << USER)))
         return;
       setValue(value(USER), DEFAULT);
       clearValue(USER);
@@ -595,7 +650,7 @@ namespace Valuable
     virtual bool isValueDefinedOnLayer(Layer layer) const FINAL
     {
       if (layer >= CURRENT_LAYER) return true;
-      return m_valueSet[layer];
+      return m_valueSet & (1 << layer);
     }
 
     virtual void setTransitionParameters(TransitionParameters params) FINAL
@@ -617,7 +672,7 @@ namespace Valuable
     {
       if (differs(m_currentValue, t)) {
         m_currentValue = t;
-        Attribute::emitChange();
+        emitChangeListeners();
       }
     }
 
@@ -642,13 +697,23 @@ namespace Valuable
       return m_transition;
     }
 
+    virtual void collectMemoryUsage(AttributeMemoryUsage & usage) const override
+    {
+      Attribute::collectMemoryUsage(usage);
+      usage.bytes += sizeof(AttributeBaseT<T>) - sizeof(Attribute);
+      if (m_layerValues) {
+        ++usage.layerStorage;
+        usage.bytes += sizeof(LayerValues);
+      }
+    }
+
   protected:
     virtual void emitChange() FINAL
     {
       if (m_transition) {
-        m_transition->setTarget(value(), m_values[m_currentLayer]);
+        m_transition->setTarget(value(), layerValue(m_currentLayer));
       } else {
-        m_currentValue = m_values[m_currentLayer];
+        m_currentValue = layerValue(m_currentLayer);
         Attribute::emitChange();
       }
     }
@@ -668,12 +733,41 @@ namespace Valuable
       }
     }
 
+  private:
+    /// Values of the layers above DEFAULT, most attributes only ever have
+    /// the default value so these are allocated only when needed
+    struct LayerValues
+    {
+      T values[LAYER_COUNT - 1];
+    };
+
+    inline const T & layerValue(int layer) const
+    {
+      if (layer == DEFAULT)
+        return m_defaultValue;
+      if (m_layerValues)
+        return m_layerValues->values[layer - 1];
+      static const T s_empty{};
+      return s_empty;
+    }
+
+    inline T & layerValueRef(int layer)
+    {
+      if (layer == DEFAULT)
+        return m_defaultValue;
+      if (!m_layerValues)
+        m_layerValues.reset(new LayerValues());
+      return m_layerValues->values[layer - 1];
+    }
+
   private:
     TransitionAnimT<T> * m_transition;
     T m_currentValue;
+    T m_defaultValue;
+    std::unique_ptr<LayerValues> m_layerValues;
     Layer m_currentLayer;
-    T m_values[LAYER_COUNT];
-    bool m_valueSet[LAYER_COUNT];
+    /// Bit n is set if the layer n has a value
+    uint8_t m_valueSet;
   };
 
   template <typename T, typename Select = void>
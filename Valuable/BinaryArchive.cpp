@@ -0,0 +1,889 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "BinaryArchive.hpp"
+
+#include <Radiant/Trace.hpp>
+
+#include <QFile>
+#include <QHash>
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+/// Archive layout. Integers and values are in the host byte order, the
+/// archives are meant for caching and transferring data between similar
+/// machines. The version is written in the same byte order, so archives
+/// from a machine with different byte order are rejected as unsupported
+/// versions instead of being misread.
+///
+///   header       magic[8], u32 version, u32 reserved, u64 string table offset
+///   root element (optional)
+///   string table u32 count, count * (u32 length, UTF-8 bytes)
+///
+/// Element:
+///   u32 size       number of bytes in the rest of the element, including children
+///   u32 name       string id
+///   u32 count      number of attributes
+///   count * (u32 name string id, u32 value string id)
+///   u8 content     CONTENT_NONE, CONTENT_STRING or CONTENT_VALUES
+///   CONTENT_STRING: u32 length, UTF-8 bytes
+///   CONTENT_VALUES: u8 ArchiveValueType, u32 count, raw values
+///   child elements
+namespace
+{
+  using Valuable::ArchiveValueType;
+
+  const char s_magic[8] = {'c', 's', 'a', 'r', 'c', 'h', 'i', 'v'};
+  const uint32_t s_version = 1;
+  const uint32_t s_headerSize = 24;
+  /// Protects against stack overflow with corrupted data
+  const int s_maxDepth = 1024;
+
+  enum ContentKind : uint8_t
+  {
+    CONTENT_NONE = 0,
+    CONTENT_STRING = 1,
+    CONTENT_VALUES = 2
+  };
+
+  int valueSize(ArchiveValueType type)
+  {
+    switch (type) {
+    case ArchiveValueType::INT32:
+    case ArchiveValueType::FLOAT:
+      return 4;
+    case ArchiveValueType::INT64:
+    case ArchiveValueType::DOUBLE:
+      return 8;
+    }
+    return 0;
+  }
+
+  inline uint32_t read32(const char * ptr)
+  {
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+  }
+
+  template <typename T>
+  T readValue(ArchiveValueType type, const char * values, uint32_t index)
+  {
+    switch (type) {
+    case ArchiveValueType::INT32: {
+      int32_t v;
+      memcpy(&v, values + index * sizeof(v), sizeof(v));
+      return static_cast<T>(v);
+    }
+    case ArchiveValueType::INT64: {
+      int64_t v;
+      memcpy(&v, values + index * sizeof(v), sizeof(v));
+      return static_cast<T>(v);
+    }
+    case ArchiveValueType::FLOAT: {
+      float v;
+      memcpy(&v, values + index * sizeof(v), sizeof(v));
+      return static_cast<T>(v);
+    }
+    case ArchiveValueType::DOUBLE: {
+      double v;
+      memcpy(&v, values + index * sizeof(v), sizeof(v));
+      return static_cast<T>(v);
+    }
+    }
+    return T();
+  }
+
+  template <typename T>
+  void convertValues(ArchiveValueType srcType, const char * src, void * dst, int count)
+  {
+    T * out = static_cast<T*>(dst);
+    for (int i = 0; i < count; ++i)
+      out[i] = readValue<T>(srcType, src, i);
+  }
+
+  bool convertValues(ArchiveValueType srcType, const char * src, uint32_t srcCount,
+                     ArchiveValueType dstType, void * dst, int count)
+  {
+    if (count < 0 || srcCount != static_cast<uint32_t>(count))
+      return false;
+
+    switch (dstType) {
+    case ArchiveValueType::INT32:
+      convertValues<int32_t>(srcType, src, dst, count);
+      return true;
+    case ArchiveValueType::INT64:
+      convertValues<int64_t>(srcType, src, dst, count);
+      return true;
+    case ArchiveValueType::FLOAT:
+      convertValues<float>(srcType, src, dst, count);
+      return true;
+    case ArchiveValueType::DOUBLE:
+      convertValues<double>(srcType, src, dst, count);
+      return true;
+    }
+    return false;
+  }
+
+  QString formatValues(ArchiveValueType type, const char * values, uint32_t count)
+  {
+    QString str;
+    for (uint32_t i = 0; i < count; ++i) {
+      if (i > 0)
+        str += ' ';
+      switch (type) {
+      case ArchiveValueType::INT32:
+      case ArchiveValueType::INT64:
+        str += QString::number(readValue<qlonglong>(type, values, i));
+        break;
+      case ArchiveValueType::FLOAT:
+        str += QString::number(readValue<double>(type, values, i), 'g', 9);
+        break;
+      case ArchiveValueType::DOUBLE:
+        str += QString::number(readValue<double>(type, values, i), 'g', 17);
+        break;
+      }
+    }
+    return str;
+  }
+
+  /// Archive data after readFromMem, shared by all element views
+  struct Buffer
+  {
+    QByteArray data;
+    std::vector<QString> strings;
+    QHash<QString, uint32_t> ids;
+  };
+
+  /// Decoded element header
+  struct ElementView
+  {
+    uint32_t end = 0;
+    uint32_t name = 0;
+    uint32_t attributeCount = 0;
+    uint32_t attributes = 0;
+    ContentKind content = CONTENT_NONE;
+    /// String or value data
+    uint32_t contentOffset = 0;
+    /// String length in bytes or number of values
+    uint32_t contentSize = 0;
+    ArchiveValueType valueType = ArchiveValueType::INT32;
+    uint32_t children = 0;
+  };
+
+  /// Parses the element at offset, limit is the end of the parent element
+  bool parseElement(const QByteArray & data, uint32_t offset, uint32_t limit, ElementView & view)
+  {
+    const char * ptr = data.constData();
+    uint64_t pos = offset;
+
+    if (pos + 12 > limit)
+      return false;
+    const uint32_t size = read32(ptr + pos);
+    view.end = offset + 4 + size;
+    if (uint64_t(offset) + 4 + size > limit)
+      return false;
+
+    view.name = read32(ptr + pos + 4);
+    view.attributeCount = read32(ptr + pos + 8);
+    view.attributes = offset + 12;
+    pos = view.attributes + uint64_t(view.attributeCount) * 8;
+
+    if (pos + 1 > view.end)
+      return false;
+    view.content = ContentKind(ptr[pos]);
+    ++pos;
+
+    if (view.content == CONTENT_STRING) {
+      if (pos + 4 > view.end)
+        return false;
+      view.contentSize = read32(ptr + pos);
+      view.contentOffset = pos + 4;
+      pos = view.contentOffset + uint64_t(view.contentSize);
+    } else if (view.content == CONTENT_VALUES) {
+      if (pos + 5 > view.end)
+        return false;
+      view.valueType = ArchiveValueType(ptr[pos]);
+      const int bytes = valueSize(view.valueType);
+      if (bytes == 0)
+        return false;
+      view.contentSize = read32(ptr + pos + 1);
+      view.contentOffset = pos + 5;
+      pos = view.contentOffset + uint64_t(view.contentSize) * bytes;
+    } else if (view.content != CONTENT_NONE) {
+      return false;
+    }
+
+    if (pos > view.end)
+      return false;
+    view.children = static_cast<uint32_t>(pos);
+    return true;
+  }
+
+  /// Parses an element that was already validated
+  inline ElementView parseValid(const Buffer & buffer, uint32_t offset)
+  {
+    ElementView view;
+    bool ok = parseElement(buffer.data, offset, buffer.data.size(), view);
+    assert(ok);
+    (void)ok;
+    return view;
+  }
+
+  bool validateElement(const Buffer & buffer, uint32_t offset, uint32_t limit, int depth)
+  {
+    ElementView view;
+    if (depth > s_maxDepth || !parseElement(buffer.data, offset, limit, view))
+      return false;
+
+    const uint32_t strings = static_cast<uint32_t>(buffer.strings.size());
+    if (view.name >= strings)
+      return false;
+    for (uint32_t i = 0; i < view.attributeCount; ++i) {
+      const char * attr = buffer.data.constData() + view.attributes + i * 8;
+      if (read32(attr) >= strings || read32(attr + 4) >= strings)
+        return false;
+    }
+
+    uint32_t pos = view.children;
+    while (pos < view.end) {
+      if (!validateElement(buffer, pos, view.end, depth + 1))
+        return false;
+      pos = read32(buffer.data.constData() + pos) + pos + 4;
+    }
+    return pos == view.end;
+  }
+}
+
+namespace Valuable
+{
+  class BinaryArchiveWriter::D
+  {
+  public:
+    struct OpenElement
+    {
+      size_t start;
+      uint32_t attributeCount;
+      bool contentWritten;
+    };
+
+    D() { reset(); }
+
+    void reset()
+    {
+      m_data.assign(s_headerSize, 0);
+      m_ids.clear();
+      m_strings.clear();
+      m_stack.clear();
+      m_hasRoot = false;
+      m_error = false;
+    }
+
+    uint32_t intern(const QString & str)
+    {
+      auto it = m_ids.find(str);
+      if (it != m_ids.end())
+        return *it;
+      uint32_t id = static_cast<uint32_t>(m_strings.size());
+      m_strings.push_back(str.toUtf8());
+      m_ids.insert(str, id);
+      return id;
+    }
+
+    void put8(uint8_t v)
+    {
+      m_data.push_back(static_cast<char>(v));
+    }
+
+    void put32(uint32_t v)
+    {
+      const char * p = reinterpret_cast<const char*>(&v);
+      m_data.insert(m_data.end(), p, p + sizeof(v));
+    }
+
+    void put(const void * data, size_t bytes)
+    {
+      const char * p = static_cast<const char*>(data);
+      m_data.insert(m_data.end(), p, p + bytes);
+    }
+
+    void patch32(size_t pos, uint32_t v)
+    {
+      memcpy(m_data.data() + pos, &v, sizeof(v));
+    }
+
+    /// Checks that there is an open element that doesn't have contents yet
+    bool canWriteContent(const char * func)
+    {
+      if (m_stack.empty() || m_stack.back().contentWritten) {
+        Radiant::error("BinaryArchiveWriter::%s # No open element or the element already has contents or children", func);
+        m_error = true;
+        return false;
+      }
+      return true;
+    }
+
+    void ensureContent()
+    {
+      if (!m_stack.back().contentWritten) {
+        put8(CONTENT_NONE);
+        m_stack.back().contentWritten = true;
+      }
+    }
+
+  public:
+    std::vector<char> m_data;
+    QHash<QString, uint32_t> m_ids;
+    std::vector<QByteArray> m_strings;
+    std::vector<OpenElement> m_stack;
+    bool m_hasRoot;
+    bool m_error;
+  };
+
+  BinaryArchiveWriter::BinaryArchiveWriter()
+    : m_d(new D())
+  {
+  }
+
+  BinaryArchiveWriter::~BinaryArchiveWriter()
+  {
+  }
+
+  void BinaryArchiveWriter::beginElement(const QString & name)
+  {
+    if (m_d->m_stack.empty()) {
+      if (m_d->m_hasRoot) {
+        Radiant::error("BinaryArchiveWriter::beginElement # Archive can have only one root element");
+        m_d->m_error = true;
+        return;
+      }
+      m_d->m_hasRoot = true;
+    } else {
+      m_d->ensureContent();
+    }
+
+    m_d->m_stack.push_back({m_d->m_data.size(), 0, false});
+    m_d->put32(0);
+    m_d->put32(m_d->intern(name));
+    m_d->put32(0);
+  }
+
+  void BinaryArchiveWriter::addAttribute(const QString & name, const QString & value)
+  {
+    if (!m_d->canWriteContent("addAttribute"))
+      return;
+    m_d->put32(m_d->intern(name));
+    m_d->put32(m_d->intern(value));
+    ++m_d->m_stack.back().attributeCount;
+  }
+
+  void BinaryArchiveWriter::setContent(const QString & content)
+  {
+    if (!m_d->canWriteContent("setContent"))
+      return;
+    const QByteArray utf8 = content.toUtf8();
+    m_d->put8(CONTENT_STRING);
+    m_d->put32(utf8.size());
+    m_d->put(utf8.data(), utf8.size());
+    m_d->m_stack.back().contentWritten = true;
+  }
+
+  void BinaryArchiveWriter::setValues(ArchiveValueType type, const void * values, int count)
+  {
+    const int bytes = valueSize(type);
+    if (bytes == 0 || count < 0) {
+      Radiant::error("BinaryArchiveWriter::setValues # Invalid value type or count");
+      m_d->m_error = true;
+      return;
+    }
+    if (!m_d->canWriteContent("setValues"))
+      return;
+    m_d->put8(CONTENT_VALUES);
+    m_d->put8(static_cast<uint8_t>(type));
+    m_d->put32(count);
+    m_d->put(values, size_t(count) * bytes);
+    m_d->m_stack.back().contentWritten = true;
+  }
+
+  void BinaryArchiveWriter::endElement()
+  {
+    if (m_d->m_stack.empty()) {
+      Radiant::error("BinaryArchiveWriter::endElement # No open element");
+      m_d->m_error = true;
+      return;
+    }
+    m_d->ensureContent();
+    const D::OpenElement & e = m_d->m_stack.back();
+    m_d->patch32(e.start, static_cast<uint32_t>(m_d->m_data.size() - e.start - 4));
+    m_d->patch32(e.start + 8, e.attributeCount);
+    m_d->m_stack.pop_back();
+  }
+
+  QByteArray BinaryArchiveWriter::finish()
+  {
+    while (!m_d->m_stack.empty())
+      endElement();
+
+    const uint64_t tableOffset = m_d->m_data.size();
+    m_d->put32(static_cast<uint32_t>(m_d->m_strings.size()));
+    for (const QByteArray & str: m_d->m_strings) {
+      m_d->put32(str.size());
+      m_d->put(str.data(), str.size());
+    }
+
+    QByteArray out;
+    if (m_d->m_error || m_d->m_data.size() > std::numeric_limits<uint32_t>::max()) {
+      Radiant::error("BinaryArchiveWriter::finish # Failed to write the archive");
+    } else {
+      char * header = m_d->m_data.data();
+      memcpy(header, s_magic, sizeof(s_magic));
+      memcpy(header + 8, &s_version, sizeof(s_version));
+      memcpy(header + 16, &tableOffset, sizeof(tableOffset));
+      out = QByteArray(m_d->m_data.data(), static_cast<int>(m_d->m_data.size()));
+    }
+
+    m_d->reset();
+    return out;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  /// Element of BinaryArchive. Elements read from an archive are views to
+  /// the archive data until they are modified.
+  class BinaryArchiveElement : public ArchiveElementImpl
+  {
+  public:
+    /// Shared by all copies of the same element
+    struct Data
+    {
+      /// Archive data of the element, null if the element was created with
+      /// createElement or it was modified after reading
+      std::shared_ptr<const Buffer> buffer;
+      uint32_t offset = 0;
+
+      QString name;
+      std::vector<std::pair<QString, QString>> attributes;
+      ContentKind content = CONTENT_NONE;
+      QString text;
+      ArchiveValueType valueType = ArchiveValueType::INT32;
+      uint32_t valueCount = 0;
+      QByteArray values;
+      std::vector<std::shared_ptr<Data>> children;
+
+      /// Decodes the element from the archive data so that it can be modified
+      void detach();
+    };
+
+    class Iterator : public ArchiveIteratorImpl
+    {
+    public:
+      Iterator(std::shared_ptr<Data> data)
+        : m_data(std::move(data))
+      {
+        if (m_data->buffer) {
+          ElementView view = parseValid(*m_data->buffer, m_data->offset);
+          m_pos = view.children;
+          m_end = view.end;
+        } else {
+          m_end = static_cast<uint32_t>(m_data->children.size());
+        }
+      }
+
+      virtual std::shared_ptr<ArchiveElementImpl> get() const override
+      {
+        if (!isValid())
+          return nullptr;
+        if (m_data->buffer) {
+          auto child = std::make_shared<Data>();
+          child->buffer = m_data->buffer;
+          child->offset = m_pos;
+          return std::make_shared<BinaryArchiveElement>(std::move(child));
+        }
+        return std::make_shared<BinaryArchiveElement>(m_data->children[m_pos]);
+      }
+
+      virtual void next() override
+      {
+        if (!isValid())
+          return;
+        if (m_data->buffer)
+          m_pos += read32(m_data->buffer->data.constData() + m_pos) + 4;
+        else
+          ++m_pos;
+      }
+
+      virtual bool isValid() const override
+      {
+        return m_pos < m_end;
+      }
+
+      virtual bool operator == (const ArchiveIteratorImpl & other) const override
+      {
+        auto it = dynamic_cast<const Iterator *>(&other);
+        return it && it->m_data == m_data && it->m_pos == m_pos;
+      }
+
+    private:
+      std::shared_ptr<Data> m_data;
+      /// Offset of the current child in the archive data, or index in Data::children
+      uint32_t m_pos = 0;
+      uint32_t m_end = 0;
+    };
+
+    BinaryArchiveElement(std::shared_ptr<Data> data)
+      : m_data(std::move(data))
+    {}
+
+    virtual void add(ArchiveElementImpl & element) override
+    {
+      auto e = dynamic_cast<BinaryArchiveElement*>(&element);
+      if (!e)
+        return;
+      m_data->detach();
+      m_data->children.push_back(e->m_data);
+    }
+
+    virtual ArchiveIterator children() const override
+    {
+      return ArchiveIterator(std::make_shared<Iterator>(m_data));
+    }
+
+    virtual void add(const QString & name, const QString & value) override
+    {
+      m_data->detach();
+      for (auto & attr: m_data->attributes) {
+        if (attr.first == name) {
+          attr.second = value;
+          return;
+        }
+      }
+      m_data->attributes.emplace_back(name, value);
+    }
+
+    virtual QString get(const QString & name) const override
+    {
+      if (const Buffer * buffer = m_data->buffer.get()) {
+        auto it = buffer->ids.find(name);
+        if (it == buffer->ids.end())
+          return QString();
+        ElementView view = parseValid(*buffer, m_data->offset);
+        for (uint32_t i = 0; i < view.attributeCount; ++i) {
+          const char * attr = buffer->data.constData() + view.attributes + i * 8;
+          if (read32(attr) == *it)
+            return buffer->strings[read32(attr + 4)];
+        }
+        return QString();
+      }
+
+      for (auto & attr: m_data->attributes)
+        if (attr.first == name)
+          return attr.second;
+      return QString();
+    }
+
+    virtual void set(const QString & s) override
+    {
+      m_data->detach();
+      m_data->content = CONTENT_STRING;
+      m_data->text = s;
+      m_data->values.clear();
+      m_data->valueCount = 0;
+    }
+
+    virtual QString get() const override
+    {
+      if (const Buffer * buffer = m_data->buffer.get()) {
+        ElementView view = parseValid(*buffer, m_data->offset);
+        const char * content = buffer->data.constData() + view.contentOffset;
+        if (view.content == CONTENT_STRING)
+          return QString::fromUtf8(content, view.contentSize);
+        if (view.content == CONTENT_VALUES)
+          return formatValues(view.valueType, content, view.contentSize);
+        return QString();
+      }
+
+      if (m_data->content == CONTENT_VALUES)
+        return formatValues(m_data->valueType, m_data->values.constData(), m_data->valueCount);
+      return m_data->text;
+    }
+
+    virtual bool setValues(ArchiveValueType type, const void * values, int count) override
+    {
+      const int bytes = valueSize(type);
+      if (bytes == 0 || count < 0)
+        return false;
+      m_data->detach();
+      m_data->content = CONTENT_VALUES;
+      m_data->text.clear();
+      m_data->valueType = type;
+      m_data->valueCount = count;
+      m_data->values = QByteArray(static_cast<const char*>(values), count * bytes);
+      return true;
+    }
+
+    virtual bool getValues(ArchiveValueType type, void * values, int count) const override
+    {
+      if (const Buffer * buffer = m_data->buffer.get()) {
+        ElementView view = parseValid(*buffer, m_data->offset);
+        if (view.content != CONTENT_VALUES)
+          return false;
+        return convertValues(view.valueType, buffer->data.constData() + view.contentOffset,
+                             view.contentSize, type, values, count);
+      }
+
+      if (m_data->content != CONTENT_VALUES)
+        return false;
+      return convertValues(m_data->valueType, m_data->values.constData(), m_data->valueCount,
+                           type, values, count);
+    }
+
+    virtual QString name() const override
+    {
+      if (const Buffer * buffer = m_data->buffer.get())
+        return buffer->strings[parseValid(*buffer, m_data->offset).name];
+      return m_data->name;
+    }
+
+    virtual void setName(const QString & name) override
+    {
+      m_data->detach();
+      m_data->name = name;
+    }
+
+    const std::shared_ptr<Data> & data() const { return m_data; }
+
+  private:
+    std::shared_ptr<Data> m_data;
+  };
+
+  void BinaryArchiveElement::Data::detach()
+  {
+    if (!buffer)
+      return;
+
+    std::shared_ptr<const Buffer> b = std::move(buffer);
+    const char * ptr = b->data.constData();
+    ElementView view = parseValid(*b, offset);
+
+    name = b->strings[view.name];
+    attributes.reserve(view.attributeCount);
+    for (uint32_t i = 0; i < view.attributeCount; ++i) {
+      const char * attr = ptr + view.attributes + i * 8;
+      attributes.emplace_back(b->strings[read32(attr)], b->strings[read32(attr + 4)]);
+    }
+
+    content = view.content;
+    if (content == CONTENT_STRING) {
+      text = QString::fromUtf8(ptr + view.contentOffset, view.contentSize);
+    } else if (content == CONTENT_VALUES) {
+      valueType = view.valueType;
+      valueCount = view.contentSize;
+      values = QByteArray(ptr + view.contentOffset, view.contentSize * valueSize(valueType));
+    }
+
+    // Children stay as views to the archive data
+    for (uint32_t pos = view.children; pos < view.end; pos += read32(ptr + pos) + 4) {
+      auto child = std::make_shared<Data>();
+      child->buffer = b;
+      child->offset = pos;
+      children.push_back(std::move(child));
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////
+
+  class BinaryArchive::D
+  {
+  public:
+    static void write(BinaryArchiveWriter & writer, const Buffer & buffer, uint32_t offset);
+    static void write(BinaryArchiveWriter & writer, const BinaryArchiveElement::Data & data);
+
+  public:
+    std::shared_ptr<BinaryArchiveElement::Data> m_root;
+  };
+
+  void BinaryArchive::D::write(BinaryArchiveWriter & writer, const Buffer & buffer, uint32_t offset)
+  {
+    const char * ptr = buffer.data.constData();
+    ElementView view = parseValid(buffer, offset);
+
+    writer.beginElement(buffer.strings[view.name]);
+    for (uint32_t i = 0; i < view.attributeCount; ++i) {
+      const char * attr = ptr + view.attributes + i * 8;
+      writer.addAttribute(buffer.strings[read32(attr)], buffer.strings[read32(attr + 4)]);
+    }
+    if (view.content == CONTENT_STRING)
+      writer.setContent(QString::fromUtf8(ptr + view.contentOffset, view.contentSize));
+    else if (view.content == CONTENT_VALUES)
+      writer.setValues(view.valueType, ptr + view.contentOffset, view.contentSize);
+
+    for (uint32_t pos = view.children; pos < view.end; pos += read32(ptr + pos) + 4)
+      write(writer, buffer, pos);
+    writer.endElement();
+  }
+
+  void BinaryArchive::D::write(BinaryArchiveWriter & writer, const BinaryArchiveElement::Data & data)
+  {
+    if (data.buffer) {
+      write(writer, *data.buffer, data.offset);
+      return;
+    }
+
+    writer.beginElement(data.name);
+    for (auto & attr: data.attributes)
+      writer.addAttribute(attr.first, attr.second);
+    if (data.content == CONTENT_STRING)
+      writer.setContent(data.text);
+    else if (data.content == CONTENT_VALUES)
+      writer.setValues(data.valueType, data.values.constData(), data.valueCount);
+
+    for (auto & child: data.children)
+      write(writer, *child);
+    writer.endElement();
+  }
+
+  BinaryArchive::BinaryArchive(unsigned int options)
+    : Archive(options)
+    , m_d(new D())
+  {
+  }
+
+  BinaryArchive::~BinaryArchive()
+  {
+  }
+
+  ArchiveElement BinaryArchive::createElement(const QString & name)
+  {
+    auto data = std::make_shared<BinaryArchiveElement::Data>();
+    data->name = name;
+    return ArchiveElement(std::make_shared<BinaryArchiveElement>(std::move(data)));
+  }
+
+  ArchiveElement BinaryArchive::root() const
+  {
+    if (!m_d->m_root)
+      return ArchiveElement();
+    return ArchiveElement(std::make_shared<BinaryArchiveElement>(m_d->m_root));
+  }
+
+  void BinaryArchive::setRoot(const ArchiveElement & element)
+  {
+    auto e = dynamic_cast<BinaryArchiveElement*>(element.m_impl.get());
+    assert(e || element.isNull());
+    m_d->m_root = e ? e->data() : nullptr;
+  }
+
+  bool BinaryArchive::writeToFile(const QString & filename) const
+  {
+    QByteArray buffer;
+    if (!writeToMem(buffer))
+      return false;
+
+    QFile file(filename);
+    if (!file.open(QFile::WriteOnly) || file.write(buffer) != buffer.size()) {
+      Radiant::error("BinaryArchive::writeToFile # Failed to write %s: %s", filename.toUtf8().data(),
+                     file.errorString().toUtf8().data());
+      return false;
+    }
+    return true;
+  }
+
+  bool BinaryArchive::writeToMem(QByteArray & buffer) const
+  {
+    BinaryArchiveWriter writer;
+    if (m_d->m_root)
+      D::write(writer, *m_d->m_root);
+    buffer = writer.finish();
+    return !buffer.isEmpty();
+  }
+
+  bool BinaryArchive::readFromFile(const QString & filename)
+  {
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly)) {
+      Radiant::error("BinaryArchive::readFromFile # Failed to open %s: %s", filename.toUtf8().data(),
+                     file.errorString().toUtf8().data());
+      return false;
+    }
+    return readFromMem(file.readAll());
+  }
+
+  bool BinaryArchive::readFromMem(const QByteArray & data)
+  {
+    m_d->m_root.reset();
+
+    if (!isBinaryArchive(data)) {
+      Radiant::error("BinaryArchive::readFromMem # Invalid archive header");
+      return false;
+    }
+
+    auto buffer = std::make_shared<Buffer>();
+    buffer->data = data;
+    const char * ptr = data.constData();
+    const uint64_t size = data.size();
+
+    uint64_t tableOffset;
+    memcpy(&tableOffset, ptr + 16, sizeof(tableOffset));
+    if (tableOffset < s_headerSize || tableOffset > size || size - tableOffset < 4) {
+      Radiant::error("BinaryArchive::readFromMem # Invalid string table offset");
+      return false;
+    }
+
+    uint64_t pos = tableOffset;
+    const uint32_t count = read32(ptr + pos);
+    pos += 4;
+    // Every string needs at least four bytes
+    if (count > (size - pos) / 4) {
+      Radiant::error("BinaryArchive::readFromMem # Invalid string table");
+      return false;
+    }
+    buffer->strings.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (pos + 4 > size) {
+        Radiant::error("BinaryArchive::readFromMem # Invalid string table");
+        return false;
+      }
+      const uint32_t bytes = read32(ptr + pos);
+      pos += 4;
+      if (pos + bytes > size) {
+        Radiant::error("BinaryArchive::readFromMem # Invalid string table");
+        return false;
+      }
+      buffer->strings.push_back(QString::fromUtf8(ptr + pos, bytes));
+      buffer->ids.insert(buffer->strings.back(), i);
+      pos += bytes;
+    }
+
+    if (tableOffset > s_headerSize) {
+      if (!validateElement(*buffer, s_headerSize, static_cast<uint32_t>(tableOffset), 0) ||
+          read32(ptr + s_headerSize) + uint64_t(s_headerSize) + 4 != tableOffset) {
+        Radiant::error("BinaryArchive::readFromMem # Archive data is corrupted");
+        return false;
+      }
+      m_d->m_root = std::make_shared<BinaryArchiveElement::Data>();
+      m_d->m_root->offset = s_headerSize;
+      m_d->m_root->buffer = std::move(buffer);
+    }
+    return true;
+  }
+
+  bool BinaryArchive::isBinaryArchive(const QByteArray & buffer)
+  {
+    if (buffer.size() < static_cast<int>(s_headerSize) ||
+        memcmp(buffer.constData(), s_magic, sizeof(s_magic)) != 0)
+      return false;
+    uint32_t version = read32(buffer.constData() + 8);
+    return version == s_version;
+  }
+}
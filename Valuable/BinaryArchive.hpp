@@ -0,0 +1,115 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Archive.hpp"
+#include "Export.hpp"
+
+#include <Patterns/NotCopyable.hpp>
+
+#include <QByteArray>
+#include <QString>
+
+#include <memory>
+
+namespace Valuable
+{
+  /// Streaming writer for the binary archive format.
+  ///
+  /// Elements are written directly to a byte buffer in document order, so
+  /// large object trees can be written without building any intermediate
+  /// tree. Element and attribute names and attribute values are interned to
+  /// a string table that is written once at the end of the archive. Element
+  /// contents can be strings or arrays of native numbers.
+  ///
+  /// For every element, attributes need to be written before the contents,
+  /// and the contents before the child elements.
+  ///
+  /// @code
+  /// Valuable::BinaryArchiveWriter writer;
+  /// writer.beginElement("node");
+  /// writer.addAttribute("type", "float");
+  /// writer.setValues(Valuable::ArchiveValueType::FLOAT, &value, 1);
+  /// writer.endElement();
+  /// QByteArray data = writer.finish();
+  /// @endcode
+  class VALUABLE_API BinaryArchiveWriter : public Patterns::NotCopyable
+  {
+  public:
+    BinaryArchiveWriter();
+    ~BinaryArchiveWriter();
+
+    /// Starts a new element. If there is an open element, the new element
+    /// is its child, otherwise it is the root element. There can be only
+    /// one root element.
+    void beginElement(const QString & name);
+    /// Adds an attribute to the open element
+    void addAttribute(const QString & name, const QString & value);
+    /// Sets the contents of the open element
+    void setContent(const QString & content);
+    /// Sets the contents of the open element as an array of numbers
+    void setValues(ArchiveValueType type, const void * values, int count);
+    /// Closes the open element
+    void endElement();
+
+    /// Closes all open elements and writes the string table.
+    /// @return archive data, or empty buffer if there was an error. The
+    ///         writer can be used again for a new archive after this.
+    QByteArray finish();
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+
+  /**
+   * Compact binary implementation of the Archive interface.
+   *
+   * Element names and attributes are interned and numeric element contents
+   * written with ArchiveElement::setValues are stored natively, so
+   * scalars, Nimble vectors and colors are not converted to strings.
+   *
+   * Reading doesn't build a tree. readFromMem and readFromFile validate the
+   * data and keep it as is, and elements are lightweight views to the data
+   * that decode names, attributes and contents only when they are accessed.
+   * Iterating children skips over the grandchildren without decoding them.
+   *
+   * Elements read from an archive can still be modified. Only the modified
+   * element is decoded, its children stay as views to the original data.
+   *
+   * Archives are written in the host byte order and can't be read on
+   * machines with different byte order.
+   */
+  class VALUABLE_API BinaryArchive : public Archive
+  {
+  public:
+    /// @param options Bitmask of SerializationOptions::Options
+    BinaryArchive(unsigned int options = DEFAULTS);
+    virtual ~BinaryArchive();
+
+    virtual ArchiveElement createElement(const QString & name) override;
+
+    virtual ArchiveElement root() const override;
+    virtual void setRoot(const ArchiveElement & element) override;
+
+    virtual bool writeToFile(const QString & filename) const override;
+    virtual bool writeToMem(QByteArray & buffer) const override;
+    virtual bool readFromFile(const QString & filename) override;
+    virtual bool readFromMem(const QByteArray & buffer) override;
+
+    /// Checks if the buffer starts with the binary archive header
+    static bool isBinaryArchive(const QByteArray & buffer);
+
+  private:
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}
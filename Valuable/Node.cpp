@@ -8,6 +8,7 @@
  * 
  */
 
+#include <Valuable/BinaryArchive.hpp>
 #include <Valuable/DOMDocument.hpp>
 #include <Valuable/DOMElement.hpp>
 #include <Valuable/Valuable.hpp>
@@ -29,6 +30,15 @@
 
 namespace
 {
+  /// Child node that Node::applyChanges created for a node that was added
+  /// on the sending side. Owned by its host and deleted when a later patch
+  /// removes it.
+  class PatchNode : public Valuable::Node
+  {
+  public:
+    using Node::Node;
+  };
+
   struct QueueItem
   {
     QueueItem(Valuable::Node * sender_, Valuable::Node * target_,
@@ -357,7 +367,8 @@ namespace Valuable
     /// optimize the insertion by adding the new attribute directly to the
     /// implementation vector. This is safe, since we just checked that it
     /// doesn't already exist.
-    m_attributes.vector().emplace_back(std::make_pair(cname, attribute));
+    m_attributes.vector().emplace_back(std::make_pair(attribute->name(), attribute));
+    m_structureGeneration = nextGeneration();
 #ifdef ENABLE_THREAD_CHECKS
     attribute->setOwnerThread(m_ownerThread);
 #endif
@@ -375,6 +386,7 @@ namespace Valuable
     for (auto it = m_attributes.begin(), end = m_attributes.end(); it != end; ++it) {
       if (it->second == attribute) {
         m_attributes.erase(it);
+        m_structureGeneration = nextGeneration();
 #ifdef ENABLE_THREAD_CHECKS
         attribute->setOwnerThread(nullptr);
 #endif
@@ -455,6 +467,46 @@ namespace Valuable
     return deserialize(archive.root());
   }
 
+  bool Node::saveToFileBinary(const QString & filename, unsigned int opts) const
+  {
+    BinaryArchive archive(opts);
+    archive.setRoot(serialize(archive));
+
+    bool ok = archive.writeToFile(filename);
+    if (!ok) {
+      Radiant::error("Node::saveToFileBinary # object failed to serialize (%s)", filename.toUtf8().data());
+    }
+    return ok;
+  }
+
+  bool Node::saveToMemoryBinary(QByteArray & buffer, unsigned int opts) const
+  {
+    BinaryArchive archive(opts);
+    archive.setRoot(serialize(archive));
+
+    return archive.writeToMem(buffer);
+  }
+
+  bool Node::loadFromFileBinary(const QString & filename)
+  {
+    BinaryArchive archive;
+
+    if(!archive.readFromFile(filename) || archive.root().isNull())
+      return false;
+
+    return deserialize(archive.root());
+  }
+
+  bool Node::loadFromMemoryBinary(const QByteArray & buffer)
+  {
+    BinaryArchive archive;
+
+    if(!archive.readFromMem(buffer) || archive.root().isNull())
+      return false;
+
+    return deserialize(archive.root());
+  }
+
   ArchiveElement Node::serialize(Archive & archive) const
   {
     REQUIRE_THREAD(m_ownerThread);
@@ -503,7 +555,7 @@ namespace Valuable
       // If the attribute exists, just deserialize it. Otherwise, pass the element
       // to readElement()
       if(a) {
-        if(!a->deserialize(elem)) {
+        if(!deserializeAttribute(*a, elem)) {
           Radiant::error("Node::deserialize # (%s) deserialize failed for element '%s'",
                          typeid(*this).name(), name.data());
           allChildrenOk = false;
@@ -521,6 +573,148 @@ namespace Valuable
     return allChildrenOk;
   }
 
+  ArchiveElement Node::serializeChanges(Archive & archive, uint64_t sinceGeneration) const
+  {
+    REQUIRE_THREAD(m_ownerThread);
+    // If attributes have been added, removed or renamed, write everything
+    // and list the attributes, so that the receiver can remove the ones
+    // that are not in the list
+    const bool complete = sinceGeneration == 0 || m_structureGeneration > sinceGeneration;
+
+    int clearedLayers = 0;
+    for (int layer = STYLE; layer < LAYER_COUNT; ++layer)
+      if (archive.checkFlags(SerializationOptions::Options(1 << layer)))
+        clearedLayers |= 1 << layer;
+
+    ArchiveElement elem;
+    auto createElement = [&] {
+      elem = archive.createElement(m_name.isEmpty() ? QByteArray("Node") : m_name);
+      if (elem.isNull()) {
+        Radiant::error("Node::serializeChanges # failed to create element");
+        return false;
+      }
+      if (QByteArray t = type(); !t.isEmpty())
+        elem.add("type", t);
+      return true;
+    };
+
+    QByteArray names;
+    if (complete && !createElement())
+      return ArchiveElement();
+
+    for(container::const_iterator it = m_attributes.begin(); it != m_attributes.end(); ++it) {
+      Attribute * vo = it->second;
+
+      if (!vo->isSerializable())
+        continue;
+
+      // Names are separated by spaces, they are not allowed in element names
+      if (complete) {
+        if (!names.isEmpty())
+          names += ' ';
+        names += it->first;
+      }
+
+      ArchiveElement child;
+      if (Node * node = dynamic_cast<Node*>(vo)) {
+        // Child nodes of a complete element are written in full as well, in
+        // case the receiver doesn't have them yet
+        child = node->serializeChanges(archive, complete ? 0 : sinceGeneration);
+      } else if (complete || vo->changeGeneration() > sinceGeneration) {
+        child = vo->serialize(archive);
+        if (child.isNull() && clearedLayers && vo->changeGeneration() > sinceGeneration) {
+          // The attribute has no value on any of the serialized layers
+          // anymore, tell the receiver to clear those layers
+          child = archive.createElement(vo->name());
+          child.add("cleared-layers", QString::number(clearedLayers));
+        }
+      }
+
+      if (child.isNull())
+        continue;
+
+      if (elem.isNull() && !createElement())
+        return ArchiveElement();
+      elem.add(child);
+    }
+
+    if (complete) {
+      elem.add("complete", "1");
+      elem.add("attributes", names);
+    }
+
+    return elem;
+  }
+
+  bool Node::applyChanges(const ArchiveElement & patch)
+  {
+    REQUIRE_THREAD(m_ownerThread);
+
+    bool allChildrenOk = true;
+    for(ArchiveElement::Iterator it = patch.children(); it; ++it) {
+      ArchiveElement elem = *it;
+
+      QByteArray name = elem.name().toUtf8();
+
+      Attribute * a = attribute(name);
+      bool ok;
+      if (!a) {
+        ok = readElement(elem);
+        // Child node that was added on the sending side. New child nodes
+        // are always written as complete elements.
+        if (!ok && !elem.get("complete").isEmpty()) {
+          Node * node = new PatchNode(this, name);
+          ok = node->applyChanges(elem);
+        }
+      } else if (Node * node = dynamic_cast<Node*>(a)) {
+        ok = node->applyChanges(elem);
+      } else {
+        ok = deserializeAttribute(*a, elem);
+      }
+
+      if (!ok) {
+        Radiant::error("Node::applyChanges # (%s) failed to apply element '%s'",
+                       typeid(*this).name(), name.data());
+        allChildrenOk = false;
+      }
+    }
+
+    if (!patch.get("complete").isEmpty()) {
+      std::set<QByteArray> included;
+      for (const QString & name: patch.get("attributes").split(' ', QString::SkipEmptyParts))
+        included.insert(name.toUtf8());
+
+      // Attributes that were removed on the sending side
+      std::vector<Attribute*> removed;
+      for (auto it = m_attributes.begin(); it != m_attributes.end(); ++it)
+        if (it->second->isSerializable() && included.count(it->first) == 0)
+          removed.push_back(it->second);
+
+      for (Attribute * a: removed) {
+        if (dynamic_cast<PatchNode*>(a))
+          delete a;
+        else
+          removeAttribute(a);
+      }
+    }
+
+    return allChildrenOk;
+  }
+
+  bool Node::deserializeAttribute(Attribute & attribute, const ArchiveElement & element)
+  {
+    const QString cleared = element.get("cleared-layers");
+    if (cleared.isEmpty())
+      return attribute.deserialize(element);
+
+    bool ok = false;
+    const int layers = cleared.toInt(&ok);
+    for (int layer = STYLE; ok && layer < LAYER_COUNT; ++layer)
+      if ((layers & (1 << layer)) && attribute.isValueDefinedOnLayer(Layer(layer)))
+        attribute.clearValue(Layer(layer));
+    return ok;
+  }
+
   void Node::debugDump() {
     Radiant::debug("%s {", m_name.data());
 
@@ -1043,6 +1237,7 @@ namespace Valuable
     Attribute * vo = (*it).second;
     m_attributes.erase(it);
     m_attributes[now] = vo;
+    m_structureGeneration = nextGeneration();
   }
 
 
@@ -1088,6 +1283,24 @@ namespace Valuable
     return false;
   }
 
+  void Node::collectMemoryUsage(AttributeMemoryUsage & usage) const
+  {
+    Attribute::collectMemoryUsage(usage);
+    // m_id is counted below with the other attributes
+    usage.bytes += sizeof(Node) - sizeof(Attribute) - sizeof(m_id);
+    usage.bytes += m_attributes.vector().capacity() * sizeof(container::value_type);
+    for (auto i = m_attributes.begin(); i != m_attributes.end(); ++i)
+      i->second->collectMemoryUsage(usage);
+  }
+
+  AttributeMemoryUsage Node::memoryUsage() const
+  {
+    REQUIRE_THREAD(m_ownerThread);
+    AttributeMemoryUsage usage;
+    collectMemoryUsage(usage);
+    return usage;
+  }
+
   void Node::eventAddDeprecated(const QByteArray &deprecatedId, const QByteArray &newId)
   {
     m_deprecatedEventCompatibility[deprecatedId] = newId;
@@ -1134,9 +1347,12 @@ namespace Valuable
     }
 
     Q_FOREACH(Attribute* vo, m_attributeListening) {
-      for(QMap<long, AttributeListener>::iterator it = vo->m_listeners.begin(); it != vo->m_listeners.end(); ) {
+      if (!vo->m_listeners)
+        continue;
+      QMap<long, AttributeListener> & map = vo->m_listeners->map;
+      for(QMap<long, AttributeListener>::iterator it = map.begin(); it != map.end(); ) {
         if(it->listener == this) {
-          it = vo->m_listeners.erase(it);
+          it = map.erase(it);
         } else ++it;
       }
     }
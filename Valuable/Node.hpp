@@ -216,11 +216,54 @@ namespace Valuable
     /// Reads this object (and its children) from a memory buffer
     bool loadFromMemoryXML(const QByteArray & buffer);
 
+    /// Saves this object (and its children) to a file using BinaryArchive
+    bool saveToFileBinary(const QString & filename, unsigned int opts = SerializationOptions::DEFAULTS) const;
+    /// Saves this object (and its children) to a memory buffer using BinaryArchive
+    bool saveToMemoryBinary(QByteArray & buffer, unsigned int opts = SerializationOptions::DEFAULTS) const;
+
+    /// Reads this object (and its children) from a file written with saveToFileBinary
+    bool loadFromFileBinary(const QString & filename);
+    /// Reads this object (and its children) from a memory buffer written with saveToMemoryBinary
+    bool loadFromMemoryBinary(const QByteArray & buffer);
+
     /// Serializes this object (and its children) to a DOM node
     virtual ArchiveElement serialize(Archive &doc) const OVERRIDE;
     /// De-serializes this object (and its children) from a DOM node
     virtual bool deserialize(const ArchiveElement & element) OVERRIDE;
 
+    /// Serializes only the attributes that have changed after the given
+    /// generation, see Attribute::currentGeneration. Child nodes that have
+    /// no changes are skipped and child nodes with changes are serialized
+    /// recursively the same way.
+    ///
+    /// If attributes of a node have been added, removed or renamed after the
+    /// generation, or the generation is zero, the node is written in full as
+    /// a complete element. Its "attributes" attribute lists the names of all
+    /// serializable attributes, so that the receiver can remove the ones
+    /// that are not in the list.
+    ///
+    /// Attributes that have no value on any of the serialized layers
+    /// anymore are written as empty elements with a "cleared-layers"
+    /// attribute, so that the receiving side can clear them.
+    /// @param archive archive used to create the elements
+    /// @param sinceGeneration generation of the previous save
+    /// @returns patch element or null element if nothing has changed
+    virtual ArchiveElement serializeChanges(Archive & archive, uint64_t sinceGeneration) const;
+    /// Applies a patch written with serializeChanges. Attributes that are
+    /// not included in the patch are not modified. If the patch is a
+    /// complete element, serializable attributes that are not listed in it
+    /// are removed from this node with removeAttribute.
+    ///
+    /// Elements for attributes that don't exist are given to readElement.
+    /// If readElement doesn't handle a new child node, a plain Node is
+    /// created for it, and deleted again when a later patch removes it.
+    /// @param patch patch element
+    /// @returns true if all elements in the patch were applied
+    virtual bool applyChanges(const ArchiveElement & patch);
+    /// @returns the generation of the latest time an attribute was added to,
+    ///          removed from or renamed in this node
+    uint64_t structureGeneration() const { return m_structureGeneration; }
+
     /// Handles a serialization element that lacks automatic handlers.
     /// @param element The element to be deserialized
     /// @return true on success
@@ -473,6 +516,14 @@ namespace Valuable
 
     virtual bool isChanged() const OVERRIDE;
 
+    virtual void collectMemoryUsage(AttributeMemoryUsage & usage) const override;
+
+    /// Reports the approximate memory used by this node and all its
+    /// attributes, including nested nodes. Can be used to find out which
+    /// parts of a large scene use the most memory for attribute storage.
+    /// @returns memory usage of the node and its attributes
+    AttributeMemoryUsage memoryUsage() const;
+
     /// Sends an event and bd to all listeners on this eventId
     void eventSend(const QByteArray & eventId, Radiant::BinaryData & bd);
     /// Sends an event to all listeners on this eventId
@@ -601,6 +652,10 @@ namespace Valuable
     /// listeners from this object, they are removed in the Node destructor.
     void internalRemoveListeners();
 
+    /// Deserializes an attribute, or clears its layers if the element was
+    /// written for a cleared value by serializeChanges
+    static bool deserializeAttribute(Attribute & attribute, const ArchiveElement & element);
+
   private:
 
     Node * m_sender;
@@ -610,6 +665,7 @@ namespace Valuable
     void attributeRenamed(const QByteArray & was, const QByteArray & now);
 
     container m_attributes;
+    uint64_t m_structureGeneration = 0;
 
     class ValuePass {
     public:
@@ -22,8 +22,21 @@
 #include <QMap>
 #include <QStringList>
 
+#include <type_traits>
 #include <typeinfo>
 
+namespace Nimble
+{
+  template <class T> class Vector2T;
+  template <class T> class Vector3T;
+  template <class T> class Vector4T;
+}
+
+namespace Radiant
+{
+  template <typename Self> class ColorBase;
+}
+
 namespace Valuable
 {
   class Serializable;
@@ -168,6 +181,83 @@ namespace Valuable
 
     /// @cond
 
+    /// NativeScalar<T>::type is the ArchiveValueType of T, if T can be
+    /// stored in archives without converting it to a string
+    template <typename T, typename Enable = void>
+    struct NativeScalar
+    {
+      static const bool valid = false;
+    };
+
+    template <typename T>
+    struct NativeScalar<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value &&
+                                                   (sizeof(T) == 4 || sizeof(T) == 8)>::type>
+    {
+      static const bool valid = true;
+      static const ArchiveValueType type = sizeof(T) == 4 ? ArchiveValueType::INT32 : ArchiveValueType::INT64;
+    };
+
+    template <>
+    struct NativeScalar<float>
+    {
+      static const bool valid = true;
+      static const ArchiveValueType type = ArchiveValueType::FLOAT;
+    };
+
+    template <>
+    struct NativeScalar<double>
+    {
+      static const bool valid = true;
+      static const ArchiveValueType type = ArchiveValueType::DOUBLE;
+    };
+
+    /// NativeValue<T> writes and reads scalars, Nimble vectors and colors
+    /// with ArchiveElement::setValues and getValues. Archives that don't
+    /// support native values use strings as before.
+    template <typename T, typename Enable = void>
+    struct NativeValue
+    {
+      static const int count = 0;
+      inline static bool write(ArchiveElement &, const T &) { return false; }
+      inline static bool read(const ArchiveElement &, T &) { return false; }
+    };
+
+    template <typename T, typename Scalar, int Count>
+    struct NativeArray
+    {
+      static const int count = Count;
+      inline static bool write(ArchiveElement & e, const T & t)
+      {
+        return e.setValues(NativeScalar<Scalar>::type, data(t), count);
+      }
+      inline static bool read(const ArchiveElement & e, T & t)
+      {
+        return e.getValues(NativeScalar<Scalar>::type, data(t), count);
+      }
+      inline static const Scalar * data(const T & t) { return reinterpret_cast<const Scalar*>(&t); }
+      inline static Scalar * data(T & t) { return reinterpret_cast<Scalar*>(&t); }
+    };
+
+    template <typename T>
+    struct NativeValue<T, typename std::enable_if<NativeScalar<T>::valid>::type>
+      : public NativeArray<T, T, 1> {};
+
+    template <typename T>
+    struct NativeValue<Nimble::Vector2T<T>, typename std::enable_if<NativeScalar<T>::valid>::type>
+      : public NativeArray<Nimble::Vector2T<T>, T, 2> {};
+
+    template <typename T>
+    struct NativeValue<Nimble::Vector3T<T>, typename std::enable_if<NativeScalar<T>::valid>::type>
+      : public NativeArray<Nimble::Vector3T<T>, T, 3> {};
+
+    template <typename T>
+    struct NativeValue<Nimble::Vector4T<T>, typename std::enable_if<NativeScalar<T>::valid>::type>
+      : public NativeArray<Nimble::Vector4T<T>, T, 4> {};
+
+    template <typename T>
+    struct NativeValue<T, typename std::enable_if<std::is_base_of<Radiant::ColorBase<T>, T>::value>::type>
+      : public NativeArray<T, float, 4> {};
+
     /// Default implementation for "other" types.
     /// Implementations need to be inside of a struct because of partial template specialization
     template <typename T, int type_id = Trait<T>::type>
@@ -176,13 +266,20 @@ namespace Valuable
       inline static ArchiveElement serialize(Archive &archive, const T & t)
       {
         ArchiveElement elem = archive.createElement(tagName<T>());
-        elem.set(Radiant::StringUtils::toString(t));
+        if (!NativeValue<T>::write(elem, t))
+          elem.set(Radiant::StringUtils::toString(t));
         return elem;
       }
 
       inline static typename std::remove_cv<T>::type deserialize(const ArchiveElement & element)
       {
-        return Radiant::StringUtils::fromString<typename std::remove_cv<T>::type>(element.get().toUtf8());
+        typedef typename std::remove_cv<T>::type V;
+        if constexpr (NativeValue<V>::count > 0) {
+          V v;
+          if (NativeValue<V>::read(element, v))
+            return v;
+        }
+        return Radiant::StringUtils::fromString<V>(element.get().toUtf8());
       }
     };
 
@@ -52,6 +52,7 @@ HEADERS += AttributeString.hpp
 HEADERS += AttributeVector.hpp
 HEADERS += AttributeGrid.hpp
 HEADERS += XMLArchive.hpp
+HEADERS += BinaryArchive.hpp
 HEADERS += State.hpp
 HEADERS += ListenerHolder.hpp
 HEADERS += AttributeSpline.hpp
@@ -86,6 +87,7 @@ SOURCES += AttributeBool.cpp
 SOURCES += Attribute.cpp
 SOURCES += AttributeString.cpp
 SOURCES += XMLArchive.cpp
+SOURCES += BinaryArchive.cpp
 SOURCES += State.cpp
 SOURCES += ListenerHolder.cpp
 SOURCES += AttributeSpline.cpp
@@ -14,9 +14,11 @@
 #include "FfmpegDecoder.hpp"
 #include "DummyDecoder.hpp"
 
+#include <Radiant/BGThread.hpp>
 #include <Radiant/Timer.hpp>
 
 #include <QFileInfo>
+#include <QThread>
 
 namespace VideoDisplay
 {
@@ -39,6 +41,9 @@ namespace VideoDisplay
   public:
     AVDecoder::DecoderState m_state;
     AVDecoderPtr m_previousDecoder;
+
+    mutable Radiant::Mutex m_presentationHintMutex;
+    AVDecoder::PresentationHint m_presentationHint;
   };
 
   AVDecoder::D::D()
@@ -121,6 +126,42 @@ namespace VideoDisplay
     return false;
   }
 
+  void AVDecoder::setVisibilityHint(bool visible)
+  {
+    PresentationHint hint = presentationHint();
+    if (hint.visible != visible) {
+      hint.visible = visible;
+      setPresentationHint(hint);
+    }
+  }
+
+  void AVDecoder::setPresentationHint(const PresentationHint & hint)
+  {
+    Radiant::Guard g(m_d->m_presentationHintMutex);
+    m_d->m_presentationHint = hint;
+  }
+
+  AVDecoder::PresentationHint AVDecoder::presentationHint() const
+  {
+    Radiant::Guard g(m_d->m_presentationHintMutex);
+    return m_d->m_presentationHint;
+  }
+
+  std::shared_ptr<Radiant::BGThread> AVDecoder::decoderThreadPool()
+  {
+    static Radiant::Mutex s_poolMutex;
+    static std::weak_ptr<Radiant::BGThread> s_pool;
+
+    Radiant::Guard g(s_poolMutex);
+    auto pool = s_pool.lock();
+    if (!pool) {
+      pool = std::make_shared<Radiant::BGThread>("Decoder");
+      pool->run(std::max(1, QThread::idealThreadCount()));
+      s_pool = pool;
+    }
+    return pool;
+  }
+
   void AVDecoder::setPreviousDecoder(AVDecoderPtr decoder)
   {
     m_d->m_previousDecoder = decoder;
@@ -202,4 +243,11 @@ namespace VideoDisplay
         maxResolution == o.maxResolution &&
         preferUncompressedStream == o.preferUncompressedStream;
   }
+
+  bool AVDecoder::PresentationHint::operator==(const AVDecoder::PresentationHint & o) const
+  {
+    return visible == o.visible &&
+        targetSize == o.targetSize &&
+        importance == o.importance;
+  }
 }
@@ -33,6 +33,11 @@
 #include <cassert>
 #include <memory>
 
+namespace Radiant
+{
+  class BGThread;
+}
+
 /** VideoDisplay is a video player library.
 
   \b Copyright: All rights reserved, MultiTouch Oy. You may use this
@@ -403,6 +408,28 @@ namespace VideoDisplay
       inline bool operator!=(const VideoStreamHints & o) const { return !operator==(o); }
     };
 
+    /// Hint from the renderer about how the decoded video is presented.
+    /// Decoders can use this to spend less time on videos that are not
+    /// visible or are shown much smaller than their native resolution.
+    /// @sa setPresentationHint
+    struct PresentationHint
+    {
+      /// Is any part of the video visible on the screen
+      bool visible = true;
+
+      /// Approximate size of the video on the screen in pixels. Empty
+      /// size means unknown, the video is then decoded at full quality.
+      Nimble::SizeI targetSize;
+
+      /// Relative importance of the video compared to the other videos
+      /// in the range 0..1. Less important videos are decoded with lower
+      /// priority when the decoders share a thread pool.
+      float importance = 1.0f;
+
+      VIDEODISPLAY_API bool operator==(const PresentationHint & o) const;
+      inline bool operator!=(const PresentationHint & o) const { return !operator==(o); }
+    };
+
     /// Video and audio parameters for AVDecoder when opening a new media file.
     class Options
     {
@@ -420,6 +447,8 @@ namespace VideoDisplay
         , m_videoBufferFrames(10)
         , m_pixelFormat(VideoFrame::UNKNOWN)
         , m_videoDecodingThreads(2)
+        , m_pooledDecoding(false)
+        , m_keyframeScrubbing(true)
       {}
 
     public:
@@ -698,6 +727,27 @@ namespace VideoDisplay
       int videoDecodingThreads() const { return m_videoDecodingThreads; }
       void setVideoDecodingThreads(int t) { m_videoDecodingThreads = t; }
 
+      /// Run the decoding loop as a job in the shared decoderThreadPool()
+      /// instead of a dedicated thread per decoder. The job only runs when
+      /// there is space in the decoded frame buffers or there is a new seek
+      /// request, and jobs are prioritized by visibility and by how soon
+      /// their buffers would run empty. Use this when playing lots of videos
+      /// at the same time. The source is still opened in a separate thread,
+      /// since opening network streams can block for a long time.
+      /// Disabled by default.
+      bool isPooledDecoding() const { return m_pooledDecoding; }
+      void setPooledDecoding(bool pooled) { m_pooledDecoding = pooled; }
+
+      /// Decode only keyframes during real-time seeking. The keyframe
+      /// positions of local video files are indexed once and stored to the
+      /// disk cache, so that the decoder can seek directly to the keyframe
+      /// closest to the scrub position and reuse the previous frame if it
+      /// doesn't change. The exact position is decoded once the user stops
+      /// dragging, or when real-time seeking is disabled.
+      /// Enabled by default.
+      bool isKeyframeScrubbing() const { return m_keyframeScrubbing; }
+      void setKeyframeScrubbing(bool enabled) { m_keyframeScrubbing = enabled; }
+
       /// Name of the video decoder backend. Leave empty for automatic selection
       QString decoderBackend() const { return m_decoderBackend; }
       void setDecoderBackend(const QString & backendName) { m_decoderBackend = backendName; }
@@ -730,6 +780,8 @@ namespace VideoDisplay
       int m_videoBufferFrames;
       VideoFrame::Format m_pixelFormat;
       int m_videoDecodingThreads;
+      bool m_pooledDecoding;
+      bool m_keyframeScrubbing;
       QString m_decoderBackend;
       VideoStreamHints m_videoStreamHints;
       std::shared_ptr<AVSync> m_sync;
@@ -846,6 +898,36 @@ namespace VideoDisplay
     /// be something more human readable. This is meant only for debugging.
     virtual QString source() const = 0;
 
+    /// Tells the decoder if its video is currently visible on the screen.
+    /// Same as changing PresentationHint::visible with setPresentationHint.
+    /// @param visible true if the video is visible
+    void setVisibilityHint(bool visible);
+
+    /// Tells the decoder how its video is currently presented. This should
+    /// be called by the renderer whenever the visibility or the on-screen
+    /// size of the video changes noticeably. The default is a visible video
+    /// of unknown size, which is decoded at full quality.
+    ///
+    /// FfmpegDecoder uses the hint as follows:
+    ///  - Visible decoders are preferred when scheduling decoding jobs in the
+    ///    shared pool, see Options::setPooledDecoding. Importance adjusts
+    ///    the priority further.
+    ///  - Hidden videos skip non-reference frames. Hidden videos that are
+    ///    paused or have no audio stop reading the source once they have a
+    ///    frame to show, and are resynchronized when they become visible.
+    ///    Live sources are never paused.
+    ///  - Videos shown much smaller than their native size skip the loop
+    ///    filter. For decoders that support it, the target size given before
+    ///    load() also selects a reduced decoding resolution (lowres).
+    /// @param hint new presentation hint
+    virtual void setPresentationHint(const PresentationHint & hint);
+    /// @returns the latest hint given to setPresentationHint
+    PresentationHint presentationHint() const;
+
+    /// Shared thread pool for decoders that use Options::setPooledDecoding.
+    /// The pool has one thread per CPU core.
+    static std::shared_ptr<Radiant::BGThread> decoderThreadPool();
+
     /// Close all AVDecoders
     static void shutdown(double maxWaitTimeSecs = 5.0);
 
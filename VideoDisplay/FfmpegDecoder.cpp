@@ -13,17 +13,21 @@
 
 #include "FfmpegDecoder.hpp"
 #include "FfmpegVideoFormatSelector.hpp"
+#include "KeyframeIndex.hpp"
 
 #include "Utils.hpp"
 #include "AudioTransfer.hpp"
 #include "VideoCaptureMonitor.hpp"
 
+#include <Nimble/Math.hpp>
 #include <Nimble/Vector2.hpp>
 
 #include <Radiant/Allocators.hpp>
+#include <Radiant/BGThread.hpp>
 #include <Radiant/Condition.hpp>
 #include <Radiant/Trace.hpp>
 #include <Radiant/Sleep.hpp>
+#include <Radiant/Timer.hpp>
 
 #include <Resonant/DSPNetwork.hpp>
 
@@ -37,6 +41,7 @@
 #include <QFileInfo>
 
 #include <array>
+#include <atomic>
 #include <cassert>
 
 extern "C" {
@@ -233,6 +238,56 @@ namespace VideoDisplay
     AVFilterGraph * graph;
   };
 
+  enum EofState
+  {
+    EOF_NORMAL,
+    EOF_FLUSH,
+    EOF_EOF
+  };
+
+  /// Result of one iteration of the decoding loop
+  enum StepResult
+  {
+    /// Decoded something, there is more to do
+    STEP_CONTINUE,
+    /// Nothing to do until the buffers have free space or a new seek request
+    /// is made
+    STEP_IDLE,
+    /// Temporary read error, try again soon
+    STEP_RETRY,
+    /// Decoding is finished
+    STEP_DONE,
+    /// Unrecoverable error
+    STEP_ERROR
+  };
+
+  /// Decoding loop variables that need to persist between the iterations
+  struct DecodingLoopState
+  {
+    EofState eof = EOF_NORMAL;
+    double videoDpts = std::numeric_limits<double>::quiet_NaN();
+    double audioDpts = std::numeric_limits<double>::quiet_NaN();
+    int lastError = 0;
+    int consecutiveErrorCount = 0;
+    /// With v4l2 streams on some devices (like Inogeni DVI capture cards) lots
+    /// of errors in the beginning is normal
+    int maxConsecutiveErrors = 50;
+    QByteArray src;
+    QByteArray errorMsg;
+    VideoDisplay::AudioTransferPtr audioTransfer;
+  };
+
+  /// Pooled decoders decode this long at a time before letting other
+  /// decoders to use the thread
+  const double s_pooledSliceSeconds = 0.01;
+  /// Maximum time a pooled decoder waits for a wake-up event before checking
+  /// the buffers again
+  const double s_pooledIdleSeconds = 0.1;
+
+  /// While scrubbing with keyframes, the exact position is decoded once
+  /// there hasn't been a new seek request for this long
+  const double s_scrubRefineSeconds = 0.25;
+
   // -------------------------------------------------------------------------
 
   class FfmpegDecoder::D
@@ -251,7 +306,24 @@ namespace VideoDisplay
     bool increaseSeekGeneration();
 
     bool seekToBeginning();
-    bool seek(SeekRequest req, int seekRequestGeneration);
+    bool seek(SeekRequest req, int seekRequestGeneration, bool refine);
+
+    /// Enables or disables keyframe-only decoding
+    void setScrubbing(bool scrubbing);
+    /// Applies AVDecoder::presentationHint to the decoding parameters
+    void applyPresentationHint();
+    /// Updates codec skip flags based on scrubbing and the presentation hint
+    void updateSkipFlags();
+    /// Can a hidden video stop reading the source until it becomes visible again
+    bool canPauseDemuxing();
+    /// Seeks directly to the indexed keyframe closest to the request.
+    /// Returns false if the index can't be used for this request.
+    bool seekKeyframe(const SeekRequest & req, int seekRequestGeneration);
+    /// Shows the previously decoded keyframe again with a new seek generation
+    bool reuseScrubFrame(int seekRequestGeneration);
+    /// Requests an exact seek to the latest position that was shown with
+    /// keyframe scrubbing. Returns false if there is nothing to refine.
+    bool requestScrubRefine();
 
     QByteArray supportedPixFormatsStr();
     void updateSupportedPixFormats();
@@ -261,6 +333,27 @@ namespace VideoDisplay
     std::shared_ptr<VideoFrameFfmpeg> getFreeFrame();
     bool checkSeek();
 
+    /// Opens the source, called from the decoder thread
+    bool startDecoding();
+    /// One iteration of the decoding loop, reads and decodes one packet
+    StepResult decodeStep();
+    /// Called once after the decoding loop, result is either STEP_DONE or STEP_ERROR
+    void finishDecoding(StepResult result);
+
+    /// With pooled decoding, true if the decoded buffers are full and there
+    /// is no point to read more packets
+    bool buffersFull();
+    /// Runs the decoding loop for one time slice in the shared pool
+    void runPooledSlice(Radiant::Task & task);
+    /// Priority of the pooled decoding task, based on the visibility and
+    /// how full the buffers are
+    Radiant::Priority poolPriority();
+    /// Wakes up pooled decoding task if it's waiting
+    void wakePooled();
+    /// Waits for the pooled decoding task to finish, finishing it here if
+    /// the task didn't get to run
+    void stopPooled();
+
     void setFormat(VideoFrameFfmpeg & frame, const AVPixFmtDescriptor & fmtDescriptor,
                    Nimble::Vector2i size);
 
@@ -293,6 +386,11 @@ namespace VideoDisplay
     double m_exactAudioSeekRequestPts = std::numeric_limits<double>::quiet_NaN();
     // m_sync activeSeekGeneration will be set to this once the seeking is finished
     int m_seekRequestGeneration = 0;
+    /// True if m_seekRequest is the exact seek after keyframe scrubbing
+    bool m_seekRefine = false;
+    /// Latest seek request made during real-time seeking, protected by
+    /// m_seekRequestMutex
+    SeekRequest m_scrubRequest;
     /// If this mutex is locked at the same time with m_decodedVideoFramesMutex,
     /// the latter needs to be locked first
     Radiant::Mutex m_seekRequestMutex;
@@ -344,6 +442,32 @@ namespace VideoDisplay
 
     bool m_hasExclusiveAccess = false;
     std::set<QString>::iterator m_exclusiveAccess;
+
+    DecodingLoopState m_loop;
+
+    /// Only set with Options::isPooledDecoding, created in load()
+    std::shared_ptr<Radiant::BGThread> m_pool;
+    Radiant::TaskPtr m_pooledTask;
+    std::atomic<bool> m_wakePending{false};
+    std::atomic<bool> m_visible{true};
+    std::atomic<float> m_importance{1.0f};
+    /// Set when the presentation hint changes, applied in the decoder thread
+    std::atomic<bool> m_presentationHintChanged{false};
+    /// Decoder thread copy of PresentationHint::visible
+    bool m_hidden = false;
+    /// Loop filter setting chosen based on the on-screen size of the video
+    AVDiscard m_skipLoopFilter = AVDISCARD_DEFAULT;
+    /// True while a hidden video doesn't read the source at all
+    bool m_demuxPaused = false;
+
+    /// Only set for local files with Options::isKeyframeScrubbing
+    KeyframeIndexPtr m_keyframeIndex;
+    /// True while only keyframes are decoded
+    bool m_scrubbing = false;
+    /// Keyframe that was last seeked to while scrubbing, in the video stream time base
+    int64_t m_scrubKeyframePts = AV_NOPTS_VALUE;
+    /// Time since the latest scrubbing seek
+    Radiant::Timer m_scrubIdleTimer;
   };
 
 
@@ -580,6 +704,8 @@ namespace VideoDisplay
     m_exactAudioSeekRequestPts = std::numeric_limits<double>::quiet_NaN();
     m_hasDecodedAudioFrames = false;
     m_allowJpegRange = false;
+    m_scrubbing = false;
+    m_scrubKeyframePts = AV_NOPTS_VALUE;
 
 #ifdef RADIANT_LINUX
     /// Detect video4linux2 devices automatically
@@ -779,6 +905,21 @@ namespace VideoDisplay
         } else {
           m_av.videoCodecContext->thread_count = m_options.videoDecodingThreads();
         }
+
+        // Decode at reduced resolution if the video is shown much smaller
+        // than its native size. This needs to be decided before opening the
+        // codec, and only few decoders support it.
+        const PresentationHint hint = m_host->presentationHint();
+        const AVCodecParameters * par = m_av.formatContext->streams[m_av.videoStreamIndex]->codecpar;
+        if (m_av.videoCodec->max_lowres > 0 && !hint.targetSize.isEmpty() &&
+            !m_options.videoOptions().contains("lowres")) {
+          int lowres = 0;
+          while (lowres < m_av.videoCodec->max_lowres &&
+                 (par->width >> (lowres + 1)) >= hint.targetSize.width() &&
+                 (par->height >> (lowres + 1)) >= hint.targetSize.height())
+            ++lowres;
+          m_av.videoCodecContext->lowres = lowres;
+        }
       }
     }
 
@@ -988,9 +1129,16 @@ namespace VideoDisplay
       /// stream normally. After the first video frame is decoded, size should
       /// be updated and then the events should be triggered
       m_av.videoSize = Nimble::Size(m_av.videoCodecContext->width, m_av.videoCodecContext->height);
+      if (m_av.videoCodecContext->lowres > 0) {
+        // Report the native size, the frames are just decoded at lower resolution
+        const AVCodecParameters * par = m_av.formatContext->streams[m_av.videoStreamIndex]->codecpar;
+        m_av.videoSize = Nimble::Size(par->width, par->height);
+      }
     } else {
       m_av.videoSize = Nimble::Size();
     }
+    m_presentationHintChanged = false;
+    applyPresentationHint();
     if (m_av.formatContext->duration != AV_NOPTS_VALUE) {
       m_av.duration = m_av.formatContext->duration / double(AV_TIME_BASE);
       m_av.hasReliableDuration = true;
@@ -1110,13 +1258,25 @@ namespace VideoDisplay
     return true;
   }
 
-  bool FfmpegDecoder::D::seek(SeekRequest req, int seekRequestGeneration)
+  bool FfmpegDecoder::D::seek(SeekRequest req, int seekRequestGeneration, bool refine)
   {
     QByteArray errorMsg("FfmpegDecoder::D::seek # " + m_options.source().toUtf8() + ":");
 
     m_exactVideoSeekRequestPts = std::numeric_limits<double>::quiet_NaN();
     m_exactAudioSeekRequestPts = std::numeric_limits<double>::quiet_NaN();
 
+    const bool scrub = !refine && m_realTimeSeeking && m_options.isKeyframeScrubbing() &&
+        m_av.videoCodecContext && req.type() != SEEK_BY_BYTES;
+    setScrubbing(scrub);
+    if (scrub) {
+      m_scrubIdleTimer.start();
+      if (seekKeyframe(req, seekRequestGeneration))
+        return true;
+      // Without the index we still seek to a keyframe and decode only that,
+      // the exact position is decoded later with requestScrubRefine
+      req.setFlags(req.flags() & ~SEEK_FLAG_ACCURATE);
+    }
+
     if(req.value() <= std::numeric_limits<double>::epsilon()) {
       bool ok = seekToBeginning();
       if(ok) {
@@ -1215,6 +1375,171 @@ namespace VideoDisplay
     return true;
   }
 
+  void FfmpegDecoder::D::setScrubbing(bool scrubbing)
+  {
+    if (m_scrubbing == scrubbing)
+      return;
+
+    m_scrubbing = scrubbing;
+    m_scrubKeyframePts = AV_NOPTS_VALUE;
+    updateSkipFlags();
+  }
+
+  void FfmpegDecoder::D::applyPresentationHint()
+  {
+    const PresentationHint hint = m_host->presentationHint();
+    m_hidden = !hint.visible;
+
+    m_skipLoopFilter = AVDISCARD_DEFAULT;
+    if (!hint.targetSize.isEmpty() && !m_av.videoSize.isEmpty()) {
+      const float scale = float(hint.targetSize.width()) * hint.targetSize.height() /
+          (m_av.videoSize.width() * m_av.videoSize.height());
+      // Skipping the loop filter on non-reference frames doesn't affect the
+      // following frames. Tiny videos skip it on all frames, the error that
+      // accumulates until the next keyframe isn't visible at that size.
+      if (scale < 1.0f / 16.0f)
+        m_skipLoopFilter = AVDISCARD_ALL;
+      else if (scale < 0.25f)
+        m_skipLoopFilter = AVDISCARD_NONREF;
+    }
+
+    updateSkipFlags();
+  }
+
+  void FfmpegDecoder::D::updateSkipFlags()
+  {
+    AVCodecContext * ctx = m_av.videoCodecContext;
+    if (!ctx)
+      return;
+
+    if (m_scrubbing) {
+      ctx->skip_frame = AVDISCARD_NONKEY;
+    } else if (m_hidden) {
+      // Reference frames are still decoded so that there are no artifacts
+      // when the video becomes visible again
+      ctx->skip_frame = AVDISCARD_NONREF;
+    } else {
+      ctx->skip_frame = AVDISCARD_DEFAULT;
+    }
+    ctx->skip_loop_filter = m_skipLoopFilter;
+  }
+
+  bool FfmpegDecoder::D::canPauseDemuxing()
+  {
+    if (!m_hidden || !m_av.videoCodec || m_realTimeSeeking || m_hasExternalSync)
+      return false;
+
+    // Live sources can't be paused, reading them needs to keep up
+    if (!m_av.seekingSupported || !m_options.format().isEmpty())
+      return false;
+
+    // Audio is audible even if the video is hidden
+    if (m_av.audioCodec && m_sync->playMode() == AVSync::PLAY)
+      return false;
+
+    // Keep at least one frame to show when the video becomes visible again
+    Radiant::Guard g(m_decodedVideoFramesMutex);
+    return !m_decodedVideoFrames.empty();
+  }
+
+  bool FfmpegDecoder::D::seekKeyframe(const SeekRequest & req, int seekRequestGeneration)
+  {
+    if (!m_keyframeIndex || !m_keyframeIndex->isReady() || !m_av.seekingSupported || m_av.seekByBytes)
+      return false;
+
+    double target = req.value();
+    if (req.type() == SEEK_RELATIVE) {
+      if (!m_av.hasReliableDuration)
+        return false;
+      target *= m_av.duration;
+    }
+    if (m_av.formatContext->start_time != (int64_t) AV_NOPTS_VALUE)
+      target += m_av.formatContext->start_time / double(AV_TIME_BASE);
+
+    const KeyframeIndex & index = *m_keyframeIndex;
+    const int i = (req.flags() & SEEK_FLAG_FORWARD) ? index.keyframeAfter(target)
+                                                    : index.keyframeBefore(target);
+    if (i < 0)
+      return false;
+
+    const int64_t pts = index.keyframe(i).pts;
+    if (pts == m_scrubKeyframePts && reuseScrubFrame(seekRequestGeneration))
+      return true;
+
+    int err = avformat_seek_file(m_av.formatContext.get(), m_av.videoStreamIndex,
+                                 std::numeric_limits<int64_t>::min(), pts, pts, 0);
+    if (err < 0)
+      return false;
+
+    if(m_av.audioCodecContext)
+      avcodec_flush_buffers(m_av.audioCodecContext);
+    avcodec_flush_buffers(m_av.videoCodecContext);
+    {
+      Radiant::Guard g(m_decodedVideoFramesMutex);
+      setSeekGeneration(seekRequestGeneration);
+    }
+    m_av.nextPts = m_av.startPts;
+    m_av.nextPtsTb = m_av.startPtsTb;
+    m_scrubKeyframePts = pts;
+
+    return true;
+  }
+
+  bool FfmpegDecoder::D::reuseScrubFrame(int seekRequestGeneration)
+  {
+    std::shared_ptr<VideoFrameFfmpeg> last = lastReadyDecodedFrame();
+    if (!last || !last->frame.avframe || !last->frame.referenced)
+      return false;
+
+    std::shared_ptr<VideoFrameFfmpeg> frame = std::make_shared<VideoFrameFfmpeg>();
+    frame->frameUnrefMightBlock = m_frameUnrefMightBlock;
+    frame->deallocatedFrames = m_deallocatedFrames;
+    frame->frame.avframe = av_frame_alloc();
+    if (!frame->frame.avframe)
+      return false;
+
+    // Shares the same frame buffers
+    AVFrame & avframe = *frame->frame.avframe;
+    av_frame_ref(&avframe, last->frame.avframe);
+    frame->frame.referenced = true;
+    frame->frame.context = last->frame.context;
+
+    frame->setIndex(m_index++);
+
+    auto fmtDescriptor = av_pix_fmt_desc_get(AVPixelFormat(avframe.format));
+    setFormat(*frame, *fmtDescriptor, Nimble::Vector2i(avframe.width, avframe.height));
+    for (int i = 0; i < frame->planes(); ++i) {
+      frame->setLineSize(i, avframe.linesize[i]);
+      frame->setData(i, avframe.data[i]);
+    }
+    frame->setImageSize(last->imageSize());
+    frame->setTimestamp(Timestamp(last->timestamp().pts(), seekRequestGeneration));
+
+    {
+      Radiant::Guard g(m_decodedVideoFramesMutex);
+      setSeekGeneration(seekRequestGeneration);
+      m_decodedVideoFrames.push_back(std::move(frame));
+    }
+    m_decodedVideoFramesCond.wakeAll();
+    return true;
+  }
+
+  bool FfmpegDecoder::D::requestScrubRefine()
+  {
+    {
+      Radiant::Guard g(m_seekRequestMutex);
+      if (m_scrubRequest.type() == SEEK_NONE)
+        return false;
+      m_seekRequestGeneration = std::max(m_sync->seekGeneration(), m_seekRequestGeneration) + 1;
+      m_seekRequest = m_scrubRequest;
+      m_seekRefine = true;
+      m_scrubRequest.setType(SEEK_NONE);
+    }
+    // Needs to be done without m_seekRequestMutex, see m_seekRequestMutex
+    wakePooled();
+    return true;
+  }
+
   std::shared_ptr<VideoFrameFfmpeg> FfmpegDecoder::D::getFreeFrame()
   {
     AudioTransferPtr audioTransfer(m_audioTransfer);
@@ -1236,6 +1561,12 @@ namespace VideoDisplay
           continue;
         }
 
+        // Pooled decoders check the buffer before reading the packet, a
+        // single packet might still produce a few extra frames. Allow that
+        // instead of blocking a shared thread.
+        if (m_pooledTask)
+          break;
+
         m_decodedVideoFramesCond.wait(m_decodedVideoFramesMutex, 100);
       }
     }
@@ -1725,15 +2056,17 @@ namespace VideoDisplay
   {
     SeekRequest req;
     int seekRequestGeneration;
+    bool refine;
     {
       Radiant::Guard g(m_seekRequestMutex);
       req = m_seekRequest;
       seekRequestGeneration = m_seekRequestGeneration;
+      refine = m_seekRefine;
     }
 
     bool didSeek = false;
     if((req.type() != SEEK_NONE)) {
-      if(seek(req, seekRequestGeneration)) {
+      if(seek(req, seekRequestGeneration, refine)) {
         m_loopOffset = 0;
         didSeek = true;
       }
@@ -1764,6 +2097,7 @@ namespace VideoDisplay
     close();
     if(isRunning())
       waitEnd();
+    m_d->stopPooled();
     m_d->close();
   }
 
@@ -1775,6 +2109,7 @@ namespace VideoDisplay
   void FfmpegDecoder::setPlayMode(AVSync::PlayMode mode)
   {
     m_d->m_sync->setPlayMode(mode);
+    m_d->wakePooled();
   }
 
   std::shared_ptr<VideoFrame> FfmpegDecoder::playFrame(Radiant::TimeStamp presentTimestamp, ErrorFlags & errors,
@@ -1797,8 +2132,10 @@ namespace VideoDisplay
       }
     }
 
-    if (changed)
+    if (changed) {
       m_d->m_decodedVideoFramesCond.wakeAll();
+      m_d->wakePooled();
+    }
 
     return current;
   }
@@ -1913,6 +2250,7 @@ namespace VideoDisplay
     close();
     if(isRunning())
       waitEnd();
+    m_d->stopPooled();
 
     m_d->m_audioTransfer.reset();
   }
@@ -1930,6 +2268,13 @@ namespace VideoDisplay
     }
     m_d->m_sync->setPlayMode(options.playMode());
     m_d->updateSupportedPixFormats();
+    if (options.isPooledDecoding()) {
+      m_d->m_pool = decoderThreadPool();
+      D * d = m_d.get();
+      m_d->m_pooledTask = std::make_shared<Radiant::FunctionTask>([d] (Radiant::Task & task) {
+        d->runPooledSlice(task);
+      });
+    }
     seek(m_d->m_options.seekRequest());
   }
 
@@ -1940,6 +2285,7 @@ namespace VideoDisplay
     // Kill audio so that it stops at the same time as the video
     if (audioTransfer)
       audioTransfer->setGain(0.0f);
+    m_d->wakePooled();
   }
 
   Nimble::Size FfmpegDecoder::videoSize() const
@@ -1965,11 +2311,19 @@ namespace VideoDisplay
 
   int FfmpegDecoder::seek(const SeekRequest & req)
   {
-    Radiant::Guard g(m_d->m_seekRequestMutex);
-    m_d->m_seekRequestGeneration = std::max(m_d->m_sync->seekGeneration(),
-                                            m_d->m_seekRequestGeneration);
-    int gen = ++m_d->m_seekRequestGeneration;
-    m_d->m_seekRequest = req;
+    int gen;
+    {
+      Radiant::Guard g(m_d->m_seekRequestMutex);
+      m_d->m_seekRequestGeneration = std::max(m_d->m_sync->seekGeneration(),
+                                              m_d->m_seekRequestGeneration);
+      gen = ++m_d->m_seekRequestGeneration;
+      m_d->m_seekRequest = req;
+      m_d->m_seekRefine = false;
+      if (m_d->m_realTimeSeeking && m_d->m_options.isKeyframeScrubbing())
+        m_d->m_scrubRequest = req;
+    }
+    // Needs to be done without m_seekRequestMutex, see m_seekRequestMutex
+    m_d->wakePooled();
     return gen;
   }
 
@@ -1985,224 +2339,254 @@ namespace VideoDisplay
     m_d->m_realTimeSeeking = value;
     if(audioTransfer)
       audioTransfer->setSeeking(value);
+    // Decode the exact position of the latest scrub position
+    if (value || !m_d->requestScrubRefine())
+      m_d->wakePooled();
 
     return true;
   }
 
-  void FfmpegDecoder::runDecoder()
+  void FfmpegDecoder::setPresentationHint(const PresentationHint & hint)
   {
-    QByteArray errorMsg("FfmpegDecoder::D::runDecoder # " + m_d->m_options.source().toUtf8() + ":");
-    QThread::currentThread()->setPriority(QThread::LowPriority);
+    if (hint == presentationHint())
+      return;
+
+    AVDecoder::setPresentationHint(hint);
+    m_d->m_visible = hint.visible;
+    m_d->m_importance = Nimble::Math::Clamp(hint.importance, 0.0f, 1.0f);
+    m_d->m_presentationHintChanged = true;
+    m_d->wakePooled();
+  }
 
-    QByteArray src = m_d->m_options.source().toUtf8();
-    s_src = src.data();
+  bool FfmpegDecoder::D::startDecoding()
+  {
+    m_loop = DecodingLoopState();
+    m_loop.errorMsg = "FfmpegDecoder::D::runDecoder # " + m_options.source().toUtf8() + ":";
+    m_loop.src = m_options.source().toUtf8();
+    s_src = m_loop.src.data();
 
     ffmpegInit();
 
-    if (state() != STATE_FINISHED || !m_d->m_av.videoSize.isValid()) {
-      if (!m_d->open()) {
-        state() = STATE_ERROR;
-        return;
+    if (m_host->state() != STATE_FINISHED || !m_av.videoSize.isValid()) {
+      if (!open()) {
+        m_host->state() = STATE_ERROR;
+        s_src = nullptr;
+        return false;
       }
     }
-    state() = STATE_HEADER_READY;
 
-    enum EofState {
-      Normal,
-      Flush,
-      Eof
-    } eof = EofState::Normal;
+    if (!m_keyframeIndex && m_options.isKeyframeScrubbing() && m_options.format().isEmpty() &&
+        m_av.videoCodecContext && m_av.seekingSupported && !m_av.seekByBytes)
+      m_keyframeIndex = KeyframeIndex::acquire(m_options.source(), m_av.videoStreamIndex);
+    m_host->state() = STATE_HEADER_READY;
 
-    double videoDpts = std::numeric_limits<double>::quiet_NaN();
-    double audioDpts = std::numeric_limits<double>::quiet_NaN();
-
-    auto & av = m_d->m_av;
+    m_loop.audioTransfer = m_audioTransfer;
 
-    AudioTransferPtr audioTransfer(m_d->m_audioTransfer);
+    if (m_av.videoCodec && m_loop.audioTransfer)
+      m_loop.audioTransfer->setEnabled(false);
 
-    if (av.videoCodec && audioTransfer)
-      audioTransfer->setEnabled(false);
+    m_decodingStartTime.start();
+    return true;
+  }
 
-    int lastError = 0;
-    int consecutiveErrorCount = 0;
-    /// With v4l2 streams on some devices (like Inogeni DVI capture cards) lots
-    /// of errors in the beginning is normal
-    int maxConsecutiveErrors = 50;
+  StepResult FfmpegDecoder::D::decodeStep()
+  {
+    if (!m_running)
+      return STEP_DONE;
 
-    m_d->m_decodingStartTime.start();
+    int err = 0;
+    auto & av = m_av;
+    auto & loop = m_loop;
+    AudioTransferPtr & audioTransfer = loop.audioTransfer;
 
-    while(m_d->m_running) {
-      int err = 0;
+    if (checkSeek())
+      loop.videoDpts = loop.audioDpts = std::numeric_limits<double>::quiet_NaN();
 
-      if (m_d->checkSeek())
-        videoDpts = audioDpts = std::numeric_limits<double>::quiet_NaN();
+    if (m_presentationHintChanged.exchange(false))
+      applyPresentationHint();
 
-      if(m_d->m_running && m_d->m_realTimeSeeking && av.videoCodec) {
-        std::shared_ptr<VideoFrameFfmpeg> frame = m_d->lastReadyDecodedFrame();
-        if(frame && frame->timestamp().seekGeneration() == m_d->m_sync->seekGeneration()) {
-          /// frame done, give some break for this thread
-          Radiant::Sleep::sleepSome(0.001);
-          continue;
-        }
+    if(m_running && m_realTimeSeeking && av.videoCodec) {
+      std::shared_ptr<VideoFrameFfmpeg> frame = lastReadyDecodedFrame();
+      if(frame && frame->timestamp().seekGeneration() == m_sync->seekGeneration()) {
+        /// The user has stopped dragging, decode the exact position
+        if (m_scrubbing && m_scrubIdleTimer.time() > s_scrubRefineSeconds && requestScrubRefine())
+          return STEP_CONTINUE;
+        /// frame done, give some break for this thread
+        return STEP_IDLE;
       }
+    }
 
-      if(eof == EofState::Normal) {
-        err = av_read_frame(av.formatContext.get(), &av.packet);
-        if (s_forceNewestFrame) {
-          m_d->m_forceNewestFrame = true;
-          s_forceNewestFrame = false;
-        }
-      }
+    if (m_pooledTask && loop.eof == EOF_NORMAL && buffersFull())
+      return STEP_IDLE;
 
-      if(err < 0) {
-        /// @todo refactor following error handling + heuristics
-        ///
-        // With streams we might randomly get EAGAIN, at least on linux
-        if(err == AVERROR(EAGAIN)) {
-          Radiant::Sleep::sleepSome(0.001);
-          continue;
-        } else
-        if(err != AVERROR_EOF) {
-          if (err == lastError) {
-            if (++consecutiveErrorCount > maxConsecutiveErrors) {
-              state() = STATE_ERROR;
-              s_src = nullptr;
-              return;
-            }
-          } else {
-            avError(QString("%1 Read error").arg(errorMsg.data()), err);
-            lastError = err;
-          }
-          ++consecutiveErrorCount;
-          Radiant::Sleep::sleepSome(0.001);
-          continue;
-        }
+    // Hidden video without audible audio, stop reading the source. When the
+    // video becomes visible again, playFrame notices that the frames are
+    // late and resynchronizes.
+    m_demuxPaused = loop.eof == EOF_NORMAL && canPauseDemuxing();
+    if (m_demuxPaused)
+      return STEP_IDLE;
 
-        lastError = 0;
-        consecutiveErrorCount = 0;
+    if(loop.eof == EOF_NORMAL) {
+      err = av_read_frame(av.formatContext.get(), &av.packet);
+      if (s_forceNewestFrame) {
+        m_forceNewestFrame = true;
+        s_forceNewestFrame = false;
+      }
+    }
 
-        if(av.needFlushAtEof) {
-          eof = EofState::Flush;
+    if(err < 0) {
+      /// @todo refactor following error handling + heuristics
+      ///
+      // With streams we might randomly get EAGAIN, at least on linux
+      if(err == AVERROR(EAGAIN)) {
+        return STEP_RETRY;
+      } else
+      if(err != AVERROR_EOF) {
+        if (err == loop.lastError) {
+          if (++loop.consecutiveErrorCount > loop.maxConsecutiveErrors)
+            return STEP_ERROR;
         } else {
-          eof = EofState::Eof;
+          avError(QString("%1 Read error").arg(loop.errorMsg.data()), err);
+          loop.lastError = err;
         }
+        ++loop.consecutiveErrorCount;
+        return STEP_RETRY;
+      }
 
+      loop.lastError = 0;
+      loop.consecutiveErrorCount = 0;
+
+      if(av.needFlushAtEof) {
+        loop.eof = EOF_FLUSH;
       } else {
-        lastError = 0;
-        consecutiveErrorCount = 0;
+        loop.eof = EOF_EOF;
       }
 
-      // We really are at the end of the stream and we have flushed all the packages
-      if(eof == EofState::Eof) {
-        /// @todo refactor eof handling away
+    } else {
+      loop.lastError = 0;
+      loop.consecutiveErrorCount = 0;
+    }
 
-        if(m_d->m_realTimeSeeking) {
-          Radiant::Sleep::sleepSome(0.001);
-          continue;
-        }
-        if(m_d->m_options.isLooping()) {
-          if (m_d->seekToBeginning())
-            videoDpts = audioDpts = std::numeric_limits<double>::quiet_NaN();
-          else
-            break; // We are requested to loop, but seek failed and reopening the source failed.
-          eof = EofState::Normal;
-
-          m_d->m_loopOffset += m_d->m_av.duration;
-          continue;
-        } else {
-          // all done
-          break;
-        }
+    // We really are at the end of the stream and we have flushed all the packages
+    if(loop.eof == EOF_EOF) {
+      /// @todo refactor eof handling away
+
+      if(m_realTimeSeeking)
+        return STEP_IDLE;
+
+      if(m_options.isLooping()) {
+        if (seekToBeginning())
+          loop.videoDpts = loop.audioDpts = std::numeric_limits<double>::quiet_NaN();
+        else
+          return STEP_DONE; // We are requested to loop, but seek failed and reopening the source failed.
+        loop.eof = EOF_NORMAL;
+
+        m_loopOffset += m_av.duration;
+        return STEP_CONTINUE;
+      } else {
+        // all done
+        return STEP_DONE;
       }
+    }
 
-      av.frame->opaque = nullptr;
-      bool gotVideoFrame = false;
-      bool gotAudioFrame = false;
-
-      /// todo come up with descriptive name
-      bool videoCodec = av.videoCodec;
-      bool v1 = videoCodec && eof == EofState::Normal && av.packet.stream_index == av.videoStreamIndex;
-      bool v2 = videoCodec && eof == EofState::Flush && (av.videoCodec->capabilities & AV_CODEC_CAP_DELAY);
-
-      if(v1 || v2) {
-        if(v2) {
-          av_init_packet(&av.packet);
-          av.packet.data = nullptr;
-          av.packet.size = 0;
-          av.packet.stream_index = av.videoStreamIndex;
-        }
-        double prevVideoDpts = videoDpts;
-        gotVideoFrame = m_d->decodeVideoPacket(videoDpts);
-        if(gotVideoFrame && audioTransfer)
-          audioTransfer->setEnabled(true);
-
-        if (gotVideoFrame && std::isfinite(av.start) && std::isfinite(videoDpts) &&
-            std::isfinite(prevVideoDpts) && videoDpts > prevVideoDpts) {
-          double newDuration = videoDpts + (videoDpts - prevVideoDpts) - av.start;
-          if (newDuration > m_d->m_av.duration) {
-            m_d->m_av.duration = newDuration;
-          }
+    av.frame->opaque = nullptr;
+    bool gotVideoFrame = false;
+    bool gotAudioFrame = false;
+
+    /// todo come up with descriptive name
+    bool videoCodec = av.videoCodec;
+    bool v1 = videoCodec && loop.eof == EOF_NORMAL && av.packet.stream_index == av.videoStreamIndex;
+    bool v2 = videoCodec && loop.eof == EOF_FLUSH && (av.videoCodec->capabilities & AV_CODEC_CAP_DELAY);
+
+    if(v1 || v2) {
+      if(v2) {
+        av_init_packet(&av.packet);
+        av.packet.data = nullptr;
+        av.packet.size = 0;
+        av.packet.stream_index = av.videoStreamIndex;
+      }
+      double prevVideoDpts = loop.videoDpts;
+      gotVideoFrame = decodeVideoPacket(loop.videoDpts);
+      if(gotVideoFrame && audioTransfer)
+        audioTransfer->setEnabled(true);
+
+      if (gotVideoFrame && std::isfinite(av.start) && std::isfinite(loop.videoDpts) &&
+          std::isfinite(prevVideoDpts) && loop.videoDpts > prevVideoDpts) {
+        double newDuration = loop.videoDpts + (loop.videoDpts - prevVideoDpts) - av.start;
+        if (newDuration > m_av.duration) {
+          m_av.duration = newDuration;
         }
       }
+    }
 
-      av.frame->opaque = nullptr;
-
-      /// todo come up with descriptive name
-      bool acodec = av.audioCodec;
-      bool a1 = acodec && eof == EofState::Normal && av.packet.stream_index == av.audioStreamIndex;
-      bool a2 = acodec && eof == EofState::Flush && (av.audioCodec->capabilities & AV_CODEC_CAP_DELAY);
-      if(a1 || a2) {
-        if(a2) {
-          av_init_packet(&av.packet);
-          av.packet.data = nullptr;
-          av.packet.data = 0;
-          av.packet.stream_index = av.audioStreamIndex;
-        }
-        double prevAudioDpts = audioDpts;
-        gotAudioFrame = m_d->decodeAudioPacket(audioDpts);
-
-        if (gotAudioFrame && std::isfinite(av.start) && std::isfinite(audioDpts) &&
-            std::isfinite(prevAudioDpts) && audioDpts > prevAudioDpts) {
-          double newDuration = audioDpts + (audioDpts - prevAudioDpts) - av.start;
-          if (newDuration > m_d->m_av.duration) {
-            m_d->m_av.duration = newDuration;
-          }
+    av.frame->opaque = nullptr;
+
+    /// todo come up with descriptive name
+    bool acodec = av.audioCodec;
+    bool a1 = acodec && loop.eof == EOF_NORMAL && av.packet.stream_index == av.audioStreamIndex;
+    bool a2 = acodec && loop.eof == EOF_FLUSH && (av.audioCodec->capabilities & AV_CODEC_CAP_DELAY);
+    if(a1 || a2) {
+      if(a2) {
+        av_init_packet(&av.packet);
+        av.packet.data = nullptr;
+        av.packet.data = 0;
+        av.packet.stream_index = av.audioStreamIndex;
+      }
+      double prevAudioDpts = loop.audioDpts;
+      gotAudioFrame = decodeAudioPacket(loop.audioDpts);
+
+      if (gotAudioFrame && std::isfinite(av.start) && std::isfinite(loop.audioDpts) &&
+          std::isfinite(prevAudioDpts) && loop.audioDpts > prevAudioDpts) {
+        double newDuration = loop.audioDpts + (loop.audioDpts - prevAudioDpts) - av.start;
+        if (newDuration > m_av.duration) {
+          m_av.duration = newDuration;
         }
       }
+    }
 
-      const bool gotFrames = gotAudioFrame || gotVideoFrame;
+    const bool gotFrames = gotAudioFrame || gotVideoFrame;
 
-      // Flush is done if there are no more frames
-      if(eof == EofState::Flush && !gotFrames)
-        eof = EofState::Eof;
+    // Flush is done if there are no more frames
+    if(loop.eof == EOF_FLUSH && !gotFrames)
+      loop.eof = EOF_EOF;
 
-      if (!std::isfinite(av.start) && gotFrames) {
-        if (std::isfinite(videoDpts) && std::isfinite(audioDpts)) {
-          av.start = std::min(videoDpts, audioDpts);
-        } else if (std::isfinite(videoDpts)) {
-          av.start = videoDpts;
-        } else if (std::isfinite(audioDpts)) {
-          av.start = audioDpts;
-        }
+    if (!std::isfinite(av.start) && gotFrames) {
+      if (std::isfinite(loop.videoDpts) && std::isfinite(loop.audioDpts)) {
+        av.start = std::min(loop.videoDpts, loop.audioDpts);
+      } else if (std::isfinite(loop.videoDpts)) {
+        av.start = loop.videoDpts;
+      } else if (std::isfinite(loop.audioDpts)) {
+        av.start = loop.audioDpts;
       }
+    }
 
-      av_packet_unref(&av.packet);
+    av_packet_unref(&av.packet);
 
-      if (gotAudioFrame)
-        m_d->m_hasDecodedAudioFrames = true;
+    if (gotAudioFrame)
+      m_hasDecodedAudioFrames = true;
 
-      if(gotFrames)
-        state() = STATE_READY;
-    }
+    if(gotFrames)
+      m_host->state() = STATE_READY;
 
-    state() = STATE_FINISHED;
+    return STEP_CONTINUE;
+  }
+
+  void FfmpegDecoder::D::finishDecoding(StepResult result)
+  {
     s_src = nullptr;
 
-    if (audioTransfer) {
+    if (result == STEP_ERROR) {
+      m_host->state() = STATE_ERROR;
+      return;
+    }
+
+    m_host->state() = STATE_FINISHED;
+
+    if (m_loop.audioTransfer) {
       // Tell audio transfer that there are no more samples coming, so that it
       // knows that it can disable itself when it runs out of the decoded
       // buffer.
-      audioTransfer->setDecodingFinished(true);
+      m_loop.audioTransfer->setDecodingFinished(true);
     }
 
     // If m_running is false, someone called AVDecoder::close(), so we can
@@ -2211,8 +2595,134 @@ namespace VideoDisplay
     // Also this way we can close all decoders in parallel on application
     // shutdown, saving a lot of time, especially with Datapath video sources
     // (those can take 1-2 seconds to close).
-    if (!m_d->m_running)
-      m_d->close();
+    if (!m_running)
+      close();
+  }
+
+  bool FfmpegDecoder::D::buffersFull()
+  {
+    AudioTransferPtr & audioTransfer = m_loop.audioTransfer;
+    const float audioSeconds = audioTransfer ? audioTransfer->bufferStateSeconds() : 0.0f;
+
+    bool videoFull = false;
+    if (m_av.videoCodec) {
+      Radiant::Guard g(m_decodedVideoFramesMutex);
+      videoFull = (int)m_decodedVideoFrames.size() >= m_options.videoBufferFrames();
+    }
+
+    // Same heuristics as in getFreeFrame, if the video buffer is full and
+    // audio buffer is almost empty, we need to resize the video buffer,
+    // otherwise we could starve.
+    if (videoFull && audioTransfer && audioSeconds < m_options.audioBufferSeconds() * 0.15f &&
+        m_options.videoBufferFrames() < 40) {
+      m_options.setVideoBufferFrames(m_options.videoBufferFrames() + 1);
+      videoFull = false;
+    }
+
+    // Audio is decoded in bigger chunks, leave room for one packet so that
+    // decodeAudioPacket doesn't need to wait for a free buffer
+    const bool audioFull = m_av.audioCodec && audioTransfer && m_hasDecodedAudioFrames &&
+        audioSeconds >= m_options.audioBufferSeconds() * 0.9f;
+
+    return videoFull || audioFull;
+  }
+
+  void FfmpegDecoder::D::runPooledSlice(Radiant::Task & task)
+  {
+    s_src = m_loop.src.data();
+
+    Radiant::Timer timer;
+    StepResult result = STEP_CONTINUE;
+    while (result == STEP_CONTINUE && timer.time() < s_pooledSliceSeconds)
+      result = decodeStep();
+
+    if (result == STEP_DONE || result == STEP_ERROR) {
+      finishDecoding(result);
+      task.setFinished();
+      return;
+    }
+
+    s_src = nullptr;
+    task.setPriority(poolPriority());
+
+    if (result == STEP_CONTINUE) {
+      task.scheduleFromNowSecs(0);
+    } else {
+      task.scheduleFromNowSecs(result == STEP_RETRY ? 0.001 : s_pooledIdleSeconds);
+      // Someone woke us up while we were decoding, the wake-up could have
+      // been lost since we just overwrote the schedule time
+      if (m_wakePending.exchange(false))
+        task.scheduleFromNowSecs(0);
+    }
+  }
+
+  Radiant::Priority FfmpegDecoder::D::poolPriority()
+  {
+    // Fill rate of the buffer that is closest to running empty, that is
+    // the one that has the closest deadline
+    float fill = 1.0f;
+    if (m_av.videoCodec && m_options.videoBufferFrames() > 0) {
+      Radiant::Guard g(m_decodedVideoFramesMutex);
+      fill = std::min(fill, float(m_decodedVideoFrames.size()) / m_options.videoBufferFrames());
+    }
+    AudioTransferPtr audioTransfer(m_audioTransfer);
+    if (m_av.audioCodec && audioTransfer && m_options.audioBufferSeconds() > 0)
+      fill = std::min<float>(fill, audioTransfer->bufferStateSeconds() / m_options.audioBufferSeconds());
+
+    Radiant::Priority priority = Radiant::Task::PRIORITY_NORMAL +
+        200.0f * (1.0f - Nimble::Math::Clamp(fill, 0.0f, 1.0f));
+    if (m_visible)
+      priority += 200.0f * m_importance;
+    return priority;
+  }
+
+  void FfmpegDecoder::D::wakePooled()
+  {
+    if (!m_pooledTask)
+      return;
+
+    m_wakePending = true;
+    m_pooledTask->scheduleFromNowSecs(0);
+    m_pool->reschedule(m_pooledTask, poolPriority());
+  }
+
+  void FfmpegDecoder::D::stopPooled()
+  {
+    if (!m_pooledTask)
+      return;
+
+    // If the task was still in the pool, it never saw that m_running was
+    // set to false, finish it here
+    if (m_pool->removeTask(m_pooledTask, true, true) && !m_host->finished())
+      finishDecoding(STEP_DONE);
+  }
+
+  void FfmpegDecoder::runDecoder()
+  {
+    QThread::currentThread()->setPriority(QThread::LowPriority);
+
+    if (!m_d->startDecoding())
+      return;
+
+    if (m_d->m_pooledTask) {
+      // The decoding loop is run by the shared pool from now on
+      s_src = nullptr;
+      m_d->m_pooledTask->setPriority(m_d->poolPriority());
+      m_d->m_pool->addTask(m_d->m_pooledTask);
+      return;
+    }
+
+    StepResult result;
+    while (true) {
+      result = m_d->decodeStep();
+      if (result == STEP_IDLE || result == STEP_RETRY) {
+        Radiant::Sleep::sleepSome(m_d->m_demuxPaused ? 0.01 : 0.001);
+      } else if (result != STEP_CONTINUE) {
+        break;
+      }
+    }
+
+    m_d->finishDecoding(result);
   }
 
   void ffmpegInit()
@@ -141,6 +141,8 @@ namespace VideoDisplay
 
     virtual QString source() const override;
 
+    virtual void setPresentationHint(const PresentationHint & hint) override;
+
     VIDEODISPLAY_API BufferState bufferState() const;
 
     /// @cond
@@ -0,0 +1,282 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "KeyframeIndex.hpp"
+
+#include <Radiant/BGThread.hpp>
+#include <Radiant/CacheManager.hpp>
+#include <Radiant/Mutex.hpp>
+#include <Radiant/Task.hpp>
+#include <Radiant/Trace.hpp>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+extern "C" {
+  typedef uint64_t UINT64_C;
+  typedef int64_t INT64_C;
+
+# include <libavformat/avformat.h>
+}
+
+namespace
+{
+  /// Increase this when the cache file format changes
+  const int s_cacheVersion = 1;
+  const char s_magic[4] = {'K', 'F', 'I', '1'};
+
+  struct CacheHeader
+  {
+    char magic[4];
+    uint32_t reserved;
+    double timeBase;
+    uint64_t count;
+  };
+
+  Radiant::Mutex s_indexesMutex;
+  std::map<std::pair<QString, int>, std::weak_ptr<VideoDisplay::KeyframeIndex>> s_indexes;
+  QString s_cacheDir;
+
+  void avWarning(const QByteArray & prefix, const char * msg, int err)
+  {
+    char buffer[128];
+    av_strerror(err, buffer, sizeof(buffer));
+    Radiant::warning("%s %s - %s", prefix.data(), msg, buffer);
+  }
+}
+
+namespace VideoDisplay
+{
+  KeyframeIndex::KeyframeIndex(const QString & src, int streamIndex)
+    : m_src(src)
+    , m_streamIndex(streamIndex)
+  {
+  }
+
+  std::shared_ptr<KeyframeIndex> KeyframeIndex::acquire(const QString & src, int streamIndex)
+  {
+    const QFileInfo info(src);
+    if (!info.isFile() || streamIndex < 0)
+      return nullptr;
+
+    const QString path = info.absoluteFilePath();
+    auto cacheMgr = Radiant::CacheManager::instance();
+
+    Radiant::Guard g(s_indexesMutex);
+    const auto key = std::make_pair(path, streamIndex);
+    auto it = s_indexes.find(key);
+    if (it != s_indexes.end()) {
+      if (auto index = it->second.lock())
+        return index;
+    }
+
+    // Remove the entries of indexes that are not used anymore, so that the
+    // map doesn't grow with every video ever opened
+    for (it = s_indexes.begin(); it != s_indexes.end();) {
+      if (it->second.expired())
+        it = s_indexes.erase(it);
+      else
+        ++it;
+    }
+
+    if (s_cacheDir.isEmpty())
+      s_cacheDir = cacheMgr->createCacheDir(QString("keyframes.%1").arg(s_cacheVersion));
+
+    std::shared_ptr<KeyframeIndex> index(new KeyframeIndex(path, streamIndex));
+    s_indexes[key] = index;
+
+    Radiant::CacheManager::CacheItem item = cacheMgr->cacheItem(
+          s_cacheDir, path, QString::number(streamIndex), "kfi");
+    if (item.isValid && index->load(item.path))
+      return index;
+
+    // Scanning reads through the whole file, so do it in the IO pool
+    QString cacheFile = item.path;
+    Radiant::BGThread::ioThreadPool()->addTask(std::make_shared<Radiant::SingleShotTask>(
+                                                 [index, cacheFile] {
+      if (index->scan())
+        index->save(cacheFile);
+    }));
+    return index;
+  }
+
+  int KeyframeIndex::size() const
+  {
+    return m_ready ? static_cast<int>(m_keyframes.size()) : 0;
+  }
+
+  double KeyframeIndex::gopDuration(int i) const
+  {
+    if (i + 1 >= size())
+      return std::numeric_limits<double>::quiet_NaN();
+    return (m_keyframes[i+1].pts - m_keyframes[i].pts) * m_timeBase;
+  }
+
+  int KeyframeIndex::keyframeBefore(double seconds) const
+  {
+    const int count = size();
+    if (count == 0)
+      return -1;
+
+    const int64_t pts = static_cast<int64_t>(std::floor(seconds / m_timeBase));
+    auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.begin() + count, pts,
+                               [] (int64_t pts, const Keyframe & k) { return pts < k.pts; });
+    if (it == m_keyframes.begin())
+      return 0;
+    return static_cast<int>(it - m_keyframes.begin()) - 1;
+  }
+
+  int KeyframeIndex::keyframeAfter(double seconds) const
+  {
+    const int count = size();
+    if (count == 0)
+      return -1;
+
+    const int64_t pts = static_cast<int64_t>(std::ceil(seconds / m_timeBase));
+    auto it = std::lower_bound(m_keyframes.begin(), m_keyframes.begin() + count, pts,
+                               [] (const Keyframe & k, int64_t pts) { return k.pts < pts; });
+    if (it == m_keyframes.begin() + count)
+      return count - 1;
+    return static_cast<int>(it - m_keyframes.begin());
+  }
+
+  bool KeyframeIndex::load(const QString & cacheFile)
+  {
+    QFile file(cacheFile);
+    if (!file.open(QFile::ReadOnly))
+      return false;
+
+    CacheHeader header;
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || !(header.timeBase > 0)) {
+      Radiant::warning("KeyframeIndex # Invalid cache file %s", cacheFile.toUtf8().data());
+      return false;
+    }
+
+    const qint64 bytes = static_cast<qint64>(header.count * sizeof(Keyframe));
+    if (file.size() < static_cast<qint64>(sizeof(header)) + bytes) {
+      Radiant::warning("KeyframeIndex # Truncated cache file %s", cacheFile.toUtf8().data());
+      return false;
+    }
+
+    m_keyframes.resize(header.count);
+    if (file.read(reinterpret_cast<char*>(m_keyframes.data()), bytes) != bytes) {
+      m_keyframes.clear();
+      return false;
+    }
+
+    m_timeBase = header.timeBase;
+    m_ready = true;
+    return true;
+  }
+
+  bool KeyframeIndex::save(const QString & cacheFile) const
+  {
+    QSaveFile file(cacheFile);
+    if (!file.open(QSaveFile::WriteOnly)) {
+      Radiant::warning("KeyframeIndex # Failed to open %s for writing: %s",
+                       cacheFile.toUtf8().data(), file.errorString().toUtf8().data());
+      return false;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.reserved = 0;
+    header.timeBase = m_timeBase;
+    header.count = m_keyframes.size();
+
+    const qint64 bytes = static_cast<qint64>(m_keyframes.size() * sizeof(Keyframe));
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    ok = ok && file.write(reinterpret_cast<const char*>(m_keyframes.data()), bytes) == bytes;
+    return ok && file.commit();
+  }
+
+  bool KeyframeIndex::scan()
+  {
+    QByteArray errorMsg("KeyframeIndex::scan # " + m_src.toUtf8() + ":");
+
+    AVFormatContext * formatContext = nullptr;
+    int err = avformat_open_input(&formatContext, m_src.toUtf8().data(), nullptr, nullptr);
+    if (err != 0) {
+      avWarning(errorMsg, "Failed to open the source file", err);
+      return false;
+    }
+
+    // The decoder calls this before picking the stream, and with some
+    // formats (like MPEG-TS) streams are only added here, so it must be
+    // done also here for the stream index to refer to the same stream.
+    // Like in the decoder, this is not fatal.
+    err = avformat_find_stream_info(formatContext, nullptr);
+    if (err < 0)
+      avWarning(errorMsg, "Failed to find stream info", err);
+
+    if (m_streamIndex >= static_cast<int>(formatContext->nb_streams) ||
+        formatContext->streams[m_streamIndex]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+      Radiant::warning("%s Stream %d is not a video stream", errorMsg.data(), m_streamIndex);
+      avformat_close_input(&formatContext);
+      return false;
+    }
+
+    // Ask the demuxer to skip everything except video keyframes. Demuxers with
+    // a sample index (mov, matroska) skip the data of discarded packets, so
+    // this only reads a fraction of the file. Other demuxers return all
+    // packets and we filter them here. Nothing is decoded.
+    for (unsigned int i = 0; i < formatContext->nb_streams; ++i) {
+      formatContext->streams[i]->discard = int(i) == m_streamIndex ? AVDISCARD_NONKEY : AVDISCARD_ALL;
+    }
+
+    std::vector<Keyframe> keyframes;
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = nullptr;
+    packet.size = 0;
+
+    while ((err = av_read_frame(formatContext, &packet)) >= 0) {
+      if (packet.stream_index == m_streamIndex && (packet.flags & AV_PKT_FLAG_KEY)) {
+        int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+        if (pts != AV_NOPTS_VALUE)
+          keyframes.push_back({pts, packet.pos});
+      }
+      av_packet_unref(&packet);
+    }
+
+    if (err != AVERROR_EOF)
+      avWarning(errorMsg, "Read error", err);
+
+    m_timeBase = av_q2d(formatContext->streams[m_streamIndex]->time_base);
+    const bool ok = m_timeBase > 0 && !keyframes.empty();
+    avformat_close_input(&formatContext);
+
+    if (!ok) {
+      Radiant::warning("%s No keyframes found", errorMsg.data());
+      return false;
+    }
+
+    std::sort(keyframes.begin(), keyframes.end(), [] (const Keyframe & a, const Keyframe & b) {
+      return a.pts < b.pts;
+    });
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end(), [] (const Keyframe & a, const Keyframe & b) {
+      return a.pts == b.pts;
+    }), keyframes.end());
+
+    m_keyframes = std::move(keyframes);
+    m_ready = true;
+
+    Radiant::debug("%s Indexed %d keyframes", errorMsg.data(), static_cast<int>(m_keyframes.size()));
+    return true;
+  }
+}
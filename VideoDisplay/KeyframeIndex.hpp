@@ -0,0 +1,93 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace VideoDisplay
+{
+  /// Index of all keyframes (GOP starts) of one video stream in a file.
+  ///
+  /// The index is built once per file with a packet-only scan that doesn't
+  /// decode anything, and it's stored to the disk cache using
+  /// Radiant::CacheManager. The decoder uses it for fast scrubbing, where
+  /// only keyframes are decoded while the user is dragging the timeline.
+  ///
+  /// Index instances are shared between all decoders that use the same file.
+  class VIDEODISPLAY_API KeyframeIndex
+  {
+  public:
+    struct Keyframe
+    {
+      /// Presentation timestamp in the stream time base
+      int64_t pts;
+      /// Byte position of the packet in the file, or -1 if unknown
+      int64_t pos;
+    };
+
+    /// Returns the keyframe index of the given video stream. The index is
+    /// read from the disk cache if available, otherwise a packet scan is
+    /// started in Radiant::BGThread::ioThreadPool and the returned index
+    /// becomes ready once the scan is finished.
+    /// @param src local video file
+    /// @param streamIndex video stream index in the file
+    /// @return nullptr if src is not a local file
+    static std::shared_ptr<KeyframeIndex> acquire(const QString & src, int streamIndex);
+
+    /// True when the index is loaded and can be used. Other functions
+    /// return empty results until this returns true.
+    bool isReady() const { return m_ready; }
+
+    /// Number of keyframes in the index
+    int size() const;
+
+    /// Stream time base in seconds
+    double timeBase() const { return m_timeBase; }
+
+    /// @param i keyframe index, 0 <= i < size()
+    const Keyframe & keyframe(int i) const { return m_keyframes[i]; }
+    /// Keyframe presentation time in seconds
+    double seconds(int i) const { return m_keyframes[i].pts * m_timeBase; }
+
+    /// Duration of the group of pictures that begins at keyframe i, in
+    /// seconds. Returns NaN for the last group.
+    double gopDuration(int i) const;
+
+    /// Returns the last keyframe at or before the given time, or the first
+    /// keyframe if there is none. Returns -1 if the index is empty.
+    int keyframeBefore(double seconds) const;
+    /// Returns the first keyframe at or after the given time, or the last
+    /// keyframe if there is none. Returns -1 if the index is empty.
+    int keyframeAfter(double seconds) const;
+
+  private:
+    KeyframeIndex(const QString & src, int streamIndex);
+
+    bool load(const QString & cacheFile);
+    bool save(const QString & cacheFile) const;
+    bool scan();
+
+  private:
+    const QString m_src;
+    const int m_streamIndex;
+    double m_timeBase = 0;
+    std::vector<Keyframe> m_keyframes;
+    std::atomic<bool> m_ready{false};
+  };
+  typedef std::shared_ptr<KeyframeIndex> KeyframeIndexPtr;
+}
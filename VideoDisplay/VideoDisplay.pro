@@ -16,6 +16,12 @@ SOURCES += FfmpegDecoder.cpp
 HEADERS += FfmpegVideoFormatSelector.hpp
 SOURCES += FfmpegVideoFormatSelector.cpp
 
+HEADERS += KeyframeIndex.hpp
+SOURCES += KeyframeIndex.cpp
+
+HEADERS += VideoPreviewGenerator.hpp
+SOURCES += VideoPreviewGenerator.cpp
+
 win32 {
   SOURCES += WindowsVideoMonitor.cpp \
              WindowsVideoHelpers.cpp \
@@ -55,7 +61,7 @@ DEFINES += __STDC_CONSTANT_MACROS
 
 LIBS += $$LIB_RESONANT $$LIB_SCREENPLAY $$LIB_NIMBLE
 LIBS += $$LIB_RADIANT $$LIB_OPENGL $$LIB_RESONANT
-LIBS += $$LIB_PATTERNS $$LIB_VALUABLE $$LIB_FFMPEG
+LIBS += $$LIB_PATTERNS $$LIB_VALUABLE $$LIB_FFMPEG $$LIB_FOLLY
 
 # TODO: Should update our code that uses deprecated FFMPEG API
 *clang* | *g++*: QMAKE_CXXFLAGS_WARN_ON += -Wno-error=deprecated-declarations
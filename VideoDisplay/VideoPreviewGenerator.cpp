@@ -0,0 +1,532 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#include "VideoPreviewGenerator.hpp"
+#include "AVDecoder.hpp"
+#include "FfmpegDecoder.hpp"
+
+#include <Radiant/BGThread.hpp>
+#include <Radiant/CacheManager.hpp>
+#include <Radiant/Task.hpp>
+#include <Radiant/Trace.hpp>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+extern "C" {
+  typedef uint64_t UINT64_C;
+  typedef int64_t INT64_C;
+
+# include <libavutil/frame.h>
+
+# include <libavformat/avformat.h>
+
+# include <libavcodec/avcodec.h>
+
+# include <libswscale/swscale.h>
+}
+
+namespace
+{
+  /// Increase this when the cache file format or the thumbnail generation
+  /// changes in a way that invalidates old caches
+  const char * s_generatorVersion = "1";
+  const char s_magic[4] = {'V', 'P', 'V', '1'};
+
+  /// Maximum number of packets read after a seek when looking for a keyframe
+  const int s_maxPacketsPerThumbnail = 2000;
+
+  /// Thumbnails that failed to decode are retried if the cache file is older
+  /// than this, in seconds. Failures are often temporary, for example when
+  /// the file was still being copied or a network drive was unavailable.
+  const qint64 s_failedRetryInterval = 10 * 60;
+
+  /// Packed cache file layout:
+  /// CacheHeader
+  /// double timestamps[count], actual timestamp of each thumbnail or NaN if it failed
+  /// uint8_t pixels[count][height][width][4], RGBA
+  struct CacheHeader
+  {
+    char magic[4];
+    uint32_t count;
+    uint32_t width;
+    uint32_t height;
+    double duration;
+  };
+
+  QString errorString(const QString & prefix, int err)
+  {
+    char buffer[128];
+    av_strerror(err, buffer, sizeof(buffer));
+    return QString("%1 - %2").arg(prefix, buffer);
+  }
+
+  /// State of one generate() request
+  struct PreviewJob
+  {
+    ~PreviewJob();
+
+    bool loadCache();
+    void writeCache();
+    /// True if some thumbnails in the loaded cache failed and the cache is
+    /// old enough that they should be decoded again
+    bool shouldRetryFailed() const;
+    /// Preview with all thumbnails from the loaded cache
+    VideoDisplay::VideoPreviewGenerator::Preview cachedPreview() const;
+
+    bool open(QString & error);
+    void close();
+    void initTimestamps();
+
+    /// Decodes the next pending thumbnail to pixels and fulfills its promise
+    void decodeNext();
+    bool decodeKeyframe(double seconds, uint8_t * out, double & actual);
+
+    QImage image(size_t i) const;
+
+    QString src;
+    QString cacheFile;
+    bool cacheValid = false;
+    VideoDisplay::VideoPreviewGenerator::PreviewOptions opts;
+
+    folly::Promise<VideoDisplay::VideoPreviewGenerator::Preview> preview;
+    std::vector<folly::Promise<QImage>> promises;
+
+    double duration = 0;
+    std::vector<double> timestamps;
+    std::vector<double> actualTimestamps;
+    Nimble::SizeI size;
+    QByteArray pixels;
+    /// Indices of the thumbnails that need to be decoded
+    std::vector<size_t> pending;
+    /// Index to pending
+    size_t next = 0;
+    bool opened = false;
+
+    AVFormatContext * formatContext = nullptr;
+    AVCodecContext * codecContext = nullptr;
+    SwsContext * swsContext = nullptr;
+    AVFrame * frame = nullptr;
+    int streamIndex = -1;
+  };
+
+  PreviewJob::~PreviewJob()
+  {
+    close();
+  }
+
+  void PreviewJob::close()
+  {
+    if (swsContext)
+      sws_freeContext(swsContext);
+    swsContext = nullptr;
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+    if (formatContext)
+      avformat_close_input(&formatContext);
+  }
+
+  QImage PreviewJob::image(size_t i) const
+  {
+    const int bytes = size.width() * size.height() * 4;
+    QImage img(size.width(), size.height(), QImage::Format_RGBA8888);
+    const char * src = pixels.data() + i * bytes;
+    for (int y = 0; y < size.height(); ++y)
+      memcpy(img.scanLine(y), src + y * size.width() * 4, size.width() * 4);
+    return img;
+  }
+
+  bool PreviewJob::loadCache()
+  {
+    QFile file(cacheFile);
+    if (!file.open(QFile::ReadOnly))
+      return false;
+
+    CacheHeader header;
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, s_magic, sizeof(s_magic)) != 0) {
+      Radiant::warning("VideoPreviewGenerator # Invalid cache file %s", cacheFile.toUtf8().data());
+      return false;
+    }
+
+    const qint64 pixelBytes = qint64(header.count) * header.width * header.height * 4;
+    const qint64 tableBytes = qint64(header.count) * sizeof(double);
+    if (file.size() < qint64(sizeof(header)) + tableBytes + pixelBytes) {
+      Radiant::warning("VideoPreviewGenerator # Truncated cache file %s", cacheFile.toUtf8().data());
+      return false;
+    }
+
+    actualTimestamps.resize(header.count);
+    if (file.read(reinterpret_cast<char*>(actualTimestamps.data()), tableBytes) != tableBytes)
+      return false;
+    pixels = file.read(pixelBytes);
+    if (pixels.size() != pixelBytes)
+      return false;
+
+    duration = header.duration;
+    size.make(header.width, header.height);
+    initTimestamps();
+    return timestamps.size() == actualTimestamps.size();
+  }
+
+  void PreviewJob::writeCache()
+  {
+    QSaveFile file(cacheFile);
+    if (!file.open(QSaveFile::WriteOnly)) {
+      Radiant::warning("VideoPreviewGenerator # Failed to open %s for writing: %s",
+                       cacheFile.toUtf8().data(), file.errorString().toUtf8().data());
+      return;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.count = static_cast<uint32_t>(actualTimestamps.size());
+    header.width = size.width();
+    header.height = size.height();
+    header.duration = duration;
+
+    const qint64 tableBytes = qint64(actualTimestamps.size() * sizeof(double));
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    ok = ok && file.write(reinterpret_cast<const char*>(actualTimestamps.data()), tableBytes) == tableBytes;
+    ok = ok && file.write(pixels) == pixels.size();
+    if (!ok || !file.commit()) {
+      Radiant::warning("VideoPreviewGenerator # Failed to write %s: %s",
+                       cacheFile.toUtf8().data(), file.errorString().toUtf8().data());
+    }
+  }
+
+  bool PreviewJob::shouldRetryFailed() const
+  {
+    bool failed = false;
+    for (double t: actualTimestamps)
+      failed = failed || std::isnan(t);
+    if (!failed)
+      return false;
+
+    const QDateTime modified = QFileInfo(cacheFile).lastModified();
+    return !modified.isValid() || modified.secsTo(QDateTime::currentDateTime()) >= s_failedRetryInterval;
+  }
+
+  VideoDisplay::VideoPreviewGenerator::Preview PreviewJob::cachedPreview() const
+  {
+    VideoDisplay::VideoPreviewGenerator::Preview preview;
+    preview.cacheFile = cacheFile;
+    preview.duration = duration;
+    preview.timestamps = timestamps;
+    for (size_t i = 0; i < actualTimestamps.size(); ++i) {
+      if (std::isnan(actualTimestamps[i])) {
+        preview.thumbnails.push_back(folly::makeFuture<QImage>(std::runtime_error(
+          QString("Failed to decode %1 at thumbnail %2").arg(src).arg(i).toStdString())));
+      } else {
+        preview.thumbnails.push_back(folly::makeFuture(image(i)));
+      }
+    }
+    return preview;
+  }
+
+  bool PreviewJob::open(QString & error)
+  {
+    int err = avformat_open_input(&formatContext, src.toUtf8().data(), nullptr, nullptr);
+    if (err != 0) {
+      error = errorString(QString("Failed to open %1").arg(src), err);
+      return false;
+    }
+
+    err = avformat_find_stream_info(formatContext, nullptr);
+    if (err < 0)
+      Radiant::warning("VideoPreviewGenerator # %s", errorString(
+                         QString("%1: Failed to find stream info").arg(src), err).toUtf8().data());
+
+    AVCodec * codec = nullptr;
+    streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (streamIndex < 0 || !codec) {
+      error = errorString(QString("%1 has no decodable video stream").arg(src), streamIndex);
+      return false;
+    }
+
+    for (unsigned int i = 0; i < formatContext->nb_streams; ++i)
+      if (int(i) != streamIndex)
+        formatContext->streams[i]->discard = AVDISCARD_ALL;
+
+    AVStream * stream = formatContext->streams[streamIndex];
+    codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext || avcodec_parameters_to_context(codecContext, stream->codecpar) < 0) {
+      error = QString("Failed to create a decoder for %1").arg(src);
+      return false;
+    }
+
+    const Nimble::SizeI videoSize(codecContext->width, codecContext->height);
+    if (!videoSize.isValid()) {
+      error = QString("%1 has invalid video size").arg(src);
+      return false;
+    }
+
+    Nimble::SizeF target = videoSize.cast<float>();
+    target.fit(opts.maxSize.cast<float>(), Qt::KeepAspectRatio);
+    size.make(std::max(1, int(std::round(target.width()))), std::max(1, int(std::round(target.height()))));
+
+    // Let the decoder drop resolution by powers of two as long as the result
+    // is still larger than the thumbnail. Only some codecs support this.
+    int lowres = 0;
+    while (lowres < codec->max_lowres &&
+           (videoSize.width() >> (lowres + 1)) >= size.width() &&
+           (videoSize.height() >> (lowres + 1)) >= size.height())
+      ++lowres;
+    codecContext->lowres = lowres;
+    codecContext->skip_frame = AVDISCARD_NONKEY;
+    codecContext->skip_loop_filter = AVDISCARD_ALL;
+    codecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+    // There are typically lots of jobs running in parallel
+    codecContext->thread_count = 1;
+
+    err = avcodec_open2(codecContext, codec, nullptr);
+    if (err < 0) {
+      error = errorString(QString("Failed to open the video decoder for %1").arg(src), err);
+      return false;
+    }
+
+    frame = av_frame_alloc();
+    if (!frame) {
+      error = "Failed to allocate AVFrame";
+      return false;
+    }
+
+    if (formatContext->duration != AV_NOPTS_VALUE)
+      duration = formatContext->duration / double(AV_TIME_BASE);
+
+    return true;
+  }
+
+  void PreviewJob::initTimestamps()
+  {
+    timestamps = opts.timestamps;
+    if (timestamps.empty()) {
+      const double interval = opts.interval > 0 ? opts.interval : 10.0;
+      for (int i = 0; i < std::max(1, opts.maxCount); ++i) {
+        const double t = i * interval;
+        if (i > 0 && t >= duration)
+          break;
+        timestamps.push_back(t);
+      }
+    }
+  }
+
+  bool PreviewJob::decodeKeyframe(double seconds, uint8_t * out, double & actual)
+  {
+    AVStream * stream = formatContext->streams[streamIndex];
+    int64_t ts = av_rescale_q(static_cast<int64_t>(std::max(0.0, seconds) * AV_TIME_BASE),
+                              AV_TIME_BASE_Q, stream->time_base);
+    if (stream->start_time != AV_NOPTS_VALUE)
+      ts += stream->start_time;
+
+    if (av_seek_frame(formatContext, streamIndex, ts, AVSEEK_FLAG_BACKWARD) < 0)
+      return false;
+    avcodec_flush_buffers(codecContext);
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = nullptr;
+    packet.size = 0;
+
+    bool eof = false;
+    for (int packets = 0; packets < s_maxPacketsPerThumbnail; ++packets) {
+      int err = avcodec_receive_frame(codecContext, frame);
+      if (err == 0)
+        break;
+      if (err != AVERROR(EAGAIN) || eof)
+        return false;
+
+      err = av_read_frame(formatContext, &packet);
+      if (err < 0) {
+        // Flush the decoder
+        eof = true;
+        avcodec_send_packet(codecContext, nullptr);
+        continue;
+      }
+      if (packet.stream_index == streamIndex)
+        avcodec_send_packet(codecContext, &packet);
+      av_packet_unref(&packet);
+    }
+
+    if (frame->width <= 0 || frame->height <= 0)
+      return false;
+
+    swsContext = sws_getCachedContext(swsContext, frame->width, frame->height,
+                                      AVPixelFormat(frame->format), size.width(), size.height(),
+                                      AV_PIX_FMT_RGBA, SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!swsContext) {
+      av_frame_unref(frame);
+      return false;
+    }
+
+    uint8_t * dst[4] = {out, nullptr, nullptr, nullptr};
+    int dstLineSize[4] = {size.width() * 4, 0, 0, 0};
+    sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstLineSize);
+
+    const int64_t pts = frame->best_effort_timestamp;
+    actual = pts == AV_NOPTS_VALUE ? seconds : (pts - (stream->start_time != AV_NOPTS_VALUE ?
+                                                       stream->start_time : 0)) * av_q2d(stream->time_base);
+    av_frame_unref(frame);
+    return true;
+  }
+
+  void PreviewJob::decodeNext()
+  {
+    const size_t i = pending[next++];
+    const int bytes = size.width() * size.height() * 4;
+    uint8_t * out = reinterpret_cast<uint8_t*>(pixels.data()) + i * bytes;
+    double actual = std::numeric_limits<double>::quiet_NaN();
+
+    if (decodeKeyframe(timestamps[i], out, actual)) {
+      actualTimestamps[i] = actual;
+      promises[i].setValue(image(i));
+    } else {
+      actualTimestamps[i] = std::numeric_limits<double>::quiet_NaN();
+      memset(out, 0, bytes);
+      promises[i].setException(std::runtime_error(
+                                 QString("Failed to decode %1 at %2 s").arg(src).
+                                 arg(timestamps[i]).toStdString()));
+    }
+  }
+}
+
+namespace VideoDisplay
+{
+  class VideoPreviewGenerator::D
+  {
+  public:
+    std::shared_ptr<Radiant::CacheManager> m_cacheMgr = Radiant::CacheManager::instance();
+    std::shared_ptr<Radiant::BGThread> m_pool = AVDecoder::decoderThreadPool();
+    QString m_cacheDir;
+  };
+
+  VideoPreviewGenerator::VideoPreviewGenerator()
+    : m_d(new D())
+  {
+    m_d->m_cacheDir = m_d->m_cacheMgr->createCacheDir("video-previews");
+  }
+
+  VideoPreviewGenerator::~VideoPreviewGenerator()
+  {
+  }
+
+  folly::Future<VideoPreviewGenerator::Preview> VideoPreviewGenerator::generate(
+      const QString & src, const PreviewOptions & opts)
+  {
+    auto job = std::make_shared<PreviewJob>();
+    job->src = QFileInfo(src).absoluteFilePath();
+    job->opts = opts;
+
+    // Sha1 is used because it's really fast
+    QCryptographicHash optionsHash(QCryptographicHash::Sha1);
+    optionsHash.addData(reinterpret_cast<const char*>(&opts.maxSize), sizeof(opts.maxSize));
+    optionsHash.addData(reinterpret_cast<const char*>(opts.timestamps.data()),
+                        static_cast<int>(opts.timestamps.size() * sizeof(double)));
+    if (opts.timestamps.empty()) {
+      optionsHash.addData(reinterpret_cast<const char*>(&opts.interval), sizeof(opts.interval));
+      optionsHash.addData(reinterpret_cast<const char*>(&opts.maxCount), sizeof(opts.maxCount));
+    }
+    optionsHash.addData(s_generatorVersion);
+    auto item = m_d->m_cacheMgr->cacheItem(m_d->m_cacheDir, job->src,
+                                           optionsHash.result().toHex(), "vpv");
+    job->cacheFile = item.path;
+    job->cacheValid = item.isValid;
+
+    auto future = job->preview.getFuture();
+
+    auto previewTask = std::make_shared<Radiant::FunctionTask>([job] (Radiant::Task & task) {
+      if (!job->opened) {
+        job->opened = true;
+
+        const bool cached = job->cacheValid && job->loadCache();
+        if (cached && !job->shouldRetryFailed()) {
+          job->preview.setValue(job->cachedPreview());
+          task.setFinished();
+          return;
+        }
+
+        ffmpegInit();
+
+        const Nimble::SizeI cachedSize = job->size;
+        const std::vector<double> cachedTimestamps = job->timestamps;
+
+        QString error;
+        if (!job->open(error)) {
+          Radiant::warning("VideoPreviewGenerator # %s", error.toUtf8().data());
+          if (cached) {
+            // Keep the old failures, the cache is retried again later
+            job->preview.setValue(job->cachedPreview());
+          } else {
+            job->preview.setException(std::runtime_error(error.toStdString()));
+          }
+          job->close();
+          task.setFinished();
+          return;
+        }
+
+        job->initTimestamps();
+        const size_t count = job->timestamps.size();
+        job->promises.resize(count);
+        job->pending.clear();
+
+        if (cached && job->size == cachedSize && job->timestamps == cachedTimestamps) {
+          // Only decode the thumbnails that failed before
+          for (size_t i = 0; i < count; ++i)
+            if (std::isnan(job->actualTimestamps[i]))
+              job->pending.push_back(i);
+        } else {
+          job->actualTimestamps.assign(count, std::numeric_limits<double>::quiet_NaN());
+          job->pixels.resize(static_cast<int>(count * job->size.width() * job->size.height() * 4));
+          for (size_t i = 0; i < count; ++i)
+            job->pending.push_back(i);
+        }
+
+        Preview preview;
+        preview.cacheFile = job->cacheFile;
+        preview.duration = job->duration;
+        preview.timestamps = job->timestamps;
+        preview.thumbnails.reserve(count);
+        for (size_t i = 0, p = 0; i < count; ++i) {
+          if (p < job->pending.size() && job->pending[p] == i) {
+            preview.thumbnails.push_back(job->promises[i].getFuture());
+            ++p;
+          } else {
+            preview.thumbnails.push_back(folly::makeFuture(job->image(i)));
+          }
+        }
+        job->preview.setValue(std::move(preview));
+        return;
+      }
+
+      // One thumbnail per run, so that other jobs get to use the threads too
+      if (job->next < job->pending.size())
+        job->decodeNext();
+
+      if (job->next >= job->pending.size()) {
+        job->close();
+        job->writeCache();
+        task.setFinished();
+      }
+    });
+    m_d->m_pool->addTask(previewTask);
+
+    return future;
+  }
+
+  DEFINE_SINGLETON(VideoPreviewGenerator)
+}
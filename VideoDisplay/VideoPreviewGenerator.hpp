@@ -0,0 +1,91 @@
+/* Copyright (C) 2007-2022: Multi Touch Oy, Helsinki University of Technology
+ * and others.
+ *
+ * This file is licensed under GNU Lesser General Public License (LGPL),
+ * version 2.1. The LGPL conditions can be found in file "LGPL.txt" that is
+ * distributed with this source package or obtained from the GNU organization
+ * (www.gnu.org).
+ *
+ */
+
+#pragma once
+
+#include "Export.hpp"
+
+#include <Radiant/Singleton.hpp>
+
+#include <Nimble/Size.hpp>
+
+#include <folly/futures/Future.h>
+
+#include <QImage>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+namespace VideoDisplay
+{
+  /// Generates small preview images of video files without opening an
+  /// AVDecoder. This is meant for media browsers and timelines that need
+  /// thumbnails of lots of videos at the same time.
+  ///
+  /// Only keyframes are decoded, and codecs that support it decode directly
+  /// at a reduced resolution. Each thumbnail is the keyframe at or before the
+  /// requested timestamp. All thumbnails of one request are stored to a
+  /// single packed cache file, so the next request with the same parameters
+  /// only needs to read one file.
+  ///
+  /// Decoding is done in AVDecoder::decoderThreadPool.
+  class VIDEODISPLAY_API VideoPreviewGenerator
+  {
+    DECLARE_SINGLETON(VideoPreviewGenerator);
+
+  public:
+    struct PreviewOptions
+    {
+      /// Maximum thumbnail size. The aspect ratio of the video is preserved.
+      Nimble::SizeI maxSize{256, 256};
+      /// Timestamps in seconds. If empty, thumbnails are generated every
+      /// interval seconds.
+      std::vector<double> timestamps;
+      /// Time between thumbnails in seconds, used if timestamps is empty
+      double interval = 10.0;
+      /// Maximum number of thumbnails when using interval
+      int maxCount = 200;
+    };
+
+    struct Preview
+    {
+      /// Cache file that contains all thumbnails of this preview
+      QString cacheFile;
+      /// Video duration in seconds, or zero if unknown
+      double duration = 0;
+      /// Requested timestamps in seconds, one for each thumbnail
+      std::vector<double> timestamps;
+      /// Thumbnails in QImage::Format_RGBA8888, in the same order as
+      /// timestamps. If a thumbnail can't be decoded, the future contains
+      /// std::runtime_error. Failed thumbnails are cached too, but they are
+      /// decoded again by later requests once the cache is a few minutes old.
+      std::vector<folly::Future<QImage>> thumbnails;
+    };
+
+  public:
+    ~VideoPreviewGenerator();
+
+    /// Generates thumbnails of the given video file, or reads them from the
+    /// cache if they have been generated before.
+    /// @param src video filename
+    /// @param opts thumbnail size and timestamps
+    /// @return Preview once the video is opened and the timestamps are
+    ///         known, the thumbnails are then delivered one by one. If the
+    ///         video can't be opened, contains std::runtime_error.
+    folly::Future<Preview> generate(const QString & src, const PreviewOptions & opts);
+
+  private:
+    VideoPreviewGenerator();
+
+    class D;
+    std::unique_ptr<D> m_d;
+  };
+}